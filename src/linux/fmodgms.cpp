@@ -104,7 +104,11 @@ GMexport double FMODGMS_Sys_Update()
 		
 		int numChan = fftParams->numchannels;
 
-		for (int j = 0; j < nyquist; j++)
+		// Until the DSP has processed a block at a new window size it still has the old
+		// spectrum, which may be shorter.
+		int numBins = std::min(nyquist, fftParams->length);
+
+		for (int j = 0; j < numBins && numChan > 0; j++)
 		{
 			binValues[j] = 0;
 
@@ -290,10 +294,24 @@ GMexport double FMODGMS_Sys_Get_NumDSPBuffers()
 
 #pragma region FFT (Spectrum) Functions
 
-// Init Spectrum DSP
+// FMOD's FFT DSP only takes powers of two from 128 to 16384
+bool FMODGMS_FFT_IsValidWindowSize(int size)
+{
+	return size >= 128 && size <= 16384 && (size & (size - 1)) == 0;
+}
+
+// Init Spectrum DSP, window size is a power of two from 128 to 16384
 GMexport double FMODGMS_FFT_Init(double wSize)
 {
+	if (!FMODGMS_FFT_IsValidWindowSize((int)round(wSize)))
+	{
+		errorMessage = "Window size must be a power of two from 128 to 16384";
+		return GMS_error;
+	}
+
 	windowSize = (int)round(wSize);
+	nyquist = windowSize / 2;
+	binValues.assign(nyquist, 0);
 
 	result = sys->getMasterChannelGroup(&masterGroup);
 	if (result != FMOD_OK)
@@ -319,9 +337,8 @@ GMexport double FMODGMS_FFT_Init(double wSize)
 	return FMODGMS_Util_ErrorChecker();
 }
 
-// Sets the FFT window size (winodw size = 2 * nyquist = 2 * number of bins) 
+// Sets the FFT window size, a power of two from 128 to 16384 (window size = 2 * nyquist = 2 * number of bins)
 // FMODGMS_FFT_Get_NumBins should be called after this function to ensure the game know what the new number of bins are
-// NOTE: Doesn't work yet
 GMexport double FMODGMS_FFT_Set_WindowSize(double size)
 {
 	if (fftdsp == NULL)
@@ -329,14 +346,17 @@ GMexport double FMODGMS_FFT_Set_WindowSize(double size)
 		errorMessage = "FFT not initialized";
 		return GMS_error;
 	}
-	windowSize = (int)round(size);
-	nyquist = windowSize / 2;
-	binValues.clear();
-	for (int i = 0; i < nyquist; i++)
+
+	if (!FMODGMS_FFT_IsValidWindowSize((int)round(size)))
 	{
-		binValues[i] = 0;
+		errorMessage = "Window size must be a power of two from 128 to 16384";
+		return GMS_error;
 	}
 
+	windowSize = (int)round(size);
+	nyquist = windowSize / 2;
+	binValues.assign(nyquist, 0);
+
 	result = fftdsp->setParameterInt(FMOD_DSP_FFT_WINDOWSIZE, windowSize);
 	return FMODGMS_Util_ErrorChecker();
 }
@@ -391,9 +411,12 @@ GMexport double FMODGMS_FFT_Normalize()
 		errorMessage = "FFT not initialized";
 		return GMS_error;
 	}
-	auto maxIterator = std::max_element(&binValues[0], &binValues[nyquist - 1]);
+	auto maxIterator = std::max_element(binValues.begin(), binValues.end());
+	if (maxIterator == binValues.end() || *maxIterator <= 0)
+		return FMODGMS_Util_ErrorChecker();
+
 	float maxVol = *maxIterator;
-	for (int i = 0; i < windowSize; i++)
+	for (int i = 0; i < nyquist; i++)
 	{
 		binValues[i] = binValues[i] / maxVol;
 	}
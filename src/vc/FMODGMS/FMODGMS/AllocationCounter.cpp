@@ -0,0 +1,70 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+using namespace AllocationCounter;
+
+#ifdef FMODGMS_TRACK_ALLOCATIONS
+
+namespace
+{
+    thread_local bool t_tracking = false;
+    thread_local uint64_t t_count = 0;
+}
+
+// The array forms forward to these.
+void* operator new(std::size_t size)
+{
+    if (t_tracking)
+    {
+        t_count++;
+    }
+
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    free(ptr);
+}
+
+Scope::Scope() : m_start(t_count), m_wasTracking(t_tracking)
+{
+    t_tracking = true;
+}
+
+Scope::~Scope()
+{
+    t_tracking = m_wasTracking;
+}
+
+uint64_t Scope::Count() const
+{
+    return t_count - m_start;
+}
+
+#else
+
+Scope::Scope() : m_start(0), m_wasTracking(false)
+{}
+
+Scope::~Scope()
+{}
+
+uint64_t Scope::Count() const
+{
+    return 0;
+}
+
+#endif
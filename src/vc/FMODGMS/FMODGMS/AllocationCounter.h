@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Debug builds count every heap allocation made on a thread while a scope is open,
+// so we can check the audio callbacks never touch the allocator.
+#if defined(_DEBUG) && !defined(FMODGMS_TRACK_ALLOCATIONS)
+#define FMODGMS_TRACK_ALLOCATIONS
+#endif
+
+namespace AllocationCounter
+{
+    constexpr bool Enabled()
+    {
+#ifdef FMODGMS_TRACK_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Counts allocations made on the current thread for the lifetime of the scope.
+    // Always zero when tracking is compiled out.
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        uint64_t Count() const;
+
+    private:
+        uint64_t m_start;
+        bool m_wasTracking;
+    };
+}
@@ -1,5 +1,7 @@
 #include "AnnotationStore.h"
 #include <charconv>
+#include <algorithm>
+#include <cmath>
 
 std::optional<TimeRange> TimeRange::Parse(const std::string_view& str)
 {
@@ -63,21 +65,125 @@ std::optional<Annotation> Annotation::Parse(const std::string_view& str)
     return Annotation{ std::string(value), parsedTimeRange.value() };
 }
 
+AnnotationTable::AnnotationTable(std::vector<Annotation> annotations) : m_annotations(std::move(annotations))
+{
+    std::stable_sort(m_annotations.begin(), m_annotations.end(), [](const Annotation& x, const Annotation& y)
+    {
+        return x.Range.Start < y.Range.Start;
+    });
+
+    while (m_leafCount < m_annotations.size())
+    {
+        m_leafCount *= 2;
+    }
+
+    m_endTree.assign(2 * m_leafCount, -HUGE_VAL);
+    for (size_t i = 0; i < m_annotations.size(); i++)
+    {
+        m_endTree[m_leafCount + i] = m_annotations[i].Range.End;
+    }
+
+    for (size_t node = m_leafCount - 1; node > 0; node--)
+    {
+        m_endTree[node] = std::max(m_endTree[2 * node], m_endTree[2 * node + 1]);
+    }
+}
+
+const std::vector<Annotation>& AnnotationTable::GetAnnotations() const
+{
+    return m_annotations;
+}
+
+bool AnnotationTable::IsLatestContaining(uint32_t index, double position) const
+{
+    const auto& x = m_annotations[index];
+    if (!(position > x.Range.Start && position < x.Range.End))
+    {
+        return false;
+    }
+
+    // A later annotation that has also started would take priority.
+    return index + 1 == m_annotations.size() || !(m_annotations[index + 1].Range.Start < position);
+}
+
+const Annotation* AnnotationTable::Find(double position, uint32_t* index) const
+{
+    // First annotation starting at or after position, everything before it has started.
+    const auto upper = std::lower_bound(m_annotations.begin(), m_annotations.end(), position, [](const Annotation& x, double pos)
+    {
+        return x.Range.Start < pos;
+    });
+
+    // So the latest of them still going is the one that wins.
+    const size_t found = this->FindLastEndingAfter(1, 0, m_leafCount, upper - m_annotations.begin(), position);
+    if (found == SIZE_MAX)
+    {
+        return nullptr;
+    }
+
+    if (index != nullptr)
+    {
+        *index = static_cast<uint32_t>(found);
+    }
+
+    return &m_annotations[found];
+}
+
+size_t AnnotationTable::FindLastEndingAfter(size_t node, size_t first, size_t count, size_t limit, double position) const
+{
+    if (first >= limit || !(m_endTree[node] > position))
+    {
+        return SIZE_MAX;
+    }
+
+    if (count == 1)
+    {
+        return first;
+    }
+
+    // A whole subtree below limit with an end after position always has a match, so only
+    // the subtree limit falls in can fail after going down into it.
+    const size_t half = count / 2;
+    const size_t right = this->FindLastEndingAfter(2 * node + 1, first + half, half, limit, position);
+    return right != SIZE_MAX ? right : this->FindLastEndingAfter(2 * node, first, half, limit, position);
+}
+
+const Annotation* AnnotationTable::FindFrom(double position, uint32_t* index) const
+{
+    // Playback is usually still in the same annotation or has moved onto the next one.
+    const uint32_t start = *index;
+    for (uint32_t i = start; i < start + 2 && i < m_annotations.size(); i++)
+    {
+        if (this->IsLatestContaining(i, position))
+        {
+            *index = i;
+            return &m_annotations[i];
+        }
+    }
+
+    return this->Find(position, index);
+}
+
 bool AnnotationStore::ParseAddAnnotationList(size_t soundId, const std::string_view& annotationList)
 {
+    std::vector<Annotation> annotations;
+
     std::string_view::size_type pos = 0;
     std::string_view::size_type end;
 
     do {
         end = annotationList.find(';', pos);
         const auto annotationStr = annotationList.substr(pos, end - pos);
-        if (!this->ParseAddAnnotation(soundId, annotationStr))
+        auto annotation = Annotation::Parse(annotationStr);
+        if (!annotation.has_value())
         {
             return false;
         }
+        annotations.emplace_back(std::move(annotation.value()));
         pos = end + 1;
     } while (end != std::string_view::npos);
 
+    this->AddAnnotations(soundId, std::move(annotations));
     return true;
 }
 
@@ -95,28 +201,101 @@ bool AnnotationStore::ParseAddAnnotation(size_t soundId, const std::string_view&
 
 void AnnotationStore::AddAnnotation(size_t soundId, Annotation annotation)
 {
+    std::vector<Annotation> annotations;
+    annotations.emplace_back(std::move(annotation));
+    this->AddAnnotations(soundId, std::move(annotations));
+}
+
+void AnnotationStore::AddAnnotations(size_t soundId, std::vector<Annotation> annotations)
+{
+    for (auto& x : annotations)
+    {
+        x.Id = this->Intern(x.Value);
+    }
+
     std::unique_lock<std::shared_mutex> writeLock(m_rwLock);
 
+    // Tables are frozen once built, adding more means building a new one.
     auto& entry = m_annotations[soundId];
-    entry.emplace_back(std::move(annotation));
+    if (entry != nullptr)
+    {
+        const auto& existing = entry->GetAnnotations();
+        annotations.insert(annotations.begin(), existing.begin(), existing.end());
+    }
+
+    entry = std::make_shared<const AnnotationTable>(std::move(annotations));
 }
 
-std::optional<std::string_view> AnnotationStore::GetAnnotation(size_t soundId, double position)
+AnnotationId AnnotationStore::GetAnnotation(size_t soundId, double position, AnnotationCursor* cursor)
 {
     std::shared_lock<std::shared_mutex> readLock(m_rwLock);
 
     const auto annotations = m_annotations.find(soundId);
     if (annotations != m_annotations.end())
     {
-        const auto& annotationList = annotations->second;
-        for (const auto& x : annotationList)
+        const auto& table = *annotations->second;
+
+        const Annotation* found;
+        if (cursor != nullptr && cursor->SoundId == soundId)
         {
-            if (position > x.Range.Start && position < x.Range.End)
+            found = table.FindFrom(position, &cursor->Index);
+        }
+        else
+        {
+            uint32_t index = 0;
+            found = table.Find(position, &index);
+            if (cursor != nullptr && found != nullptr)
             {
-                return x.Value;
+                cursor->SoundId = soundId;
+                cursor->Index = index;
             }
         }
+
+        if (found != nullptr)
+        {
+            return found->Id;
+        }
+    }
+
+    return NO_ANNOTATION;
+}
+
+AnnotationId AnnotationStore::Intern(const std::string_view& value)
+{
+    {
+        std::shared_lock<std::shared_mutex> readLock(m_stringLock);
+        const auto existing = m_stringIds.find(value);
+        if (existing != m_stringIds.end())
+        {
+            return existing->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> writeLock(m_stringLock);
+
+    // Someone may have added it between dropping the read lock and taking this one.
+    const auto existing = m_stringIds.find(value);
+    if (existing != m_stringIds.end())
+    {
+        return existing->second;
+    }
+
+    // Id 0 is NO_ANNOTATION
+    const AnnotationId id = static_cast<AnnotationId>(m_strings.size() + 1);
+    const auto& stored = m_strings.emplace_back(value);
+    m_stringIds.emplace(stored, id);
+
+    return id;
+}
+
+std::string_view AnnotationStore::GetString(AnnotationId id)
+{
+    std::shared_lock<std::shared_mutex> readLock(m_stringLock);
+
+    if (id == NO_ANNOTATION || id > m_strings.size())
+    {
+        return {};
     }
 
-    return {};
+    return m_strings[id - 1];
 }
@@ -3,7 +3,17 @@
 #include <string_view>
 #include <unordered_map>
 #include <optional>
+#include <mutex>
 #include <shared_mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+
+// Interned annotation string, see AnnotationStore::Intern.
+typedef uint32_t AnnotationId;
+constexpr AnnotationId NO_ANNOTATION = 0;
 
 struct TimeRange
 {
@@ -17,6 +27,42 @@ struct Annotation
     static std::optional<Annotation> Parse(const std::string_view& str);
     std::string Value;
     TimeRange Range;
+    AnnotationId Id = NO_ANNOTATION;
+};
+
+// Remembers where the last lookup landed so sequential playback hits in O(1).
+struct AnnotationCursor
+{
+    size_t SoundId = SIZE_MAX;
+    uint32_t Index = 0;
+};
+
+// Immutable list of a sound's annotations, sorted by start time.
+class AnnotationTable
+{
+public:
+    AnnotationTable(std::vector<Annotation> annotations);
+
+    // If several annotations overlap the position the one that started last wins.
+    const Annotation* Find(double position, uint32_t* index) const;
+    const Annotation* FindFrom(double position, uint32_t* index) const;
+
+    const std::vector<Annotation>& GetAnnotations() const;
+
+private:
+    std::vector<Annotation> m_annotations;
+
+    // Binary tree over the annotations in order, each node the largest end time below it
+    // and the leaves from m_leafCount on. Finds the last annotation that started before a
+    // position and is still going in O(log n), however long the ones before it run.
+    std::vector<double> m_endTree;
+    size_t m_leafCount = 1;
+
+    bool IsLatestContaining(uint32_t index, double position) const;
+
+    // Last annotation below limit in the subtree at node that ends after position, or
+    // SIZE_MAX. first and count are the annotations the subtree covers.
+    size_t FindLastEndingAfter(size_t node, size_t first, size_t count, size_t limit, double position) const;
 };
 
 class AnnotationStore
@@ -25,9 +71,20 @@ public:
     bool ParseAddAnnotationList(size_t soundId, const std::string_view& annotationList);
     bool ParseAddAnnotation(size_t soundId, const std::string_view& annotation);
     void AddAnnotation(size_t soundId, Annotation annotation);
-    std::optional<std::string_view> GetAnnotation(size_t soundId, double position);
+    void AddAnnotations(size_t soundId, std::vector<Annotation> annotations);
+    AnnotationId GetAnnotation(size_t soundId, double position, AnnotationCursor* cursor = nullptr);
+
+    // Returns the same id for equal strings. Ids are never freed so they are safe
+    // to hold onto from the audio thread.
+    AnnotationId Intern(const std::string_view& value);
+    std::string_view GetString(AnnotationId id);
 private:
 
-    std::unordered_map<size_t, std::vector<Annotation>> m_annotations;
+    std::unordered_map<size_t, std::shared_ptr<const AnnotationTable>> m_annotations;
     std::shared_mutex m_rwLock;
-};
\ No newline at end of file
+
+    // Deque so the strings never move and the map can key on views of them.
+    std::deque<std::string> m_strings;
+    std::unordered_map<std::string_view, AnnotationId> m_stringIds;
+    std::shared_mutex m_stringLock;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <vector>
+#include <cmath>
+#include <span>
 
 namespace AudioProcessors
 {
@@ -26,7 +27,7 @@ namespace AudioProcessors
             return Sustain;
         }
 
-        double ValUp(double input)
+        double ValUp(double input) const
         {
             if (input < Release)
             {
@@ -37,34 +38,247 @@ namespace AudioProcessors
         }
     };
 
-    float Compress(float x, float mult, float thresh, float ramp);
-    std::vector<float> HighPass(const std::vector<float>& data, float alpha);
+    inline float Compress(float x, float mult, float thresh, float ramp)
+    {
+        x *= mult;
+
+        float ax = std::abs(x);
+        if (ax > thresh)
+        {
+            const float diff = ax - thresh;
+            ax = thresh + ramp * diff;
+        }
+
+        return x >= 0 ? ax : -ax;
+    }
+
+    //
+    // Filters
+    //
+    // All process a block in place and keep whatever they need between blocks in an
+    // explicit state struct owned by the caller, so nothing here allocates.
+    //
+
+    struct OnePoleState
+    {
+        float Output = 0.f;
+    };
+
+    struct HighPassState
+    {
+        float Output = 0.f;
+        float Input = 0.f;
+    };
+
+    // One pole low pass, alpha in (0, 1], 1 passes everything through.
+    inline void LowPass(std::span<float> data, float alpha, OnePoleState& state)
+    {
+        float prev = state.Output;
+
+        for (float& x : data)
+        {
+            prev += alpha * (x - prev);
+            x = prev;
+        }
 
-    class LowPass
+        state.Output = prev;
+    }
+
+    // One pole high pass, alpha in (0, 1], closer to 1 keeps more of the low end.
+    inline void HighPass(std::span<float> data, float alpha, HighPassState& state)
     {
-        float m_finalValue;
-    public:
-        std::vector<float> Run(const std::vector<float>& data, float alpha)
+        float prev = state.Output;
+        float prevInput = state.Input;
+
+        for (float& x : data)
         {
-            const size_t len = data.size();
-            std::vector<float> ret;
-            ret.resize(len);
+            const float input = x;
+            prev = alpha * (prev + input - prevInput);
+            prevInput = input;
+            x = prev;
+        }
+
+        state.Output = prev;
+        state.Input = prevInput;
+    }
+
+    enum class BiquadType
+    {
+        LowPass,
+        HighPass,
+        BandPass,
+        Notch,
+    };
 
-            float prev = m_finalValue;
+    // Normalised so a0 is 1, see the RBJ audio EQ cookbook.
+    struct BiquadCoeffs
+    {
+        float B0 = 1.f;
+        float B1 = 0.f;
+        float B2 = 0.f;
+        float A1 = 0.f;
+        float A2 = 0.f;
+
+        static BiquadCoeffs Make(BiquadType type, double freq, double q, double sampleRate)
+        {
+            const double w0 = 2.0 * 3.14159265358979 * freq / sampleRate;
+            const double cosw0 = cos(w0);
+            const double alpha = sin(w0) / (2.0 * q);
 
-            for (uint32_t i = 0; i < len; i++)
+            double b0, b1, b2;
+            switch (type)
             {
-                const float x = prev + alpha * (data[i] - prev);
-                prev = x;
-                ret[i] = x;
+            case BiquadType::HighPass:
+                b0 = (1.0 + cosw0) / 2.0;
+                b1 = -(1.0 + cosw0);
+                b2 = b0;
+                break;
+            case BiquadType::BandPass:
+                b0 = alpha;
+                b1 = 0.0;
+                b2 = -alpha;
+                break;
+            case BiquadType::Notch:
+                b0 = 1.0;
+                b1 = -2.0 * cosw0;
+                b2 = 1.0;
+                break;
+            case BiquadType::LowPass:
+            default:
+                b0 = (1.0 - cosw0) / 2.0;
+                b1 = 1.0 - cosw0;
+                b2 = b0;
+                break;
             }
 
-            m_finalValue = (ret[len - 1]);
+            const double a0 = 1.0 + alpha;
+
+            BiquadCoeffs coeffs;
+            coeffs.B0 = static_cast<float>(b0 / a0);
+            coeffs.B1 = static_cast<float>(b1 / a0);
+            coeffs.B2 = static_cast<float>(b2 / a0);
+            coeffs.A1 = static_cast<float>(-2.0 * cosw0 / a0);
+            coeffs.A2 = static_cast<float>((1.0 - alpha) / a0);
+            return coeffs;
+        }
+    };
+
+    struct BiquadState
+    {
+        float Z1 = 0.f;
+        float Z2 = 0.f;
+    };
+
+    // Transposed direct form II.
+    inline void Biquad(std::span<float> data, const BiquadCoeffs& c, BiquadState& state)
+    {
+        float z1 = state.Z1;
+        float z2 = state.Z2;
+
+        for (float& x : data)
+        {
+            const float input = x;
+            const float y = c.B0 * input + z1;
+            z1 = c.B1 * input - c.A1 * y + z2;
+            z2 = c.B2 * input - c.A2 * y;
+            x = y;
+        }
+
+        state.Z1 = z1;
+        state.Z2 = z2;
+    }
+
+    enum class StateVariableMode
+    {
+        LowPass,
+        HighPass,
+        BandPass,
+    };
+
+    // Trapezoidal state variable filter, stays stable when the cutoff is modulated
+    // every block which the biquad doesn't.
+    struct StateVariableCoeffs
+    {
+        float K = 0.f;
+        float A1 = 0.f;
+        float A2 = 0.f;
+        float A3 = 0.f;
+
+        static StateVariableCoeffs Make(double freq, double q, double sampleRate)
+        {
+            const double g = tan(3.14159265358979 * freq / sampleRate);
+            const double k = 1.0 / q;
+            const double a1 = 1.0 / (1.0 + g * (g + k));
 
-            return ret;
+            StateVariableCoeffs coeffs;
+            coeffs.K = static_cast<float>(k);
+            coeffs.A1 = static_cast<float>(a1);
+            coeffs.A2 = static_cast<float>(g * a1);
+            coeffs.A3 = static_cast<float>(g * g * a1);
+            return coeffs;
         }
     };
 
+    struct StateVariableState
+    {
+        float IC1 = 0.f;
+        float IC2 = 0.f;
+    };
+
+    template <StateVariableMode Mode>
+    inline void StateVariableImpl(std::span<float> data, const StateVariableCoeffs& c, StateVariableState& state)
+    {
+        float ic1 = state.IC1;
+        float ic2 = state.IC2;
+
+        for (float& x : data)
+        {
+            const float v0 = x;
+            const float v3 = v0 - ic2;
+            const float v1 = c.A1 * ic1 + c.A2 * v3;
+            const float v2 = ic2 + c.A2 * ic1 + c.A3 * v3;
+            ic1 = 2.f * v1 - ic1;
+            ic2 = 2.f * v2 - ic2;
+
+            if constexpr (Mode == StateVariableMode::LowPass)
+            {
+                x = v2;
+            }
+            else if constexpr (Mode == StateVariableMode::BandPass)
+            {
+                x = v1;
+            }
+            else
+            {
+                x = v0 - c.K * v1 - v2;
+            }
+        }
+
+        state.IC1 = ic1;
+        state.IC2 = ic2;
+    }
+
+    inline void StateVariable(
+        std::span<float> data,
+        StateVariableMode mode,
+        const StateVariableCoeffs& c,
+        StateVariableState& state)
+    {
+        switch (mode)
+        {
+        case StateVariableMode::HighPass:
+            StateVariableImpl<StateVariableMode::HighPass>(data, c, state);
+            break;
+        case StateVariableMode::BandPass:
+            StateVariableImpl<StateVariableMode::BandPass>(data, c, state);
+            break;
+        case StateVariableMode::LowPass:
+        default:
+            StateVariableImpl<StateVariableMode::LowPass>(data, c, state);
+            break;
+        }
+    }
+
     inline double lerp(double x0, double x1, double k)
     {
         return (x0 * (k - 1) + x1) / k;
@@ -0,0 +1,417 @@
+#include "BeatTracker.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // Flux an onset needs whatever the recent average, keeps room tone and hiss quiet.
+    constexpr float MIN_ONSET_FLUX = 1.f;
+    constexpr double MIN_ONSET_GAP_SECONDS = 0.1;
+
+    // Tempos searched, and the one favoured when a tune could be heard at either of two.
+    constexpr double MIN_BPM = 60.0;
+    constexpr double MAX_BPM = 200.0;
+    constexpr double TEMPO_PRIOR_BPM = 120.0;
+    // Standard deviation of the preference in octaves.
+    constexpr double TEMPO_PRIOR_WIDTH = 1.0;
+
+    // How well the flux has to line up with itself a period later, as a fraction of how
+    // well it lines up with itself unshifted, for there to be a beat at all. Noise gets
+    // to about 0.15, anything with a steady pulse well over 0.5.
+    constexpr double MIN_TEMPO_CORRELATION = 0.3;
+
+    // Tempo events are only sent when the estimate moves by more than this.
+    constexpr float TEMPO_EVENT_CHANGE = 0.5f;
+
+    // Onsets within this fraction of a period of a predicted beat pull the following beats
+    // this fraction of the way towards them.
+    constexpr double BEAT_CAPTURE = 0.25;
+    constexpr double BEAT_PHASE_GAIN = 0.2;
+}
+
+BeatTrackerDSP::BeatTrackerDSP()
+{
+    memset(&m_dspDescr, 0, sizeof(m_dspDescr));
+
+    snprintf(m_dspDescr.name, sizeof(m_dspDescr.name), "Beat Tracker DSP");
+    m_dspDescr.version = 0x00010000;
+    m_dspDescr.numinputbuffers = 1;
+    m_dspDescr.numoutputbuffers = 1;
+    m_dspDescr.read = BeatTrackerGenericCallback;
+    m_dspDescr.userdata = (void *)0x12345678;
+
+    m_frame.fill(0.f);
+    m_flux.fill(0.f);
+}
+
+bool BeatTrackerDSP::Register(FMOD::System* sys, std::string& error)
+{
+    // Everything the callback uses is made here, it never allocates.
+    m_plan = FFTPlan::Create(FRAME_LENGTH);
+    if (m_plan == nullptr)
+    {
+        error = "Could not create FFT plan";
+        return false;
+    }
+
+    const size_t binCount = m_plan->GetMagnitudeCount();
+    m_magnitudes = std::make_unique<float[]>(binCount);
+    m_previousMagnitudes = std::make_unique<float[]>(binCount);
+    std::fill_n(m_previousMagnitudes.get(), binCount, 0.f);
+
+    int sampleRate;
+    if (sys->getSoftwareFormat(&sampleRate, nullptr, nullptr) == FMOD_OK && sampleRate > 0)
+    {
+        m_sampleRate = static_cast<uint32_t>(sampleRate);
+    }
+
+    m_minOnsetGap = static_cast<SampleTime>(m_sampleRate * MIN_ONSET_GAP_SECONDS);
+
+    FMOD_RESULT result = sys->createDSP(&m_dspDescr, &m_dsp);
+    if (result != FMOD_OK)
+    {
+        error = "Could not create DSP";
+        return false;
+    }
+
+    m_dsp->setUserData(reinterpret_cast<void*>(this));
+
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    result = sys->getMasterChannelGroup(&masterGroup);
+
+    if (result != FMOD_OK || masterGroup == nullptr)
+    {
+        error = "Could not get master channel";
+        return false;
+    }
+
+    // Push to end of dsp list.
+    result = masterGroup->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL, m_dsp);
+    if (result != FMOD_OK)
+    {
+        error = "Could not add dsp";
+        return false;
+    }
+
+    return true;
+}
+
+void BeatTrackerDSP::Unregister(FMOD::System* sys)
+{
+    if (m_dsp == nullptr)
+    {
+        return;
+    }
+
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    if (sys->getMasterChannelGroup(&masterGroup) == FMOD_OK && masterGroup != nullptr)
+    {
+        masterGroup->removeDSP(m_dsp);
+    }
+
+    m_dsp->release();
+    m_dsp = nullptr;
+}
+
+bool BeatTrackerDSP::PopEvent(BeatEvent& event)
+{
+    return m_events.TryPop(event);
+}
+
+void BeatTrackerDSP::SetSensitivity(float multiplier)
+{
+    m_sensitivity.store(std::max(multiplier, 0.f), std::memory_order_relaxed);
+}
+
+float BeatTrackerDSP::GetBpm() const
+{
+    return m_publishedBpm.load(std::memory_order_relaxed);
+}
+
+SampleTime BeatTrackerDSP::GetSampleTime() const
+{
+    return m_clock.Read();
+}
+
+uint64_t BeatTrackerDSP::GetDroppedCount() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+float BeatTrackerDSP::GetFlux(uint64_t index) const
+{
+    return m_flux[index % TEMPO_HISTORY];
+}
+
+void BeatTrackerDSP::PushEvent(BeatEventType type, SampleTime time, float value)
+{
+    if (!m_events.TryPush(BeatEvent{ type, time, value }))
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void BeatTrackerDSP::AnalyseFrame(SampleTime frameStart)
+{
+    const size_t binCount = m_plan->GetMagnitudeCount();
+    m_plan->Analyse(m_frame.data(), m_magnitudes.get());
+    const float flux = SpectralFlux(m_magnitudes.get(), m_previousMagnitudes.get(), binCount);
+
+    // The first frame is only being compared with silence.
+    m_flux[m_fluxCount % TEMPO_HISTORY] = m_fluxCount > 0 ? flux : 0.f;
+    m_fluxCount++;
+
+    // Flux is put down to the middle of its frame, the frame before this one can now be
+    // checked for a peak.
+    const SampleTime frameCentre = frameStart + FRAME_LENGTH / 2;
+    if (m_fluxCount >= 3)
+    {
+        this->PickOnset(frameCentre - HOP_LENGTH);
+    }
+
+    if (m_fluxCount % TEMPO_INTERVAL == 0)
+    {
+        this->EstimateTempo();
+    }
+
+    this->TrackBeats(frameCentre);
+}
+
+void BeatTrackerDSP::PickOnset(SampleTime peakTime)
+{
+    const uint64_t index = m_fluxCount - 2;
+    const float peak = this->GetFlux(index);
+    if (peak <= this->GetFlux(index - 1) || peak < this->GetFlux(index + 1))
+    {
+        return;
+    }
+
+    const size_t history = static_cast<size_t>(std::min<uint64_t>(THRESHOLD_HISTORY, index));
+    float sum = 0.f;
+    for (size_t i = 1; i <= history; i++)
+    {
+        sum += this->GetFlux(index - i);
+    }
+
+    const float threshold = sum / history * m_sensitivity.load(std::memory_order_relaxed) + MIN_ONSET_FLUX;
+    if (peak <= threshold)
+    {
+        return;
+    }
+
+    if (m_lastOnset > 0 && peakTime < m_lastOnset + m_minOnsetGap)
+    {
+        return;
+    }
+
+    m_lastOnset = peakTime;
+    this->PushEvent(BeatEventType::Onset, peakTime, peak);
+
+    if (m_period <= 0.0)
+    {
+        return;
+    }
+
+    // Every beat up to the last analysed frame has gone out, so the nearest predicted
+    // beat is either the one just sent or the next.
+    const double time = static_cast<double>(peakTime);
+    const double sinceLast = time - (m_nextBeat - m_period);
+    const double untilNext = m_nextBeat - time;
+    const double error = sinceLast < untilNext ? sinceLast : -untilNext;
+    if (std::abs(error) < m_period * BEAT_CAPTURE)
+    {
+        m_nextBeat += error * BEAT_PHASE_GAIN;
+    }
+}
+
+void BeatTrackerDSP::EstimateTempo()
+{
+    if (m_fluxCount < TEMPO_HISTORY)
+    {
+        return;
+    }
+
+    const double hopRate = static_cast<double>(m_sampleRate) / HOP_LENGTH;
+    const size_t minLag = std::max<size_t>(2, static_cast<size_t>(hopRate * 60.0 / MAX_BPM));
+    const size_t maxLag = std::min<size_t>(TEMPO_HISTORY / 2, static_cast<size_t>(ceil(hopRate * 60.0 / MIN_BPM)));
+
+    // Oldest first with the mean taken off, so a loud stretch doesn't favour short lags.
+    std::array<float, TEMPO_HISTORY> centred;
+    float mean = 0.f;
+    for (float flux : m_flux)
+    {
+        mean += flux;
+    }
+
+    mean /= TEMPO_HISTORY;
+    for (size_t i = 0; i < TEMPO_HISTORY; i++)
+    {
+        centred[i] = this->GetFlux(m_fluxCount + i) - mean;
+    }
+
+    double energy = 0.0;
+    for (float value : centred)
+    {
+        energy += value * value;
+    }
+
+    // Correlations either side of the range are needed to interpolate the ends.
+    std::array<double, TEMPO_HISTORY / 2 + 2> correlation;
+    size_t best = 0;
+    double bestScore = 0.0;
+    for (size_t lag = minLag - 1; lag <= maxLag + 1; lag++)
+    {
+        double sum = 0.0;
+        for (size_t i = lag; i < TEMPO_HISTORY; i++)
+        {
+            sum += centred[i] * centred[i - lag];
+        }
+
+        correlation[lag] = sum / (TEMPO_HISTORY - lag);
+        if (lag < minLag || lag > maxLag || correlation[lag] <= 0.0)
+        {
+            continue;
+        }
+
+        const double octaves = log2(60.0 * hopRate / lag / TEMPO_PRIOR_BPM) / TEMPO_PRIOR_WIDTH;
+        const double score = correlation[lag] * exp(-0.5 * octaves * octaves);
+        if (score > bestScore)
+        {
+            best = lag;
+            bestScore = score;
+        }
+    }
+
+    if (best == 0 || correlation[best] < energy / TEMPO_HISTORY * MIN_TEMPO_CORRELATION)
+    {
+        this->LoseTempo();
+        return;
+    }
+
+    // Peak of the parabola through the best lag and its neighbours.
+    double lag = static_cast<double>(best);
+    const double before = correlation[best - 1];
+    const double at = correlation[best];
+    const double after = correlation[best + 1];
+    const double curvature = before - 2.0 * at + after;
+    if (curvature < 0.0)
+    {
+        lag += 0.5 * (before - after) / curvature;
+    }
+
+    m_period = lag * HOP_LENGTH;
+    const float bpm = static_cast<float>(60.0 * hopRate / lag);
+    if (std::abs(bpm - m_bpm) > TEMPO_EVENT_CHANGE)
+    {
+        m_bpm = bpm;
+        m_publishedBpm.store(bpm, std::memory_order_relaxed);
+        this->PushEvent(BeatEventType::Tempo, m_clock.Now(), bpm);
+    }
+}
+
+void BeatTrackerDSP::LoseTempo()
+{
+    if (m_period <= 0.0)
+    {
+        return;
+    }
+
+    m_period = 0.0;
+    m_nextBeat = 0.0;
+    m_bpm = 0.f;
+    m_publishedBpm.store(0.f, std::memory_order_relaxed);
+    this->PushEvent(BeatEventType::Tempo, m_clock.Now(), 0.f);
+}
+
+void BeatTrackerDSP::TrackBeats(SampleTime analysedUpTo)
+{
+    if (m_period <= 0.0)
+    {
+        return;
+    }
+
+    const double upTo = static_cast<double>(analysedUpTo);
+    if (m_nextBeat <= 0.0)
+    {
+        // Start the pulse off from the last onset, the beats before now are not sent.
+        m_nextBeat = m_lastOnset > 0 ? static_cast<double>(m_lastOnset) : upTo;
+        while (m_nextBeat + m_period <= upTo)
+        {
+            m_nextBeat += m_period;
+        }
+    }
+
+    while (m_nextBeat <= upTo)
+    {
+        this->PushEvent(BeatEventType::Beat, static_cast<SampleTime>(m_nextBeat + 0.5), m_bpm);
+        m_nextBeat += m_period;
+    }
+}
+
+FMOD_RESULT BeatTrackerDSP::Callback(
+    float* inbuffer,
+    float* outbuffer,
+    uint32_t length,
+    int inchannels,
+    int* outchannels)
+{
+    const int channels = *outchannels;
+
+    // Only listening.
+    memcpy(outbuffer, inbuffer, sizeof(float) * length * channels);
+
+    if (m_plan == nullptr || channels <= 0)
+    {
+        m_clock.Advance(length);
+        return FMOD_OK;
+    }
+
+    const float scale = 1.f / channels;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        const float* in = inbuffer + static_cast<size_t>(i) * channels;
+        float mono = 0.f;
+        for (int c = 0; c < channels; c++)
+        {
+            mono += in[c];
+        }
+
+        m_frame[m_frameFill++] = mono * scale;
+        if (m_frameFill == FRAME_LENGTH)
+        {
+            this->AnalyseFrame(m_clock.Now() + i + 1 - FRAME_LENGTH);
+
+            // Keep the overlap for the next frame.
+            std::copy(m_frame.begin() + HOP_LENGTH, m_frame.end(), m_frame.begin());
+            m_frameFill = FRAME_LENGTH - HOP_LENGTH;
+        }
+    }
+
+    m_clock.Advance(length);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK BeatTrackerDSP::BeatTrackerGenericCallback(
+    FMOD_DSP_STATE* dsp_state,
+    float* inbuffer,
+    float* outbuffer,
+    uint32_t length,
+    int inchannels,
+    int* outchannels)
+{
+    FMOD_RESULT result;
+
+    FMOD::DSP *thisdsp = reinterpret_cast<FMOD::DSP *>(dsp_state->instance);
+
+    BeatTrackerDSP* tracker;
+    result = thisdsp->getUserData(reinterpret_cast<void **>(&tracker));
+
+    if (result != FMOD_OK)
+    {
+        return result;
+    }
+
+    return tracker->Callback(inbuffer, outbuffer, length, inchannels, outchannels);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "fmod_common.h"
+#include "fmod.hpp"
+#include "fmod_errors.h"
+#include "CommandQueue.h"
+#include "FFTPlans.h"
+#include "SpscQueue.h"
+
+enum class BeatEventType : uint8_t
+{
+    // Something started, Value is its spectral flux.
+    Onset = 1,
+    // Where the tracked pulse falls, Value is the tempo it was predicted from.
+    Beat = 2,
+    // The tempo estimate moved, Value is the new BPM or 0 once there's no beat to follow.
+    Tempo = 3,
+};
+
+struct BeatEvent
+{
+    BeatEventType Type;
+    // Sample on the tracker's clock the event happened at in the audio, see GetSampleTime.
+    SampleTime Time;
+    float Value;
+};
+
+// Listens to the master group and finds onsets, the tempo and where the beats fall as
+// the audio goes past, rather than the game polling a spectrum every frame.
+//
+// The mix is analysed in overlapping frames. Onsets are peaks in the spectral flux that
+// stand out from its recent average, and the tempo is the lag the flux best correlates
+// with itself over the last few seconds. Beats are then predicted a period apart and
+// nudged towards onsets landing close to them.
+//
+// Events are timestamped with the sample they happened at so the game can line things
+// up exactly, but are only found FRAME_LENGTH + HOP_LENGTH samples or so afterwards.
+// Beats are the exception, they come out as soon as their sample has been analysed.
+class BeatTrackerDSP
+{
+public:
+    static constexpr size_t FRAME_LENGTH = 1024;
+    static constexpr size_t HOP_LENGTH = 512;
+
+    BeatTrackerDSP();
+
+    bool Register(FMOD::System* sys, std::string& error);
+
+    // Takes the DSP off the master group and releases it, the callback doesn't run again
+    // afterwards. Must happen before the tracker is destroyed.
+    void Unregister(FMOD::System* sys);
+
+    // Game thread. Oldest first, false once there are none left.
+    bool PopEvent(BeatEvent& event);
+
+    // How far above its recent average the flux has to be to count as an onset.
+    void SetSensitivity(float multiplier);
+
+    // 0 until enough has been heard to tell, or while nothing has a steady beat.
+    float GetBpm() const;
+    SampleTime GetSampleTime() const;
+
+    // Events thrown away because the game wasn't popping them.
+    uint64_t GetDroppedCount() const;
+
+    FMOD_RESULT Callback(
+        float* inbuffer,
+        float* outbuffer,
+        uint32_t length,
+        int inchannels,
+        int* outchannels);
+
+private:
+    // Flux values the threshold averages over, a third of a second or so.
+    static constexpr size_t THRESHOLD_HISTORY = 32;
+    // Flux values the tempo is estimated from, five and a half seconds at 48kHz.
+    static constexpr size_t TEMPO_HISTORY = 512;
+    // Hops between tempo estimates.
+    static constexpr size_t TEMPO_INTERVAL = 32;
+    static constexpr size_t EVENT_QUEUE_LENGTH = 256;
+
+    std::unique_ptr<FFTPlan> m_plan;
+    std::array<float, FRAME_LENGTH> m_frame;
+    size_t m_frameFill = 0;
+    std::unique_ptr<float[]> m_magnitudes;
+    std::unique_ptr<float[]> m_previousMagnitudes;
+
+    // Every flux value in a ring, the newest at m_fluxCount - 1.
+    std::array<float, TEMPO_HISTORY> m_flux;
+    uint64_t m_fluxCount = 0;
+
+    // Onsets closer together than this many samples are counted once.
+    SampleTime m_minOnsetGap = 0;
+    SampleTime m_lastOnset = 0;
+
+    // Beat period in samples, 0 while the tempo is unknown.
+    double m_period = 0.0;
+    double m_nextBeat = 0.0;
+    float m_bpm = 0.f;
+
+    SampleClock m_clock;
+    SpscQueue<BeatEvent, EVENT_QUEUE_LENGTH> m_events;
+
+    std::atomic<float> m_sensitivity = 1.5f;
+    std::atomic<float> m_publishedBpm = 0.f;
+    std::atomic<uint64_t> m_dropped = 0;
+
+    uint32_t m_sampleRate = 48000;
+
+    FMOD::DSP* m_dsp = nullptr;
+    FMOD_DSP_DESCRIPTION m_dspDescr;
+
+    float GetFlux(uint64_t index) const;
+    void AnalyseFrame(SampleTime frameStart);
+    void PickOnset(SampleTime peakTime);
+    void EstimateTempo();
+    void LoseTempo();
+    void TrackBeats(SampleTime analysedUpTo);
+    void PushEvent(BeatEventType type, SampleTime time, float value);
+
+    static FMOD_RESULT F_CALLBACK BeatTrackerGenericCallback(
+        FMOD_DSP_STATE* dsp_state,
+        float* inbuffer,
+        float* outbuffer,
+        uint32_t length,
+        int inchannels,
+        int* outchannels);
+};
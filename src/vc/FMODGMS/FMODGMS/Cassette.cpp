@@ -1,30 +1,51 @@
 #include "Cassette.h"
 #include "UserData.h"
 #include "ConstantReader.h"
+#include "AllocationCounter.h"
+#include "TapeFile.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 
 using namespace Cassette;
 
+// FMOD's default DSP block length and rate, used until Register queries the real ones.
+constexpr size_t DEFAULT_BLOCK_LENGTH = 1024;
+constexpr uint32_t DEFAULT_MIX_RATE = 48000;
+
 CassetteDSP::CassetteDSP(
-    size_t recordCount,
+    const std::vector<TapeFormat>& tapes,
     AnnotationStore* annotationStore,
-    const std::unordered_map<size_t, FMOD::Channel*>* channels,
+    const SlotMap<ChannelSlot>* channels,
     const SpeechSynthDSP* speechSynth) :
+    m_tapeFormats(tapes),
+    m_mixRate(DEFAULT_MIX_RATE),
+    m_control(CassetteControl(static_cast<double>(tapes.at(0).Length))),
     m_annotationStore(annotationStore),
     m_channels(channels),
     m_speechSynth(speechSynth),
-    m_control(CassetteControl(RECORDBUFFER_SIZE))
+    m_mixKernel(MixKernels::MixKernel::Select())
 {
-    RecordBuffer buffer(RECORDBUFFER_SIZE);
-    m_recordBuffers.emplace_back(std::move(buffer));
-    RecordBuffer buffer2(RECORDBUFFER_SIZE);
-    m_recordBuffers.emplace_back(std::move(buffer2));
+    for (size_t i = 0; i < m_resamplers.size(); i++)
+    {
+        m_resamplers[i] = Resampling::Resampler::Select(static_cast<Resampling::ResampleQuality>(i));
+    }
+
+    m_recordBuffers.reserve(tapes.size());
+    for (const auto& tape : tapes)
+    {
+        m_recordBuffers.emplace_back(tape.Length);
+    }
+
+    m_pendingTapes = std::make_unique<PendingTape[]>(tapes.size());
+
+    m_control.SetTape(static_cast<double>(tapes[0].Length), this->GetTapeRatio(0));
 
     // Do we need this?
     memset(&m_dspDescr, 0, sizeof(m_dspDescr));
     
-    strncpy_s(m_dspDescr.name, "record capture DSP", sizeof(m_dspDescr.name));
+    snprintf(m_dspDescr.name, sizeof(m_dspDescr.name), "record capture DSP");
     m_dspDescr.version = 0x00010000;
     m_dspDescr.numinputbuffers = 1;
     m_dspDescr.numoutputbuffers = 1;
@@ -32,35 +53,239 @@ CassetteDSP::CassetteDSP(
     m_dspDescr.userdata = (void *)0x12345678; 
 
     m_state = CassetteState::CASSETTE_PAUSED;
+
+    m_playbackVolume = Constants::Globals.RegisterDouble("cassette_playback_volume");
+
+    this->ResizeScratch(DEFAULT_BLOCK_LENGTH);
+
+    m_dirtyColumns.set();
 }
 
-void CassetteDSP::SetActive(size_t id)
+// Room either side of a block's samples for the widest resampling kernel.
+constexpr size_t RESAMPLE_WINDOW_PADDING = 128;
+
+void CassetteDSP::ResizeScratch(size_t length)
 {
-    m_active = min(id, m_recordBuffers.size() - 1);
+    m_playBuffer.resize(std::max(length, static_cast<size_t>(1)));
+    m_monoBuffer.resize(m_playBuffer.size());
+
+    double maxRatio = 1.0;
+    for (size_t i = 0; i < m_tapeFormats.size(); i++)
+    {
+        maxRatio = std::max(maxRatio, this->GetTapeRatio(i));
+    }
+
+    // Twice the block so playback up to double speed reads the tape in one go.
+    const size_t tapeBlock = static_cast<size_t>(ceil(m_playBuffer.size() * maxRatio));
+    m_resampleWindow.resize(2 * tapeBlock + RESAMPLE_WINDOW_PADDING);
+
+    const auto& recordResampler = m_resamplers[static_cast<size_t>(Resampling::ResampleQuality::Sinc)];
+    m_recordHistory = recordResampler.GetTapsBefore() + recordResampler.GetTapsAfter() + 1;
+    m_recordWindow.resize(m_recordHistory + m_playBuffer.size());
+    m_recordOut.resize(tapeBlock + 2);
+    this->ResetRecordHistory();
 }
 
-void CassetteDSP::SetState(CassetteState state)
+uint32_t CassetteDSP::GetTapeRate(size_t i) const
 {
-    m_state = state;
+    const uint32_t rate = m_tapeFormats[i].SampleRate;
+    return rate == 0 ? m_mixRate : rate;
+}
 
-    if (m_state == CassetteState::CASSETTE_PLAYING)
+double CassetteDSP::GetTapeRatio(size_t i) const
+{
+    const uint32_t rate = m_tapeFormats[i].SampleRate;
+    return rate == 0 || rate == m_mixRate ? 1.0 : static_cast<double>(rate) / m_mixRate;
+}
+
+void CassetteDSP::SelectTape(size_t i)
+{
+    if (i == m_active)
     {
-        m_control.StartPlaying();
+        return;
     }
-    else
+
+    m_active = i;
+    m_control.SetTape(static_cast<double>(m_recordBuffers[i].GetSize()), this->GetTapeRatio(i));
+    this->ResetRecordHistory();
+}
+
+void CassetteDSP::ResetRecordHistory()
+{
+    std::fill(m_recordWindow.begin(), m_recordWindow.end(), 0.f);
+    m_recordPos = static_cast<double>(m_resamplers[static_cast<size_t>(Resampling::ResampleQuality::Sinc)].GetTapsBefore());
+}
+
+void CassetteDSP::SetActive(size_t id, SampleTime time)
+{
+    m_requestedActive = std::min(id, m_recordBuffers.size() - 1);
+    m_commands.Push(Command{ CommandType::SetActive, static_cast<double>(m_requestedActive) }, time);
+}
+
+void CassetteDSP::SetState(CassetteState state, SampleTime time)
+{
+    m_requestedState = state;
+    m_commands.Push(Command{ CommandType::SetState, static_cast<double>(state) }, time);
+}
+
+void CassetteDSP::SetPlaybackRate(double playbackRate, SampleTime time)
+{
+    m_commands.Push(Command{ CommandType::SetPlaybackRate, std::max(0.0, playbackRate) }, time);
+}
+
+void CassetteDSP::SetResampleQuality(Resampling::ResampleQuality quality, SampleTime time)
+{
+    m_commands.Push(Command{ CommandType::SetResampleQuality, static_cast<double>(quality) }, time);
+}
+
+void CassetteDSP::ApplyCommand(const Command& command)
+{
+    switch (command.Type)
     {
-        m_control.StopPlaying();
+    case CommandType::SetActive:
+        this->SelectTape(static_cast<size_t>(command.Value));
+        break;
+    case CommandType::SetState:
+        m_state = static_cast<CassetteState>(static_cast<int>(command.Value));
+
+        if (m_state == CassetteState::CASSETTE_RECORDING)
+        {
+            this->ResetRecordHistory();
+        }
+
+        if (m_state == CassetteState::CASSETTE_PLAYING)
+        {
+            m_control.StartPlaying();
+        }
+        else
+        {
+            m_control.StopPlaying();
+        }
+        break;
+    case CommandType::SetPlaybackRate:
+        m_playbackRate = command.Value;
+        break;
+    case CommandType::SetResampleQuality:
+        m_resampleQuality = static_cast<Resampling::ResampleQuality>(
+            std::min(static_cast<size_t>(command.Value), m_resamplers.size() - 1));
+        break;
+    case CommandType::SwapTape:
+        this->SwapTape(static_cast<size_t>(command.Value));
+        break;
+    default:
+        break;
     }
 }
 
-void CassetteDSP::SetPlaybackRate(double playbackRate)
+size_t CassetteDSP::GetTapeCount() const
 {
-    m_playbackRate = max(0.0, playbackRate);
+    return m_recordBuffers.size();
+}
+
+bool CassetteDSP::SaveTape(size_t i, const std::string& path, bool compress, std::string& error)
+{
+    if (i >= m_recordBuffers.size())
+    {
+        error = "Invalid cassette index";
+        return false;
+    }
+
+    // Both what was asked for and what the audio thread last did, a stop may not have
+    // been applied yet.
+    const CassetteTelemetry& telemetry = m_publishedTelemetry.Read();
+    const bool requestedRecording = m_requestedState == CassetteState::CASSETTE_RECORDING && m_requestedActive == i;
+    const bool recording = telemetry.Recording && telemetry.Active == i;
+    if (requestedRecording || recording)
+    {
+        error = "Can't save a cassette while recording onto it";
+        return false;
+    }
+
+    if (m_pendingTapes[i].Queued.load(std::memory_order_acquire))
+    {
+        error = "Cassette is still loading";
+        return false;
+    }
+
+    return TapeFile::Save(m_recordBuffers[i], this->GetTapeRate(i), *m_annotationStore, path, compress, error);
+}
+
+bool CassetteDSP::LoadTape(size_t i, const std::string& path, std::string& error)
+{
+    if (i >= m_recordBuffers.size())
+    {
+        error = "Invalid cassette index";
+        return false;
+    }
+
+    PendingTape& pending = m_pendingTapes[i];
+    if (pending.Queued.load(std::memory_order_acquire))
+    {
+        error = "Cassette is still loading";
+        return false;
+    }
+
+    // Whatever the last swap left behind.
+    pending.Buffer.reset();
+
+    std::unique_ptr<RecordBuffer> buffer;
+    uint32_t sampleRate = 0;
+    if (!TapeFile::Load(path, *m_annotationStore, buffer, sampleRate, error))
+    {
+        return false;
+    }
+
+    if (sampleRate != this->GetTapeRate(i))
+    {
+        error = "Tape was recorded at a different sample rate";
+        return false;
+    }
+
+    pending.Buffer = std::move(buffer);
+    pending.Queued.store(true, std::memory_order_release);
+    if (!m_commands.Push(Command{ CommandType::SwapTape, static_cast<double>(i) }))
+    {
+        pending.Queued.store(false, std::memory_order_relaxed);
+        pending.Buffer.reset();
+        error = "Too many cassette commands queued";
+        return false;
+    }
+
+    return true;
+}
+
+void CassetteDSP::SwapTape(size_t i)
+{
+    PendingTape& pending = m_pendingTapes[i];
+    if (!pending.Queued.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // Moves pointers around, nothing is allocated or freed. Both tapes are told the
+    // callback's access has ended or begun as the swap happens part way through one.
+    m_recordBuffers[i].EndAccess(0.0);
+    std::swap(m_recordBuffers[i], *pending.Buffer);
+    m_recordBuffers[i].BeginAccess();
+
+    if (i == m_active)
+    {
+        m_control.SetTape(static_cast<double>(m_recordBuffers[i].GetSize()), this->GetTapeRatio(i));
+        m_dirtyColumns.set();
+        this->ResetRecordHistory();
+    }
+
+    pending.Queued.store(false, std::memory_order_release);
 }
 
 size_t CassetteDSP::GetActive() const
 {
-    return m_active;
+    return m_requestedActive;
+}
+
+SampleTime CassetteDSP::GetSampleTime() const
+{
+    return m_clock.Read();
 }
 
 
@@ -71,25 +296,173 @@ double CassetteDSP::GetWaveform(double pos) const
         return 0.0;
     }
 
-    const auto& recordBuffer = this->m_recordBuffers.at(this->m_active);
-    double recordBufferPos = pos * (double)(recordBuffer.GetSize() - 1);
+    // The column's peak, so a curve drawn at any resolution keeps the loud parts.
+    const CassetteTelemetry& telemetry = m_publishedTelemetry.Read();
+    const size_t column = std::min(static_cast<size_t>(pos * WAVEFORM_COLUMNS), WAVEFORM_COLUMNS - 1);
+    const float lo = telemetry.Min[column];
+    const float hi = telemetry.Max[column];
 
-    return recordBuffer.ReadPosInterpolate(recordBufferPos);
+    return -lo > hi ? lo : hi;
+}
+
+size_t CassetteDSP::GetWaveformOverview(float* minMax, size_t count) const
+{
+    const CassetteTelemetry& telemetry = m_publishedTelemetry.Read();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Merge every published column under this one, or repeat one when upsampling.
+        const size_t start = i * WAVEFORM_COLUMNS / count;
+        const size_t end = std::max((i + 1) * WAVEFORM_COLUMNS / count, start + 1);
+
+        float lo = telemetry.Min[start];
+        float hi = telemetry.Max[start];
+        for (size_t column = start + 1; column < end; column++)
+        {
+            lo = std::min(lo, telemetry.Min[column]);
+            hi = std::max(hi, telemetry.Max[column]);
+        }
+
+        minMax[2 * i] = lo;
+        minMax[2 * i + 1] = hi;
+    }
+
+    return count;
 }
 
 double CassetteDSP::GetActivePosition() const
 {
-    const auto& x = m_recordBuffers.at(m_active);
-    return x.GetPosition();
+    return m_publishedTelemetry.Read().Position;
+}
+
+void CassetteDSP::MarkRecorded(size_t start, size_t count)
+{
+    const size_t size = m_recordBuffers.at(m_active).GetSize();
+
+    // Split where the recording wraps round the end of the tape.
+    while (count > 0)
+    {
+        const size_t run = std::min(count, size - start);
+        const size_t first = start * WAVEFORM_COLUMNS / size;
+        const size_t last = (start + run - 1) * WAVEFORM_COLUMNS / size;
+        for (size_t column = first; column <= last; column++)
+        {
+            m_dirtyColumns.set(column);
+        }
+
+        count -= run;
+        start = 0;
+    }
+}
+
+void CassetteDSP::PublishTelemetry()
+{
+    const auto& buffer = m_recordBuffers.at(m_active);
+    const size_t size = buffer.GetSize();
+
+    if (m_telemetry.Active != m_active)
+    {
+        m_telemetry.Active = m_active;
+        m_dirtyColumns.set();
+    }
+
+    if (m_dirtyColumns.any())
+    {
+        for (size_t column = 0; column < WAVEFORM_COLUMNS; column++)
+        {
+            if (m_dirtyColumns.test(column))
+            {
+                // Samples s with s * WAVEFORM_COLUMNS / size == column, matching MarkRecorded.
+                const size_t start = (column * size + WAVEFORM_COLUMNS - 1) / WAVEFORM_COLUMNS;
+                const size_t end = ((column + 1) * size + WAVEFORM_COLUMNS - 1) / WAVEFORM_COLUMNS;
+                const PeakSummary peaks = buffer.ReadPeaks(start, end);
+                m_telemetry.Min[column] = peaks.Min;
+                m_telemetry.Max[column] = peaks.Max;
+            }
+        }
+
+        m_dirtyColumns.reset();
+    }
+
+    m_telemetry.Recording = m_state == CassetteState::CASSETTE_RECORDING;
+    m_telemetry.Position = buffer.GetPosition();
+
+    m_publishedTelemetry.Back() = m_telemetry;
+    m_publishedTelemetry.Publish();
+}
+
+AnnotationId CassetteDSP::GetCurrentWorldAnnotation() const
+{
+    return this->m_worldCurrentAnnotation.load(std::memory_order_relaxed);
+}
+
+void CassetteDSP::UpdateEnvironmentAnnotation()
+{
+    AnnotationId annotation = NO_ANNOTATION;
+    for (const ChannelSlot& slot : *m_channels)
+    {
+        FMOD::Channel* channel = slot.Channel;
+        if (channel == nullptr)
+        {
+            continue;
+        }
+
+        bool chanIsPlaying;
+        FMOD::Sound* playingSound;
+        SoundUserData* userData = nullptr;
+        ChannelUserData* channelData = nullptr;
+        uint32_t posMs;
+        if (channel->isPlaying(&chanIsPlaying) == FMOD_OK && chanIsPlaying
+            && channel->getCurrentSound(&playingSound) == FMOD_OK)
+        {
+            if (playingSound->getUserData(reinterpret_cast<void**>(&userData)) == FMOD_OK && userData != nullptr
+                && channel->getPosition(&posMs, FMOD_TIMEUNIT_MS) == FMOD_OK)
+            {
+                AnnotationCursor* cursor = nullptr;
+                if (channel->getUserData(reinterpret_cast<void**>(&channelData)) == FMOD_OK && channelData != nullptr)
+                {
+                    cursor = &channelData->Cursor;
+                }
+
+                annotation = this->m_annotationStore->GetAnnotation(userData->Id, (double)posMs / 1000.0, cursor);
+                break;
+            }
+        }
+    }
+
+    m_environmentAnnotation.store(annotation, std::memory_order_relaxed);
 }
 
-const AnnotationValue& CassetteDSP::GetCurrentWorldAnnotation() const
+uint64_t CassetteDSP::GetCallbackAllocations() const
 {
-    return this->m_worldCurrentAnnotation;
+    return this->m_callbackAllocations.load(std::memory_order_relaxed);
 }
 
 bool CassetteDSP::Register(FMOD::System* sys, std::string& error)
 {
+    int mixRate = 0;
+    if (sys->getSoftwareFormat(&mixRate, nullptr, nullptr) == FMOD_OK && mixRate > 0)
+    {
+        m_mixRate = static_cast<uint32_t>(mixRate);
+        m_control.SetTape(static_cast<double>(m_recordBuffers[m_active].GetSize()), this->GetTapeRatio(m_active));
+    }
+
+    uint32_t blockLength = static_cast<uint32_t>(m_playBuffer.size());
+    if (sys->getDSPBufferSize(&blockLength, nullptr) != FMOD_OK || blockLength == 0)
+    {
+        blockLength = static_cast<uint32_t>(m_playBuffer.size());
+    }
+
+    this->ResizeScratch(blockLength);
+
+    for (auto& buffer : m_recordBuffers)
+    {
+        if (!buffer.Open(error))
+        {
+            return false;
+        }
+    }
+
     FMOD_RESULT result = sys->createDSP(&m_dspDescr, &m_dsp);
     if (result != FMOD_OK)
     {
@@ -119,7 +492,24 @@ bool CassetteDSP::Register(FMOD::System* sys, std::string& error)
     return true;
 }
 
-AnnotationValue CassetteDSP::GetCurrentAnnotationValue()
+void CassetteDSP::Unregister(FMOD::System* sys)
+{
+    if (m_dsp == nullptr)
+    {
+        return;
+    }
+
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    if (sys->getMasterChannelGroup(&masterGroup) == FMOD_OK && masterGroup != nullptr)
+    {
+        masterGroup->removeDSP(m_dsp);
+    }
+
+    m_dsp->release();
+    m_dsp = nullptr;
+}
+
+AnnotationId CassetteDSP::GetCurrentAnnotation()
 {
     constexpr double VEL_THRESHOLD = 0.01;
     if (m_state != CassetteState::CASSETTE_RECORDING && abs(m_control.GetVel()) > VEL_THRESHOLD)
@@ -131,57 +521,53 @@ AnnotationValue CassetteDSP::GetCurrentAnnotationValue()
     else
     {
         // Try get from speech synth
-        auto speechSynthText = this->m_speechSynth->TryGetText();
-        if (speechSynthText.has_value())
+        const AnnotationId speechSynthText = this->m_speechSynth->TryGetAnnotation();
+        if (speechSynthText != NO_ANNOTATION)
         {
-            return AnnotationValue{ std::move(speechSynthText) };
+            return speechSynthText;
         }
 
-        // Take annotation from environment
-        for (const auto& kv : *m_channels)
-        {
-            const auto& channel = kv.second;
-
-            bool chanIsPlaying;
-            FMOD::Sound* playingSound;
-            SoundUserData* userData;
-            uint32_t posMs;
-            if (channel->isPlaying(&chanIsPlaying) == FMOD_OK && chanIsPlaying
-                && channel->getCurrentSound(&playingSound) == FMOD_OK)
-            {
-                if (playingSound->getUserData(reinterpret_cast<void**>(&userData)) == FMOD_OK
-                    && channel->getPosition(&posMs, FMOD_TIMEUNIT_MS) == FMOD_OK)
-                {
-                    const auto view = this->m_annotationStore->GetAnnotation(userData->Id, (double)posMs / 1000.0);
-                    if (view.has_value())
-                    {
-                        return AnnotationValue{ std::make_optional<std::string>(view.value()) };
-                    }
-
-                    return AnnotationValue{ std::nullopt };
-                }
-            }
-        }
+        // Take annotation from environment, worked out on the game thread
+        return m_environmentAnnotation.load(std::memory_order_relaxed);
     }
-
-    return AnnotationValue();
 }
 
-std::vector<float> CassetteDSP::PlayCassetteSamples(size_t count)
+void CassetteDSP::PlayCassetteSamples(float* samples, size_t count, const ConstantSnapshot& constants)
 {
-    std::vector<float> samples;
-    samples.resize(count);
-
-    for (uint32_t i = 0; i < count; i++)
+    // Playback in mono
+    const auto& buffer = this->m_recordBuffers.at(this->m_active);
+    const auto& resampler = m_resamplers[static_cast<size_t>(m_resampleQuality)];
+    const double pos = m_control.GetPos();
+    const double vel = m_control.GetVel() * this->GetTapeRatio(m_active);
+
+    const int64_t tapsBefore = resampler.GetTapsBefore();
+    const size_t taps = tapsBefore + resampler.GetTapsAfter() + 2;
+    const size_t maxSpan = m_resampleWindow.size() - taps;
+    const double speed = std::abs(vel);
+
+    // Copy out the stretch of tape each run reads then resample it in one go. Only very
+    // fast scrubs need more than one run a block.
+    size_t done = 0;
+    while (done < count)
     {
-        // Playback in mono
-        const auto& buffer = this->m_recordBuffers.at(this->m_active);
-        const double readPos = m_control.GetPos() + i * m_control.GetVel();
-        samples[i] = buffer.ReadPosInterpolate(readPos);
+        size_t run = count - done;
+        if (speed * (run - 1) > maxSpan)
+        {
+            run = static_cast<size_t>(maxSpan / speed) + 1;
+        }
+
+        const double first = pos + done * vel;
+        const double last = first + (run - 1) * vel;
+        const double lowest = floor(std::min(first, last));
+        const int64_t start = static_cast<int64_t>(lowest) - tapsBefore;
+        const size_t length = static_cast<size_t>(floor(std::max(first, last)) - lowest) + taps;
+
+        buffer.CopyWindow(start, length, m_resampleWindow.data());
+        resampler.Run(m_resampleWindow.data(), first - start, vel, samples + done, static_cast<uint32_t>(run));
+        done += run;
     }
 
-    std::vector<float> distorted = m_distort.Run(samples);
-    return distorted;
+    m_distort.Run(samples, count, constants);
 }
 
 float noise(float amp)
@@ -202,67 +588,144 @@ FMOD_RESULT CassetteDSP::Callback(
     int inchannels,
     int* outChannels)
 {
-    const double cassettePlaybackVolume = Constants::Globals.GetDouble("cassette_playback_volume");
-    const size_t sampleCount = length * (*outChannels);
+    AllocationCounter::Scope allocations;
 
-    AnnotationValue annotation = this->GetCurrentAnnotationValue();
-    this->m_worldCurrentAnnotation = annotation;
+    const int channels = *outChannels;
+    const auto constants = Constants::Globals.ReadSnapshot();
 
-    std::vector<float> cassettePlayBuffer;
-    if (m_state != CassetteState::CASSETTE_RECORDING)
+    for (auto& buffer : m_recordBuffers)
     {
-        cassettePlayBuffer = this->PlayCassetteSamples(length);
+        buffer.BeginAccess();
     }
 
-    for (uint32_t samp = 0; samp < length; samp++) 
-    { 
-        // Buffer of samples to write
-        // We want to record in mono so average over channels
-        float averagedSample = 0.0;
+    const AnnotationId annotation = this->GetCurrentAnnotation();
+    this->m_worldCurrentAnnotation.store(annotation, std::memory_order_relaxed);
+
+    // FMOD should never hand us more than the block length we sized for in Register,
+    // but split the block up rather than allocate if it does.
+    const uint32_t maxBlockLength = static_cast<uint32_t>(m_playBuffer.size());
+    uint32_t processed = 0;
+    while (processed < length)
+    {
+        uint32_t blockLength = std::min(length - processed, maxBlockLength);
 
-        for (int chan = 0; chan < *outChannels; chan++)
+        // Shortened so timed commands land on the right sample.
+        blockLength = m_commands.Drain(m_clock.Now(), blockLength, [this](const Command& command)
         {
-			const uint32_t offset = (samp * *outChannels) + chan;
-			float value = inbuffer[offset] * 1.f;
+            this->ApplyCommand(command);
+        });
 
-            averagedSample += value / ((float)(*outChannels));
+        const size_t offset = static_cast<size_t>(processed) * channels;
+        this->ProcessBlock(inbuffer + offset, outbuffer + offset, blockLength, channels, annotation, *constants);
+        m_clock.Advance(blockLength);
+        processed += blockLength;
+    }
 
-            if (cassettePlayBuffer.size() > 0)
-            {
-                value += cassettePlaybackVolume * cassettePlayBuffer.at(samp);
-            }
+    this->PublishTelemetry();
 
-			if (value > 1.f)
-			{
-				value = 1.f;
-			}
-			else if (value < -1.f)
-			{
-				value = -1.f;
-			}
+    // Let the streamers know which way each tape is going.
+    const double vel = (m_state == CassetteState::CASSETTE_RECORDING ? 1.0 : m_control.GetVel()) * this->GetTapeRatio(m_active);
+    for (size_t i = 0; i < m_recordBuffers.size(); i++)
+    {
+        m_recordBuffers[i].EndAccess(i == m_active ? vel : 0.0);
+    }
 
-			outbuffer[offset] = value;
-        }
+    m_callbackAllocations.fetch_add(allocations.Count(), std::memory_order_relaxed);
 
-        if (m_state == CassetteState::CASSETTE_RECORDING)
-        {
-            auto& recordingBuffer = this->m_recordBuffers.at(this->m_active);
-            const float recordSample = averagedSample + noise(0.01);
-            recordingBuffer.Push(recordSample, annotation);
-            this->m_control.SetPos(recordingBuffer.GetPositionSample());
-        }
-    } 
+    return FMOD_OK;
+}
+
+void CassetteDSP::ProcessBlock(
+    const float* inbuffer,
+    float* outbuffer,
+    uint32_t length,
+    int channels,
+    AnnotationId annotation,
+    const ConstantSnapshot& constants)
+{
+    const double cassettePlaybackVolume = constants.GetDouble(m_playbackVolume);
+
+    const bool playing = m_state != CassetteState::CASSETTE_RECORDING;
+    float* cassettePlayBuffer = m_playBuffer.data();
+    if (playing)
+    {
+        this->PlayCassetteSamples(cassettePlayBuffer, length, constants);
+    }
+    else
+    {
+        std::fill(cassettePlayBuffer, cassettePlayBuffer + length, 0.f);
+    }
 
-    if (m_state != CassetteState::CASSETTE_RECORDING)
+    // Mix the tape into every channel and clamp, we record the channel average in mono.
+    float* monoBuffer = m_monoBuffer.data();
+    m_mixKernel.Run(
+        inbuffer,
+        outbuffer,
+        length,
+        channels,
+        cassettePlayBuffer,
+        static_cast<float>(cassettePlaybackVolume),
+        monoBuffer);
+
+    if (m_state == CassetteState::CASSETTE_RECORDING)
+    {
+        auto& recordingBuffer = this->m_recordBuffers.at(this->m_active);
+        const size_t start = recordingBuffer.GetPositionSample();
+        const size_t recorded = this->RecordSamples(recordingBuffer, monoBuffer, length, annotation);
+        this->MarkRecorded(start, recorded);
+
+        this->m_control.SetPos(recordingBuffer.GetPositionSample());
+    }
+
+    if (playing)
     {
         auto& buffer = this->m_recordBuffers.at(this->m_active);
-        m_control.Tick(static_cast<double>(length));
+        m_control.Tick(static_cast<double>(length), constants);
         const uint32_t pos = static_cast<uint32_t>(m_control.GetPos());
         buffer.Seek(pos);
         //buffer.SeekOffset(length);
     }
+}
 
-    return FMOD_OK;
+size_t CassetteDSP::RecordSamples(RecordBuffer& buffer, const float* samples, uint32_t length, AnnotationId annotation)
+{
+    const double ratio = this->GetTapeRatio(m_active);
+    if (ratio == 1.0)
+    {
+        for (uint32_t samp = 0; samp < length; samp++)
+        {
+            const float recordSample = samples[samp] + noise(0.01);
+            buffer.Push(recordSample, annotation);
+        }
+
+        return length;
+    }
+
+    // Band limited by the sinc kernel, which widens itself when squeezing down to a lower rate.
+    const auto& resampler = m_resamplers[static_cast<size_t>(Resampling::ResampleQuality::Sinc)];
+    float* window = m_recordWindow.data();
+    memcpy(window + m_recordHistory, samples, length * sizeof(float));
+
+    // Every tape sample whose taps have all arrived.
+    const double step = 1.0 / ratio;
+    const double last = static_cast<double>(m_recordHistory + length - 1 - resampler.GetTapsAfter());
+    size_t count = 0;
+    if (m_recordPos <= last)
+    {
+        count = std::min(static_cast<size_t>((last - m_recordPos) / step) + 1, m_recordOut.size());
+    }
+
+    resampler.Run(window, m_recordPos, step, m_recordOut.data(), static_cast<uint32_t>(count));
+    m_recordPos += count * step - length;
+    memmove(window, window + length, m_recordHistory * sizeof(float));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const float recordSample = m_recordOut[i] + noise(0.01);
+        buffer.Push(recordSample, annotation);
+    }
+
+    return count;
 }
 
 FMOD_RESULT F_CALLBACK CassetteDSP::CassetteDspGenericCallback(
@@ -288,46 +751,372 @@ FMOD_RESULT F_CALLBACK CassetteDSP::CassetteDspGenericCallback(
     return cassetteObj->Callback(inbuffer, outbuffer, length, inchannels, outchannels);
 }
 
-RecordBuffer::RecordBuffer(size_t count)
+// Reserved up front so recording doesn't allocate unless annotations change very often.
+constexpr size_t RESERVED_ANNOTATION_SPANS = 1024;
+
+// Columns at least this many bins wide are read to the nearest bin edge.
+constexpr size_t PEAK_SNAP_BINS = 16;
+
+void PeakSummary::Add(float sample)
+{
+    if (Count == 0)
+    {
+        Min = sample;
+        Max = sample;
+    }
+    else
+    {
+        Min = std::min(Min, sample);
+        Max = std::max(Max, sample);
+    }
+
+    SumSquares += static_cast<double>(sample) * sample;
+    Count++;
+}
+
+void PeakSummary::Add(const PeakSummary& other)
 {
-    m_buffer.resize(count);
-    m_annotations.resize(count);
+    if (other.Count == 0)
+    {
+        return;
+    }
+
+    if (Count == 0)
+    {
+        *this = other;
+        return;
+    }
+
+    Min = std::min(Min, other.Min);
+    Max = std::max(Max, other.Max);
+    SumSquares += other.SumSquares;
+    Count += other.Count;
+}
+
+float PeakSummary::GetRms() const
+{
+    return Count > 0 ? static_cast<float>(sqrt(SumSquares / Count)) : 0.f;
+}
+
+RecordBuffer::RecordBuffer(size_t count) :
+    m_tape(std::make_unique<TapeStore>(count))
+{
+    m_annotationSpans.reserve(RESERVED_ANNOTATION_SPANS);
+    m_annotationSpans.push_back(AnnotationSpan{ 0, static_cast<uint32_t>(count), NO_ANNOTATION });
     m_pos = 0;
+
+    // Bins never straddle a chunk of tape so one is either all in memory or not at all.
+    m_peakBinShift = 0;
+    while ((static_cast<size_t>(1) << m_peakBinShift) < PEAK_BIN_SIZE
+        || (((count - 1) >> m_peakBinShift) >= PEAK_MAX_BINS && m_peakBinShift < TAPE_CHUNK_SHIFT))
+    {
+        m_peakBinShift++;
+    }
+
+    const size_t binSize = static_cast<size_t>(1) << m_peakBinShift;
+    size_t levelSize = std::max((count + binSize - 1) >> m_peakBinShift, static_cast<size_t>(1));
+    m_peakLevels.emplace_back(levelSize);
+    while (levelSize > 1)
+    {
+        levelSize = (levelSize + 1) / 2;
+        m_peakLevels.emplace_back(levelSize);
+    }
+
+    // Blank tape, which is what bins that aren't streamed in yet fall back to.
+    for (size_t bin = 0; bin < m_peakLevels[0].size(); bin++)
+    {
+        m_peakLevels[0][bin].Count = static_cast<uint32_t>(std::min(binSize, count - (bin << m_peakBinShift)));
+        this->FinishBin(bin, false);
+    }
+}
+
+bool RecordBuffer::Open(std::string& error)
+{
+    return m_tape->Open(error);
+}
+
+void RecordBuffer::BeginAccess()
+{
+    m_tape->BeginAccess();
 }
 
-void RecordBuffer::Push(float f, AnnotationValue annotation)
+void RecordBuffer::EndAccess(double velocity)
 {
-    m_buffer[m_pos] = f;
-    m_annotations[m_pos] = annotation;
+    m_tape->SetHead(m_pos, velocity);
+    m_tape->EndAccess();
+}
+
+void RecordBuffer::Push(float f, AnnotationId annotation)
+{
+    m_tape->Write(m_pos, f);
+    this->WriteAnnotation(static_cast<uint32_t>(m_pos), annotation);
+
+    const size_t bin = m_pos >> m_peakBinShift;
+    m_peakPathStale = true;
 
     m_pos++;
 
-    if (m_pos >= m_buffer.size())
+    if (m_pos >= m_tape->GetSize())
     {
         m_pos = 0;
     }
+
+    if ((m_pos >> m_peakBinShift) != bin)
+    {
+        this->FinishBin(bin, false);
+    }
 }
 
 void RecordBuffer::Seek(size_t pos)
 {
+    // Leaving the bin being written, so nothing will be climbing up its path any more.
+    if (m_peakPathStale && (pos >> m_peakBinShift) != (m_pos >> m_peakBinShift))
+    {
+        this->FinishBin(m_pos >> m_peakBinShift, true);
+        m_peakPathStale = false;
+    }
+
     m_pos = pos;
 }
 
 void RecordBuffer::SeekOffset(int offset)
 {
-    const size_t pos = this->WrapOffset(offset);
-    m_pos = pos;
+    this->Seek(this->WrapOffset(offset));
+}
+
+PeakSummary RecordBuffer::ScanBin(size_t bin) const
+{
+    const size_t start = bin << m_peakBinShift;
+    size_t count = 0;
+    const float* samples = m_tape->ReadRun(start, count);
+    count = std::min(count, static_cast<size_t>(1) << m_peakBinShift);
+
+    // Paged out, the last summary we made of it still stands.
+    if (samples == nullptr)
+    {
+        return m_peakLevels[0][bin];
+    }
+
+    // Runs every bin's worth of pushes, keep it branch free.
+    float lo = samples[0];
+    float hi = lo;
+    float sumSquares = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        const float sample = samples[i];
+        lo = std::min(lo, sample);
+        hi = std::max(hi, sample);
+        sumSquares += sample * sample;
+    }
+
+    PeakSummary summary;
+    summary.Min = lo;
+    summary.Max = hi;
+    summary.SumSquares = sumSquares;
+    summary.Count = static_cast<uint32_t>(count);
+    return summary;
+}
+
+void RecordBuffer::AddSamples(PeakSummary& summary, size_t start, size_t end) const
+{
+    while (start < end)
+    {
+        size_t count = 0;
+        const float* samples = m_tape->ReadRun(start, count);
+        count = std::min(count, end - start);
+
+        if (samples == nullptr)
+        {
+            // Only whole bins are known for tape that is paged out.
+            const size_t bin = start >> m_peakBinShift;
+            summary.Add(m_peakLevels[0][bin]);
+            count = std::min(((bin + 1) << m_peakBinShift) - start, end - start);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                summary.Add(samples[i]);
+            }
+        }
+
+        start += count;
+    }
+}
+
+void RecordBuffer::FinishBin(size_t bin, bool wholePath)
+{
+    m_peakLevels[0][bin] = this->ScanBin(bin);
+
+    // Each level halves the work so this is O(1) a sample on average.
+    size_t index = bin;
+    for (size_t level = 1; level < m_peakLevels.size(); level++)
+    {
+        const auto& children = m_peakLevels[level - 1];
+        const bool lastChild = index % 2 == 1 || index + 1 == children.size();
+        if (!wholePath && !lastChild)
+        {
+            break;
+        }
+
+        index /= 2;
+
+        PeakSummary node = children[2 * index];
+        if (2 * index + 1 < children.size())
+        {
+            node.Add(children[2 * index + 1]);
+        }
+
+        m_peakLevels[level][index] = node;
+    }
+}
+
+void RecordBuffer::RebuildPeaks()
+{
+    for (size_t level = 1; level < m_peakLevels.size(); level++)
+    {
+        const auto& children = m_peakLevels[level - 1];
+        for (size_t index = 0; index < m_peakLevels[level].size(); index++)
+        {
+            PeakSummary node = children[2 * index];
+            if (2 * index + 1 < children.size())
+            {
+                node.Add(children[2 * index + 1]);
+            }
+
+            m_peakLevels[level][index] = node;
+        }
+    }
+
+    m_peakPathStale = false;
+}
+
+PeakSummary RecordBuffer::ReadPeakNode(size_t level, size_t index) const
+{
+    // Nodes over the write head may be missing some of what was pushed.
+    if (m_peakPathStale && index == (m_pos >> m_peakBinShift) >> level)
+    {
+        if (level == 0)
+        {
+            return this->ScanBin(index);
+        }
+
+        const size_t childCount = m_peakLevels[level - 1].size();
+
+        PeakSummary node = this->ReadPeakNode(level - 1, 2 * index);
+        if (2 * index + 1 < childCount)
+        {
+            node.Add(this->ReadPeakNode(level - 1, 2 * index + 1));
+        }
+
+        return node;
+    }
+
+    return m_peakLevels[level][index];
+}
+
+PeakSummary RecordBuffer::ReadPeaks(size_t start, size_t end) const
+{
+    return this->ReadPeaks(start, end, false);
+}
+
+PeakSummary RecordBuffer::ReadPeaks(size_t start, size_t end, bool snapToBins) const
+{
+    PeakSummary result;
+
+    const size_t size = m_tape->GetSize();
+    end = std::min(end, size);
+
+    // Round to the nearest bin edges when there are plenty of bins in the range, so long
+    // tapes don't scan hundreds of samples at each end for a difference nobody can see.
+    const size_t binSize = static_cast<size_t>(1) << m_peakBinShift;
+    if (snapToBins)
+    {
+        const size_t snappedStart = ((start + binSize / 2) >> m_peakBinShift) << m_peakBinShift;
+        const size_t snappedEnd = end == size ? end : std::min(((end + binSize / 2) >> m_peakBinShift) << m_peakBinShift, size);
+        if (snappedStart < snappedEnd)
+        {
+            start = snappedStart;
+            end = snappedEnd;
+        }
+    }
+
+    if (start >= end)
+    {
+        return result;
+    }
+
+    // Whole bins come from the pyramid, the ragged ends are read directly.
+    const size_t firstBin = (start + binSize - 1) >> m_peakBinShift;
+    const size_t lastBin = end == size ? m_peakLevels[0].size() : end >> m_peakBinShift;
+
+    if (firstBin >= lastBin)
+    {
+        this->AddSamples(result, start, end);
+        return result;
+    }
+
+    this->AddSamples(result, start, firstBin << m_peakBinShift);
+    this->AddSamples(result, lastBin << m_peakBinShift, end);
+
+    size_t lo = firstBin;
+    size_t hi = lastBin;
+    for (size_t level = 0; lo < hi; level++)
+    {
+        if (lo % 2 == 1)
+        {
+            result.Add(this->ReadPeakNode(level, lo++));
+        }
+
+        if (hi % 2 == 1)
+        {
+            result.Add(this->ReadPeakNode(level, --hi));
+        }
+
+        lo /= 2;
+        hi /= 2;
+    }
+
+    return result;
+}
+
+void RecordBuffer::ReadPeaks(size_t start, size_t end, PeakSummary* columns, size_t count) const
+{
+    const size_t size = m_tape->GetSize();
+    const size_t length = end >= start ? end - start : end + size - start;
+    const bool snap = length / count >= PEAK_SNAP_BINS << m_peakBinShift;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t columnStart = start + i * length / count;
+        const size_t columnEnd = std::max(start + (i + 1) * length / count, columnStart + 1);
+
+        // Columns narrower than a sample still show the sample they land on.
+        if (columnEnd <= size)
+        {
+            columns[i] = this->ReadPeaks(columnStart, columnEnd, snap);
+        }
+        else if (columnStart >= size)
+        {
+            columns[i] = this->ReadPeaks(columnStart - size, columnEnd - size, snap);
+        }
+        else
+        {
+            columns[i] = this->ReadPeaks(columnStart, size, snap);
+            columns[i].Add(this->ReadPeaks(0, columnEnd - size, snap));
+        }
+    }
 }
 
 float RecordBuffer::ReadOffset(int offset) const
 {
     const size_t pos = this->WrapOffset(offset);
-    return m_buffer[pos];
+    return m_tape->Read(pos);
 }
 
 float RecordBuffer::ReadPos(size_t pos) const
 {
-    return m_buffer[pos];
+    return m_tape->Read(pos);
 }
 
 float RecordBuffer::ReadPosInterpolate(double pos) const
@@ -335,37 +1124,159 @@ float RecordBuffer::ReadPosInterpolate(double pos) const
     double intPart;
     const float fracPart = static_cast<float>(modf(pos, &intPart));
 
+    const size_t size = m_tape->GetSize();
     uint32_t lower = (uint32_t)intPart;
-    if (lower >= m_buffer.size())
+    if (lower >= size)
     {
-        lower -= m_buffer.size();
+        lower -= size;
     }
     uint32_t upper = lower + 1;
-    if (upper >= m_buffer.size())
+    if (upper >= size)
     {
-        upper -= m_buffer.size();
+        upper -= size;
     }
 
     const float valLower = this->ReadPos(lower);
     const float valUpper = this->ReadPos(upper);
 
-    return (float)(fracPart * valLower + (1.0 - fracPart) * valUpper);
+    return (float)((1.0 - fracPart) * valLower + fracPart * valUpper);
 }
 
-const AnnotationValue& RecordBuffer::ReadOffsetAnnotation(int offset) const
+void RecordBuffer::CopyWindow(int64_t start, size_t count, float* out) const
+{
+    const int64_t size = static_cast<int64_t>(m_tape->GetSize());
+    size_t pos = static_cast<size_t>(((start % size) + size) % size);
+
+    // A run at a time up to the end of a chunk or the tape, whichever comes first.
+    while (count > 0)
+    {
+        size_t run = 0;
+        const float* samples = m_tape->ReadRun(pos, run);
+        run = std::min(run, count);
+
+        if (samples != nullptr)
+        {
+            memcpy(out, samples, run * sizeof(float));
+        }
+        else
+        {
+            std::fill(out, out + run, 0.f);
+        }
+
+        out += run;
+        count -= run;
+        pos += run;
+        if (pos >= m_tape->GetSize())
+        {
+            pos = 0;
+        }
+    }
+}
+
+AnnotationId RecordBuffer::ReadOffsetAnnotation(int offset) const
 {
     const size_t pos = this->WrapOffset(offset);
-    return m_annotations[pos];
+    return this->ReadPosAnnotation(pos);
+}
+
+AnnotationId RecordBuffer::ReadPosAnnotation(size_t pos) const
+{
+    return m_annotationSpans[this->FindSpan(pos)].Id;
+}
+
+const std::vector<AnnotationSpan>& RecordBuffer::GetAnnotationSpans() const
+{
+    return m_annotationSpans;
+}
+
+size_t RecordBuffer::FindSpan(size_t pos) const
+{
+    // Last span starting at or before pos
+    const auto next = std::upper_bound(m_annotationSpans.begin(), m_annotationSpans.end(), pos, [](size_t x, const AnnotationSpan& span)
+    {
+        return x < span.Start;
+    });
+
+    return (next - m_annotationSpans.begin()) - 1;
+}
+
+void RecordBuffer::RestoreSpans(const std::vector<AnnotationSpan>& spans)
+{
+    // Keep the usual headroom so recording over a loaded tape doesn't allocate either.
+    m_annotationSpans.reserve(spans.size() + RESERVED_ANNOTATION_SPANS);
+    m_annotationSpans.assign(spans.begin(), spans.end());
+    m_writeSpan = 0;
 }
 
-const AnnotationValue& RecordBuffer::ReadPosAnnotation(size_t pos) const
+void RecordBuffer::WriteAnnotation(uint32_t pos, AnnotationId annotation)
 {
-    return m_annotations[pos];
+    auto& spans = m_annotationSpans;
+
+    // Writes are sequential so the span we wrote to last time is almost always the right one.
+    size_t i = m_writeSpan;
+    if (i >= spans.size() || pos < spans[i].Start || pos >= spans[i].Start + spans[i].Length)
+    {
+        i = this->FindSpan(pos);
+    }
+
+    m_writeSpan = i;
+
+    if (spans[i].Id == annotation)
+    {
+        return;
+    }
+
+    if (pos == spans[i].Start && i > 0 && spans[i - 1].Id == annotation)
+    {
+        // Eat the first sample of this span into the previous one
+        spans[i - 1].Length++;
+        spans[i].Start++;
+        spans[i].Length--;
+        m_writeSpan = i - 1;
+
+        if (spans[i].Length == 0)
+        {
+            spans.erase(spans.begin() + i);
+
+            if (i < spans.size() && spans[i].Id == annotation)
+            {
+                spans[i - 1].Length += spans[i].Length;
+                spans.erase(spans.begin() + i);
+            }
+        }
+
+        return;
+    }
+
+    // Split into [start, pos) [pos] [pos + 1, end)
+    const AnnotationSpan span = spans[i];
+    const AnnotationSpan before{ span.Start, pos - span.Start, span.Id };
+    const AnnotationSpan after{ pos + 1, span.Start + span.Length - (pos + 1), span.Id };
+
+    spans[i] = AnnotationSpan{ pos, 1, annotation };
+
+    if (after.Length > 0)
+    {
+        spans.insert(spans.begin() + i + 1, after);
+    }
+    else if (i + 1 < spans.size() && spans[i + 1].Id == annotation)
+    {
+        spans[i].Length += spans[i + 1].Length;
+        spans.erase(spans.begin() + i + 1);
+    }
+
+    if (before.Length > 0)
+    {
+        spans.insert(spans.begin() + i, before);
+        i++;
+    }
+
+    m_writeSpan = i;
 }
 
 float RecordBuffer::GetPosition() const
 {
-    return (float)m_pos / (float)m_buffer.size();
+    return (float)m_pos / (float)m_tape->GetSize();
 }
 
 uint32_t RecordBuffer::GetPositionSample() const
@@ -379,11 +1290,11 @@ size_t RecordBuffer::WrapOffset(int offset) const
     // Assume size > abs(offset) and won't wrap twice.
     if (pos < 0)
     {
-        pos += (int)m_buffer.size();
+        pos += (int)m_tape->GetSize();
     }
-    else if (pos >= (int)m_buffer.size())
+    else if (pos >= (int)m_tape->GetSize())
     {
-        pos -= m_buffer.size();
+        pos -= (int)m_tape->GetSize();
     }
 
     return pos;
@@ -391,5 +1302,5 @@ size_t RecordBuffer::WrapOffset(int offset) const
 
 size_t RecordBuffer::GetSize() const
 {
-    return this->m_buffer.size();
+    return this->m_tape->GetSize();
 }
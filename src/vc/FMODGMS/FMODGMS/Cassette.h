@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <vector>
 #include <memory>
 #include <optional>
@@ -9,8 +12,15 @@
 #include <string>
 #include "AnnotationStore.h"
 #include "CassetteControl.h"
+#include "CommandQueue.h"
 #include "CassetteDistortion.h"
+#include "MixKernels.h"
+#include "Resampler.h"
+#include "SlotMap.h"
 #include "SpeechSynth.h"
+#include "TapeStore.h"
+#include "TripleBuffer.h"
+#include "UserData.h"
 
 namespace Cassette
 {
@@ -18,9 +28,53 @@ namespace Cassette
     //constexpr size_t RECORDBUFFER_SIZE = 44100 * 2;
     constexpr size_t RECORDBUFFER_SIZE = static_cast<size_t>(24100 * 2.5);
 
-    struct AnnotationValue
+    // Samples summarised by each node at the bottom of a RecordBuffer's peak pyramid.
+    // Long tapes double it until there are at most PEAK_MAX_BINS bins.
+    constexpr size_t PEAK_BIN_SIZE = 16;
+    constexpr size_t PEAK_MAX_BINS = 65536;
+
+    // Length in samples and rate of one tape, 0 for the mixer's rate. Lower rates cost
+    // less memory for the same length of tape and get resampled on the way in and out.
+    struct TapeFormat
+    {
+        size_t Length = RECORDBUFFER_SIZE;
+        uint32_t SampleRate = 0;
+    };
+
+    // Resolution of the waveform overview handed to GML.
+    constexpr size_t WAVEFORM_COLUMNS = 512;
+
+    // What the game thread sees of the tape, published by the audio thread each callback.
+    struct CassetteTelemetry
     {
-        std::optional<std::string> Value;
+        size_t Active = 0;
+        bool Recording = false;
+        double Position = 0;
+
+        // Sample range of each column of the active tape.
+        std::array<float, WAVEFORM_COLUMNS> Min = {};
+        std::array<float, WAVEFORM_COLUMNS> Max = {};
+    };
+
+    // Run of samples recorded with the same annotation.
+    struct AnnotationSpan
+    {
+        uint32_t Start;
+        uint32_t Length;
+        AnnotationId Id;
+    };
+
+    // Min, max and energy of a run of samples.
+    struct PeakSummary
+    {
+        float Min = 0.f;
+        float Max = 0.f;
+        double SumSquares = 0.0;
+        uint32_t Count = 0;
+
+        void Add(float sample);
+        void Add(const PeakSummary& other);
+        float GetRms() const;
     };
 
     class RecordBuffer
@@ -28,7 +82,15 @@ namespace Cassette
     public:
         RecordBuffer(size_t count);
 
-        void Push(float f, AnnotationValue annotation);
+        // Starts streaming tapes too long to keep in memory.
+        bool Open(std::string& error);
+
+        // Audio thread, around everything done to the tape in a callback. velocity is how
+        // fast the head is moving so the tape can be streamed in ahead of it.
+        void BeginAccess();
+        void EndAccess(double velocity);
+
+        void Push(float f, AnnotationId annotation);
         void Seek(size_t pos);
         void SeekOffset(int offset);
 
@@ -36,21 +98,58 @@ namespace Cassette
         float ReadPos(size_t pos) const;
         float ReadPosInterpolate(double pos) const;
 
-        const AnnotationValue& ReadOffsetAnnotation(int offset) const;
-        const AnnotationValue& ReadPosAnnotation(size_t pos) const;
+        // Copies count samples from start onwards, wrapping round either end of the buffer.
+        // Tape that isn't streamed in yet copies as silence.
+        void CopyWindow(int64_t start, size_t count, float* out) const;
+
+        // Summary of the samples in [start, end) from the peak pyramid, so costs
+        // O(log size) whatever the length of the range.
+        PeakSummary ReadPeaks(size_t start, size_t end) const;
+
+        // One summary per column for count columns evenly covering [start, end), the
+        // range may wrap round the end of the buffer. For drawing at any zoom level.
+        void ReadPeaks(size_t start, size_t end, PeakSummary* columns, size_t count) const;
+
+        AnnotationId ReadOffsetAnnotation(int offset) const;
+        AnnotationId ReadPosAnnotation(size_t pos) const;
+
+        // Sorted runs covering the whole tape, neighbouring runs never share an id.
+        const std::vector<AnnotationSpan>& GetAnnotationSpans() const;
 
         float GetPosition() const;
         uint32_t GetPositionSample() const;
         size_t GetSize() const;
     private:
-        std::vector<float> m_buffer;
+        friend class TapeFile;
 
-        // TODO Optimise, this is dumb
-        std::vector<AnnotationValue> m_annotations;
+        // Held by pointer as the streaming thread keeps hold of it.
+        std::unique_ptr<TapeStore> m_tape;
+
+        // Sorted spans covering the whole buffer, annotations only change a few
+        // times a second so this stays tiny compared to one entry per sample.
+        std::vector<AnnotationSpan> m_annotationSpans;
+        size_t m_writeSpan = 0;
 
         size_t m_pos;
 
+        // Level 0 summarises bins of 1 << m_peakBinShift samples and each level above pairs
+        // up the one below. Push only climbs when it finishes the last child of a node,
+        // so nodes above the bin being written are worked out from their children when
+        // read and brought up to date when the write head leaves on a Seek.
+        std::vector<std::vector<PeakSummary>> m_peakLevels;
+        bool m_peakPathStale = false;
+        size_t m_peakBinShift = 0;
+
         size_t WrapOffset(int offset) const;
+        PeakSummary ScanBin(size_t bin) const;
+        void AddSamples(PeakSummary& summary, size_t start, size_t end) const;
+        PeakSummary ReadPeaks(size_t start, size_t end, bool snapToBins) const;
+        PeakSummary ReadPeakNode(size_t level, size_t index) const;
+        void FinishBin(size_t bin, bool wholePath);
+        void RebuildPeaks();
+        void RestoreSpans(const std::vector<AnnotationSpan>& spans);
+        size_t FindSpan(size_t pos) const;
+        void WriteAnnotation(uint32_t pos, AnnotationId annotation);
     };
 
     enum class CassetteState
@@ -63,24 +162,109 @@ namespace Cassette
     class CassetteDSP
     {
     public:
+        // One cassette per format, there has to be at least one. Tapes too long to keep in
+        // memory are streamed from a temporary file once registered.
         CassetteDSP(
-            size_t recordCount,
+            const std::vector<TapeFormat>& tapes,
             AnnotationStore* annotationStore,
-            const std::unordered_map<std::size_t, FMOD::Channel*>* channels,
+            const SlotMap<ChannelSlot>* channels,
             const SpeechSynthDSP* speechSynth);
 
         bool Register(FMOD::System* sys, std::string& error);
 
-        void SetActive(size_t i);
-        void SetState(CassetteState state);
-        void SetPlaybackRate(double playbackRate);
+        // Takes the DSP off the master group and releases it, the callback doesn't run
+        // again afterwards. Must happen before the cassette is destroyed.
+        void Unregister(FMOD::System* sys);
+
+        // Queued for the audio thread. With a time they are applied on that sample of
+        // GetSampleTime's clock.
+        void SetActive(size_t i, SampleTime time = IMMEDIATE);
+        void SetState(CassetteState state, SampleTime time = IMMEDIATE);
+        void SetPlaybackRate(double playbackRate, SampleTime time = IMMEDIATE);
+        void SetResampleQuality(Resampling::ResampleQuality quality, SampleTime time = IMMEDIATE);
 
+        size_t GetTapeCount() const;
+
+        // Game thread, see TapeFile. Can't save the tape being recorded onto. A loaded
+        // tape has to be at the rate the cassette was created with and is swapped in by
+        // the audio thread, so one load per cassette can be in flight at once.
+        bool SaveTape(size_t i, const std::string& path, bool compress, std::string& error);
+        bool LoadTape(size_t i, const std::string& path, std::string& error);
+
+        // As last requested by the game thread.
         size_t GetActive() const;
+        SampleTime GetSampleTime() const;
         double GetActivePosition() const;
         double GetWaveform(double pos) const;
-        const AnnotationValue& GetCurrentWorldAnnotation() const;
+
+        // Fills interleaved min, max pairs for count columns across the whole tape, as
+        // of the last callback. Never blocks the audio thread.
+        size_t GetWaveformOverview(float* minMax, size_t count) const;
+
+        AnnotationId GetCurrentWorldAnnotation() const;
+
+        // Game thread, once a frame. Finds the annotation under the first playing channel
+        // that has one and publishes it, so the audio thread never touches the channels.
+        void UpdateEnvironmentAnnotation();
+
+        // Total heap allocations seen inside the audio callback, always zero unless
+        // allocation tracking is compiled in.
+        uint64_t GetCallbackAllocations() const;
+
+        FMOD_RESULT Callback(
+            float* inbuffer,
+            float* outbuffer,
+            uint32_t length,
+            int inchannels,
+            int* outchannels);
     private:
+        enum class CommandType : uint8_t
+        {
+            SetActive,
+            SetState,
+            SetPlaybackRate,
+            SetResampleQuality,
+            SwapTape,
+        };
+
+        struct Command
+        {
+            CommandType Type;
+            double Value;
+        };
+
+        static constexpr size_t COMMAND_QUEUE_LENGTH = 64;
+
+        CommandQueue<Command, COMMAND_QUEUE_LENGTH> m_commands;
+        SampleClock m_clock;
+        size_t m_requestedActive = 0;
+        CassetteState m_requestedState = CassetteState::CASSETTE_PAUSED;
+
+        // A loaded tape waiting for the audio thread to swap it in. Afterwards it holds
+        // the old tape until the next load so it is never freed on the audio thread.
+        struct PendingTape
+        {
+            std::unique_ptr<RecordBuffer> Buffer;
+            std::atomic<bool> Queued = false;
+        };
+
+        std::unique_ptr<PendingTape[]> m_pendingTapes;
+
+        void SwapTape(size_t i);
+
+        void ApplyCommand(const Command& command);
+
+        // Audio thread copy, only columns recorded over since the last callback are rescanned.
+        CassetteTelemetry m_telemetry;
+        std::bitset<WAVEFORM_COLUMNS> m_dirtyColumns;
+        mutable TripleBuffer<CassetteTelemetry> m_publishedTelemetry;
+
+        void MarkRecorded(size_t start, size_t count);
+        void PublishTelemetry();
+
         std::vector<RecordBuffer> m_recordBuffers;
+        std::vector<TapeFormat> m_tapeFormats;
+        uint32_t m_mixRate;
         double m_playbackRate = 0;
         size_t m_active = 0;
         CassetteState m_state = CassetteState::CASSETTE_PAUSED;
@@ -89,24 +273,63 @@ namespace Cassette
         CassetteDistortion m_distort;
 
         AnnotationStore* m_annotationStore;
-        const std::unordered_map<std::size_t, FMOD::Channel*>* m_channels;
+        const SlotMap<ChannelSlot>* m_channels;
 
         const SpeechSynthDSP* m_speechSynth;
 
-        FMOD::DSP* m_dsp;
+        FMOD::DSP* m_dsp = nullptr;
         FMOD_DSP_DESCRIPTION m_dspDescr;
 
-        AnnotationValue m_worldCurrentAnnotation;
+        // Annotation recorded with each block, and the environment's as of the last
+        // UpdateEnvironmentAnnotation.
+        std::atomic<AnnotationId> m_worldCurrentAnnotation = NO_ANNOTATION;
+        std::atomic<AnnotationId> m_environmentAnnotation = NO_ANNOTATION;
 
-        AnnotationValue GetCurrentAnnotationValue();
-        std::vector<float> PlayCassetteSamples(size_t count);
+        // Scratch space for the audio callback, sized to the mixer block length in
+        // Register so the callback never allocates.
+        std::vector<float> m_playBuffer;
+        std::vector<float> m_monoBuffer;
 
-        FMOD_RESULT Callback(
-            float* inbuffer,
+        // Written by the audio callback, read from the game thread.
+        std::atomic<uint64_t> m_callbackAllocations = 0;
+
+        void ResizeScratch(size_t length);
+
+        // Picked for this CPU when the DSP is created.
+        MixKernels::MixKernel m_mixKernel;
+        std::array<Resampling::Resampler, Resampling::RESAMPLE_QUALITY_COUNT> m_resamplers;
+        Resampling::ResampleQuality m_resampleQuality = Resampling::ResampleQuality::Cubic;
+
+        // Tape under the read head for one block, copied out so the resampler never wraps.
+        std::vector<float> m_resampleWindow;
+
+        // Mixer samples waiting to be resampled onto a tape at a different rate. The
+        // window starts with the last few samples of the previous block so the filter
+        // runs on across blocks, m_recordPos is where the next tape sample falls in it.
+        std::vector<float> m_recordWindow;
+        std::vector<float> m_recordOut;
+        size_t m_recordHistory = 0;
+        double m_recordPos = 0;
+
+        // Tape samples per mixer sample.
+        uint32_t GetTapeRate(size_t i) const;
+        double GetTapeRatio(size_t i) const;
+        void SelectTape(size_t i);
+        void ResetRecordHistory();
+        size_t RecordSamples(RecordBuffer& buffer, const float* samples, uint32_t length, AnnotationId annotation);
+
+        AnnotationId GetCurrentAnnotation();
+        ConstantHandle m_playbackVolume;
+
+        void PlayCassetteSamples(float* samples, size_t count, const ConstantSnapshot& constants);
+
+        void ProcessBlock(
+            const float* inbuffer,
             float* outbuffer,
             uint32_t length,
-            int inchannels,
-            int* outchannels);
+            int channels,
+            AnnotationId annotation,
+            const ConstantSnapshot& constants);
 
         static FMOD_RESULT F_CALLBACK CassetteDspGenericCallback(
             FMOD_DSP_STATE* dsp_state,
@@ -1,5 +1,6 @@
 #include "CassetteControl.h"
 #include <cmath>
+#include <algorithm>
 #include "ConstantReader.h"
 
 using namespace Cassette;
@@ -10,6 +11,10 @@ CassetteControl::CassetteControl(double sampleLength)
     m_vel = 0.0;
     m_playing = false;
     m_sampleLength = sampleLength;
+    m_rateRatio = 1.0;
+
+    m_weightDivisor = Constants::Globals.RegisterDouble("cassette_control_weight_divisor");
+    m_weightDecelMult = Constants::Globals.RegisterDouble("cassette_control_weight_decel_mult");
 }
 
 void CassetteControl::StartPlaying()
@@ -32,6 +37,18 @@ void CassetteControl::SetVel(double vel)
     m_vel = vel;
 }
 
+void CassetteControl::SetTape(double sampleLength, double rateRatio)
+{
+    m_pos = fmod(m_pos * rateRatio / m_rateRatio, sampleLength);
+    if (m_pos < 0.0)
+    {
+        m_pos += sampleLength;
+    }
+
+    m_sampleLength = sampleLength;
+    m_rateRatio = rateRatio;
+}
+
 double CassetteControl::GetPos() const
 {
     return m_pos;
@@ -60,7 +77,7 @@ double weightVals(double x0, double x1, double weight)
     return (x0 * (weight - 1.0) + x1) / weight;
 }
 
-void CassetteControl::Tick(double dt)
+void CassetteControl::Tick(double dt, const ConstantSnapshot& constants)
 {
     if (dt == 0)
     {
@@ -69,7 +86,7 @@ void CassetteControl::Tick(double dt)
 
     const double targetVel = GetTargetVel();
 
-    double weight_div = Constants::Globals.GetDouble("cassette_control_weight_divisor");
+    double weight_div = constants.GetDouble(m_weightDivisor);
 
     if (weight_div == 0.0)
     {
@@ -80,13 +97,14 @@ void CassetteControl::Tick(double dt)
 
     //const double WEIGHT = 1.0 / 200.0;
     //const double DECEL_WEIGHT = WEIGHT * 1.8;
-    const double decel_weight = weight_base * Constants::Globals.GetDouble("cassette_control_weight_decel_mult");
+    const double decel_weight = weight_base * constants.GetDouble(m_weightDecelMult);
 
     const double weight = std::abs(targetVel) > 0.001 ? weight_base : decel_weight;
 
-    m_vel = weightVals(m_vel, targetVel, dt * weight);
+    // weightVals overshoots and diverges for weights below 1, which small DSP blocks hit.
+    m_vel = weightVals(m_vel, targetVel, std::max(dt * weight, 1.0));
 
-    m_pos += m_vel * dt;
+    m_pos += m_vel * dt * m_rateRatio;
     if (m_pos > m_sampleLength)
     {
         m_pos -= m_sampleLength;
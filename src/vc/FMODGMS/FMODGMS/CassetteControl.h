@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ConstantReader.h"
+
 namespace Cassette
 {
     class CassetteControl
@@ -13,20 +15,28 @@ namespace Cassette
         void SetPos(double pos);
         void SetVel(double vel);
 
+        // Switches to a tape of another length, rateRatio tape samples go by each sample
+        // Tick is given. The position keeps the same time into the tape.
+        void SetTape(double sampleLength, double rateRatio);
+
         // Delta time measured in samples
-        void Tick(double len);
+        void Tick(double len, const ConstantSnapshot& constants);
 
         double GetPos() const;
         double GetVel() const;
 
     private:
         double m_sampleLength;
+        double m_rateRatio;
         double m_pos;
         // Measured in samples / second
         double m_vel;
 
         bool m_playing;
 
+        ConstantHandle m_weightDivisor;
+        ConstantHandle m_weightDecelMult;
+
         double GetTargetVel() const;
     };
 }
\ No newline at end of file
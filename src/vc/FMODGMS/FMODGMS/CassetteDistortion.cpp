@@ -4,133 +4,72 @@
 
 using namespace Cassette;
 
-constexpr size_t BUFFERSIZE = 2;
-CassetteDistortion::CassetteDistortion() : m_lowpassBuffer(BUFFERSIZE), m_highpassBuffer(BUFFERSIZE)
-{}
-
-float CassetteDistortion::Compress(float x, float mult, float thresh, float ramp)
-{
-    x *= mult;
-
-    float ax = abs(x);
-    if (ax > thresh)
-    {
-        const float diff = ax - thresh;
-        ax = thresh + ramp * diff;
-    }
-
-    if (x >= 0)
-    {
-        return ax;
-    }
-    else
-    {
-        return -ax;
-    }
-}
-
-std::vector<float> CassetteDistortion::HighPass(const std::vector<float>& data, float alpha)
+CassetteDistortion::CassetteDistortion()
 {
-    const size_t len = data.size();
-    std::vector<float> ret;
-    ret.resize(len);
-
-    float prev = this->m_highpassBuffer.ReadOffset(0);
-    ret[0] = prev;
+    m_params.PreCompressEnabled = Constants::Globals.RegisterBool("cassette_dist_compress_pre_enabled");
+    m_params.PreMult = Constants::Globals.RegisterDouble("cassette_dist_compress_pre_mult");
+    m_params.PreThresh = Constants::Globals.RegisterDouble("cassette_dist_compress_pre_thresh");
+    m_params.PreRamp = Constants::Globals.RegisterDouble("cassette_dist_compress_pre_ramp");
 
-    for (uint32_t i = 1; i < len; i++)
-    {
-        const float x = alpha * (prev + data[i] - data[i - 1]);
-        prev = x;
-        ret[i] = x;
-    }
+    m_params.Mult = Constants::Globals.RegisterDouble("cassette_dist_compress_mult");
+    m_params.Thresh = Constants::Globals.RegisterDouble("cassette_dist_compress_thresh");
+    m_params.Ramp = Constants::Globals.RegisterDouble("cassette_dist_compress_ramp");
 
-    this->m_highpassBuffer.Push(ret[ret.size() - 1]);
+    m_params.HighpassAlpha = Constants::Globals.RegisterDouble("cassette_dist_highpass_alpha");
+    m_params.HighpassEnabled = Constants::Globals.RegisterBool("cassette_dist_highpass_enabled");
 
-    return ret;
+    m_params.LowpassAlpha = Constants::Globals.RegisterDouble("cassette_dist_lowpass_alpha");
+    m_params.LowpassEnabled = Constants::Globals.RegisterBool("cassette_dist_lowpass_enabled");
 }
 
-std::vector<float> CassetteDistortion::LowPass(const std::vector<float>& data, float alpha)
+void CassetteDistortion::Run(float* data, size_t len, const ConstantSnapshot& constants)
 {
-    const size_t len = data.size();
-    std::vector<float> ret;
-    ret.resize(len);
-
-    float prev = this->m_lowpassBuffer.ReadOffset(0);
-
-    for (uint32_t i = 0; i < len; i++)
+    if (len == 0)
     {
-        const float x = prev + alpha * (data[i] - prev);
-        prev = x;
-        ret[i] = x;
+        return;
     }
 
-    this->m_lowpassBuffer.Push(ret[len - 1]);
-
-    return ret;
-}
-
-std::vector<float> CassetteDistortion::Run(const std::vector<float>& data)
-{
-
     //constexpr float MULT = 3.4;
     //constexpr float THRESH = 0.7;
     //constexpr float RAMP = 0.2;
 
-    const double preCompressEnabled = Constants::Globals.GetBool("cassette_dist_compress_pre_enabled");
-    const double pre_mult = Constants::Globals.GetDouble("cassette_dist_compress_pre_mult");
-    const double pre_thresh = Constants::Globals.GetDouble("cassette_dist_compress_pre_thresh");
-    const double pre_ramp = Constants::Globals.GetDouble("cassette_dist_compress_pre_ramp");
-
-    const double mult = Constants::Globals.GetDouble("cassette_dist_compress_mult");
-    const double thresh = Constants::Globals.GetDouble("cassette_dist_compress_thresh");
-    const double ramp = Constants::Globals.GetDouble("cassette_dist_compress_ramp");
+    const double preCompressEnabled = constants.GetBool(m_params.PreCompressEnabled);
+    const double pre_mult = constants.GetDouble(m_params.PreMult);
+    const double pre_thresh = constants.GetDouble(m_params.PreThresh);
+    const double pre_ramp = constants.GetDouble(m_params.PreRamp);
 
-    const double highpassAlpha = Constants::Globals.GetDouble("cassette_dist_highpass_alpha");
-    const bool highpassEnabled = Constants::Globals.GetBool("cassette_dist_highpass_enabled");
+    const double mult = constants.GetDouble(m_params.Mult);
+    const double thresh = constants.GetDouble(m_params.Thresh);
+    const double ramp = constants.GetDouble(m_params.Ramp);
 
-    const double lowpassAlpha = Constants::Globals.GetDouble("cassette_dist_lowpass_alpha");
-    const bool lowpassEnabled = Constants::Globals.GetBool("cassette_dist_lowpass_enabled");
+    const double highpassAlpha = constants.GetDouble(m_params.HighpassAlpha);
+    const bool highpassEnabled = constants.GetBool(m_params.HighpassEnabled);
 
-    const size_t len = data.size();
+    const double lowpassAlpha = constants.GetDouble(m_params.LowpassAlpha);
+    const bool lowpassEnabled = constants.GetBool(m_params.LowpassEnabled);
 
-    std::vector<float> highPassed;
-    std::vector<float> lowPassed;
-    std::vector<float> preCompress;
-    const std::vector<float>* curData = &data;
+    const std::span<float> block(data, len);
 
     if (preCompressEnabled)
     {
-        preCompress.resize(len);
-
-        for (uint32_t i = 0; i < len; i++)
+        for (float& x : block)
         {
-            preCompress[i] = this->Compress((*curData)[i], pre_mult, pre_thresh, pre_ramp);
+            x = AudioProcessors::Compress(x, pre_mult, pre_thresh, pre_ramp);
         }
-
-        curData = &preCompress;
     }
 
     if (highpassEnabled)
     {
-        highPassed = this->HighPass(*curData, highpassAlpha);
-        curData = &highPassed;
+        AudioProcessors::HighPass(block, highpassAlpha, m_highpassState);
     }
 
     if (lowpassEnabled)
     {
-        lowPassed = this->LowPass(*curData, lowpassAlpha);
-        curData = &lowPassed;
+        AudioProcessors::LowPass(block, lowpassAlpha, m_lowpassState);
     }
 
-    std::vector<float> ret;
-    ret.resize(len);
-
-    for (uint32_t i = 0; i < len; i++)
+    for (float& x : block)
     {
-        ret[i] = this->Compress((*curData)[i], mult, thresh, ramp);
+        x = AudioProcessors::Compress(x, mult, thresh, ramp);
     }
-
-    return ret;
 }
-
@@ -1,5 +1,6 @@
 #pragma once
-#include "RingBuffer.h"
+#include "AudioProcessors.h"
+#include "ConstantReader.h"
 
 namespace Cassette
 {
@@ -7,15 +8,31 @@ namespace Cassette
     {
     public:
         CassetteDistortion();
-        std::vector<float> Run(const std::vector<float>& data);
+        // Processes the block in place.
+        void Run(float* data, size_t len, const ConstantSnapshot& constants);
 
     private:
+        AudioProcessors::OnePoleState m_lowpassState;
+        AudioProcessors::HighPassState m_highpassState;
 
-        float Compress(float x, float mult, float thresh, float ramp);
-        std::vector<float> HighPass(const std::vector<float>& data, float alpha);
-        std::vector<float> LowPass(const std::vector<float>& data, float alpha);
+        struct Params
+        {
+            ConstantHandle PreCompressEnabled;
+            ConstantHandle PreMult;
+            ConstantHandle PreThresh;
+            ConstantHandle PreRamp;
 
-        RingBuffer m_lowpassBuffer;
-        RingBuffer m_highpassBuffer;
+            ConstantHandle Mult;
+            ConstantHandle Thresh;
+            ConstantHandle Ramp;
+
+            ConstantHandle HighpassAlpha;
+            ConstantHandle HighpassEnabled;
+
+            ConstantHandle LowpassAlpha;
+            ConstantHandle LowpassEnabled;
+        };
+
+        Params m_params;
     };
 }
\ No newline at end of file
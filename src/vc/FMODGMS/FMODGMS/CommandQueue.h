@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "SpscQueue.h"
+
+// Samples rendered by a DSP since it started.
+typedef uint64_t SampleTime;
+
+// Command time meaning as soon as possible, at the start of the DSP's next block.
+constexpr SampleTime IMMEDIATE = 0;
+
+// A DSP's sample count, advanced by its callback and readable from the game thread so
+// commands can be scheduled against it.
+class SampleClock
+{
+public:
+    // Audio thread.
+    SampleTime Now() const
+    {
+        return m_now;
+    }
+
+    void Advance(uint32_t frames)
+    {
+        m_now += frames;
+        m_published.store(m_now, std::memory_order_relaxed);
+    }
+
+    // Any thread, the time at the end of the last rendered block.
+    SampleTime Read() const
+    {
+        return m_published.load(std::memory_order_relaxed);
+    }
+
+private:
+    SampleTime m_now = 0;
+    std::atomic<SampleTime> m_published = 0;
+};
+
+// Carries commands from GML calls to a DSP callback without locks, so the game thread
+// never writes state the mixer is reading. The callback drains it at the start of every
+// block and splits blocks so timed commands land on their exact sample.
+template <typename T, size_t Capacity>
+class CommandQueue
+{
+public:
+    // Game thread. Commands apply in the order they were pushed, so a timed command holds
+    // back everything pushed after it. Returns false when the queue is full.
+    bool Push(const T& command, SampleTime time = IMMEDIATE)
+    {
+        return m_queue.TryPush(Entry{ time, command });
+    }
+
+    // Audio thread. Hands everything due by now to apply, then returns how many frames
+    // can be rendered before the next timed command, at most maxFrames.
+    template <typename Apply>
+    uint32_t Drain(SampleTime now, uint32_t maxFrames, Apply&& apply)
+    {
+        while (const Entry* entry = m_queue.Peek())
+        {
+            if (entry->Time > now)
+            {
+                const SampleTime wait = entry->Time - now;
+                return wait < maxFrames ? static_cast<uint32_t>(wait) : maxFrames;
+            }
+
+            apply(entry->Command);
+            m_queue.Pop();
+        }
+
+        return maxFrames;
+    }
+
+private:
+    struct Entry
+    {
+        SampleTime Time;
+        T Command;
+    };
+
+    SpscQueue<Entry, Capacity> m_queue;
+};
@@ -1,8 +1,8 @@
 #include "ConstantReader.h"
-#include <handleapi.h> 
-#include <fileapi.h> 
+#include <fstream>
 #include <optional>
 #include <charconv>
+#include <thread>
 #include "StringHelpers.h"
 
 typedef _ConstantReader_Constant Constant;
@@ -80,27 +80,11 @@ std::optional<Constant> ConstantObj::FindConstant(const std::string_view& name)
 }
 
 
-std::string ReadAll(HANDLE handle)
+std::string ReadAll(const std::string& path)
 {
-    SetFilePointer(handle, 0, NULL, FILE_BEGIN);
-
-    std::string ret;
-
-    constexpr size_t BUFFERSIZE = 1024;
-
-    void* buffer = calloc(BUFFERSIZE, sizeof(char));
-
-    DWORD bytesRead = 0;
-    do
-    {
-        void* buffer = calloc(BUFFERSIZE, sizeof(char));
-        ReadFile(handle, buffer, BUFFERSIZE - 1, &bytesRead, NULL);
-        ret.append(reinterpret_cast<const char*>(buffer), bytesRead);
-    } while (bytesRead == BUFFERSIZE - 1);
-
-    free(buffer);
-
-    return ret;
+    // Opened for each read so an editor saving over the file is never locked out.
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
 }
 
 std::vector<std::string_view> lineSplit(const std::string_view& str)
@@ -244,21 +228,17 @@ std::unordered_map<std::string_view, Constant> ConstantReader::ParseValues(const
     return map;
 }
 
-ConstantReader::ConstantReader(const std::string_view& path)
+ConstantReader::ConstantReader(const std::string_view& path) : m_path(path)
 {
-    m_handle = CreateFileA(path.data(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    std::error_code error;
+    m_lastModified = std::filesystem::last_write_time(m_path, error);
 
-    if (m_handle == INVALID_HANDLE_VALUE)
+    if (error)
     {
         throw std::runtime_error("Could not load constant file.");
     }
 
-    FILETIME creationTime;
-    FILETIME lastAccessTime;
-    FILETIME lastWriteTime;
-    GetFileTime(m_handle, &creationTime, &lastAccessTime, &lastWriteTime);
-    m_lastModified = lastWriteTime;
-    m_fileContents = ReadAll(m_handle);
+    m_fileContents = ReadAll(m_path);
 
     constexpr bool forceRefresh = true;
     this->Refresh(forceRefresh);
@@ -266,34 +246,107 @@ ConstantReader::ConstantReader(const std::string_view& path)
 
 ConstantReader::~ConstantReader()
 {
-    CloseHandle(m_handle);
+    delete m_snapshot.load();
 }
 
 void ConstantReader::Refresh(bool force)
 {
-    FILETIME newLastModifiedTime = m_lastModified;
-    if (force || this->ShouldRebuild(&newLastModifiedTime))
+    auto newLastModifiedTime = m_lastModified;
+    if (force || this->ShouldRebuild(newLastModifiedTime))
     {
         const std::unique_lock<std::shared_mutex> guard(m_rwMutex);
 
-        const auto data = ReadAll(m_handle);
+        const auto data = ReadAll(m_path);
         if (data.size() > 0)
         {
             m_fileContents = data;
             auto topLevelValues = this->ParseValues(m_fileContents);
             m_baseObj = ConstantObj(std::move(topLevelValues));
             m_lastModified = newLastModifiedTime;
+            this->PublishSnapshot();
+        }
+    }
+}
+
+ConstantHandle ConstantReader::RegisterDouble(const std::string_view& name)
+{
+    return this->Register(name, false);
+}
+
+ConstantHandle ConstantReader::RegisterBool(const std::string_view& name)
+{
+    return this->Register(name, true);
+}
+
+ConstantHandle ConstantReader::Register(const std::string_view& name, bool isBool)
+{
+    const std::unique_lock<std::shared_mutex> guard(m_rwMutex);
+
+    for (uint32_t i = 0; i < m_registered.size(); i++)
+    {
+        if (m_registered[i].Name == name && m_registered[i].IsBool == isBool)
+        {
+            return ConstantHandle{ i };
         }
     }
+
+    m_registered.push_back(RegisteredConstant{ std::string(name), isBool });
+    this->PublishSnapshot();
+
+    return ConstantHandle{ static_cast<uint32_t>(m_registered.size() - 1) };
+}
+
+void ConstantReader::PublishSnapshot()
+{
+    auto snapshot = new ConstantSnapshot();
+    snapshot->m_values.reserve(m_registered.size());
+    for (const auto& constant : m_registered)
+    {
+        if (constant.IsBool)
+        {
+            snapshot->m_values.push_back(m_baseObj.GetBool(constant.Name) ? 1.0 : 0.0);
+        }
+        else
+        {
+            snapshot->m_values.push_back(m_baseObj.GetDouble(constant.Name));
+        }
+    }
+
+    const ConstantSnapshot* old = m_snapshot.exchange(snapshot);
+
+    // Anyone still reading may hold the old snapshot. Readers only hold it for a
+    // single audio block and this only runs when the file changes, so spin it out.
+    while (m_snapshotReaders.load() != 0)
+    {
+        std::this_thread::yield();
+    }
+
+    delete old;
+}
+
+ConstantReader::SnapshotGuard ConstantReader::ReadSnapshot() const
+{
+    return SnapshotGuard(*this);
+}
+
+ConstantReader::SnapshotGuard::SnapshotGuard(const ConstantReader& reader) : m_reader(reader)
+{
+    m_reader.m_snapshotReaders.fetch_add(1);
+    m_snapshot = m_reader.m_snapshot.load();
+}
+
+ConstantReader::SnapshotGuard::~SnapshotGuard()
+{
+    m_reader.m_snapshotReaders.fetch_sub(1);
 }
 
-bool ConstantReader::ShouldRebuild(LPFILETIME lastWriteTime) const
+bool ConstantReader::ShouldRebuild(std::filesystem::file_time_type& lastWriteTime) const
 {
-    FILETIME creationTime;
-    FILETIME lastAccessTime;
-    GetFileTime(m_handle, &creationTime, &lastAccessTime, lastWriteTime);
+    std::error_code error;
+    lastWriteTime = std::filesystem::last_write_time(m_path, error);
 
-    return (lastWriteTime->dwHighDateTime != m_lastModified.dwHighDateTime || lastWriteTime->dwLowDateTime != m_lastModified.dwLowDateTime);
+    // Mid save or briefly missing, try again next refresh.
+    return !error && lastWriteTime != m_lastModified;
 }
 
 int ConstantReader::GetInt(const std::string_view& name) const
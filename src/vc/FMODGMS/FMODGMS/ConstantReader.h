@@ -4,8 +4,11 @@
 #include <string_view>
 #include <variant>
 #include <unordered_map>
+#include <mutex>
 #include <shared_mutex>
-#include <windows.h>
+#include <atomic>
+#include <vector>
+#include <filesystem>
 #include <optional>
 
 class ConstantObj;
@@ -30,6 +33,31 @@ private:
     std::unordered_map<std::string_view, _ConstantReader_Constant> m_values;
 };
 
+// Slot of a constant registered with ConstantReader::RegisterDouble / RegisterBool.
+struct ConstantHandle
+{
+    uint32_t Index = 0;
+};
+
+// Flattened, immutable copy of every registered constant.
+// A new one is published each time the constants are reloaded.
+class ConstantSnapshot
+{
+public:
+    double GetDouble(ConstantHandle handle) const
+    {
+        return m_values[handle.Index];
+    }
+
+    bool GetBool(ConstantHandle handle) const
+    {
+        return m_values[handle.Index] != 0.0;
+    }
+
+private:
+    friend class ConstantReader;
+    std::vector<double> m_values;
+};
 
 class ConstantReader
 {
@@ -39,6 +67,38 @@ public:
 
     void Refresh(bool force);
 
+    // Registration is done up front from the game thread, the audio thread then
+    // reads the values from a snapshot without locking or hashing.
+    ConstantHandle RegisterDouble(const std::string_view& name);
+    ConstantHandle RegisterBool(const std::string_view& name);
+
+    // Keeps the current snapshot alive until destroyed. Never blocks.
+    class SnapshotGuard
+    {
+    public:
+        SnapshotGuard(const ConstantReader& reader);
+        ~SnapshotGuard();
+
+        SnapshotGuard(const SnapshotGuard&) = delete;
+        SnapshotGuard& operator=(const SnapshotGuard&) = delete;
+
+        const ConstantSnapshot& operator*() const
+        {
+            return *m_snapshot;
+        }
+
+        const ConstantSnapshot* operator->() const
+        {
+            return m_snapshot;
+        }
+
+    private:
+        const ConstantReader& m_reader;
+        const ConstantSnapshot* m_snapshot;
+    };
+
+    SnapshotGuard ReadSnapshot() const;
+
     bool GetBool(const std::string_view& name) const;
     int GetInt(const std::string_view& name) const;
     uint32_t GetUint(const std::string_view& name) const;
@@ -48,8 +108,8 @@ public:
 
 
 private:
-    HANDLE m_handle;
-    FILETIME m_lastModified;
+    std::string m_path;
+    std::filesystem::file_time_type m_lastModified;
 
     mutable std::shared_mutex m_rwMutex;
 
@@ -60,7 +120,21 @@ private:
     static std::optional<std::pair<std::string_view, _ConstantReader_Constant>> ParseObject(uint32_t& i, const std::vector<std::string_view>& lines);
 
     ConstantObj m_baseObj;
-    bool ShouldRebuild(LPFILETIME newLastWriteTime) const;
+    bool ShouldRebuild(std::filesystem::file_time_type& newLastWriteTime) const;
+
+    struct RegisteredConstant
+    {
+        std::string Name;
+        bool IsBool;
+    };
+
+    std::vector<RegisteredConstant> m_registered;
+    std::atomic<const ConstantSnapshot*> m_snapshot = nullptr;
+    mutable std::atomic<uint32_t> m_snapshotReaders = 0;
+
+    ConstantHandle Register(const std::string_view& name, bool isBool);
+    // Must be called with the write lock held.
+    void PublishSnapshot();
 };
 
 namespace Constants
@@ -0,0 +1,109 @@
+#include "FFTPlans.h"
+#include <algorithm>
+#include <cmath>
+
+std::unique_ptr<FFTPlan> FFTPlan::Create(size_t points)
+{
+    kiss_fftr_cfg cfg = kiss_fftr_alloc(static_cast<int>(points), 0, nullptr, nullptr);
+    if (cfg == nullptr)
+    {
+        return nullptr;
+    }
+
+    return std::unique_ptr<FFTPlan>(new FFTPlan(points, cfg));
+}
+
+FFTPlan::FFTPlan(size_t points, kiss_fftr_cfg cfg) :
+    m_points(points),
+    m_magnitudeCount(GetMagnitudeCount(points)),
+    m_cfg(cfg),
+    m_window(points),
+    m_windowed(points),
+    m_spectrum(points / 2 + 1)
+{
+    for (size_t i = 0; i < points; i++)
+    {
+        m_window[i] = powf(sinf(3.141592f * static_cast<float>(i) / static_cast<float>(points - 1)), 2);
+    }
+}
+
+FFTPlan::~FFTPlan()
+{
+    kiss_fftr_free(m_cfg);
+}
+
+double FFTPlan::Analyse(const float* samples, float* magnitudes)
+{
+    double loudness = 0;
+    for (size_t i = 0; i < m_points; i++)
+    {
+        m_windowed[i] = samples[i] * m_window[i];
+        loudness += static_cast<double>(m_windowed[i]) * m_windowed[i];
+    }
+
+    kiss_fftr(m_cfg, m_windowed.data(), m_spectrum.data());
+
+    const float scale = static_cast<float>(m_points);
+    for (size_t i = 0; i < m_magnitudeCount; i++)
+    {
+        const kiss_fft_cpx& bin = m_spectrum[i];
+        magnitudes[i] = sqrtf(bin.i * bin.i + bin.r * bin.r) / scale;
+    }
+
+    return sqrt(loudness / static_cast<double>(m_points));
+}
+
+FFTPlan* FFTPlanCache::Get(size_t points)
+{
+    auto found = std::find_if(m_plans.begin(), m_plans.end(),
+        [points](const std::unique_ptr<FFTPlan>& plan) { return plan->GetSize() == points; });
+    if (found != m_plans.end())
+    {
+        std::rotate(m_plans.begin(), found, found + 1);
+        return m_plans.front().get();
+    }
+
+    auto plan = FFTPlan::Create(points);
+    if (plan == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (m_plans.size() >= MAX_PLANS)
+    {
+        m_plans.pop_back();
+    }
+
+    m_plans.insert(m_plans.begin(), std::move(plan));
+    return m_plans.front().get();
+}
+
+float SpectralFlux(const float* magnitudes, float* previous, size_t count)
+{
+    float flux = 0.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        const float current = log1pf(ONSET_COMPRESSION * magnitudes[i]);
+        flux += std::max(current - previous[i], 0.f);
+        previous[i] = current;
+    }
+
+    return flux;
+}
+
+void NormalizeMagnitudes(float* magnitudes, size_t count)
+{
+    float largest = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (magnitudes[i] > largest)
+        {
+            largest = magnitudes[i];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        magnitudes[i] /= largest;
+    }
+}
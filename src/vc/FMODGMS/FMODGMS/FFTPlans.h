@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "kissfft/kiss_fftr.h"
+
+// Real FFT of one size and the Hann window that goes with it, worked out once. Not
+// thread safe, kiss keeps scratch space in its setup.
+class FFTPlan
+{
+public:
+    // Null if kiss can't allocate the setup. points has to be even.
+    static std::unique_ptr<FFTPlan> Create(size_t points);
+    ~FFTPlan();
+
+    FFTPlan(const FFTPlan&) = delete;
+    FFTPlan& operator=(const FFTPlan&) = delete;
+
+    size_t GetSize() const { return m_points; }
+
+    // The lowest quarter of the bins, as FMODGMS_Util_FFT has always returned.
+    static size_t GetMagnitudeCount(size_t points) { return static_cast<size_t>(points / 4. + 0.5); }
+    size_t GetMagnitudeCount() const { return m_magnitudeCount; }
+
+    // Windows GetSize samples and writes GetMagnitudeCount bin magnitudes, divided by
+    // the size. Returns the RMS of the windowed samples.
+    double Analyse(const float* samples, float* magnitudes);
+
+private:
+    FFTPlan(size_t points, kiss_fftr_cfg cfg);
+
+    size_t m_points;
+    size_t m_magnitudeCount;
+    kiss_fftr_cfg m_cfg;
+
+    std::vector<float> m_window;
+    std::vector<float> m_windowed;
+    std::vector<kiss_fft_cpx> m_spectrum;
+};
+
+// Plans for the few sizes used most recently, so a game sweeping through sizes doesn't
+// keep a setup and window for every one it ever asked for. Game thread.
+class FFTPlanCache
+{
+public:
+    static constexpr size_t MAX_PLANS = 4;
+
+    // Null if the plan couldn't be made. Only valid until the next Get, which may free it.
+    FFTPlan* Get(size_t points);
+
+private:
+    // Most recently used first.
+    std::vector<std::unique_ptr<FFTPlan>> m_plans;
+};
+
+// Scales magnitudes down so the largest is 1, leaves them alone if none is above 1.
+void NormalizeMagnitudes(float* magnitudes, size_t count);
+
+// Magnitudes are log compressed before differencing so quiet onsets still count.
+constexpr float ONSET_COMPRESSION = 1000.f;
+
+// Spectral flux, how much louder each bin got since the previous frame summed over the
+// bins. previous holds that frame's log compressed magnitudes, this frame's on return.
+float SpectralFlux(const float* magnitudes, float* previous, size_t count);
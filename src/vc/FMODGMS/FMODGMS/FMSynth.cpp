@@ -1,18 +1,25 @@
 #include "FMSynth.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    constexpr double TWO_PI = 6.283185307179586;
+    constexpr double INV_TWO_PI = 1.0 / TWO_PI;
+}
 
 FMSynthDSP::FMSynthDSP() : m_prevSamples(32)
 {
     // Do we need this?
     memset(&m_dspDescr, 0, sizeof(m_dspDescr));
     
-    strncpy_s(m_dspDescr.name, "FM Synth DSP", sizeof(m_dspDescr.name));
+    snprintf(m_dspDescr.name, sizeof(m_dspDescr.name), "FM Synth DSP");
     m_dspDescr.version = 0x00010000;
     m_dspDescr.numinputbuffers = 1;
     m_dspDescr.numoutputbuffers = 1;
     m_dspDescr.read = FMSynthGenericCallback; 
     m_dspDescr.userdata = (void *)0x12345678; 
-
-    m_curSample = 0;
 }
 
 bool FMSynthDSP::Register(FMOD::System* sys, std::string& error)
@@ -47,40 +54,50 @@ bool FMSynthDSP::Register(FMOD::System* sys, std::string& error)
     return true;
 }
 
-float PulseWidthGenerator(double samp, double pulseWidth)
+void FMSynthDSP::ApplyCommand(const Command& command)
 {
-    const double yy = fmod(samp, 6.282);
-
-    if (yy < pulseWidth)
+    switch (command.Type)
     {
-        return 1.0;
-    }
-    else
+    case CommandType::SetConfig:
+        m_config = command.Config;
+        break;
+    case CommandType::SetEnabled:
+        m_enabled = command.Value != 0.0;
+        break;
+    case CommandType::SetKeydown:
     {
-        return -1.0;
-    }
-}
-
-float SawGenerator(double samp)
-{
-    const double yy = fmod(samp, 6.282);
+        const bool keydown = command.Value != 0.0;
+        if (keydown != m_keydown)
+        {
+            m_keydownTime = 0;
+            m_keyupTime = 0;
+        }
 
-    return 2.0 * ((yy / 6.282) - 0.5);
+        m_keydown = keydown;
+        break;
+    }
+    case CommandType::SetPitch:
+        m_pitch = command.Value;
+        break;
+    default:
+        break;
+    }
 }
 
-void FMSynthDSP::FillBuffer(std::vector<float>& buffer)
+void FMSynthDSP::FillBuffer(float* buffer, size_t len)
 {
     if (!m_enabled)
     {
         return;
     }
 
-    const double baseSynthVol = 0.2;
     const double freqMult = 0.03 * m_config.Freq;// Constants::Globals.GetDouble("speech_synth_freq_mult");
 
-    double pulseWidth = m_config.PulseWidth;
+    // Pulse width is given in radians.
+    double duty = m_config.PulseWidth * INV_TWO_PI;
+    duty = duty < 0.0 ? 0.0 : (duty > 1.0 ? 1.0 : duty);
 
-    for (uint32_t i = 0; i < buffer.size(); i++)
+    for (uint32_t i = 0; i < len; i++)
     {
         float amp1;
         if (m_keydown)
@@ -97,26 +114,11 @@ void FMSynthDSP::FillBuffer(std::vector<float>& buffer)
         m_amp = AudioProcessors::lerp(m_amp, amp1, m_config.AmpSmoothK);
         m_freq = AudioProcessors::lerp(m_freq, freqMult, m_config.FreqSmoothK);
 
-        const double samp = (m_pitch * m_freq * (double)m_curSample);
-        float oscValue = 0;
-
-        if (m_config.Wave == WaveType::SIN)
-        {
-            oscValue = sin(samp);
-        }
-        else if (m_config.Wave == WaveType::PULSE)
-        {
-            //pulseWidth += pulseWidthLfoDepth * sin((double)m_curSample * pulseWidthLfoSpeed);
-            oscValue = PulseWidthGenerator(samp, pulseWidth);
-        }
-        else if (m_config.Wave == WaveType::SAW)
-        {
-            oscValue = SawGenerator(samp);
-        }
+        // m_freq is in radians per sample.
+        const double increment = m_pitch * m_freq * INV_TWO_PI;
+        const float oscValue = m_osc.Next(m_config.Wave, increment, duty);
 
         buffer[i] = m_amp * oscValue;
-
-        m_curSample++;
     }
 }
 
@@ -127,8 +129,6 @@ FMOD_RESULT FMSynthDSP::Callback(
     int inchannels,
     int* outChannels)
 {
-    const double synthVol = 0.2;
-    const double freqMult = 0.03;// Constants::Globals.GetDouble("speech_synth_freq_mult");
     //const double freqLfoSpeed = Constants::Globals.GetDouble("speech_synth_freq_lfo_speed");
     //const double freqLfoDepth = Constants::Globals.GetDouble("speech_synth_freq_lfo_depth");
 
@@ -138,38 +138,43 @@ FMOD_RESULT FMSynthDSP::Callback(
     //const double pulseWidthLfoDepth = Constants::Globals.GetDouble("speech_synth_pulse_width_lfo_depth");
 
 
-    std::vector<float> oscBuffer;
-    oscBuffer.resize(length);
-    this->FillBuffer(oscBuffer);
+    const int channels = *outChannels;
 
-    oscBuffer = m_lowPass.Run(oscBuffer, m_config.LowPassAlpha);
-
-    for (uint32_t samp = 0; samp < length; samp++) 
+    uint32_t processed = 0;
+    while (processed < length)
     {
-        for (int chan = 0; chan < *outChannels; chan++)
-        {
-			const uint32_t offset = (samp * *outChannels) + chan;
-            float value = inbuffer[offset];
+        const uint32_t remaining = length - processed;
+        uint32_t blockLength = remaining < OSC_BLOCK_LENGTH ? remaining : static_cast<uint32_t>(OSC_BLOCK_LENGTH);
 
-            {
-                value += oscBuffer[samp];
+        // Shortened so timed commands land on the right sample.
+        blockLength = m_commands.Drain(m_clock.Now(), blockLength, [this](const Command& command)
+        {
+            this->ApplyCommand(command);
+        });
 
-                /*
-                const double samp = (m_pitch * freqMult * (double)m_curSample) 
-                    + freqLfoDepth * sin((double)m_curSample * m_pitch * freqLfoSpeed);
+        float* oscBuffer = m_oscBuffer.data();
 
+        // FillBuffer leaves the buffer alone when disabled, the low pass still rings out.
+        std::fill(oscBuffer, oscBuffer + blockLength, 0.f);
+        this->FillBuffer(oscBuffer, blockLength);
+        AudioProcessors::LowPass(std::span<float>(oscBuffer, blockLength), m_config.LowPassAlpha, m_lowPass);
 
-                //if (samp == 0)
-                {
-                    //m_freqBuf.Push(100.0 * frequency);
-                }
-                */
+        const size_t offset = static_cast<size_t>(processed) * channels;
+        const float* in = inbuffer + offset;
+        float* out = outbuffer + offset;
 
+        for (uint32_t samp = 0; samp < blockLength; samp++)
+        {
+            for (int chan = 0; chan < channels; chan++)
+            {
+                const uint32_t index = (samp * channels) + chan;
+                out[index] = in[index] + oscBuffer[samp];
             }
-
-			outbuffer[offset] = value;
         }
-    } 
+
+        m_clock.Advance(blockLength);
+        processed += blockLength;
+    }
 
     return FMOD_OK;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <optional>
@@ -9,14 +10,8 @@
 #include "fmod_errors.h"
 #include "RingBuffer.h"
 #include "AudioProcessors.h"
-
-
-enum class WaveType
-{
-    SIN,
-    PULSE,
-    SAW,
-};
+#include "CommandQueue.h"
+#include "Oscillator.h"
 
 struct FMSynthConfig
 {
@@ -39,48 +34,37 @@ public:
 
     bool Register(FMOD::System* sys, std::string& error);
 
-    void SetConfig(FMSynthConfig config)
+    // Queued for the audio thread. With a time they are applied on that sample of
+    // GetSampleTime's clock.
+    void SetConfig(const FMSynthConfig& config, SampleTime time = IMMEDIATE)
     {
-        m_config = config;
+        Command command = {};
+        command.Type = CommandType::SetConfig;
+        command.Config = config;
+        m_commands.Push(command, time);
     }
 
-    FMSynthConfig& GetConfigMut()
+    void SetEnabled(bool enabled, SampleTime time = IMMEDIATE)
     {
-        return m_config;
+        this->PushCommand(CommandType::SetEnabled, enabled ? 1.0 : 0.0, time);
     }
 
-    void SetEnabled(bool enabled)
+    void SetKeydown(bool keydown, SampleTime time = IMMEDIATE)
     {
-        if (!m_enabled)
-        {
-            // Retrigger
-            //m_curSample = 0;
-        }
-
-        m_enabled = enabled;
+        this->PushCommand(CommandType::SetKeydown, keydown ? 1.0 : 0.0, time);
     }
 
-    void SetKeydown(bool keydown)
+    void SetPitch(double pitch, SampleTime time = IMMEDIATE)
     {
-        if (keydown != m_keydown)
-        {
-            m_keydownTime = 0;
-            m_keyupTime = 0;
-            if (keydown)
-            {
-                //m_curSample = 0;
-            }
-        }
-
-        m_keydown = keydown;
+        this->PushCommand(CommandType::SetPitch, pitch, time);
     }
 
-    void SetPitch(double pitch)
+    SampleTime GetSampleTime() const
     {
-        m_pitch = pitch;
+        return m_clock.Read();
     }
 
-    void FillBuffer(std::vector<float>& buffer);
+    void FillBuffer(float* buffer, size_t len);
 
     FMOD_RESULT Callback(
         float* inbuffer,
@@ -97,15 +81,49 @@ public:
         int inchannels,
         int* outchannels);
 private:
+    enum class CommandType : uint8_t
+    {
+        SetConfig,
+        SetEnabled,
+        SetKeydown,
+        SetPitch,
+    };
+
+    struct Command
+    {
+        CommandType Type;
+        FMSynthConfig Config;
+        double Value;
+    };
+
+    static constexpr size_t COMMAND_QUEUE_LENGTH = 64;
+
+    void PushCommand(CommandType type, double value, SampleTime time)
+    {
+        Command command = {};
+        command.Type = type;
+        command.Value = value;
+        m_commands.Push(command, time);
+    }
+
+    void ApplyCommand(const Command& command);
+
+    CommandQueue<Command, COMMAND_QUEUE_LENGTH> m_commands;
+    SampleClock m_clock;
+
     FMOD::DSP* m_dsp;
     FMOD_DSP_DESCRIPTION m_dspDescr;
 
     RingBuffer m_prevSamples;
     double m_pitch = 1.0;
     bool m_enabled = false;
-    uint32_t m_curSample = 0;
+    Oscillator m_osc;
     FMSynthConfig m_config;
-    AudioProcessors::LowPass m_lowPass;
+    AudioProcessors::OnePoleState m_lowPass;
+
+    // The callback renders in chunks of this so it never allocates.
+    static constexpr size_t OSC_BLOCK_LENGTH = 256;
+    std::array<float, OSC_BLOCK_LENGTH> m_oscBuffer;
 
     bool m_keydown = false;
     uint32_t m_keydownTime = 0;
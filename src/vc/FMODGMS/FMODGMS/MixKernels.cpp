@@ -0,0 +1,558 @@
+#include "MixKernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define MIXKERNELS_X86
+#endif
+
+#ifdef MIXKERNELS_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC lets any function use AVX2 intrinsics, gcc and clang need to be told per function.
+#if defined(MIXKERNELS_X86) && !defined(_MSC_VER)
+#define MIXKERNELS_AVX2 __attribute__((target("avx2")))
+#else
+#define MIXKERNELS_AVX2
+#endif
+
+using namespace MixKernels;
+
+namespace
+{
+    inline float Clamp(float x)
+    {
+        if (x > 1.f)
+        {
+            return 1.f;
+        }
+        if (x < -1.f)
+        {
+            return -1.f;
+        }
+        return x;
+    }
+
+    // Handles any channel count, also used for the frames left over by the vector kernels.
+    void MixClampScalar(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const float invChannels = 1.f / static_cast<float>(channels);
+
+        for (uint32_t frame = 0; frame < frames; frame++)
+        {
+            const float added = volume * add[frame];
+            float sum = 0.f;
+
+            for (int chan = 0; chan < channels; chan++)
+            {
+                const size_t offset = static_cast<size_t>(frame) * channels + chan;
+                const float value = in[offset];
+                sum += value;
+                out[offset] = Clamp(value + added);
+            }
+
+            mono[frame] = sum * invChannels;
+        }
+    }
+
+    void MixClampTail(
+        uint32_t done,
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        if (done < frames)
+        {
+            const size_t offset = static_cast<size_t>(done) * channels;
+            MixClampScalar(in + offset, out + offset, frames - done, channels, add + done, volume, mono + done);
+        }
+    }
+
+#ifdef MIXKERNELS_X86
+
+    //
+    // SSE2
+    //
+
+    // minps/maxps return the second operand when either is NaN, so x goes second to pass
+    // NaN through like Clamp does.
+    inline __m128 Clamp4(__m128 x)
+    {
+        return _mm_min_ps(_mm_set1_ps(1.f), _mm_max_ps(_mm_set1_ps(-1.f), x));
+    }
+
+    template <int Lane>
+    inline __m128 Broadcast4(__m128 x)
+    {
+        return _mm_shuffle_ps(x, x, _MM_SHUFFLE(Lane, Lane, Lane, Lane));
+    }
+
+    void MixClampMonoSSE2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m128 vol = _mm_set1_ps(volume);
+
+        uint32_t frame = 0;
+        for (; frame + 4 <= frames; frame += 4)
+        {
+            const __m128 x = _mm_loadu_ps(in + frame);
+            const __m128 added = _mm_mul_ps(_mm_loadu_ps(add + frame), vol);
+            _mm_storeu_ps(out + frame, Clamp4(_mm_add_ps(x, added)));
+            _mm_storeu_ps(mono + frame, x);
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // Four frames per iteration, L0 R0 L1 R1 | L2 R2 L3 R3.
+    void MixClampStereoSSE2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m128 vol = _mm_set1_ps(volume);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        uint32_t frame = 0;
+        for (; frame + 4 <= frames; frame += 4)
+        {
+            const float* src = in + frame * 2;
+            float* dst = out + frame * 2;
+
+            const __m128 x0 = _mm_loadu_ps(src);
+            const __m128 x1 = _mm_loadu_ps(src + 4);
+            const __m128 added = _mm_mul_ps(_mm_loadu_ps(add + frame), vol);
+
+            _mm_storeu_ps(dst, Clamp4(_mm_add_ps(x0, _mm_unpacklo_ps(added, added))));
+            _mm_storeu_ps(dst + 4, Clamp4(_mm_add_ps(x1, _mm_unpackhi_ps(added, added))));
+
+            const __m128 left = _mm_shuffle_ps(x0, x1, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 right = _mm_shuffle_ps(x0, x1, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(mono + frame, _mm_mul_ps(_mm_add_ps(left, right), half));
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // Sums two 5.1 frames spread over three vectors, a = f0[0..3], b = f0[4..5] f1[0..1],
+    // c = f1[2..5]. The two sums end up in the low lanes.
+    inline __m128 SumSurround51Pair(__m128 a, __m128 b, __m128 c)
+    {
+        const __m128 s = _mm_add_ps(
+            _mm_shuffle_ps(a, c, _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(a, c, _MM_SHUFFLE(3, 1, 3, 1)));
+        const __m128 z = _mm_add_ps(
+            _mm_shuffle_ps(s, b, _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(s, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm_add_ps(z, _mm_movehl_ps(z, z));
+    }
+
+    // Two frames per iteration so the frames line up with whole vectors.
+    void MixClampSurround51SSE2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m128 sixth = _mm_set1_ps(1.f / 6.f);
+
+        uint32_t frame = 0;
+        for (; frame + 2 <= frames; frame += 2)
+        {
+            const float* src = in + frame * 6;
+            float* dst = out + frame * 6;
+
+            const float added0 = volume * add[frame];
+            const float added1 = volume * add[frame + 1];
+
+            const __m128 x0 = _mm_loadu_ps(src);
+            const __m128 x1 = _mm_loadu_ps(src + 4);
+            const __m128 x2 = _mm_loadu_ps(src + 8);
+
+            _mm_storeu_ps(dst, Clamp4(_mm_add_ps(x0, _mm_set1_ps(added0))));
+            _mm_storeu_ps(dst + 4, Clamp4(_mm_add_ps(x1, _mm_setr_ps(added0, added0, added1, added1))));
+            _mm_storeu_ps(dst + 8, Clamp4(_mm_add_ps(x2, _mm_set1_ps(added1))));
+
+            const __m128 sums = _mm_mul_ps(SumSurround51Pair(x0, x1, x2), sixth);
+            _mm_storel_pi(reinterpret_cast<__m64*>(mono + frame), sums);
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // Mixes one 7.1 frame and returns its channels folded into four lanes.
+    template <int Lane>
+    inline __m128 MixSurround71Frame(const float* src, float* dst, __m128 added)
+    {
+        const __m128 lo = _mm_loadu_ps(src + Lane * 8);
+        const __m128 hi = _mm_loadu_ps(src + Lane * 8 + 4);
+        const __m128 a = Broadcast4<Lane>(added);
+
+        _mm_storeu_ps(dst + Lane * 8, Clamp4(_mm_add_ps(lo, a)));
+        _mm_storeu_ps(dst + Lane * 8 + 4, Clamp4(_mm_add_ps(hi, a)));
+
+        return _mm_add_ps(lo, hi);
+    }
+
+    void MixClampSurround71SSE2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m128 vol = _mm_set1_ps(volume);
+        const __m128 eighth = _mm_set1_ps(0.125f);
+
+        uint32_t frame = 0;
+        for (; frame + 4 <= frames; frame += 4)
+        {
+            const float* src = in + frame * 8;
+            float* dst = out + frame * 8;
+            const __m128 added = _mm_mul_ps(_mm_loadu_ps(add + frame), vol);
+
+            __m128 s0 = MixSurround71Frame<0>(src, dst, added);
+            __m128 s1 = MixSurround71Frame<1>(src, dst, added);
+            __m128 s2 = MixSurround71Frame<2>(src, dst, added);
+            __m128 s3 = MixSurround71Frame<3>(src, dst, added);
+
+            // After the transpose each vector holds one partial sum for all four frames.
+            _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+            const __m128 sums = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+            _mm_storeu_ps(mono + frame, _mm_mul_ps(sums, eighth));
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    //
+    // AVX2
+    //
+
+    MIXKERNELS_AVX2 inline __m256 Clamp8(__m256 x)
+    {
+        return _mm256_min_ps(_mm256_set1_ps(1.f), _mm256_max_ps(_mm256_set1_ps(-1.f), x));
+    }
+
+    MIXKERNELS_AVX2 void MixClampMonoAVX2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m256 vol = _mm256_set1_ps(volume);
+
+        uint32_t frame = 0;
+        for (; frame + 8 <= frames; frame += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(in + frame);
+            const __m256 added = _mm256_mul_ps(_mm256_loadu_ps(add + frame), vol);
+            _mm256_storeu_ps(out + frame, Clamp8(_mm256_add_ps(x, added)));
+            _mm256_storeu_ps(mono + frame, x);
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // Eight frames per iteration.
+    MIXKERNELS_AVX2 void MixClampStereoAVX2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m256 vol = _mm256_set1_ps(volume);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256i spreadLo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+        const __m256i spreadHi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+        // The in-lane shuffles below leave the frames ordered 0 1 4 5 2 3 6 7.
+        const __m256i reorder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+
+        uint32_t frame = 0;
+        for (; frame + 8 <= frames; frame += 8)
+        {
+            const float* src = in + frame * 2;
+            float* dst = out + frame * 2;
+
+            const __m256 x0 = _mm256_loadu_ps(src);
+            const __m256 x1 = _mm256_loadu_ps(src + 8);
+            const __m256 added = _mm256_mul_ps(_mm256_loadu_ps(add + frame), vol);
+
+            _mm256_storeu_ps(dst, Clamp8(_mm256_add_ps(x0, _mm256_permutevar8x32_ps(added, spreadLo))));
+            _mm256_storeu_ps(dst + 8, Clamp8(_mm256_add_ps(x1, _mm256_permutevar8x32_ps(added, spreadHi))));
+
+            const __m256 left = _mm256_shuffle_ps(x0, x1, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m256 right = _mm256_shuffle_ps(x0, x1, _MM_SHUFFLE(3, 1, 3, 1));
+            const __m256 sums = _mm256_mul_ps(_mm256_add_ps(left, right), half);
+            _mm256_storeu_ps(mono + frame, _mm256_permutevar8x32_ps(sums, reorder));
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // Four frames per iteration, 24 floats in three vectors.
+    MIXKERNELS_AVX2 void MixClampSurround51AVX2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m256 vol = _mm256_set1_ps(volume);
+        const __m128 sixth = _mm_set1_ps(1.f / 6.f);
+        const __m256i spread0 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 1, 1);
+        const __m256i spread1 = _mm256_setr_epi32(1, 1, 1, 1, 2, 2, 2, 2);
+        const __m256i spread2 = _mm256_setr_epi32(2, 2, 3, 3, 3, 3, 3, 3);
+
+        uint32_t frame = 0;
+        for (; frame + 4 <= frames; frame += 4)
+        {
+            const float* src = in + frame * 6;
+            float* dst = out + frame * 6;
+
+            const __m256 x0 = _mm256_loadu_ps(src);
+            const __m256 x1 = _mm256_loadu_ps(src + 8);
+            const __m256 x2 = _mm256_loadu_ps(src + 16);
+            const __m256 added = _mm256_mul_ps(_mm256_castps128_ps256(_mm_loadu_ps(add + frame)), vol);
+
+            _mm256_storeu_ps(dst, Clamp8(_mm256_add_ps(x0, _mm256_permutevar8x32_ps(added, spread0))));
+            _mm256_storeu_ps(dst + 8, Clamp8(_mm256_add_ps(x1, _mm256_permutevar8x32_ps(added, spread1))));
+            _mm256_storeu_ps(dst + 16, Clamp8(_mm256_add_ps(x2, _mm256_permutevar8x32_ps(added, spread2))));
+
+            const __m128 sums01 = SumSurround51Pair(
+                _mm256_castps256_ps128(x0), _mm256_extractf128_ps(x0, 1), _mm256_castps256_ps128(x1));
+            const __m128 sums23 = SumSurround51Pair(
+                _mm256_extractf128_ps(x1, 1), _mm256_castps256_ps128(x2), _mm256_extractf128_ps(x2, 1));
+            _mm_storeu_ps(mono + frame, _mm_mul_ps(_mm_movelh_ps(sums01, sums23), sixth));
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    // One frame per vector, eight frames per iteration.
+    MIXKERNELS_AVX2 void MixClampSurround71AVX2(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono)
+    {
+        const __m256 vol = _mm256_set1_ps(volume);
+        const __m256 eighth = _mm256_set1_ps(0.125f);
+
+        uint32_t frame = 0;
+        for (; frame + 8 <= frames; frame += 8)
+        {
+            const float* src = in + frame * 8;
+            float* dst = out + frame * 8;
+            const __m256 added = _mm256_mul_ps(_mm256_loadu_ps(add + frame), vol);
+
+            __m256 x[8];
+            for (int i = 0; i < 8; i++)
+            {
+                x[i] = _mm256_loadu_ps(src + i * 8);
+                const __m256 a = _mm256_permutevar8x32_ps(added, _mm256_set1_epi32(i));
+                _mm256_storeu_ps(dst + i * 8, Clamp8(_mm256_add_ps(x[i], a)));
+            }
+
+            // Each 128 bit lane of h0123 ends up holding the low or high half sums of frames 0-3.
+            const __m256 h0123 = _mm256_hadd_ps(_mm256_hadd_ps(x[0], x[1]), _mm256_hadd_ps(x[2], x[3]));
+            const __m256 h4567 = _mm256_hadd_ps(_mm256_hadd_ps(x[4], x[5]), _mm256_hadd_ps(x[6], x[7]));
+            const __m256 sums = _mm256_add_ps(
+                _mm256_permute2f128_ps(h0123, h4567, 0x20),
+                _mm256_permute2f128_ps(h0123, h4567, 0x31));
+            _mm256_storeu_ps(mono + frame, _mm256_mul_ps(sums, eighth));
+        }
+
+        MixClampTail(frame, in, out, frames, channels, add, volume, mono);
+    }
+
+    void Cpuid(int regs[4], int leaf, int subleaf)
+    {
+#ifdef _MSC_VER
+        __cpuidex(regs, leaf, subleaf);
+#else
+        unsigned int a, b, c, d;
+        __cpuid_count(leaf, subleaf, a, b, c, d);
+        regs[0] = static_cast<int>(a);
+        regs[1] = static_cast<int>(b);
+        regs[2] = static_cast<int>(c);
+        regs[3] = static_cast<int>(d);
+#endif
+    }
+
+    uint64_t ReadXCR0()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+    }
+
+    bool CpuHasSSE2()
+    {
+        int regs[4];
+        Cpuid(regs, 1, 0);
+        return (regs[3] & (1 << 26)) != 0;
+    }
+
+    bool CpuHasAVX2()
+    {
+        int regs[4];
+        Cpuid(regs, 0, 0);
+        if (regs[0] < 7)
+        {
+            return false;
+        }
+
+        Cpuid(regs, 1, 0);
+        const bool osxsave = (regs[2] & (1 << 27)) != 0;
+        const bool avx = (regs[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx)
+        {
+            return false;
+        }
+
+        // The OS has to save the ymm registers on context switches.
+        if ((ReadXCR0() & 0x6) != 0x6)
+        {
+            return false;
+        }
+
+        Cpuid(regs, 7, 0);
+        return (regs[1] & (1 << 5)) != 0;
+    }
+
+#endif
+}
+
+bool MixKernel::IsSupported(InstructionSet isa)
+{
+    switch (isa)
+    {
+    case InstructionSet::Scalar:
+        return true;
+#ifdef MIXKERNELS_X86
+    case InstructionSet::SSE2:
+    {
+        static const bool supported = CpuHasSSE2();
+        return supported;
+    }
+    case InstructionSet::AVX2:
+    {
+        static const bool supported = CpuHasAVX2();
+        return supported;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* MixKernel::GetName(InstructionSet isa)
+{
+    switch (isa)
+    {
+    case InstructionSet::SSE2:
+        return "sse2";
+    case InstructionSet::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+MixKernel MixKernel::Select()
+{
+    if (IsSupported(InstructionSet::AVX2))
+    {
+        return Create(InstructionSet::AVX2);
+    }
+
+    if (IsSupported(InstructionSet::SSE2))
+    {
+        return Create(InstructionSet::SSE2);
+    }
+
+    return Create(InstructionSet::Scalar);
+}
+
+MixKernel MixKernel::Create(InstructionSet isa)
+{
+    MixKernel kernel;
+    kernel.m_mono = MixClampScalar;
+    kernel.m_stereo = MixClampScalar;
+    kernel.m_surround51 = MixClampScalar;
+    kernel.m_surround71 = MixClampScalar;
+    kernel.m_generic = MixClampScalar;
+
+    if (!IsSupported(isa))
+    {
+        return kernel;
+    }
+
+    kernel.m_isa = isa;
+
+#ifdef MIXKERNELS_X86
+    if (isa == InstructionSet::SSE2)
+    {
+        kernel.m_mono = MixClampMonoSSE2;
+        kernel.m_stereo = MixClampStereoSSE2;
+        kernel.m_surround51 = MixClampSurround51SSE2;
+        kernel.m_surround71 = MixClampSurround71SSE2;
+    }
+    else if (isa == InstructionSet::AVX2)
+    {
+        kernel.m_mono = MixClampMonoAVX2;
+        kernel.m_stereo = MixClampStereoAVX2;
+        kernel.m_surround51 = MixClampSurround51AVX2;
+        kernel.m_surround71 = MixClampSurround71AVX2;
+    }
+#endif
+
+    return kernel;
+}
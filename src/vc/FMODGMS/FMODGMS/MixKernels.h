@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+
+namespace MixKernels
+{
+    enum class InstructionSet
+    {
+        Scalar,
+        SSE2,
+        AVX2,
+    };
+
+    // For each interleaved frame: writes the channel average of the input to mono,
+    // adds volume * add[frame] to every channel and clamps the result to [-1, 1].
+    // Every instruction set clamps to the same bits, NaN passing through. The vector
+    // kernels add up the average in their own order, so it can be off in the last bit.
+    typedef void (*MixClampFn)(
+        const float* in,
+        float* out,
+        uint32_t frames,
+        int channels,
+        const float* add,
+        float volume,
+        float* mono);
+
+    // Dispatch table for the channel layouts FMOD hands us, pick one when the DSP is
+    // created so the audio callback only does a switch on the channel count.
+    class MixKernel
+    {
+    public:
+        // Best instruction set this CPU and OS support.
+        static MixKernel Select();
+        static MixKernel Create(InstructionSet isa);
+
+        static bool IsSupported(InstructionSet isa);
+        static const char* GetName(InstructionSet isa);
+
+        InstructionSet GetInstructionSet() const { return m_isa; }
+
+        void Run(
+            const float* in,
+            float* out,
+            uint32_t frames,
+            int channels,
+            const float* add,
+            float volume,
+            float* mono) const
+        {
+            MixClampFn fn;
+            switch (channels)
+            {
+            case 1: fn = m_mono; break;
+            case 2: fn = m_stereo; break;
+            case 6: fn = m_surround51; break;
+            case 8: fn = m_surround71; break;
+            default: fn = m_generic; break;
+            }
+
+            fn(in, out, frames, channels, add, volume, mono);
+        }
+
+    private:
+        InstructionSet m_isa = InstructionSet::Scalar;
+        MixClampFn m_mono = nullptr;
+        MixClampFn m_stereo = nullptr;
+        MixClampFn m_surround51 = nullptr;
+        MixClampFn m_surround71 = nullptr;
+        MixClampFn m_generic = nullptr;
+    };
+}
@@ -0,0 +1,21 @@
+#include "Oscillator.h"
+#include <cmath>
+
+float OscillatorTables::Sine[OscillatorTables::SINE_SIZE + 1];
+
+namespace
+{
+    struct SineTableInit
+    {
+        SineTableInit()
+        {
+            for (size_t i = 0; i <= OscillatorTables::SINE_SIZE; i++)
+            {
+                const double phase = static_cast<double>(i) / OscillatorTables::SINE_SIZE;
+                OscillatorTables::Sine[i] = static_cast<float>(sin(2.0 * 3.14159265358979 * phase));
+            }
+        }
+    };
+
+    const SineTableInit s_sineTableInit;
+}
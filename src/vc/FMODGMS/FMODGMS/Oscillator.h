@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+enum class WaveType
+{
+    SIN,
+    PULSE,
+    SAW,
+};
+
+namespace OscillatorTables
+{
+    // One cycle of sine plus a guard sample so interpolation never wraps.
+    constexpr size_t SINE_SIZE = 2048;
+    // Filled in during static initialisation, treat as read only.
+    extern float Sine[SINE_SIZE + 1];
+}
+
+// Phase accumulator oscillator, the phase is kept in cycles in [0, 1) so it stays
+// accurate however long the synth runs. Saw and pulse are band limited with PolyBLEP.
+class Oscillator
+{
+public:
+    void Reset()
+    {
+        m_phase = 0.0;
+    }
+
+    // increment is in cycles per sample, duty is the fraction of the cycle a pulse is high.
+    float Next(WaveType wave, double increment, double duty)
+    {
+        const double t = m_phase;
+
+        m_phase += increment;
+        if (m_phase >= 1.0)
+        {
+            m_phase -= 1.0;
+        }
+        else if (m_phase < 0.0)
+        {
+            m_phase += 1.0;
+        }
+
+        // Only when the increment is more than a whole cycle. A tiny negative phase
+        // rounds to exactly 1 above, which would read past the end of the sine table.
+        if (m_phase >= 1.0 || m_phase < 0.0)
+        {
+            m_phase -= floor(m_phase);
+        }
+
+        // Anything at or above nyquist can only alias.
+        const double dt = increment < 0.0 ? -increment : increment;
+        if (dt >= 0.5)
+        {
+            return 0.f;
+        }
+
+        switch (wave)
+        {
+        case WaveType::PULSE:
+        {
+            double value = t < duty ? 1.0 : -1.0;
+            value += PolyBlep(t, dt);
+
+            double fall = t - duty;
+            if (fall < 0.0)
+            {
+                fall += 1.0;
+            }
+            value -= PolyBlep(fall, dt);
+
+            return static_cast<float>(value);
+        }
+        case WaveType::SAW:
+            return static_cast<float>(2.0 * t - 1.0 - PolyBlep(t, dt));
+        case WaveType::SIN:
+        default:
+        {
+            const double pos = t * OscillatorTables::SINE_SIZE;
+            const size_t index = static_cast<size_t>(pos);
+            const float frac = static_cast<float>(pos - static_cast<double>(index));
+            const float x0 = OscillatorTables::Sine[index];
+            const float x1 = OscillatorTables::Sine[index + 1];
+            return x0 + frac * (x1 - x0);
+        }
+        }
+    }
+
+private:
+    double m_phase = 0.0;
+
+    // Correction for a unit step at phase 0, dt is the phase increment.
+    static double PolyBlep(double t, double dt)
+    {
+        if (t < dt)
+        {
+            t /= dt;
+            return t + t - t * t - 1.0;
+        }
+
+        if (t > 1.0 - dt)
+        {
+            t = (t - 1.0) / dt;
+            return t * t + t + t + 1.0;
+        }
+
+        return 0.0;
+    }
+};
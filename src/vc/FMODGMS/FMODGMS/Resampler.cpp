@@ -0,0 +1,500 @@
+#include "Resampler.h"
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define RESAMPLER_X86
+#endif
+
+#ifdef RESAMPLER_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// MSVC lets any function use AVX2 intrinsics, gcc and clang need to be told per function.
+#if defined(RESAMPLER_X86) && !defined(_MSC_VER)
+#define RESAMPLER_AVX2 __attribute__((target("avx2")))
+#else
+#define RESAMPLER_AVX2
+#endif
+
+using namespace Resampling;
+using MixKernels::InstructionSet;
+
+namespace
+{
+    constexpr double PI = 3.14159265358979323846;
+
+    // Windowed sinc reaching 8 zero crossings either side, so 16 taps a sample.
+    constexpr int SINC_ZERO_CROSSINGS = 8;
+    constexpr int SINC_TAPS = 2 * SINC_ZERO_CROSSINGS;
+    constexpr int SINC_PHASES = 256;
+
+    // Just under Nyquist, the Kaiser window needs some room to roll off.
+    constexpr double SINC_CUTOFF = 0.92;
+    constexpr double SINC_KAISER_BETA = 8.0;
+
+    // Reading faster than 1 sample a sample widens the kernel to lower the cutoff with it,
+    // up to this many times. Faster than that aliases.
+    constexpr double MAX_SINC_STRETCH = 4.0;
+
+    struct SincTable
+    {
+        // Taps for each fractional position, laid out so a whole row loads at once.
+        alignas(32) float Phases[SINC_PHASES + 1][SINC_TAPS];
+
+        // The same kernel sampled SINC_PHASES times per sample across its whole width,
+        // for the widened kernel. One extra zero so interpolating off the end is safe.
+        float Kernel[SINC_TAPS * SINC_PHASES + 2];
+    };
+
+    double BesselI0(double x)
+    {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 32; k++)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+
+        return sum;
+    }
+
+    double SincKernel(double x)
+    {
+        if (std::abs(x) >= SINC_ZERO_CROSSINGS)
+        {
+            return 0.0;
+        }
+
+        const double r = x / SINC_ZERO_CROSSINGS;
+        const double window = BesselI0(SINC_KAISER_BETA * sqrt(1.0 - r * r)) / BesselI0(SINC_KAISER_BETA);
+
+        const double t = PI * SINC_CUTOFF * x;
+        const double sinc = t == 0.0 ? 1.0 : sin(t) / t;
+        return SINC_CUTOFF * sinc * window;
+    }
+
+    SincTable BuildSincTable()
+    {
+        SincTable table;
+
+        for (int phase = 0; phase <= SINC_PHASES; phase++)
+        {
+            const double frac = static_cast<double>(phase) / SINC_PHASES;
+
+            // Tap j reads the sample j - (SINC_ZERO_CROSSINGS - 1) away from floor(pos).
+            double sum = 0.0;
+            double taps[SINC_TAPS];
+            for (int j = 0; j < SINC_TAPS; j++)
+            {
+                taps[j] = SincKernel(j - (SINC_ZERO_CROSSINGS - 1) - frac);
+                sum += taps[j];
+            }
+
+            // Unity gain at DC for every phase, otherwise steady tones pick up a buzz.
+            for (int j = 0; j < SINC_TAPS; j++)
+            {
+                table.Phases[phase][j] = static_cast<float>(taps[j] / sum);
+            }
+        }
+
+        for (int i = 0; i <= SINC_TAPS * SINC_PHASES; i++)
+        {
+            table.Kernel[i] = static_cast<float>(SincKernel(static_cast<double>(i) / SINC_PHASES - SINC_ZERO_CROSSINGS));
+        }
+
+        table.Kernel[SINC_TAPS * SINC_PHASES + 1] = 0.f;
+
+        return table;
+    }
+
+    // Built on first use, which Create makes sure is on the game thread.
+    const SincTable& GetSincTable()
+    {
+        static const SincTable table = BuildSincTable();
+        return table;
+    }
+
+    inline void SplitPosition(double pos, double step, uint32_t i, int32_t& index, double& frac)
+    {
+        const double p = pos + static_cast<double>(i) * step;
+        const double whole = floor(p);
+        index = static_cast<int32_t>(whole);
+        frac = p - whole;
+    }
+
+    inline float Cubic(float xm1, float x0, float x1, float x2, float t)
+    {
+        // Catmull-Rom flavoured cubic Hermite.
+        const float c1 = 0.5f * (x1 - xm1);
+        const float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+        const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        return ((c3 * t + c2) * t + c1) * t + x0;
+    }
+
+    // Scalar kernels start at done so the vector kernels can hand them what is left over.
+    void LinearTail(uint32_t done, const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        for (uint32_t i = done; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            const float t = static_cast<float>(frac);
+            const float x0 = window[index];
+            const float x1 = window[index + 1];
+            out[i] = x0 + t * (x1 - x0);
+        }
+    }
+
+    void CubicTail(uint32_t done, const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        for (uint32_t i = done; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            const float* x = window + index;
+            out[i] = Cubic(x[-1], x[0], x[1], x[2], static_cast<float>(frac));
+        }
+    }
+
+    void SincTail(uint32_t done, const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        const SincTable& table = GetSincTable();
+
+        for (uint32_t i = done; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            const double phase = frac * SINC_PHASES;
+            const int32_t row = static_cast<int32_t>(phase);
+            const float a = static_cast<float>(phase - row);
+
+            const float* r0 = table.Phases[row];
+            const float* r1 = table.Phases[row + 1];
+            const float* x = window + index - (SINC_ZERO_CROSSINGS - 1);
+
+            float sum = 0.f;
+            for (int j = 0; j < SINC_TAPS; j++)
+            {
+                sum += x[j] * (r0[j] + a * (r1[j] - r0[j]));
+            }
+
+            out[i] = sum;
+        }
+    }
+
+    // Reading faster than 1 sample a sample, the kernel is stretched to filter out what
+    // would alias. The stretch changes the tap positions so look them up one at a time.
+    void SincStretched(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        const SincTable& table = GetSincTable();
+        const double stretch = std::fmin(std::abs(step), MAX_SINC_STRETCH);
+        const int half = static_cast<int>(ceil(SINC_ZERO_CROSSINGS * stretch));
+        const double tableScale = SINC_PHASES / stretch;
+        const double tableEnd = SINC_TAPS * SINC_PHASES;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            float sum = 0.f;
+            float weightSum = 0.f;
+            for (int k = 1 - half; k <= half; k++)
+            {
+                const double t = (k - frac) * tableScale + SINC_ZERO_CROSSINGS * SINC_PHASES;
+                if (t < 0.0 || t >= tableEnd)
+                {
+                    continue;
+                }
+
+                const int32_t ti = static_cast<int32_t>(t);
+                const float a = static_cast<float>(t - ti);
+                const float weight = table.Kernel[ti] + a * (table.Kernel[ti + 1] - table.Kernel[ti]);
+
+                sum += weight * window[index + k];
+                weightSum += weight;
+            }
+
+            out[i] = weightSum != 0.f ? sum / weightSum : 0.f;
+        }
+    }
+
+    void ResampleLinearScalar(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        LinearTail(0, window, pos, step, out, count);
+    }
+
+    void ResampleCubicScalar(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        CubicTail(0, window, pos, step, out, count);
+    }
+
+    void ResampleSincScalar(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        if (std::abs(step) > 1.0)
+        {
+            SincStretched(window, pos, step, out, count);
+            return;
+        }
+
+        SincTail(0, window, pos, step, out, count);
+    }
+
+#ifdef RESAMPLER_X86
+
+    // SSE2 has no gathers, so only the sinc kernel with its contiguous taps gains from it.
+    void ResampleSincSSE2(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        if (std::abs(step) > 1.0)
+        {
+            SincStretched(window, pos, step, out, count);
+            return;
+        }
+
+        const SincTable& table = GetSincTable();
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            const double phase = frac * SINC_PHASES;
+            const int32_t row = static_cast<int32_t>(phase);
+            const __m128 a = _mm_set1_ps(static_cast<float>(phase - row));
+
+            const float* r0 = table.Phases[row];
+            const float* r1 = table.Phases[row + 1];
+            const float* x = window + index - (SINC_ZERO_CROSSINGS - 1);
+
+            __m128 acc = _mm_setzero_ps();
+            for (int j = 0; j < SINC_TAPS; j += 4)
+            {
+                const __m128 c0 = _mm_load_ps(r0 + j);
+                const __m128 coef = _mm_add_ps(c0, _mm_mul_ps(a, _mm_sub_ps(_mm_load_ps(r1 + j), c0)));
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + j), coef));
+            }
+
+            // [a b c d] -> a + b + c + d
+            const __m128 pairs = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+            const __m128 sum = _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1)));
+            out[i] = _mm_cvtss_f32(sum);
+        }
+    }
+
+    // Positions of outputs first..first + 7, split into sample index and fraction. Worked
+    // out in double like the scalar kernels so long blocks don't drift.
+    RESAMPLER_AVX2 inline void SplitPositions8(double pos, double step, uint32_t first, __m256i& index, __m256& frac)
+    {
+        const __m256d lanes = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+        const __m256d posVec = _mm256_set1_pd(pos);
+        const __m256d stepVec = _mm256_set1_pd(step);
+
+        const __m256d iLo = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(first)), lanes);
+        const __m256d iHi = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(first + 4)), lanes);
+        const __m256d pLo = _mm256_add_pd(posVec, _mm256_mul_pd(iLo, stepVec));
+        const __m256d pHi = _mm256_add_pd(posVec, _mm256_mul_pd(iHi, stepVec));
+
+        const __m256d wholeLo = _mm256_floor_pd(pLo);
+        const __m256d wholeHi = _mm256_floor_pd(pHi);
+
+        index = _mm256_set_m128i(_mm256_cvttpd_epi32(wholeHi), _mm256_cvttpd_epi32(wholeLo));
+        frac = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(pHi, wholeHi)), _mm256_cvtpd_ps(_mm256_sub_pd(pLo, wholeLo)));
+    }
+
+    RESAMPLER_AVX2 void ResampleLinearAVX2(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i index;
+            __m256 t;
+            SplitPositions8(pos, step, i, index, t);
+
+            const __m256 x0 = _mm256_i32gather_ps(window, index, 4);
+            const __m256 x1 = _mm256_i32gather_ps(window + 1, index, 4);
+            _mm256_storeu_ps(out + i, _mm256_add_ps(x0, _mm256_mul_ps(t, _mm256_sub_ps(x1, x0))));
+        }
+
+        LinearTail(i, window, pos, step, out, count);
+    }
+
+    RESAMPLER_AVX2 void ResampleCubicAVX2(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 oneAndHalf = _mm256_set1_ps(1.5f);
+        const __m256 two = _mm256_set1_ps(2.f);
+        const __m256 twoAndHalf = _mm256_set1_ps(2.5f);
+
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i index;
+            __m256 t;
+            SplitPositions8(pos, step, i, index, t);
+
+            const __m256 xm1 = _mm256_i32gather_ps(window - 1, index, 4);
+            const __m256 x0 = _mm256_i32gather_ps(window, index, 4);
+            const __m256 x1 = _mm256_i32gather_ps(window + 1, index, 4);
+            const __m256 x2 = _mm256_i32gather_ps(window + 2, index, 4);
+
+            // Same order of operations as Cubic.
+            const __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x1, xm1));
+            const __m256 c2 = _mm256_sub_ps(
+                _mm256_add_ps(_mm256_sub_ps(xm1, _mm256_mul_ps(twoAndHalf, x0)), _mm256_mul_ps(two, x1)),
+                _mm256_mul_ps(half, x2));
+            const __m256 c3 = _mm256_add_ps(
+                _mm256_mul_ps(half, _mm256_sub_ps(x2, xm1)),
+                _mm256_mul_ps(oneAndHalf, _mm256_sub_ps(x0, x1)));
+
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+            y = _mm256_add_ps(_mm256_mul_ps(y, t), c1);
+            y = _mm256_add_ps(_mm256_mul_ps(y, t), x0);
+            _mm256_storeu_ps(out + i, y);
+        }
+
+        CubicTail(i, window, pos, step, out, count);
+    }
+
+    RESAMPLER_AVX2 void ResampleSincAVX2(const float* window, double pos, double step, float* out, uint32_t count)
+    {
+        if (std::abs(step) > 1.0)
+        {
+            SincStretched(window, pos, step, out, count);
+            return;
+        }
+
+        const SincTable& table = GetSincTable();
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int32_t index;
+            double frac;
+            SplitPosition(pos, step, i, index, frac);
+
+            const double phase = frac * SINC_PHASES;
+            const int32_t row = static_cast<int32_t>(phase);
+            const __m256 a = _mm256_set1_ps(static_cast<float>(phase - row));
+
+            const float* r0 = table.Phases[row];
+            const float* r1 = table.Phases[row + 1];
+            const float* x = window + index - (SINC_ZERO_CROSSINGS - 1);
+
+            const __m256 lo0 = _mm256_load_ps(r0);
+            const __m256 hi0 = _mm256_load_ps(r0 + 8);
+            const __m256 coefLo = _mm256_add_ps(lo0, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_load_ps(r1), lo0)));
+            const __m256 coefHi = _mm256_add_ps(hi0, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_load_ps(r1 + 8), hi0)));
+
+            const __m256 acc = _mm256_add_ps(
+                _mm256_mul_ps(_mm256_loadu_ps(x), coefLo),
+                _mm256_mul_ps(_mm256_loadu_ps(x + 8), coefHi));
+
+            const __m128 quad = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            const __m128 pairs = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+            const __m128 sum = _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1)));
+            out[i] = _mm_cvtss_f32(sum);
+        }
+    }
+
+#endif
+}
+
+const char* Resampler::GetName(ResampleQuality quality)
+{
+    switch (quality)
+    {
+    case ResampleQuality::Cubic:
+        return "cubic";
+    case ResampleQuality::Sinc:
+        return "sinc";
+    default:
+        return "linear";
+    }
+}
+
+Resampler Resampler::Select(ResampleQuality quality)
+{
+    if (MixKernels::MixKernel::IsSupported(InstructionSet::AVX2))
+    {
+        return Create(quality, InstructionSet::AVX2);
+    }
+
+    if (MixKernels::MixKernel::IsSupported(InstructionSet::SSE2))
+    {
+        return Create(quality, InstructionSet::SSE2);
+    }
+
+    return Create(quality, InstructionSet::Scalar);
+}
+
+Resampler Resampler::Create(ResampleQuality quality, InstructionSet isa)
+{
+    Resampler resampler;
+    resampler.m_quality = quality;
+
+    switch (quality)
+    {
+    case ResampleQuality::Cubic:
+        resampler.m_tapsBefore = 1;
+        resampler.m_tapsAfter = 2;
+        resampler.m_run = ResampleCubicScalar;
+        break;
+    case ResampleQuality::Sinc:
+        resampler.m_tapsBefore = static_cast<uint32_t>(SINC_ZERO_CROSSINGS * MAX_SINC_STRETCH) - 1;
+        resampler.m_tapsAfter = static_cast<uint32_t>(SINC_ZERO_CROSSINGS * MAX_SINC_STRETCH);
+        resampler.m_run = ResampleSincScalar;
+
+        // Keep the table build out of the audio thread.
+        GetSincTable();
+        break;
+    default:
+        resampler.m_quality = ResampleQuality::Linear;
+        resampler.m_tapsBefore = 0;
+        resampler.m_tapsAfter = 1;
+        resampler.m_run = ResampleLinearScalar;
+        break;
+    }
+
+    if (!MixKernels::MixKernel::IsSupported(isa))
+    {
+        return resampler;
+    }
+
+    resampler.m_isa = isa;
+
+#ifdef RESAMPLER_X86
+    if (isa == InstructionSet::SSE2)
+    {
+        if (resampler.m_quality == ResampleQuality::Sinc)
+        {
+            resampler.m_run = ResampleSincSSE2;
+        }
+    }
+    else if (isa == InstructionSet::AVX2)
+    {
+        switch (resampler.m_quality)
+        {
+        case ResampleQuality::Linear:
+            resampler.m_run = ResampleLinearAVX2;
+            break;
+        case ResampleQuality::Cubic:
+            resampler.m_run = ResampleCubicAVX2;
+            break;
+        case ResampleQuality::Sinc:
+            resampler.m_run = ResampleSincAVX2;
+            break;
+        }
+    }
+#endif
+
+    return resampler;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "MixKernels.h"
+
+namespace Resampling
+{
+    enum class ResampleQuality
+    {
+        Linear,
+        Cubic,
+        Sinc,
+    };
+
+    constexpr size_t RESAMPLE_QUALITY_COUNT = 3;
+
+    // Writes count samples read from window at pos, pos + step, pos + 2 * step, ...
+    // Positions are relative to window[0], which has to hold every sample the kernel
+    // touches, see Resampler::GetTapsBefore and GetTapsAfter.
+    typedef void (*ResampleFn)(
+        const float* window,
+        double pos,
+        double step,
+        float* out,
+        uint32_t count);
+
+    // Variable rate reader for tape playback. Works on a whole block at a time from a
+    // contiguous window so wrapping round the tape is handled once per block by the
+    // caller, not once per sample. Pick one when the DSP is created.
+    class Resampler
+    {
+    public:
+        // Fastest version of the quality this CPU supports.
+        static Resampler Select(ResampleQuality quality);
+        static Resampler Create(ResampleQuality quality, MixKernels::InstructionSet isa);
+
+        static const char* GetName(ResampleQuality quality);
+
+        ResampleQuality GetQuality() const { return m_quality; }
+        MixKernels::InstructionSet GetInstructionSet() const { return m_isa; }
+
+        // Samples read before floor(pos) and after it, at any step.
+        uint32_t GetTapsBefore() const { return m_tapsBefore; }
+        uint32_t GetTapsAfter() const { return m_tapsAfter; }
+
+        void Run(const float* window, double pos, double step, float* out, uint32_t count) const
+        {
+            m_run(window, pos, step, out, count);
+        }
+
+    private:
+        ResampleQuality m_quality = ResampleQuality::Linear;
+        MixKernels::InstructionSet m_isa = MixKernels::InstructionSet::Scalar;
+        uint32_t m_tapsBefore = 0;
+        uint32_t m_tapsAfter = 0;
+        ResampleFn m_run = nullptr;
+    };
+}
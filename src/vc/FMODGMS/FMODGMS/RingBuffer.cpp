@@ -1,4 +1,6 @@
 #include "RingBuffer.h"
+#include <cstdint>
+#include <cstdlib>
 
 RingBuffer::RingBuffer(size_t bufferSize)
 {
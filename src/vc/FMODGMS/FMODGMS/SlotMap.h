@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Index of a slot in the low bits and how many times that slot has been reused above
+// them, so a freshly created map hands out 0, 1, 2, ... just like a counter.
+typedef uint32_t SlotHandle;
+
+constexpr uint32_t SLOT_INDEX_BITS = 20;
+constexpr uint32_t SLOT_INDEX_MASK = (1u << SLOT_INDEX_BITS) - 1;
+
+// Never refers to anything, the all ones index is never given out.
+constexpr SlotHandle INVALID_SLOT_HANDLE = UINT32_MAX;
+
+// Objects handed out to GML by handle. Looking one up is an array index and a
+// generation check, no hashing, and a handle to something freed never finds whatever
+// reused its slot (until the slot wraps round its 12 bit generation). Freed slots are
+// reused first so the arrays stay small. The values themselves sit packed together in
+// no particular order for anything that wants to walk them all.
+template <typename T>
+class SlotMap
+{
+public:
+    // INVALID_SLOT_HANDLE once every index is in use.
+    SlotHandle Insert(T value)
+    {
+        uint32_t index = m_freeHead;
+        if (index == NO_SLOT)
+        {
+            if (m_slots.size() >= SLOT_INDEX_MASK)
+            {
+                return INVALID_SLOT_HANDLE;
+            }
+
+            index = static_cast<uint32_t>(m_slots.size());
+            m_slots.push_back(Slot{});
+        }
+        else
+        {
+            m_freeHead = m_slots[index].Link;
+        }
+
+        Slot& slot = m_slots[index];
+        slot.Link = static_cast<uint32_t>(m_values.size());
+        slot.Occupied = true;
+
+        m_values.push_back(std::move(value));
+        m_valueSlots.push_back(index);
+        return MakeHandle(index, slot.Generation);
+    }
+
+    // Null for handles that were never given out or whose value has been erased.
+    T* Find(SlotHandle handle)
+    {
+        const Slot* slot = this->FindSlot(handle);
+        return slot != nullptr ? &m_values[slot->Link] : nullptr;
+    }
+
+    const T* Find(SlotHandle handle) const
+    {
+        const Slot* slot = this->FindSlot(handle);
+        return slot != nullptr ? &m_values[slot->Link] : nullptr;
+    }
+
+    bool Contains(SlotHandle handle) const
+    {
+        return this->FindSlot(handle) != nullptr;
+    }
+
+    // Only for handles known to be valid, check with Contains first.
+    T& operator[](SlotHandle handle)
+    {
+        return m_values[m_slots[handle & SLOT_INDEX_MASK].Link];
+    }
+
+    bool Erase(SlotHandle handle)
+    {
+        const Slot* slot = this->FindSlot(handle);
+        if (slot == nullptr)
+        {
+            return false;
+        }
+
+        this->EraseAt(slot->Link);
+        return true;
+    }
+
+    // Erases every value pred returns true for.
+    template <typename Pred>
+    void EraseIf(Pred pred)
+    {
+        for (size_t i = m_values.size(); i-- > 0;)
+        {
+            if (pred(m_values[i]))
+            {
+                this->EraseAt(i);
+            }
+        }
+    }
+
+    // Every handle given out so far stays invalid afterwards.
+    void Clear()
+    {
+        this->EraseIf([](const T&) { return true; });
+    }
+
+    size_t Size() const { return m_values.size(); }
+
+    // One more than the highest index any handle has used.
+    size_t GetSlotCount() const { return m_slots.size(); }
+
+    T* begin() { return m_values.data(); }
+    T* end() { return m_values.data() + m_values.size(); }
+    const T* begin() const { return m_values.data(); }
+    const T* end() const { return m_values.data() + m_values.size(); }
+
+private:
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+    static constexpr uint32_t GENERATION_MASK = UINT32_MAX >> SLOT_INDEX_BITS;
+
+    struct Slot
+    {
+        // Where the value is while occupied, the next free slot otherwise.
+        uint32_t Link = NO_SLOT;
+        uint32_t Generation = 0;
+        bool Occupied = false;
+    };
+
+    std::vector<T> m_values;
+    std::vector<uint32_t> m_valueSlots;
+    std::vector<Slot> m_slots;
+    uint32_t m_freeHead = NO_SLOT;
+
+    static SlotHandle MakeHandle(uint32_t index, uint32_t generation)
+    {
+        return (generation << SLOT_INDEX_BITS) | index;
+    }
+
+    const Slot* FindSlot(SlotHandle handle) const
+    {
+        const uint32_t index = handle & SLOT_INDEX_MASK;
+        if (index >= m_slots.size())
+        {
+            return nullptr;
+        }
+
+        const Slot& slot = m_slots[index];
+        return slot.Occupied && slot.Generation == (handle >> SLOT_INDEX_BITS) ? &slot : nullptr;
+    }
+
+    // Moves the last value into the hole so the values stay packed.
+    void EraseAt(size_t dense)
+    {
+        const uint32_t index = m_valueSlots[dense];
+        if (dense + 1 != m_values.size())
+        {
+            m_values[dense] = std::move(m_values.back());
+            m_valueSlots[dense] = m_valueSlots.back();
+            m_slots[m_valueSlots[dense]].Link = static_cast<uint32_t>(dense);
+        }
+
+        m_values.pop_back();
+        m_valueSlots.pop_back();
+
+        Slot& slot = m_slots[index];
+        slot.Occupied = false;
+        slot.Generation = (slot.Generation + 1) & GENERATION_MASK;
+        slot.Link = m_freeHead;
+        m_freeHead = index;
+    }
+};
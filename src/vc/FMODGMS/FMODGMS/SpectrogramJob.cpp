@@ -0,0 +1,318 @@
+#include "SpectrogramJob.h"
+#include "FFTPlans.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Samples per channel the decoder reads at a time.
+constexpr size_t DECODE_CHUNK_LENGTH = 16384;
+
+namespace
+{
+    size_t GetBytesPerSample(FMOD_SOUND_FORMAT format)
+    {
+        switch (format)
+        {
+        case FMOD_SOUND_FORMAT_PCM8: return 1;
+        case FMOD_SOUND_FORMAT_PCM16: return 2;
+        case FMOD_SOUND_FORMAT_PCM24: return 3;
+        case FMOD_SOUND_FORMAT_PCM32: return 4;
+        case FMOD_SOUND_FORMAT_PCMFLOAT: return 4;
+        default: return 0;
+        }
+    }
+
+    float ReadSample(const uint8_t* data, FMOD_SOUND_FORMAT format)
+    {
+        switch (format)
+        {
+        case FMOD_SOUND_FORMAT_PCM8:
+            return static_cast<int8_t>(data[0]) / 128.f;
+        case FMOD_SOUND_FORMAT_PCM16:
+        {
+            int16_t value;
+            memcpy(&value, data, sizeof(value));
+            return value / 32768.f;
+        }
+        case FMOD_SOUND_FORMAT_PCM24:
+        {
+            const int32_t value = static_cast<int32_t>(
+                static_cast<uint32_t>(data[0]) << 8 | static_cast<uint32_t>(data[1]) << 16 | static_cast<uint32_t>(data[2]) << 24) >> 8;
+            return value / 8388608.f;
+        }
+        case FMOD_SOUND_FORMAT_PCM32:
+        {
+            int32_t value;
+            memcpy(&value, data, sizeof(value));
+            return static_cast<float>(value / 2147483648.0);
+        }
+        case FMOD_SOUND_FORMAT_PCMFLOAT:
+        {
+            float value;
+            memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        default:
+            return 0.f;
+        }
+    }
+}
+
+SpectrogramJob::SpectrogramJob(FMOD::Sound* sound, size_t points, size_t hop, size_t threads) :
+    m_sound(sound),
+    m_points(points),
+    m_hop(hop),
+    m_threadCount(threads)
+{
+}
+
+SpectrogramJob::~SpectrogramJob()
+{
+    this->Cancel();
+
+    if (m_decoder.joinable())
+    {
+        m_decoder.join();
+    }
+
+    for (auto& analyser : m_analysers)
+    {
+        analyser.join();
+    }
+}
+
+bool SpectrogramJob::Start(std::string& error)
+{
+    if (m_sound->getFormat(nullptr, &m_format, &m_channels, nullptr) != FMOD_OK
+        || m_sound->getLength(&m_length, FMOD_TIMEUNIT_PCM) != FMOD_OK)
+    {
+        error = "Could not get sound format";
+        return false;
+    }
+
+    if (GetBytesPerSample(m_format) == 0 || m_channels <= 0)
+    {
+        error = "Sound is not PCM";
+        return false;
+    }
+
+    m_frameCount = m_length < m_points ? 0 : 1 + (m_length - m_points) / m_hop;
+    m_binCount = FFTPlan::GetMagnitudeCount(m_points);
+
+    m_samples.assign(m_length, 0.f);
+    m_spectrogram.assign(m_frameCount * m_binCount, 0.f);
+    m_onsets.assign(m_frameCount, 0.f);
+
+    m_running = 1 + m_threadCount;
+    m_decoder = std::thread(&SpectrogramJob::Decode, this);
+    for (size_t i = 0; i < m_threadCount; i++)
+    {
+        m_analysers.emplace_back(&SpectrogramJob::Analyse, this);
+    }
+
+    return true;
+}
+
+void SpectrogramJob::Cancel()
+{
+    m_cancelled = true;
+
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    m_decodeProgress.notify_all();
+}
+
+SpectrogramState SpectrogramJob::GetState() const
+{
+    return m_state.load(std::memory_order_acquire);
+}
+
+const std::string& SpectrogramJob::GetError() const
+{
+    return m_error;
+}
+
+double SpectrogramJob::GetProgress() const
+{
+    if (m_frameCount == 0)
+    {
+        return this->GetState() == SpectrogramState::Done ? 1.0 : 0.0;
+    }
+
+    return static_cast<double>(m_framesDone.load(std::memory_order_relaxed)) / static_cast<double>(m_frameCount);
+}
+
+size_t SpectrogramJob::CopySpectrogram(float* out, size_t count) const
+{
+    if (this->GetState() != SpectrogramState::Done)
+    {
+        return 0;
+    }
+
+    const size_t copied = std::min(count, m_spectrogram.size());
+    std::copy(m_spectrogram.begin(), m_spectrogram.begin() + copied, out);
+    return copied;
+}
+
+size_t SpectrogramJob::CopyOnsets(float* out, size_t count) const
+{
+    if (this->GetState() != SpectrogramState::Done)
+    {
+        return 0;
+    }
+
+    const size_t copied = std::min(count, m_onsets.size());
+    std::copy(m_onsets.begin(), m_onsets.begin() + copied, out);
+    return copied;
+}
+
+void SpectrogramJob::Decode()
+{
+    const size_t sampleBytes = GetBytesPerSample(m_format);
+    const size_t channels = static_cast<size_t>(m_channels);
+    const size_t frameBytes = sampleBytes * channels;
+    std::vector<uint8_t> raw(DECODE_CHUNK_LENGTH * frameBytes);
+
+    if (m_sound->seekData(0) != FMOD_OK)
+    {
+        this->Fail("Could not seek sound");
+    }
+
+    size_t pos = 0;
+    while (pos < m_length && !m_cancelled && !m_failed)
+    {
+        const size_t wanted = std::min<size_t>(DECODE_CHUNK_LENGTH, m_length - pos) * frameBytes;
+        unsigned int read = 0;
+        const FMOD_RESULT result = m_sound->readData(raw.data(), static_cast<unsigned int>(wanted), &read);
+        if (result != FMOD_OK && result != FMOD_ERR_FILE_EOF)
+        {
+            this->Fail("Could not read sound");
+            break;
+        }
+
+        // Mixed down to mono.
+        const size_t length = read / frameBytes;
+        for (size_t i = 0; i < length; i++)
+        {
+            const uint8_t* frame = raw.data() + i * frameBytes;
+            float sum = 0.f;
+            for (size_t channel = 0; channel < channels; channel++)
+            {
+                sum += ReadSample(frame + channel * sampleBytes, m_format);
+            }
+
+            m_samples[pos + i] = sum / static_cast<float>(channels);
+        }
+
+        pos += length;
+        if (result == FMOD_ERR_FILE_EOF || length == 0)
+        {
+            // Anything the sound's length promised but didn't deliver stays silent.
+            pos = m_length;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_decodeMutex);
+            m_decoded.store(pos, std::memory_order_release);
+        }
+
+        m_decodeProgress.notify_all();
+    }
+
+    this->Finish();
+}
+
+void SpectrogramJob::Analyse()
+{
+    // Each thread has its own, kiss plans aren't thread safe.
+    const auto plan = FFTPlan::Create(m_points);
+    if (plan == nullptr)
+    {
+        this->Fail("Could not allocate FFT");
+    }
+
+    while (plan != nullptr)
+    {
+        const size_t frame = m_nextFrame.fetch_add(1, std::memory_order_relaxed);
+        if (frame >= m_frameCount)
+        {
+            break;
+        }
+
+        const size_t start = frame * m_hop;
+        const size_t needed = start + m_points;
+        if (m_decoded.load(std::memory_order_acquire) < needed)
+        {
+            std::unique_lock<std::mutex> lock(m_decodeMutex);
+            m_decodeProgress.wait(lock, [&]
+            {
+                return m_decoded.load(std::memory_order_acquire) >= needed || m_cancelled.load() || m_failed.load();
+            });
+        }
+
+        if (m_cancelled || m_failed)
+        {
+            break;
+        }
+
+        plan->Analyse(m_samples.data() + start, m_spectrogram.data() + frame * m_binCount);
+        m_framesDone.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    this->Finish();
+}
+
+void SpectrogramJob::Fail(const char* error)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_decodeMutex);
+        if (!m_failed)
+        {
+            m_error = error;
+            m_failed = true;
+        }
+    }
+
+    m_decodeProgress.notify_all();
+}
+
+void SpectrogramJob::Finish()
+{
+    if (m_running.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    if (m_failed)
+    {
+        m_state.store(SpectrogramState::Failed, std::memory_order_release);
+    }
+    else if (m_cancelled)
+    {
+        m_state.store(SpectrogramState::Cancelled, std::memory_order_release);
+    }
+    else
+    {
+        this->WorkOutOnsets();
+        m_state.store(SpectrogramState::Done, std::memory_order_release);
+    }
+}
+
+void SpectrogramJob::WorkOutOnsets()
+{
+    std::vector<float> previous(m_binCount, 0.f);
+    float strongest = 0.f;
+    for (size_t frame = 0; frame < m_frameCount; frame++)
+    {
+        const float flux = SpectralFlux(m_spectrogram.data() + frame * m_binCount, previous.data(), m_binCount);
+        m_onsets[frame] = frame > 0 ? flux : 0.f;
+        strongest = std::max(strongest, m_onsets[frame]);
+    }
+
+    if (strongest > 0.f)
+    {
+        for (float& onset : m_onsets)
+        {
+            onset /= strongest;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fmod.hpp"
+
+enum class SpectrogramState
+{
+    Running,
+    Done,
+    Failed,
+    Cancelled,
+};
+
+// Works out a whole sound's spectrogram in the background, frame for frame what
+// FMODGMS_Util_STFT gives, plus an onset strength envelope for lining gameplay up with
+// the beats. One thread decodes the sound to mono while a pool of others analyse frames
+// as soon as their samples are in.
+//
+// The sound is read with seekData and readData, so must not be played, read or released
+// until the job has stopped.
+class SpectrogramJob
+{
+public:
+    // points even, hop at least 1, threads analysing frames at least 1.
+    SpectrogramJob(FMOD::Sound* sound, size_t points, size_t hop, size_t threads);
+
+    // Cancels and waits for the threads.
+    ~SpectrogramJob();
+
+    SpectrogramJob(const SpectrogramJob&) = delete;
+    SpectrogramJob& operator=(const SpectrogramJob&) = delete;
+
+    bool Start(std::string& error);
+    void Cancel();
+
+    SpectrogramState GetState() const;
+
+    // Once Failed.
+    const std::string& GetError() const;
+
+    FMOD::Sound* GetSound() const { return m_sound; }
+
+    // Fraction of the frames analysed so far.
+    double GetProgress() const;
+
+    // Known from the start so buffers can be made ready.
+    size_t GetFrameCount() const { return m_frameCount; }
+    size_t GetBinCount() const { return m_binCount; }
+
+    // Once Done. Frames one after another, GetBinCount magnitudes each, and one onset
+    // strength a frame scaled so the strongest is 1. Returns how many values were copied.
+    size_t CopySpectrogram(float* out, size_t count) const;
+    size_t CopyOnsets(float* out, size_t count) const;
+
+private:
+    FMOD::Sound* m_sound;
+    size_t m_points;
+    size_t m_hop;
+    size_t m_threadCount;
+
+    // Sound's length in samples and how they're stored.
+    uint32_t m_length = 0;
+    FMOD_SOUND_FORMAT m_format = FMOD_SOUND_FORMAT_NONE;
+    int m_channels = 0;
+    size_t m_frameCount = 0;
+    size_t m_binCount = 0;
+
+    std::vector<float> m_samples;
+    std::vector<float> m_spectrogram;
+    std::vector<float> m_onsets;
+
+    // Samples decoded so far, frames handed out and finished.
+    std::atomic<size_t> m_decoded = 0;
+    std::atomic<size_t> m_nextFrame = 0;
+    std::atomic<size_t> m_framesDone = 0;
+
+    std::atomic<bool> m_cancelled = false;
+    std::atomic<bool> m_failed = false;
+    std::string m_error;
+
+    // Whoever finishes last of the decoder and the analysers wraps the job up.
+    std::atomic<size_t> m_running = 0;
+    std::atomic<SpectrogramState> m_state = SpectrogramState::Running;
+
+    // Analysers wait here for the decoder.
+    std::mutex m_decodeMutex;
+    std::condition_variable m_decodeProgress;
+
+    std::thread m_decoder;
+    std::vector<std::thread> m_analysers;
+
+    void Decode();
+    void Analyse();
+    void Fail(const char* error);
+    void Finish();
+    void WorkOutOnsets();
+};
@@ -0,0 +1,155 @@
+#include "SpectrumAnalyzer.h"
+#include <algorithm>
+
+SpectrumAnalyzer::SpectrumAnalyzer()
+{
+    m_bins.reserve(FFT_MAX_WINDOW_SIZE / 2);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+    if (m_dsp != nullptr)
+    {
+        this->Detach();
+        m_dsp->release();
+    }
+}
+
+bool SpectrumAnalyzer::Create(FMOD::System* sys, int windowSize, FMOD_DSP_FFT_WINDOW windowType, std::string& error)
+{
+    if (sys->createDSPByType(FMOD_DSP_TYPE_FFT, &m_dsp) != FMOD_OK)
+    {
+        m_dsp = nullptr;
+        error = "Could not create DSP";
+        return false;
+    }
+
+    return this->SetWindowType(windowType, error) && this->SetWindowSize(windowSize, error);
+}
+
+bool SpectrumAnalyzer::Attach(FMOD::ChannelControl* target, int position, std::string& error)
+{
+    this->Detach();
+
+    if (target->addDSP(position, m_dsp) != FMOD_OK)
+    {
+        error = "Could not add dsp";
+        return false;
+    }
+
+    m_target = target;
+    return true;
+}
+
+void SpectrumAnalyzer::Detach()
+{
+    if (m_target != nullptr)
+    {
+        // Fails harmlessly if a channel has finished and taken the DSP off already.
+        m_target->removeDSP(m_dsp);
+        m_target = nullptr;
+    }
+
+    std::fill(m_bins.begin(), m_bins.end(), 0.f);
+}
+
+bool SpectrumAnalyzer::SetWindowSize(int windowSize, std::string& error)
+{
+    if (windowSize < FFT_MIN_WINDOW_SIZE || windowSize > FFT_MAX_WINDOW_SIZE || (windowSize & (windowSize - 1)) != 0)
+    {
+        error = "Window size must be a power of two from 128 to 16384";
+        return false;
+    }
+
+    if (m_dsp->setParameterInt(FMOD_DSP_FFT_WINDOWSIZE, windowSize) != FMOD_OK)
+    {
+        error = "Could not set window size";
+        return false;
+    }
+
+    // Within the reserved capacity, so the storage is reused.
+    m_windowSize = windowSize;
+    m_bins.assign(windowSize / 2, 0.f);
+    return true;
+}
+
+bool SpectrumAnalyzer::SetWindowType(FMOD_DSP_FFT_WINDOW windowType, std::string& error)
+{
+    if (windowType < FMOD_DSP_FFT_WINDOW_RECT || windowType > FMOD_DSP_FFT_WINDOW_BLACKMANHARRIS)
+    {
+        error = "Invalid window type";
+        return false;
+    }
+
+    if (m_dsp->setParameterInt(FMOD_DSP_FFT_WINDOWTYPE, windowType) != FMOD_OK)
+    {
+        error = "Could not set window type";
+        return false;
+    }
+
+    return true;
+}
+
+bool SpectrumAnalyzer::Update(std::string& error)
+{
+    if (m_target == nullptr)
+    {
+        return true;
+    }
+
+    FMOD_DSP_PARAMETER_FFT* fft;
+    if (m_dsp->getParameterData(FMOD_DSP_FFT_SPECTRUMDATA, reinterpret_cast<void**>(&fft), nullptr, nullptr, 0) != FMOD_OK)
+    {
+        error = "Could not get spectrum";
+        return false;
+    }
+
+    // Until the DSP has processed a block at a new window size it still has the old
+    // spectrum, which may be shorter.
+    const size_t count = std::min(static_cast<size_t>(std::max(fft->length, 0)), m_bins.size());
+    const int channels = std::min(fft->numchannels, 32);
+    if (channels <= 0)
+    {
+        return true;
+    }
+
+    for (size_t j = 0; j < count; j++)
+    {
+        float sum = 0.f;
+        for (int i = 0; i < channels; i++)
+        {
+            sum += fft->spectrum[i][j];
+        }
+
+        m_bins[j] = sum / channels;
+    }
+
+    std::fill(m_bins.begin() + count, m_bins.end(), 0.f);
+    return true;
+}
+
+bool SpectrumAnalyzer::GetDominantFrequency(float& frequency, std::string& error) const
+{
+    if (m_dsp->getParameterFloat(FMOD_DSP_FFT_DOMINANT_FREQ, &frequency, nullptr, 0) != FMOD_OK)
+    {
+        error = "Could not get dominant frequency";
+        return false;
+    }
+
+    return true;
+}
+
+void SpectrumAnalyzer::Normalize()
+{
+    const auto maxIterator = std::max_element(m_bins.begin(), m_bins.end());
+    if (maxIterator == m_bins.end() || *maxIterator <= 0.f)
+    {
+        return;
+    }
+
+    const float scale = 1.f / *maxIterator;
+    for (float& bin : m_bins)
+    {
+        bin *= scale;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "fmod.hpp"
+#include "fmod_dsp_effects.h"
+
+// FMOD's FFT DSP takes power of two windows in this range.
+constexpr int FFT_MIN_WINDOW_SIZE = 128;
+constexpr int FFT_MAX_WINDOW_SIZE = 16384;
+
+// One of FMOD's FFT DSPs, attached to the master group or a channel, and the spectrum
+// last read from it averaged over the channels. Bin storage is sized for the largest
+// window up front so changing window size never reallocates. Game thread only.
+class SpectrumAnalyzer
+{
+public:
+    SpectrumAnalyzer();
+
+    // Detaches and releases the DSP.
+    ~SpectrumAnalyzer();
+
+    SpectrumAnalyzer(const SpectrumAnalyzer&) = delete;
+    SpectrumAnalyzer& operator=(const SpectrumAnalyzer&) = delete;
+
+    bool Create(FMOD::System* sys, int windowSize, FMOD_DSP_FFT_WINDOW windowType, std::string& error);
+
+    // Moves the DSP onto target at position, FMOD_CHANNELCONTROL_DSP_TAIL to hear what goes
+    // into target's effects or FMOD_CHANNELCONTROL_DSP_HEAD for what comes out of them.
+    bool Attach(FMOD::ChannelControl* target, int position, std::string& error);
+    void Detach();
+    bool IsAttached() const { return m_target != nullptr; }
+
+    // Bins are cleared, the new size shows up from the next block the DSP processes.
+    bool SetWindowSize(int windowSize, std::string& error);
+    bool SetWindowType(FMOD_DSP_FFT_WINDOW windowType, std::string& error);
+    int GetWindowSize() const { return m_windowSize; }
+
+    // Reads the DSP's latest spectrum into the bins, once a frame. Does nothing while
+    // detached, the DSP still holds the last spectrum it saw but the bins stay at 0.
+    bool Update(std::string& error);
+
+    // Half the window size.
+    size_t GetBinCount() const { return m_bins.size(); }
+    const float* GetBins() const { return m_bins.data(); }
+
+    bool GetDominantFrequency(float& frequency, std::string& error) const;
+
+    // Scales the bins so the largest is 1, leaves silence alone.
+    void Normalize();
+
+private:
+    FMOD::DSP* m_dsp = nullptr;
+    FMOD::ChannelControl* m_target = nullptr;
+    int m_windowSize = 0;
+    std::vector<float> m_bins;
+};
@@ -0,0 +1,115 @@
+#include "SpectrumView.h"
+#include <algorithm>
+#include <cmath>
+
+// Bands are spaced from 1kHz and cover the audible range, as far as the sample rate allows.
+constexpr double BAND_REFERENCE_HZ = 1000.0;
+constexpr double BAND_MIN_HZ = 20.0;
+constexpr double BAND_MAX_HZ = 20000.0;
+
+void SpectrumView::Configure(SpectrumScale scale, SpectrumBands bands, float smoothing)
+{
+    m_scale = scale;
+    m_smoothing = std::clamp(smoothing, 0.f, 1.f);
+
+    if (bands != m_bands)
+    {
+        m_bands = bands;
+
+        // Works the layout out again on the next export.
+        m_binCount = 0;
+    }
+}
+
+size_t SpectrumView::GetCount(size_t binCount, uint32_t sampleRate)
+{
+    this->UpdateLayout(binCount, sampleRate);
+    return m_smoothed.size();
+}
+
+size_t SpectrumView::Export(const float* bins, size_t binCount, uint32_t sampleRate, float* out, size_t count)
+{
+    this->UpdateLayout(binCount, sampleRate);
+
+    const size_t written = std::min(count, m_smoothed.size());
+    const float keep = m_smoothing;
+    for (size_t i = 0; i < written; i++)
+    {
+        float value;
+        if (m_bands == SpectrumBands::Bins)
+        {
+            value = bins[i];
+        }
+        else
+        {
+            // RMS so a flat spectrum reads the same in every band however wide.
+            const BandRange& range = m_bandRanges[i];
+            float sumSquares = 0.f;
+            for (uint32_t bin = range.Start; bin < range.End; bin++)
+            {
+                sumSquares += bins[bin] * bins[bin];
+            }
+
+            value = sqrtf(sumSquares / static_cast<float>(range.End - range.Start));
+        }
+
+        float& smoothed = m_smoothed[i];
+        smoothed = keep * smoothed + (1.f - keep) * value;
+
+        if (m_scale == SpectrumScale::Decibels)
+        {
+            out[i] = smoothed > 0.f ? std::max(20.f * log10f(smoothed), SPECTRUM_MIN_DB) : SPECTRUM_MIN_DB;
+        }
+        else
+        {
+            out[i] = smoothed;
+        }
+    }
+
+    return written;
+}
+
+void SpectrumView::UpdateLayout(size_t binCount, uint32_t sampleRate)
+{
+    if (binCount == m_binCount && sampleRate == m_sampleRate)
+    {
+        return;
+    }
+
+    m_binCount = binCount;
+    m_sampleRate = sampleRate;
+    m_bandRanges.clear();
+
+    if (m_bands == SpectrumBands::Bins || binCount == 0 || sampleRate == 0)
+    {
+        m_smoothed.assign(m_bands == SpectrumBands::Bins ? binCount : 0, 0.f);
+        return;
+    }
+
+    const double perOctave = m_bands == SpectrumBands::Octaves ? 1.0 : 3.0;
+    const double nyquist = sampleRate / 2.0;
+    const double binHz = nyquist / static_cast<double>(binCount);
+
+    const int first = static_cast<int>(std::ceil(perOctave * std::log2(BAND_MIN_HZ / BAND_REFERENCE_HZ)));
+    const int last = static_cast<int>(std::floor(perOctave * std::log2(std::min(BAND_MAX_HZ, nyquist) / BAND_REFERENCE_HZ)));
+    for (int band = first; band <= last; band++)
+    {
+        const double centre = BAND_REFERENCE_HZ * std::exp2(band / perOctave);
+        const double halfWidth = std::exp2(0.5 / perOctave);
+
+        BandRange range;
+        range.Start = static_cast<uint32_t>(std::min(std::ceil(centre / halfWidth / binHz), static_cast<double>(binCount)));
+        range.End = static_cast<uint32_t>(std::min(std::ceil(centre * halfWidth / binHz), static_cast<double>(binCount)));
+
+        // Low bands can be narrower than a bin, take the bin they fall in.
+        if (range.End <= range.Start)
+        {
+            range.Start = static_cast<uint32_t>(std::min(std::round(centre / binHz), static_cast<double>(binCount - 1)));
+            range.End = range.Start + 1;
+        }
+
+        m_bandRanges.push_back(range);
+    }
+
+    m_smoothed.assign(m_bandRanges.size(), 0.f);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class SpectrumScale
+{
+    Linear,
+    Decibels,
+};
+
+// Per FFT bin, or grouped into bands a fixed fraction of an octave wide.
+enum class SpectrumBands
+{
+    Bins,
+    Octaves,
+    ThirdOctaves,
+};
+
+// Floor for decibel output, silence reads as this rather than minus infinity.
+constexpr float SPECTRUM_MIN_DB = -100.f;
+
+// Reshapes a magnitude spectrum for drawing in a single pass over it: grouped into
+// bands, smoothed over time then scaled, so a visualiser can fetch a whole frame at once.
+class SpectrumView
+{
+public:
+    // smoothing is how much of the previous frame each value keeps, 0 for none.
+    void Configure(SpectrumScale scale, SpectrumBands bands, float smoothing);
+
+    // How many values Export writes for a spectrum of binCount bins, sampled at
+    // sampleRate.
+    size_t GetCount(size_t binCount, uint32_t sampleRate);
+
+    // Writes up to count values. Smoothing carries on from the last Export while the
+    // layout stays the same.
+    size_t Export(const float* bins, size_t binCount, uint32_t sampleRate, float* out, size_t count);
+
+private:
+    SpectrumScale m_scale = SpectrumScale::Linear;
+    SpectrumBands m_bands = SpectrumBands::Bins;
+    float m_smoothing = 0.f;
+
+    // Layout the band edges were worked out for.
+    size_t m_binCount = 0;
+    uint32_t m_sampleRate = 0;
+
+    // Bins each band averages over, empty for Bins.
+    struct BandRange
+    {
+        uint32_t Start;
+        uint32_t End;
+    };
+
+    std::vector<BandRange> m_bandRanges;
+
+    // Smoothed linear values from the last Export.
+    std::vector<float> m_smoothed;
+
+    void UpdateLayout(size_t binCount, uint32_t sampleRate);
+};
@@ -1,53 +1,75 @@
 #include "SpeechSynth.h"
 #include "ConstantReader.h"
 #include "StringHelpers.h"
+#include <algorithm>
 
-SpeechSynthDSP::SpeechSynthDSP() : m_freqBuf(128)
+namespace
 {
+    constexpr uint32_t INDEX_BITS = 16;
+    constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
 }
 
-bool SpeechSynthDSP::Register(FMOD::System* sys, std::string& error)
+SpeechSynthDSP::SpeechSynthDSP(AnnotationStore* annotationStore, SynthVoicePool* voicePool) :
+    m_annotationStore(annotationStore),
+    m_voicePool(voicePool)
 {
-    const bool success = this->m_synth.Register(sys, error);
-    if (success)
+    for (auto& finished : m_finished)
     {
-        this->m_synth.SetEnabled(true);
+        finished.store(INVALID_UTTERANCE, std::memory_order_relaxed);
     }
-
-    return success;
 }
 
-void SpeechSynthDSP::SetSpeaker(const std::string_view& speaker)
+void SpeechSynthDSP::BuildCharMutations()
 {
-    m_speaker = std::string(speaker);
+    // Seeded by the character exactly as the per character rand() calls used to be, so
+    // speakers sound the same. Done on first use as it reseeds rand().
+    for (size_t i = 0; i < m_charMutations.size(); i++)
+    {
+        srand((uint32_t)static_cast<char>(i));
+
+        CharMutation& mutation = m_charMutations[i];
+        mutation.PulseWidth = 6.282 * (double)(rand() % 100) / 100.0;
+        mutation.AttackOffset = (double)(rand() % 1000) - 500.0;
+        mutation.FreqModScale = (double)(rand() % 100) / 100.0;
+    }
+
+    m_charMutationsBuilt = true;
 }
 
-void SpeechSynthDSP::Talk(const std::string_view& text)
+bool SpeechSynthDSP::TryGetSlot(UtteranceHandle handle, size_t& index) const
 {
-    m_text = std::string(text);
-    m_textCurChar = 0;
-    m_talking = true;
+    index = handle & INDEX_MASK;
+    return handle != INVALID_UTTERANCE
+        && index < MAX_UTTERANCES
+        && m_slots[index].Handle == handle;
 }
 
-bool SpeechSynthDSP::IsTalking() const
+bool SpeechSynthDSP::IsSlotFree(size_t index) const
 {
-    return this->m_talking;
+    const UtteranceHandle handle = m_slots[index].Handle;
+    return handle == INVALID_UTTERANCE
+        || m_finished[index].load(std::memory_order_acquire) == handle;
 }
 
-std::optional<std::string> SpeechSynthDSP::TryGetText() const
+SpeakerConfig SpeechSynthDSP::ReadSpeaker(const std::string_view& speaker) const
 {
-    if (m_textCurChar < m_text.size())
+    const uint32_t samplesPerFrame = m_voicePool->GetSampleRate() / REFERENCE_FRAME_RATE;
+
+    SpeakerConfig result;
+
+    // A character is held for char_len frames then released for end_dur + 1.
+    result.SpaceLen = (Constants::Globals.GetUint("speech_space_dur") + 1) * samplesPerFrame;
+
+    const auto speakerConfig = Constants::Globals.GetObj(speaker);
+    if (speakerConfig == nullptr)
     {
-        return { m_text };
+        result.Silent = true;
+        result.CharEndWait = samplesPerFrame;
+        return result;
     }
 
-    return {};
-}
+    auto& config = result.Synth;
 
-void SpeechSynthDSP::UpdateConfigFromReader(const std::shared_ptr<const ConstantObj>& speakerConfig)
-{
-    auto& config = m_synth.GetConfigMut();
-    
     config.AmpASDR.Attack = speakerConfig->GetDouble("amp_a");
     config.AmpASDR.Decay = speakerConfig->GetDouble("amp_d");
     config.AmpASDR.Sustain = speakerConfig->GetDouble("amp_s");
@@ -73,82 +95,380 @@ void SpeechSynthDSP::UpdateConfigFromReader(const std::shared_ptr<const Constant
     config.FreqSmoothK = speakerConfig->GetDouble("freq_smooth");
 
     config.LowPassAlpha = speakerConfig->GetDouble("low_pass_alpha");
+
+    result.FreqMod = speakerConfig->GetDouble("freq_mod");
+    result.CharLen = speakerConfig->GetUint("char_len") * samplesPerFrame;
+    result.CharEndWait = (speakerConfig->GetUint("end_dur") + 1) * samplesPerFrame;
+
+    return result;
 }
 
-void SpeechSynthDSP::MutateConfig(char c, const std::shared_ptr<const ConstantObj>& speakerConfig)
+UtteranceHandle SpeechSynthDSP::Talk(const std::string_view& text, const std::string_view& speaker)
 {
-    auto& config = m_synth.GetConfigMut();
+    if (text.empty())
+    {
+        return INVALID_UTTERANCE;
+    }
 
-    srand((uint32_t)c);
+    // Published to the audio thread by the command push.
+    if (!m_charMutationsBuilt)
+    {
+        this->BuildCharMutations();
+    }
 
-    //config.SinWave = true;
+    for (size_t i = 0; i < MAX_UTTERANCES; i++)
+    {
+        if (!this->IsSlotFree(i))
+        {
+            continue;
+        }
 
+        UtteranceSlot& slot = m_slots[i];
+        uint16_t generation = slot.Generation + 1;
+        if (generation == 0)
+        {
+            generation = 1;
+        }
+
+        Command command;
+        command.Type = CommandType::Talk;
+        command.Handle = (static_cast<UtteranceHandle>(generation) << INDEX_BITS) | static_cast<UtteranceHandle>(i);
+        command.Annotation = m_annotationStore->Intern(text);
+
+        const std::string_view interned = m_annotationStore->GetString(command.Annotation);
+        command.Text = interned.data();
+        command.TextLength = static_cast<uint32_t>(interned.size());
+        command.Speaker = this->ReadSpeaker(speaker);
+        command.Value = 0.0;
+
+        if (!m_commands.TryPush(command))
+        {
+            return INVALID_UTTERANCE;
+        }
+
+        slot.Handle = command.Handle;
+        slot.Generation = generation;
+        slot.Stopped = false;
+
+        return command.Handle;
+    }
+
+    return INVALID_UTTERANCE;
+}
+
+void SpeechSynthDSP::Stop(UtteranceHandle handle)
+{
+    if (!this->IsTalking(handle))
     {
-        //const double pulseMod = Constants::Globals.GetDouble("shape_mod_mult");
-        //const double frac = fmod((double)c * pulseMod, 1.0);
-        const int pwr = rand() % 100;
-        config.PulseWidth = 6.282 * (double)(pwr) / 100.0;
+        return;
     }
 
-    config.AmpASDR.Attack += (double)(rand() % 1000) - 500.0;
+    Command command = {};
+    command.Type = CommandType::Stop;
+    command.Handle = handle;
 
-    config.Freq += speakerConfig->GetDouble("freq_mod") * (double)(rand() % 100) / 100.0;
+    // The slot is handed back once the audio thread has let go of it.
+    if (m_commands.TryPush(command))
+    {
+        m_slots[handle & INDEX_MASK].Stopped = true;
+    }
 }
 
-void SpeechSynthDSP::NextChar(uint32_t pos)
+bool SpeechSynthDSP::SetPitch(UtteranceHandle handle, double pitch)
 {
-    m_textCurChar = pos;
-    const char c = m_text[pos];
-    if (c == ' ')
+    if (!this->IsTalking(handle))
     {
-        m_curCharLen = 0;
-        m_curCharEndWait = Constants::Globals.GetUint("speech_space_dur");
+        return false;
     }
-    else
+
+    Command command = {};
+    command.Type = CommandType::SetPitch;
+    command.Handle = handle;
+    command.Value = pitch;
+    return m_commands.TryPush(command);
+}
+
+bool SpeechSynthDSP::SetVolume(UtteranceHandle handle, float volume)
+{
+    if (!this->IsTalking(handle))
+    {
+        return false;
+    }
+
+    Command command = {};
+    command.Type = CommandType::SetVolume;
+    command.Handle = handle;
+    command.Value = volume;
+    return m_commands.TryPush(command);
+}
+
+bool SpeechSynthDSP::IsTalking() const
+{
+    return this->GetTalkingCount() > 0;
+}
+
+bool SpeechSynthDSP::IsTalking(UtteranceHandle handle) const
+{
+    size_t index;
+    return this->TryGetSlot(handle, index)
+        && !m_slots[index].Stopped
+        && m_finished[index].load(std::memory_order_acquire) != handle;
+}
+
+size_t SpeechSynthDSP::GetTalkingCount() const
+{
+    size_t count = 0;
+    for (const auto& slot : m_slots)
     {
-        //if (!Constants::Globals.GetBool("speech_synth_from_config"))
-        const auto speakerConfig = Constants::Globals.GetObj(m_speaker);
-        if (speakerConfig != nullptr)
+        if (this->IsTalking(slot.Handle))
         {
-            this->UpdateConfigFromReader(speakerConfig);
-            this->MutateConfig(c, speakerConfig);
-            m_curCharLen = speakerConfig->GetUint("char_len");
-            m_curCharEndWait = speakerConfig->GetUint("end_dur");
+            count++;
         }
     }
 
-    m_curCharT = 0;
+    return count;
 }
 
-void SpeechSynthDSP::Tick()
+AnnotationId SpeechSynthDSP::TryGetAnnotation() const
 {
-    //if (Constants::Globals.GetBool("speech_synth_from_config"))
+    return m_currentAnnotation.load(std::memory_order_relaxed);
+}
+
+float SpeechSynthDSP::ReadFreqHistory(size_t framesAgo) const
+{
+    if (framesAgo >= FREQ_HISTORY_LENGTH)
     {
-        //this->UpdateConfigFromReader();
+        return 0.f;
     }
 
-    if (m_talking)
+    return m_freqHistory.Read()[framesAgo];
+}
+
+size_t SpeechSynthDSP::ReadFreqHistory(float* values, size_t count) const
+{
+    count = std::min(count, FREQ_HISTORY_LENGTH);
+
+    const FreqHistory& history = m_freqHistory.Read();
+    std::copy(history.begin(), history.begin() + count, values);
+    return count;
+}
+
+void SpeechSynthDSP::UpdateCurrentAnnotation()
+{
+    m_latestUtterance = nullptr;
+
+    for (const auto& utterance : m_utterances)
     {
-        m_curCharT += 1;
-        if (m_curCharT > m_curCharLen + m_curCharEndWait)
+        if (utterance.Handle != INVALID_UTTERANCE
+            && (m_latestUtterance == nullptr || utterance.StartedAt > m_latestUtterance->StartedAt))
         {
-            if (m_textCurChar < m_text.size())
-            {
-                this->NextChar(++m_textCurChar);
-            }
-            else
-            {
-                m_talking = false;
-                m_text = "";
-                m_curCharT = 0;
-                m_curCharLen = 0;
-            }
+            m_latestUtterance = &utterance;
         }
+    }
+
+    const AnnotationId annotation = m_latestUtterance != nullptr ? m_latestUtterance->Annotation : NO_ANNOTATION;
+    m_currentAnnotation.store(annotation, std::memory_order_relaxed);
+}
 
-        this->m_synth.SetKeydown(m_curCharT < m_curCharLen);
+void SpeechSynthDSP::RecordFreq(SynthVoicePool& pool, uint32_t frames)
+{
+    // Keys only change between sequenced blocks so one value holds for the whole block.
+    float freq = 0.f;
+    if (m_latestUtterance != nullptr && m_latestUtterance->Keydown)
+    {
+        freq = static_cast<float>(m_latestUtterance->CharFreq * m_latestUtterance->Pitch);
+    }
+
+    bool recorded = false;
+    while (frames >= m_freqFrameRemaining)
+    {
+        frames -= m_freqFrameRemaining;
+        m_freqFrameRemaining = pool.GetSampleRate() / REFERENCE_FRAME_RATE;
+
+        m_freqRing[m_freqRingPos] = freq;
+        m_freqRingPos = (m_freqRingPos + 1) % FREQ_HISTORY_LENGTH;
+        recorded = true;
+    }
+
+    m_freqFrameRemaining -= frames;
+
+    if (recorded)
+    {
+        FreqHistory& history = m_freqHistory.Back();
+        for (size_t i = 0; i < FREQ_HISTORY_LENGTH; i++)
+        {
+            history[i] = m_freqRing[(m_freqRingPos + FREQ_HISTORY_LENGTH - 1 - i) % FREQ_HISTORY_LENGTH];
+        }
+
+        m_freqHistory.Publish();
+    }
+}
+
+void SpeechSynthDSP::ApplyCommand(SynthVoicePool& pool, const Command& command)
+{
+    Utterance& utterance = m_utterances[command.Handle & INDEX_MASK];
+
+    if (command.Type == CommandType::Talk)
+    {
+        utterance.Handle = command.Handle;
+        utterance.StartedAt = ++m_startCount;
+        utterance.Annotation = command.Annotation;
+        utterance.Text = command.Text;
+        utterance.TextLength = command.TextLength;
+        utterance.Speaker = command.Speaker;
+        utterance.Voice = INVALID_VOICE;
+        utterance.Pitch = 1.0;
+        utterance.Volume = 1.f;
+
+        this->StartChar(pool, utterance, 0);
+        return;
+    }
+
+    // Anything else for an utterance that has already finished is dropped.
+    if (utterance.Handle != command.Handle)
+    {
+        return;
+    }
+
+    switch (command.Type)
+    {
+    case CommandType::Stop:
+        this->Finish(pool, utterance);
+        break;
+    case CommandType::SetPitch:
+        utterance.Pitch = command.Value;
+        pool.SetPitchImmediate(utterance.Voice, utterance.Pitch);
+        break;
+    case CommandType::SetVolume:
+        utterance.Volume = static_cast<float>(command.Value);
+        pool.SetVolumeImmediate(utterance.Voice, utterance.Volume);
+        break;
+    default:
+        break;
+    }
+}
+
+void SpeechSynthDSP::EnsureVoice(SynthVoicePool& pool, Utterance& utterance)
+{
+    // Crowds can outnumber the pool, take a voice back if ours was stolen.
+    if (!pool.IsValidImmediate(utterance.Voice))
+    {
+        utterance.Voice = pool.AllocateImmediate();
+        pool.SetPitchImmediate(utterance.Voice, utterance.Pitch);
+        pool.SetVolumeImmediate(utterance.Voice, utterance.Volume);
+    }
+}
+
+void SpeechSynthDSP::StartChar(SynthVoicePool& pool, Utterance& utterance, uint32_t pos)
+{
+    utterance.CurChar = pos;
+    const char c = utterance.Text[pos];
+    const SpeakerConfig& speaker = utterance.Speaker;
+
+    uint32_t keydownLength = 0;
+    if (c == ' ')
+    {
+        utterance.KeyupLength = speaker.SpaceLen;
+    }
+    else if (speaker.Silent)
+    {
+        utterance.KeyupLength = speaker.CharEndWait;
     }
     else
     {
-        this->m_synth.SetKeydown(false);
+        const CharMutation& mutation = m_charMutations[static_cast<uint8_t>(c)];
+
+        FMSynthConfig config = speaker.Synth;
+        config.PulseWidth = mutation.PulseWidth;
+        config.AmpASDR.Attack += mutation.AttackOffset;
+        config.Freq += speaker.FreqMod * mutation.FreqModScale;
+
+        this->EnsureVoice(pool, utterance);
+        pool.SetConfigImmediate(utterance.Voice, config);
+        utterance.CharFreq = config.Freq;
+
+        keydownLength = speaker.CharLen;
+        utterance.KeyupLength = speaker.CharEndWait;
     }
-}
\ No newline at end of file
+
+    utterance.Keydown = keydownLength > 0;
+    utterance.Remaining = utterance.Keydown ? keydownLength : utterance.KeyupLength;
+
+    if (utterance.Keydown)
+    {
+        pool.SetKeydownImmediate(utterance.Voice, true);
+    }
+}
+
+void SpeechSynthDSP::Advance(SynthVoicePool& pool, Utterance& utterance)
+{
+    if (utterance.Keydown)
+    {
+        utterance.Keydown = false;
+        utterance.Remaining = utterance.KeyupLength;
+        pool.SetKeydownImmediate(utterance.Voice, false);
+    }
+    else if (utterance.CurChar + 1 < utterance.TextLength)
+    {
+        this->StartChar(pool, utterance, utterance.CurChar + 1);
+    }
+    else
+    {
+        this->Finish(pool, utterance);
+    }
+}
+
+void SpeechSynthDSP::Finish(SynthVoicePool& pool, Utterance& utterance)
+{
+    // The voice rings out its release in the pool.
+    pool.ReleaseImmediate(utterance.Voice);
+    utterance.Voice = INVALID_VOICE;
+
+    m_finished[utterance.Handle & INDEX_MASK].store(utterance.Handle, std::memory_order_release);
+    utterance.Handle = INVALID_UTTERANCE;
+    utterance.Text = nullptr;
+}
+
+uint32_t SpeechSynthDSP::Sequence(SynthVoicePool& pool, uint32_t maxFrames)
+{
+    bool changed = false;
+
+    Command command;
+    while (m_commands.TryPop(command))
+    {
+        this->ApplyCommand(pool, command);
+        changed = true;
+    }
+
+    uint32_t frames = maxFrames;
+    for (auto& utterance : m_utterances)
+    {
+        while (utterance.Handle != INVALID_UTTERANCE && utterance.Remaining == 0)
+        {
+            this->Advance(pool, utterance);
+            changed |= utterance.Handle == INVALID_UTTERANCE;
+        }
+
+        if (utterance.Handle != INVALID_UTTERANCE)
+        {
+            frames = std::min(frames, utterance.Remaining);
+        }
+    }
+
+    for (auto& utterance : m_utterances)
+    {
+        if (utterance.Handle != INVALID_UTTERANCE)
+        {
+            utterance.Remaining -= frames;
+        }
+    }
+
+    if (changed)
+    {
+        this->UpdateCurrentAnnotation();
+    }
+
+    this->RecordFreq(pool, frames);
+
+    return frames;
+}
@@ -1,53 +1,175 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include "FMSynth.h"
 #include "ConstantReader.h"
+#include "AnnotationStore.h"
+#include "SpscQueue.h"
+#include "SynthVoicePool.h"
+#include "TripleBuffer.h"
 
-class SpeechSynthDSP
+// Low 16 bits are the utterance slot, high 16 bits its generation. Never 0 when valid.
+typedef uint32_t UtteranceHandle;
+constexpr UtteranceHandle INVALID_UTTERANCE = 0;
+
+// A speaker from the constants file, read on the game thread so the audio thread never
+// touches the constant reader. Durations are in samples.
+struct SpeakerConfig
+{
+    FMSynthConfig Synth;
+    double FreqMod = 0;
+    uint32_t CharLen = 0;
+    uint32_t CharEndWait = 0;
+    uint32_t SpaceLen = 0;
+
+    // No such speaker, characters pass in silence.
+    bool Silent = false;
+};
+
+// Babbles text through voices borrowed from the shared voice pool. Characters are
+// sequenced from the pool's render loop so timing is sample accurate at any frame rate,
+// the game thread only queues commands.
+class SpeechSynthDSP : public VoiceSequencer
 {
 public:
-    SpeechSynthDSP();
+    static constexpr size_t MAX_UTTERANCES = SynthVoicePool::MAX_VOICES;
 
-    enum class SpeechSynthState
-    {
-        SYNTH_TALKING,
-        SYNTH_STOPPED,
-    };
+    // char_len, end_dur and speech_space_dur are given in frames at this rate.
+    static constexpr uint32_t REFERENCE_FRAME_RATE = 60;
+
+    // Reference frames of key frequency kept for GML to draw.
+    static constexpr size_t FREQ_HISTORY_LENGTH = 128;
 
+    SpeechSynthDSP(AnnotationStore* annotationStore, SynthVoicePool* voicePool);
 
-    bool Register(FMOD::System* sys, std::string& error);
+    // Returns INVALID_UTTERANCE when every slot is talking.
+    UtteranceHandle Talk(const std::string_view& text, const std::string_view& speaker);
+    void Stop(UtteranceHandle handle);
 
-    void Talk(const std::string_view& text);
-    void SetSpeaker(const std::string_view& speaker);
-    void Tick();
+    bool SetPitch(UtteranceHandle handle, double pitch);
+    bool SetVolume(UtteranceHandle handle, float volume);
 
-    //void SetEnabled(bool enabled)
-    //{
-    //    m_state = enabled ? SpeechSynthState::SYNTH_TALKING : SpeechSynthState::SYNTH_STOPPED;
-    //}
+    // Text of the most recently started utterance still talking, NO_ANNOTATION when
+    // nobody is. Safe to call from the audio thread.
+    AnnotationId TryGetAnnotation() const;
 
-    //void SetPitch(double pitch)
-    //{
-    //    m_pitch = pitch;
-    //}
+    // Frequency of the most recent utterance's key, newest first with one value per
+    // reference frame and 0 while its key is up. Game thread only, never blocks.
+    float ReadFreqHistory(size_t framesAgo) const;
+    size_t ReadFreqHistory(float* values, size_t count) const;
 
-    std::optional<std::string> TryGetText() const;
     bool IsTalking() const;
+    bool IsTalking(UtteranceHandle handle) const;
+    size_t GetTalkingCount() const;
+
+    // Audio thread, called by the voice pool.
+    uint32_t Sequence(SynthVoicePool& pool, uint32_t maxFrames) override;
 
-    RingBuffer m_freqBuf;
 private:
-    void UpdateConfigFromReader(const std::shared_ptr<const ConstantObj>& constObj);
-    void MutateConfig(char c, const std::shared_ptr<const ConstantObj>& constObj);
-    void NextChar(uint32_t c);
+    enum class CommandType : uint8_t
+    {
+        Talk,
+        Stop,
+        SetPitch,
+        SetVolume,
+    };
+
+    struct Command
+    {
+        CommandType Type;
+        UtteranceHandle Handle;
+
+        // Talk only. The text is interned so it stays put for as long as it is spoken.
+        AnnotationId Annotation;
+        const char* Text;
+        uint32_t TextLength;
+        SpeakerConfig Speaker;
+
+        // SetPitch and SetVolume.
+        double Value;
+    };
+
+    // Each character nudges the speaker's config. Only depends on the character so it
+    // is worked out once, on the first Talk.
+    struct CharMutation
+    {
+        double PulseWidth;
+        double AttackOffset;
+        double FreqModScale;
+    };
+
+    // Owned by the audio thread.
+    struct Utterance
+    {
+        UtteranceHandle Handle = INVALID_UTTERANCE;
+        uint64_t StartedAt = 0;
+
+        AnnotationId Annotation = NO_ANNOTATION;
+        const char* Text = nullptr;
+        uint32_t TextLength = 0;
+        SpeakerConfig Speaker;
+
+        VoiceHandle Voice = INVALID_VOICE;
+        double Pitch = 1.0;
+        float Volume = 1.f;
+
+        uint32_t CurChar = 0;
+        double CharFreq = 0;
+        bool Keydown = false;
+        uint32_t KeyupLength = 0;
+
+        // Samples until the next key change.
+        uint32_t Remaining = 0;
+    };
+
+    // Owned by the game thread.
+    struct UtteranceSlot
+    {
+        UtteranceHandle Handle = INVALID_UTTERANCE;
+        uint16_t Generation = 1;
+        bool Stopped = false;
+    };
+
+    static constexpr size_t COMMAND_QUEUE_LENGTH = 256;
+
+    typedef std::array<float, FREQ_HISTORY_LENGTH> FreqHistory;
+
+    bool TryGetSlot(UtteranceHandle handle, size_t& index) const;
+    bool IsSlotFree(size_t index) const;
+    SpeakerConfig ReadSpeaker(const std::string_view& speaker) const;
+    void BuildCharMutations();
+
+    void ApplyCommand(SynthVoicePool& pool, const Command& command);
+    void StartChar(SynthVoicePool& pool, Utterance& utterance, uint32_t pos);
+    void Advance(SynthVoicePool& pool, Utterance& utterance);
+    void Finish(SynthVoicePool& pool, Utterance& utterance);
+    void EnsureVoice(SynthVoicePool& pool, Utterance& utterance);
+    void UpdateCurrentAnnotation();
+    void RecordFreq(SynthVoicePool& pool, uint32_t frames);
+
+    std::array<UtteranceSlot, MAX_UTTERANCES> m_slots;
+    SpscQueue<Command, COMMAND_QUEUE_LENGTH> m_commands;
+
+    std::array<Utterance, MAX_UTTERANCES> m_utterances;
+    uint64_t m_startCount = 0;
+    const Utterance* m_latestUtterance = nullptr;
+
+    // Ring of recent frequencies on the audio thread, published newest first.
+    FreqHistory m_freqRing = {};
+    size_t m_freqRingPos = 0;
+    uint32_t m_freqFrameRemaining = 0;
+    mutable TripleBuffer<FreqHistory> m_freqHistory;
+
+    // Handle of the last utterance to finish in each slot, published by the audio thread.
+    std::array<std::atomic<UtteranceHandle>, MAX_UTTERANCES> m_finished;
 
-    FMSynthDSP m_synth;
+    std::array<CharMutation, 256> m_charMutations;
+    bool m_charMutationsBuilt = false;
 
-    std::string m_text;
-    std::string m_speaker;
+    AnnotationStore* m_annotationStore;
+    SynthVoicePool* m_voicePool;
 
-    bool m_talking = false;
-    uint32_t m_textCurChar = 0;
-    uint32_t m_curCharLen = 0;
-    uint32_t m_curCharEndWait = 0;
-    uint32_t m_curCharT = 0;
+    // Written by the sequencer, read by the cassette.
+    std::atomic<AnnotationId> m_currentAnnotation = NO_ANNOTATION;
 };
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+// Fixed size lock-free queue for handing values from one producer thread to one
+// consumer thread, e.g. from GML calls to a DSP callback. Never allocates or blocks.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "Values are copied across threads");
+
+public:
+    // Producer only. Returns false when the consumer has fallen a whole queue behind.
+    bool TryPush(const T& value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == Capacity)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == Capacity)
+            {
+                return false;
+            }
+        }
+
+        m_values[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.
+    bool TryPop(T& value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail)
+            {
+                return false;
+            }
+        }
+
+        value = m_values[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. The oldest value, left in place until Pop, or null when empty.
+    const T* Peek()
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail)
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail)
+            {
+                return nullptr;
+            }
+        }
+
+        return &m_values[head & (Capacity - 1)];
+    }
+
+    // Consumer only, after Peek returned a value.
+    void Pop()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::array<T, Capacity> m_values;
+
+    // Each side keeps a stale copy of the other's index so the shared line is only
+    // read when the queue looks full or empty.
+    alignas(CACHE_LINE) std::atomic<size_t> m_head = 0;
+    size_t m_cachedTail = 0;
+
+    alignas(CACHE_LINE) std::atomic<size_t> m_tail = 0;
+    size_t m_cachedHead = 0;
+};
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+
 inline bool stringEqualIgnoreCase(const std::string_view& x, const std::string_view& y)
 {
-    return (x.size() == y.size()) && (_strnicmp(x.data(), y.data(), x.size()) == 0);
+    return std::equal(x.begin(), x.end(), y.begin(), y.end(), [](char a, char b)
+    {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
 }
@@ -0,0 +1,719 @@
+#include "SynthVoicePool.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    constexpr double INV_TWO_PI = 1.0 / 6.283185307179586;
+
+    // Below this a released voice is treated as silent and stops rendering.
+    constexpr double SILENT_AMP = 1e-4;
+
+    constexpr uint32_t INDEX_BITS = 16;
+    constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+    VoiceHandle MakeHandle(size_t index, uint16_t generation)
+    {
+        return (static_cast<VoiceHandle>(generation) << INDEX_BITS) | static_cast<VoiceHandle>(index);
+    }
+}
+
+SynthVoicePool::SynthVoicePool()
+{
+    memset(&m_dspDescr, 0, sizeof(m_dspDescr));
+
+    snprintf(m_dspDescr.name, sizeof(m_dspDescr.name), "Synth Voice Pool DSP");
+    m_dspDescr.version = 0x00010000;
+    m_dspDescr.numinputbuffers = 1;
+    m_dspDescr.numoutputbuffers = 1;
+    m_dspDescr.read = SynthVoicePoolGenericCallback;
+    m_dspDescr.userdata = (void *)0x12345678;
+
+    for (size_t i = 0; i < MAX_VOICES; i++)
+    {
+        m_state[i] = VoiceState::Free;
+        m_generation[i] = 1;
+        m_allocatedAt[i] = 0;
+        m_activeSlot[i] = -1;
+        m_clientVoice[i] = INVALID_VOICE;
+        m_owner[i] = INVALID_VOICE;
+        m_clientLost[i].store(INVALID_VOICE, std::memory_order_relaxed);
+        this->ResetVoice(i);
+    }
+}
+
+bool SynthVoicePool::Register(FMOD::System* sys, std::string& error)
+{
+    FMOD_RESULT result = sys->createDSP(&m_dspDescr, &m_dsp);
+    if (result != FMOD_OK)
+    {
+        error = "Could not create DSP";
+        return false;
+    }
+
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    result = sys->getMasterChannelGroup(&masterGroup);
+
+    if (result != FMOD_OK || masterGroup == nullptr)
+    {
+        error = "Could not get master channel";
+        return false;
+    }
+
+    // Push to end of dsp list.
+    result = masterGroup->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL, m_dsp);
+    if (result != FMOD_OK)
+    {
+        error = "Could not add dsp";
+        return false;
+    }
+
+    m_dsp->setUserData(reinterpret_cast<void*>(this));
+
+    int sampleRate;
+    if (sys->getSoftwareFormat(&sampleRate, nullptr, nullptr) == FMOD_OK && sampleRate > 0)
+    {
+        m_sampleRate = static_cast<uint32_t>(sampleRate);
+    }
+
+    return true;
+}
+
+void SynthVoicePool::Unregister(FMOD::System* sys)
+{
+    if (m_dsp == nullptr)
+    {
+        return;
+    }
+
+    FMOD::ChannelGroup* masterGroup = nullptr;
+    if (sys->getMasterChannelGroup(&masterGroup) == FMOD_OK && masterGroup != nullptr)
+    {
+        masterGroup->removeDSP(m_dsp);
+    }
+
+    m_dsp->release();
+    m_dsp = nullptr;
+}
+
+void SynthVoicePool::ResetVoice(size_t index)
+{
+    FMSynthConfig defaults;
+    defaults.AmpASDR = AudioProcessors::ASDRConfig{ 1.0, 1.0, 1.0, 1.0 };
+    defaults.Wave = WaveType::SIN;
+
+    m_wave[index] = defaults.Wave;
+    m_duty[index] = 0.5;
+    m_targetFreq[index] = 0.0;
+    m_freqSmoothK[index] = defaults.FreqSmoothK;
+    m_ampSmoothK[index] = defaults.AmpSmoothK;
+    m_pitch[index] = 1.0;
+    m_volume[index] = 1.f;
+    m_lowPassAlpha[index] = static_cast<float>(defaults.LowPassAlpha);
+    m_envelope[index] = defaults.AmpASDR;
+    m_keydown[index] = false;
+
+    m_osc[index].Reset();
+    m_amp[index] = 0.0;
+    m_freq[index] = 0.0;
+    m_envelopeTime[index] = 0;
+    m_lowPass[index] = AudioProcessors::OnePoleState{};
+}
+
+bool SynthVoicePool::TryGetIndex(VoiceHandle handle, size_t& index) const
+{
+    index = handle & INDEX_MASK;
+    const uint16_t generation = static_cast<uint16_t>(handle >> INDEX_BITS);
+
+    return index < MAX_VOICES
+        && m_state[index] == VoiceState::Allocated
+        && m_generation[index] == generation;
+}
+
+size_t SynthVoicePool::PickVoiceToSteal() const
+{
+    // Prefer voices nobody owns any more, then silent ones, then the oldest.
+    size_t best = 0;
+    int bestRank = INT_MAX;
+    uint64_t bestAge = UINT64_MAX;
+
+    for (size_t i = 0; i < MAX_VOICES; i++)
+    {
+        int rank;
+        if (m_state[i] == VoiceState::Free)
+        {
+            return i;
+        }
+        else if (m_state[i] == VoiceState::Releasing)
+        {
+            rank = 0;
+        }
+        else if (m_activeSlot[i] < 0)
+        {
+            rank = 1;
+        }
+        else if (!m_keydown[i])
+        {
+            rank = 2;
+        }
+        else
+        {
+            rank = 3;
+        }
+
+        if (rank < bestRank || (rank == bestRank && m_allocatedAt[i] < bestAge))
+        {
+            best = i;
+            bestRank = rank;
+            bestAge = m_allocatedAt[i];
+        }
+    }
+
+    return best;
+}
+
+VoiceHandle SynthVoicePool::AllocateImmediate()
+{
+    const size_t index = this->PickVoiceToSteal();
+    if (m_activeSlot[index] >= 0)
+    {
+        this->Deactivate(index);
+    }
+
+    this->ResetVoice(index);
+
+    // Invalidates any handle still pointing at a stolen voice.
+    m_generation[index]++;
+    if (m_generation[index] == 0)
+    {
+        m_generation[index] = 1;
+    }
+
+    // Let the game thread know its handle lost the voice.
+    if (m_owner[index] != INVALID_VOICE)
+    {
+        m_clientLost[m_owner[index] & INDEX_MASK].store(m_owner[index], std::memory_order_release);
+        m_owner[index] = INVALID_VOICE;
+    }
+
+    m_state[index] = VoiceState::Allocated;
+    m_allocatedAt[index] = ++m_allocationCount;
+
+    return MakeHandle(index, m_generation[index]);
+}
+
+void SynthVoicePool::ReleaseImmediate(VoiceHandle handle)
+{
+    size_t index;
+    if (!this->TryGetIndex(handle, index))
+    {
+        return;
+    }
+
+    if (m_keydown[index])
+    {
+        m_keydown[index] = false;
+        m_envelopeTime[index] = 0;
+    }
+
+    m_generation[index]++;
+    if (m_generation[index] == 0)
+    {
+        m_generation[index] = 1;
+    }
+
+    m_state[index] = m_activeSlot[index] >= 0 ? VoiceState::Releasing : VoiceState::Free;
+}
+
+bool SynthVoicePool::IsValidImmediate(VoiceHandle handle) const
+{
+    size_t index;
+    return this->TryGetIndex(handle, index);
+}
+
+bool SynthVoicePool::SetConfigImmediate(VoiceHandle handle, const FMSynthConfig& config)
+{
+    size_t index;
+    if (!this->TryGetIndex(handle, index))
+    {
+        return false;
+    }
+
+    m_wave[index] = config.Wave;
+    m_duty[index] = std::clamp(config.PulseWidth * INV_TWO_PI, 0.0, 1.0);
+    // Same scaling FMSynthDSP uses.
+    m_targetFreq[index] = 0.03 * config.Freq;
+    m_freqSmoothK[index] = config.FreqSmoothK;
+    m_ampSmoothK[index] = config.AmpSmoothK;
+    m_lowPassAlpha[index] = static_cast<float>(config.LowPassAlpha);
+    m_envelope[index] = config.AmpASDR;
+
+    // A silent voice jumps straight to its new frequency, a sounding one glides.
+    if (this->IsSilent(index))
+    {
+        m_freq[index] = m_targetFreq[index];
+    }
+
+    return true;
+}
+
+bool SynthVoicePool::SetKeydownImmediate(VoiceHandle handle, bool keydown)
+{
+    size_t index;
+    if (!this->TryGetIndex(handle, index))
+    {
+        return false;
+    }
+
+    // Restarting from silence always begins at the same phase. Otherwise the sound would
+    // depend on which block the voice happened to be deactivated in.
+    if (keydown && this->IsSilent(index))
+    {
+        m_osc[index].Reset();
+    }
+
+    if (keydown != m_keydown[index])
+    {
+        m_keydown[index] = keydown;
+        m_envelopeTime[index] = 0;
+    }
+
+    if (keydown && m_activeSlot[index] < 0)
+    {
+        this->Activate(index);
+    }
+
+    return true;
+}
+
+bool SynthVoicePool::SetPitchImmediate(VoiceHandle handle, double pitch)
+{
+    size_t index;
+    if (!this->TryGetIndex(handle, index))
+    {
+        return false;
+    }
+
+    m_pitch[index] = pitch;
+    return true;
+}
+
+bool SynthVoicePool::SetVolumeImmediate(VoiceHandle handle, float volume)
+{
+    size_t index;
+    if (!this->TryGetIndex(handle, index))
+    {
+        return false;
+    }
+
+    m_volume[index] = volume;
+    return true;
+}
+
+bool SynthVoicePool::TryGetClient(VoiceHandle handle, size_t& index) const
+{
+    index = handle & INDEX_MASK;
+    return handle != INVALID_VOICE
+        && index < MAX_VOICES
+        && m_clients[index].Handle == handle
+        && !m_clients[index].Released
+        && m_clientLost[index].load(std::memory_order_acquire) != handle;
+}
+
+VoiceHandle SynthVoicePool::Allocate()
+{
+    // A free handle slot, or failing that the one allocated longest ago.
+    size_t index = 0;
+    for (size_t i = 0; i < MAX_VOICES; i++)
+    {
+        const ClientVoice& client = m_clients[i];
+        if (client.Handle == INVALID_VOICE || m_clientLost[i].load(std::memory_order_acquire) == client.Handle)
+        {
+            index = i;
+            break;
+        }
+
+        if (client.AllocatedAt < m_clients[index].AllocatedAt)
+        {
+            index = i;
+        }
+    }
+
+    ClientVoice& client = m_clients[index];
+    uint16_t generation = client.Generation + 1;
+    if (generation == 0)
+    {
+        generation = 1;
+    }
+
+    const VoiceHandle handle = MakeHandle(index, generation);
+    if (!this->PushCommand(CommandType::Allocate, handle, 0.0, IMMEDIATE))
+    {
+        return INVALID_VOICE;
+    }
+
+    client.Handle = handle;
+    client.Generation = generation;
+    client.Released = false;
+    client.AllocatedAt = ++m_clientAllocationCount;
+    return handle;
+}
+
+void SynthVoicePool::Release(VoiceHandle handle)
+{
+    size_t index;
+    if (this->TryGetClient(handle, index) && this->PushCommand(CommandType::Release, handle, 0.0, IMMEDIATE))
+    {
+        // The slot is reused once the audio thread has let go of the voice.
+        m_clients[index].Released = true;
+    }
+}
+
+bool SynthVoicePool::IsValid(VoiceHandle handle) const
+{
+    size_t index;
+    return this->TryGetClient(handle, index);
+}
+
+bool SynthVoicePool::SetConfig(VoiceHandle handle, const FMSynthConfig& config, SampleTime time)
+{
+    size_t index;
+    if (!this->TryGetClient(handle, index))
+    {
+        return false;
+    }
+
+    Command command;
+    command.Type = CommandType::SetConfig;
+    command.Handle = handle;
+    command.Config = config;
+    command.Value = 0.0;
+    return m_commands.Push(command, time);
+}
+
+bool SynthVoicePool::SetKeydown(VoiceHandle handle, bool keydown, SampleTime time)
+{
+    return this->PushCommand(CommandType::SetKeydown, handle, keydown ? 1.0 : 0.0, time);
+}
+
+bool SynthVoicePool::SetPitch(VoiceHandle handle, double pitch, SampleTime time)
+{
+    return this->PushCommand(CommandType::SetPitch, handle, pitch, time);
+}
+
+bool SynthVoicePool::SetVolume(VoiceHandle handle, float volume, SampleTime time)
+{
+    return this->PushCommand(CommandType::SetVolume, handle, volume, time);
+}
+
+bool SynthVoicePool::PushCommand(CommandType type, VoiceHandle handle, double value, SampleTime time)
+{
+    size_t index;
+    if (type != CommandType::Allocate && !this->TryGetClient(handle, index))
+    {
+        return false;
+    }
+
+    Command command = {};
+    command.Type = type;
+    command.Handle = handle;
+    command.Value = value;
+    return m_commands.Push(command, time);
+}
+
+void SynthVoicePool::ApplyCommand(const Command& command)
+{
+    const size_t client = command.Handle & INDEX_MASK;
+
+    if (command.Type == CommandType::Allocate)
+    {
+        // The game thread reused a handle slot that still had a voice.
+        const VoiceHandle previous = m_clientVoice[client];
+        if (this->IsValidImmediate(previous) && m_owner[previous & INDEX_MASK] != INVALID_VOICE
+            && (m_owner[previous & INDEX_MASK] & INDEX_MASK) == client)
+        {
+            this->ReleaseImmediate(previous);
+            m_owner[previous & INDEX_MASK] = INVALID_VOICE;
+        }
+
+        const VoiceHandle voice = this->AllocateImmediate();
+        m_clientVoice[client] = voice;
+        m_owner[voice & INDEX_MASK] = command.Handle;
+        return;
+    }
+
+    // Dropped if the voice has been stolen since.
+    const VoiceHandle voice = m_clientVoice[client];
+    if (!this->IsValidImmediate(voice) || m_owner[voice & INDEX_MASK] != command.Handle)
+    {
+        return;
+    }
+
+    switch (command.Type)
+    {
+    case CommandType::Release:
+        this->ReleaseImmediate(voice);
+        m_owner[voice & INDEX_MASK] = INVALID_VOICE;
+        m_clientVoice[client] = INVALID_VOICE;
+        m_clientLost[client].store(command.Handle, std::memory_order_release);
+        break;
+    case CommandType::SetConfig:
+        this->SetConfigImmediate(voice, command.Config);
+        break;
+    case CommandType::SetKeydown:
+        this->SetKeydownImmediate(voice, command.Value != 0.0);
+        break;
+    case CommandType::SetPitch:
+        this->SetPitchImmediate(voice, command.Value);
+        break;
+    case CommandType::SetVolume:
+        this->SetVolumeImmediate(voice, static_cast<float>(command.Value));
+        break;
+    default:
+        break;
+    }
+}
+
+size_t SynthVoicePool::GetActiveCount() const
+{
+    return m_publishedActiveCount.load(std::memory_order_relaxed);
+}
+
+SampleTime SynthVoicePool::GetSampleTime() const
+{
+    return m_clock.Read();
+}
+
+void SynthVoicePool::SetSequencer(VoiceSequencer* sequencer)
+{
+    m_sequencer = sequencer;
+}
+
+uint32_t SynthVoicePool::GetSampleRate() const
+{
+    return m_sampleRate;
+}
+
+void SynthVoicePool::Activate(size_t index)
+{
+    m_activeSlot[index] = static_cast<int16_t>(m_activeCount);
+    m_active[m_activeCount] = static_cast<uint16_t>(index);
+    m_activeCount++;
+}
+
+void SynthVoicePool::Deactivate(size_t index)
+{
+    // Swap the last active voice into this one's slot.
+    const int16_t slot = m_activeSlot[index];
+    const uint16_t last = m_active[m_activeCount - 1];
+
+    m_active[slot] = last;
+    m_activeSlot[last] = slot;
+    m_activeSlot[index] = -1;
+    m_activeCount--;
+}
+
+bool SynthVoicePool::IsFinished(size_t index) const
+{
+    return !m_keydown[index]
+        && m_envelopeTime[index] >= m_envelope[index].Release
+        && m_amp[index] < SILENT_AMP;
+}
+
+bool SynthVoicePool::IsSilent(size_t index) const
+{
+    return m_activeSlot[index] < 0 || this->IsFinished(index);
+}
+
+template <size_t Count>
+void SynthVoicePool::RenderVoices(const uint16_t* indices, uint32_t length)
+{
+    WaveType wave[Count];
+    double duty[Count];
+    double targetFreq[Count];
+    double freqSmooth[Count];
+    double ampSmooth[Count];
+    double pitch[Count];
+    bool keydown[Count];
+    float lowPassAlpha[Count];
+    float volume[Count];
+
+    double amp[Count];
+    double freq[Count];
+    uint32_t envelopeTime[Count];
+    float lowPass[Count];
+
+    for (size_t v = 0; v < Count; v++)
+    {
+        const size_t index = indices[v];
+        wave[v] = m_wave[index];
+        duty[v] = m_duty[index];
+        targetFreq[v] = m_targetFreq[index];
+        // Same as AudioProcessors::lerp without the divides.
+        freqSmooth[v] = 1.0 / m_freqSmoothK[index];
+        ampSmooth[v] = 1.0 / m_ampSmoothK[index];
+        pitch[v] = m_pitch[index];
+        keydown[v] = m_keydown[index];
+        lowPassAlpha[v] = m_lowPassAlpha[index];
+        volume[v] = m_volume[index];
+
+        amp[v] = m_amp[index];
+        freq[v] = m_freq[index];
+        envelopeTime[v] = m_envelopeTime[index];
+        lowPass[v] = m_lowPass[index].Output;
+    }
+
+    float* mix = m_mixBuffer.data();
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        float sum = 0.f;
+
+        for (size_t v = 0; v < Count; v++)
+        {
+            const AudioProcessors::ASDRConfig& envelope = m_envelope[indices[v]];
+            const double target = keydown[v]
+                ? envelope.ValDown(static_cast<double>(envelopeTime[v]))
+                : envelope.ValUp(static_cast<double>(envelopeTime[v]));
+            envelopeTime[v]++;
+
+            amp[v] += (target - amp[v]) * ampSmooth[v];
+            freq[v] += (targetFreq[v] - freq[v]) * freqSmooth[v];
+
+            const double increment = pitch[v] * freq[v] * INV_TWO_PI;
+            const float x = static_cast<float>(amp[v] * m_osc[indices[v]].Next(wave[v], increment, duty[v]));
+
+            // One pole low pass, as AudioProcessors::LowPass.
+            lowPass[v] += lowPassAlpha[v] * (x - lowPass[v]);
+            sum += volume[v] * lowPass[v];
+        }
+
+        mix[i] += sum;
+    }
+
+    for (size_t v = 0; v < Count; v++)
+    {
+        const size_t index = indices[v];
+        m_amp[index] = amp[v];
+        m_freq[index] = freq[v];
+        m_envelopeTime[index] = envelopeTime[v];
+        m_lowPass[index].Output = lowPass[v];
+    }
+}
+
+FMOD_RESULT SynthVoicePool::Callback(
+    float* inbuffer,
+    float* outbuffer,
+    uint32_t length,
+    int inchannels,
+    int* outChannels)
+{
+    const int channels = *outChannels;
+
+    uint32_t processed = 0;
+    while (processed < length)
+    {
+        const uint32_t remaining = length - processed;
+        uint32_t blockLength = remaining < RENDER_BLOCK_LENGTH ? remaining : static_cast<uint32_t>(RENDER_BLOCK_LENGTH);
+
+        // Shortened so timed commands and the sequencer's note changes land on the right
+        // sample.
+        blockLength = m_commands.Drain(m_clock.Now(), blockLength, [this](const Command& command)
+        {
+            this->ApplyCommand(command);
+        });
+
+        if (m_sequencer != nullptr)
+        {
+            blockLength = std::clamp(m_sequencer->Sequence(*this, blockLength), 1u, blockLength);
+        }
+
+        const size_t offset = static_cast<size_t>(processed) * channels;
+        const float* in = inbuffer + offset;
+        float* out = outbuffer + offset;
+
+        if (m_activeCount == 0)
+        {
+            memcpy(out, in, sizeof(float) * blockLength * channels);
+            m_clock.Advance(blockLength);
+            processed += blockLength;
+            continue;
+        }
+
+        float* mix = m_mixBuffer.data();
+        std::fill(mix, mix + blockLength, 0.f);
+
+        size_t slot = 0;
+        for (; slot + RENDER_BATCH <= m_activeCount; slot += RENDER_BATCH)
+        {
+            this->RenderVoices<RENDER_BATCH>(&m_active[slot], blockLength);
+        }
+
+        switch (m_activeCount - slot)
+        {
+        case 3: this->RenderVoices<3>(&m_active[slot], blockLength); break;
+        case 2: this->RenderVoices<2>(&m_active[slot], blockLength); break;
+        case 1: this->RenderVoices<1>(&m_active[slot], blockLength); break;
+        default: break;
+        }
+
+        for (slot = 0; slot < m_activeCount;)
+        {
+            const size_t index = m_active[slot];
+            if (this->IsFinished(index))
+            {
+                this->Deactivate(index);
+                if (m_state[index] == VoiceState::Releasing)
+                {
+                    m_state[index] = VoiceState::Free;
+                }
+
+                // The last voice was swapped into this slot.
+                continue;
+            }
+
+            slot++;
+        }
+
+        for (uint32_t samp = 0; samp < blockLength; samp++)
+        {
+            for (int chan = 0; chan < channels; chan++)
+            {
+                const uint32_t index = (samp * channels) + chan;
+                out[index] = in[index] + mix[samp];
+            }
+        }
+
+        m_clock.Advance(blockLength);
+        processed += blockLength;
+    }
+
+    m_publishedActiveCount.store(m_activeCount, std::memory_order_relaxed);
+
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK SynthVoicePool::SynthVoicePoolGenericCallback(
+    FMOD_DSP_STATE* dsp_state,
+    float* inbuffer,
+    float* outbuffer,
+    uint32_t length,
+    int inchannels,
+    int* outchannels)
+{
+    FMOD_RESULT result;
+
+    FMOD::DSP *thisdsp = reinterpret_cast<FMOD::DSP *>(dsp_state->instance);
+
+    SynthVoicePool* pool;
+    result = thisdsp->getUserData(reinterpret_cast<void **>(&pool));
+
+    if (result != FMOD_OK)
+    {
+        return result;
+    }
+
+    return pool->Callback(inbuffer, outbuffer, length, inchannels, outchannels);
+}
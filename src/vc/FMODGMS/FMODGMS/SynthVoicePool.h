@@ -0,0 +1,216 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "fmod_common.h"
+#include "fmod.hpp"
+#include "fmod_errors.h"
+#include "AudioProcessors.h"
+#include "CommandQueue.h"
+#include "FMSynth.h"
+#include "Oscillator.h"
+
+// Low 16 bits are the voice index, high 16 bits the generation of the voice when it was
+// allocated. Generations start at 1 so a valid handle is never 0.
+typedef uint32_t VoiceHandle;
+constexpr VoiceHandle INVALID_VOICE = 0;
+
+class SynthVoicePool;
+
+// Changes voices from inside the pool's render loop on the audio thread, so notes can
+// start and stop between samples rather than on block or game frame boundaries.
+class VoiceSequencer
+{
+public:
+    virtual ~VoiceSequencer() = default;
+
+    // Applies whatever is due now and returns how many frames the pool should render
+    // before asking again, between 1 and maxFrames. Runs on the audio thread so only the
+    // pool's ...Immediate functions may be used.
+    virtual uint32_t Sequence(SynthVoicePool& pool, uint32_t maxFrames) = 0;
+};
+
+// Fixed pool of FM synth voices rendered by a single DSP. Voices are stored as a
+// structure of arrays and only the ones on the active list are touched by the callback,
+// so idle voices cost nothing.
+//
+// The game thread never touches voices directly, its calls are queued and applied by the
+// callback. Handles from Allocate belong to the game thread and handles from
+// AllocateImmediate to the audio thread, the two can't be mixed.
+class SynthVoicePool
+{
+public:
+    static constexpr size_t MAX_VOICES = 64;
+
+    SynthVoicePool();
+
+    bool Register(FMOD::System* sys, std::string& error);
+
+    // Takes the DSP off the master group and releases it, the callback doesn't run again
+    // afterwards. Must happen before the pool is destroyed.
+    void Unregister(FMOD::System* sys);
+
+    // Steals the least important voice when the pool is full, or the oldest handle's
+    // when every handle is held. Only returns INVALID_VOICE if the command queue is full.
+    VoiceHandle Allocate();
+
+    // Gives the voice back, it rings out its release before being reused.
+    void Release(VoiceHandle handle);
+
+    // False once released or stolen.
+    bool IsValid(VoiceHandle handle) const;
+
+    // The setters return false for stale handles or a full queue. With a time they are
+    // applied on that sample of GetSampleTime's clock.
+    bool SetConfig(VoiceHandle handle, const FMSynthConfig& config, SampleTime time = IMMEDIATE);
+    bool SetKeydown(VoiceHandle handle, bool keydown, SampleTime time = IMMEDIATE);
+    bool SetPitch(VoiceHandle handle, double pitch, SampleTime time = IMMEDIATE);
+    bool SetVolume(VoiceHandle handle, float volume, SampleTime time = IMMEDIATE);
+
+    size_t GetActiveCount() const;
+    SampleTime GetSampleTime() const;
+
+    // Set before the DSP starts running.
+    void SetSequencer(VoiceSequencer* sequencer);
+    uint32_t GetSampleRate() const;
+
+    // Audio thread versions of the above for a VoiceSequencer, applied straight away.
+    VoiceHandle AllocateImmediate();
+    void ReleaseImmediate(VoiceHandle handle);
+    bool IsValidImmediate(VoiceHandle handle) const;
+    bool SetConfigImmediate(VoiceHandle handle, const FMSynthConfig& config);
+    bool SetKeydownImmediate(VoiceHandle handle, bool keydown);
+    bool SetPitchImmediate(VoiceHandle handle, double pitch);
+    bool SetVolumeImmediate(VoiceHandle handle, float volume);
+
+    FMOD_RESULT Callback(
+        float* inbuffer,
+        float* outbuffer,
+        uint32_t length,
+        int inchannels,
+        int* outchannels);
+
+private:
+    enum class VoiceState : uint8_t
+    {
+        Free,
+        // Owned by a handle.
+        Allocated,
+        // Handle released, still ringing out.
+        Releasing,
+    };
+
+    enum class CommandType : uint8_t
+    {
+        Allocate,
+        Release,
+        SetConfig,
+        SetKeydown,
+        SetPitch,
+        SetVolume,
+    };
+
+    struct Command
+    {
+        CommandType Type;
+        // A game thread handle.
+        VoiceHandle Handle;
+        FMSynthConfig Config;
+        double Value;
+    };
+
+    // Game thread side of a handle from Allocate.
+    struct ClientVoice
+    {
+        VoiceHandle Handle = INVALID_VOICE;
+        uint16_t Generation = 1;
+        bool Released = false;
+        uint64_t AllocatedAt = 0;
+    };
+
+    static constexpr size_t RENDER_BLOCK_LENGTH = 256;
+    static constexpr size_t COMMAND_QUEUE_LENGTH = 1024;
+
+    // Voices rendered side by side. Each voice's smoothing and filtering is a serial
+    // chain, interleaving a few lets the CPU overlap them.
+    static constexpr size_t RENDER_BATCH = 4;
+
+    // Set from the game thread.
+    std::array<WaveType, MAX_VOICES> m_wave;
+    std::array<double, MAX_VOICES> m_duty;
+    std::array<double, MAX_VOICES> m_targetFreq;
+    std::array<double, MAX_VOICES> m_freqSmoothK;
+    std::array<double, MAX_VOICES> m_ampSmoothK;
+    std::array<double, MAX_VOICES> m_pitch;
+    std::array<float, MAX_VOICES> m_volume;
+    std::array<float, MAX_VOICES> m_lowPassAlpha;
+    std::array<AudioProcessors::ASDRConfig, MAX_VOICES> m_envelope;
+    std::array<bool, MAX_VOICES> m_keydown;
+
+    // Advanced by the audio thread.
+    std::array<Oscillator, MAX_VOICES> m_osc;
+    std::array<double, MAX_VOICES> m_amp;
+    std::array<double, MAX_VOICES> m_freq;
+    std::array<uint32_t, MAX_VOICES> m_envelopeTime;
+    std::array<AudioProcessors::OnePoleState, MAX_VOICES> m_lowPass;
+
+    // Bookkeeping.
+    std::array<VoiceState, MAX_VOICES> m_state;
+    std::array<uint16_t, MAX_VOICES> m_generation;
+    std::array<uint64_t, MAX_VOICES> m_allocatedAt;
+    uint64_t m_allocationCount = 0;
+
+    // Indices of the voices being rendered, and each voice's slot in it.
+    std::array<uint16_t, MAX_VOICES> m_active;
+    std::array<int16_t, MAX_VOICES> m_activeSlot;
+    size_t m_activeCount = 0;
+
+    std::array<float, RENDER_BLOCK_LENGTH> m_mixBuffer;
+
+    // Owned by the game thread.
+    std::array<ClientVoice, MAX_VOICES> m_clients;
+    uint64_t m_clientAllocationCount = 0;
+    CommandQueue<Command, COMMAND_QUEUE_LENGTH> m_commands;
+
+    // Owned by the audio thread. The voice behind each game thread handle, and the game
+    // thread handle owning each voice.
+    std::array<VoiceHandle, MAX_VOICES> m_clientVoice;
+    std::array<VoiceHandle, MAX_VOICES> m_owner;
+    SampleClock m_clock;
+
+    // Game thread handles whose voice was released or stolen, published by the audio
+    // thread so the handle's slot can be reused.
+    std::array<std::atomic<VoiceHandle>, MAX_VOICES> m_clientLost;
+    std::atomic<size_t> m_publishedActiveCount = 0;
+
+    VoiceSequencer* m_sequencer = nullptr;
+    uint32_t m_sampleRate = 48000;
+
+    FMOD::DSP* m_dsp = nullptr;
+    FMOD_DSP_DESCRIPTION m_dspDescr;
+
+    bool TryGetIndex(VoiceHandle handle, size_t& index) const;
+    bool TryGetClient(VoiceHandle handle, size_t& index) const;
+    bool PushCommand(CommandType type, VoiceHandle handle, double value, SampleTime time);
+    void ApplyCommand(const Command& command);
+    size_t PickVoiceToSteal() const;
+    void ResetVoice(size_t index);
+    void Activate(size_t index);
+    void Deactivate(size_t index);
+
+    template <size_t Count>
+    void RenderVoices(const uint16_t* indices, uint32_t length);
+    bool IsFinished(size_t index) const;
+    // Not rendering, or about to be deactivated.
+    bool IsSilent(size_t index) const;
+
+    static FMOD_RESULT F_CALLBACK SynthVoicePoolGenericCallback(
+        FMOD_DSP_STATE* dsp_state,
+        float* inbuffer,
+        float* outbuffer,
+        uint32_t length,
+        int inchannels,
+        int* outchannels);
+};
@@ -0,0 +1,732 @@
+#include "TapeFile.h"
+#include "Cassette.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+using namespace Cassette;
+
+static_assert(sizeof(TapeFileHeader) == 80, "Tape file header must not change size");
+static_assert(sizeof(TapePeakRecord) == 24, "Tape peak record must not change size");
+
+namespace
+{
+    constexpr char TAPE_FILE_MAGIC[4] = { 'F', 'G', 'T', 'P' };
+
+    // Samples sharing one Rice parameter. The largest parameter marks a partition where
+    // every difference is zero, stretches of blank tape cost next to nothing.
+    constexpr size_t RICE_PARTITION = 64;
+    constexpr uint32_t RICE_PARAMETER_BITS = 5;
+    constexpr uint32_t RICE_MAX_PARAMETER = 30;
+    constexpr uint32_t RICE_ZERO_PARTITION = 31;
+
+    // Quotients this big are written as the whole value instead.
+    constexpr uint32_t RICE_ESCAPE = 24;
+
+    enum ChunkCoding : uint8_t
+    {
+        CHUNK_RAW = 0,
+        CHUNK_RICE = 1,
+    };
+
+    constexpr size_t RAW_CHUNK_BYTES = TAPE_CHUNK_SIZE * sizeof(float);
+
+    uint64_t AlignUp(uint64_t x, uint64_t alignment)
+    {
+        return (x + alignment - 1) / alignment * alignment;
+    }
+
+    // Orders float bit patterns the same way as the floats so neighbouring samples are
+    // close together. -0 stays apart from 0 so this round trips exactly.
+    int32_t ToOrdered(float f)
+    {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return (bits & 0x80000000) ? static_cast<int32_t>(~(bits & 0x7FFFFFFF)) : static_cast<int32_t>(bits);
+    }
+
+    float FromOrdered(int32_t ordered)
+    {
+        const uint32_t bits = ordered < 0 ? (~static_cast<uint32_t>(ordered)) | 0x80000000 : static_cast<uint32_t>(ordered);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    uint32_t LowBits(uint32_t value, uint32_t count)
+    {
+        return count >= 32 ? value : value & ((1u << count) - 1);
+    }
+
+    // Least significant bit first.
+    class BitWriter
+    {
+    public:
+        BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+        void Write(uint32_t bits, uint32_t count)
+        {
+            m_bits |= static_cast<uint64_t>(LowBits(bits, count)) << m_count;
+            m_count += count;
+            while (m_count >= 8)
+            {
+                m_out.push_back(static_cast<uint8_t>(m_bits));
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        void WriteOnes(uint32_t count)
+        {
+            while (count > 0)
+            {
+                const uint32_t run = std::min(count, 32u);
+                this->Write(0xFFFFFFFF, run);
+                count -= run;
+            }
+        }
+
+        void Flush()
+        {
+            if (m_count > 0)
+            {
+                m_out.push_back(static_cast<uint8_t>(m_bits));
+            }
+
+            m_bits = 0;
+            m_count = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& m_out;
+        uint64_t m_bits = 0;
+        uint32_t m_count = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+        bool Read(uint32_t count, uint32_t& bits)
+        {
+            while (m_count < count)
+            {
+                if (m_pos >= m_size)
+                {
+                    return false;
+                }
+
+                m_bits |= static_cast<uint64_t>(m_data[m_pos++]) << m_count;
+                m_count += 8;
+            }
+
+            bits = LowBits(static_cast<uint32_t>(m_bits), count);
+            m_bits >>= count;
+            m_count -= count;
+            return true;
+        }
+
+        // Ones up to the first zero, which is used up, or limit ones with no zero after.
+        bool ReadOnes(uint32_t limit, uint32_t& count)
+        {
+            count = 0;
+            uint32_t bit = 0;
+            while (count < limit)
+            {
+                if (!this->Read(1, bit))
+                {
+                    return false;
+                }
+
+                if (bit == 0)
+                {
+                    return true;
+                }
+
+                count++;
+            }
+
+            return true;
+        }
+
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+        size_t m_pos = 0;
+        uint64_t m_bits = 0;
+        uint32_t m_count = 0;
+    };
+
+    uint32_t RiceCost(const uint32_t* values, size_t count, uint32_t k)
+    {
+        uint32_t bits = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint32_t q = values[i] >> k;
+            bits += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + 32;
+        }
+
+        return bits;
+    }
+
+    uint32_t ChooseRiceParameter(const uint32_t* values, size_t count, uint64_t sum)
+    {
+        // Start from the mean's bit length and walk downhill, a few escaped outliers can
+        // pull the mean well above the best parameter.
+        const uint64_t mean = sum / count;
+        uint32_t best = 0;
+        while (best < RICE_MAX_PARAMETER && (mean >> (best + 1)) > 0)
+        {
+            best++;
+        }
+
+        uint32_t bestCost = RiceCost(values, count, best);
+        for (int direction : { -1, 1 })
+        {
+            while (direction < 0 ? best > 0 : best < RICE_MAX_PARAMETER)
+            {
+                const uint32_t cost = RiceCost(values, count, best + direction);
+                if (cost >= bestCost)
+                {
+                    break;
+                }
+
+                best += direction;
+                bestCost = cost;
+            }
+        }
+
+        return best;
+    }
+
+    void AppendBytes(std::vector<uint8_t>& out, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    bool WriteAt(std::ofstream& file, uint64_t offset, const void* data, size_t size)
+    {
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        return file.good();
+    }
+
+    bool ReadAt(std::ifstream& file, uint64_t offset, void* data, size_t size)
+    {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+        return file.good();
+    }
+
+    // Runs the samples of one chunk into the level 0 peak bins they belong to.
+    void SummariseChunk(const float* samples, size_t chunk, size_t length, size_t binShift, std::vector<TapePeakRecord>& peaks)
+    {
+        const size_t start = chunk * TAPE_CHUNK_SIZE;
+        const size_t end = std::min(start + TAPE_CHUNK_SIZE, length);
+        const size_t binSize = static_cast<size_t>(1) << binShift;
+
+        for (size_t binStart = start; binStart < end; binStart += binSize)
+        {
+            PeakSummary summary;
+            const size_t binEnd = std::min(binStart + binSize, end);
+            for (size_t i = binStart; i < binEnd; i++)
+            {
+                summary.Add(samples[i - start]);
+            }
+
+            TapePeakRecord& record = peaks[binStart >> binShift];
+            record.Min = summary.Min;
+            record.Max = summary.Max;
+            record.SumSquares = summary.SumSquares;
+            record.Count = summary.Count;
+            record.Reserved = 0;
+        }
+    }
+}
+
+void TapeCoding::EncodeChunk(const float* samples, std::vector<uint8_t>& out)
+{
+    out.clear();
+    out.push_back(CHUNK_RICE);
+
+    BitWriter bits(out);
+    uint32_t values[RICE_PARTITION];
+    int32_t previous = 0;
+    for (size_t start = 0; start < TAPE_CHUNK_SIZE; start += RICE_PARTITION)
+    {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < RICE_PARTITION; i++)
+        {
+            const int32_t ordered = ToOrdered(samples[start + i]);
+            const uint32_t delta = static_cast<uint32_t>(ordered) - static_cast<uint32_t>(previous);
+            previous = ordered;
+
+            values[i] = (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+            sum += values[i];
+        }
+
+        if (sum == 0)
+        {
+            bits.Write(RICE_ZERO_PARTITION, RICE_PARAMETER_BITS);
+            continue;
+        }
+
+        const uint32_t k = ChooseRiceParameter(values, RICE_PARTITION, sum);
+        bits.Write(k, RICE_PARAMETER_BITS);
+
+        for (size_t i = 0; i < RICE_PARTITION; i++)
+        {
+            const uint32_t q = values[i] >> k;
+            if (q < RICE_ESCAPE)
+            {
+                bits.WriteOnes(q);
+                bits.Write(0, 1);
+                bits.Write(values[i], k);
+            }
+            else
+            {
+                bits.WriteOnes(RICE_ESCAPE);
+                bits.Write(values[i], 32);
+            }
+        }
+    }
+
+    bits.Flush();
+
+    if (out.size() >= 1 + RAW_CHUNK_BYTES)
+    {
+        out.resize(1 + RAW_CHUNK_BYTES);
+        out[0] = CHUNK_RAW;
+        memcpy(out.data() + 1, samples, RAW_CHUNK_BYTES);
+    }
+}
+
+bool TapeCoding::DecodeChunk(const uint8_t* data, size_t size, float* samples)
+{
+    if (size == 0)
+    {
+        return false;
+    }
+
+    if (data[0] == CHUNK_RAW)
+    {
+        if (size != 1 + RAW_CHUNK_BYTES)
+        {
+            return false;
+        }
+
+        memcpy(samples, data + 1, RAW_CHUNK_BYTES);
+        return true;
+    }
+
+    if (data[0] != CHUNK_RICE)
+    {
+        return false;
+    }
+
+    BitReader bits(data + 1, size - 1);
+    int32_t previous = 0;
+    for (size_t start = 0; start < TAPE_CHUNK_SIZE; start += RICE_PARTITION)
+    {
+        uint32_t k = 0;
+        if (!bits.Read(RICE_PARAMETER_BITS, k))
+        {
+            return false;
+        }
+
+        if (k == RICE_ZERO_PARTITION)
+        {
+            std::fill(samples + start, samples + start + RICE_PARTITION, FromOrdered(previous));
+            continue;
+        }
+
+        for (size_t i = 0; i < RICE_PARTITION; i++)
+        {
+            uint32_t q = 0;
+            uint32_t value = 0;
+            if (!bits.ReadOnes(RICE_ESCAPE, q))
+            {
+                return false;
+            }
+
+            if (q < RICE_ESCAPE)
+            {
+                uint32_t low = 0;
+                if (!bits.Read(k, low))
+                {
+                    return false;
+                }
+
+                value = (q << k) | low;
+            }
+            else if (!bits.Read(32, value))
+            {
+                return false;
+            }
+
+            const uint32_t delta = (value >> 1) ^ (0u - (value & 1));
+            previous = static_cast<int32_t>(static_cast<uint32_t>(previous) + delta);
+            samples[start + i] = FromOrdered(previous);
+        }
+    }
+
+    return true;
+}
+
+void TapeCoding::WriteVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+bool TapeCoding::ReadVarint(const std::vector<uint8_t>& data, size_t& pos, uint64_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 64 && pos < data.size(); shift += 7)
+    {
+        const uint8_t byte = data[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TapeFile::Save(
+    RecordBuffer& buffer,
+    uint32_t sampleRate,
+    AnnotationStore& annotations,
+    const std::string& path,
+    bool compress,
+    std::string& error)
+{
+    TapeStore& tape = *buffer.m_tape;
+    const size_t length = tape.GetSize();
+    const size_t chunkCount = tape.GetChunkCount();
+
+    // Each annotation string once, numbered in the order the spans first use them.
+    std::vector<uint8_t> strings;
+    std::vector<uint8_t> spans;
+    std::unordered_map<AnnotationId, uint32_t> stringNumbers;
+    for (const auto& span : buffer.m_annotationSpans)
+    {
+        uint32_t number = 0;
+        if (span.Id != NO_ANNOTATION)
+        {
+            const auto found = stringNumbers.find(span.Id);
+            if (found != stringNumbers.end())
+            {
+                number = found->second;
+            }
+            else
+            {
+                const std::string_view value = annotations.GetString(span.Id);
+                const uint32_t size = static_cast<uint32_t>(value.size());
+                AppendBytes(strings, &size, sizeof(size));
+                AppendBytes(strings, value.data(), value.size());
+
+                number = static_cast<uint32_t>(stringNumbers.size() + 1);
+                stringNumbers.emplace(span.Id, number);
+            }
+        }
+
+        TapeCoding::WriteVarint(spans, span.Length);
+        TapeCoding::WriteVarint(spans, number);
+    }
+
+    TapeFileHeader header = {};
+    memcpy(header.Magic, TAPE_FILE_MAGIC, sizeof(header.Magic));
+    header.Version = TAPE_FILE_VERSION;
+    header.Flags = compress ? TAPE_FILE_COMPRESSED : 0;
+    header.SampleRate = sampleRate;
+    header.Length = length;
+    header.PeakBinShift = static_cast<uint32_t>(buffer.m_peakBinShift);
+    header.StringCount = static_cast<uint32_t>(stringNumbers.size());
+    header.SpanCount = buffer.m_annotationSpans.size();
+    header.StringsOffset = sizeof(TapeFileHeader);
+    header.SpansOffset = header.StringsOffset + strings.size();
+    header.PeaksOffset = header.SpansOffset + spans.size();
+
+    // Only long raw tapes are mapped, which need whole aligned chunks and their peaks
+    // stored. Everything else has the samples to hand when it loads.
+    const bool mapped = !compress && tape.IsSpilled();
+    std::vector<TapePeakRecord> peaks(mapped ? buffer.m_peakLevels[0].size() : 0);
+    header.SamplesOffset = AlignUp(header.PeaksOffset + peaks.size() * sizeof(TapePeakRecord), mapped ? TAPE_FILE_ALIGNMENT : sizeof(uint64_t));
+
+    const std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        error = "Could not create tape file";
+        return false;
+    }
+
+    bool ok = WriteAt(file, header.StringsOffset, strings.data(), strings.size())
+        && WriteAt(file, header.SpansOffset, spans.data(), spans.size());
+
+    // Compressed chunks go after their offset table, which is filled in at the end.
+    std::vector<uint64_t> chunkOffsets(compress ? chunkCount + 1 : 0);
+    uint64_t samplesEnd = header.SamplesOffset + chunkOffsets.size() * sizeof(uint64_t);
+
+    std::vector<float> samples(TAPE_CHUNK_SIZE);
+    std::vector<uint8_t> coded;
+    for (size_t chunk = 0; ok && chunk < chunkCount; chunk++)
+    {
+        tape.ReadChunk(chunk, samples.data());
+        if (mapped)
+        {
+            SummariseChunk(samples.data(), chunk, length, buffer.m_peakBinShift, peaks);
+        }
+
+        if (compress)
+        {
+            TapeCoding::EncodeChunk(samples.data(), coded);
+            chunkOffsets[chunk] = samplesEnd - header.SamplesOffset;
+            ok = WriteAt(file, samplesEnd, coded.data(), coded.size());
+            samplesEnd += coded.size();
+        }
+        else
+        {
+            const size_t bytes = mapped ? RAW_CHUNK_BYTES : std::min(TAPE_CHUNK_SIZE, length - chunk * TAPE_CHUNK_SIZE) * sizeof(float);
+            ok = WriteAt(file, samplesEnd, samples.data(), bytes);
+            samplesEnd += bytes;
+        }
+    }
+
+    if (compress)
+    {
+        chunkOffsets[chunkCount] = samplesEnd - header.SamplesOffset;
+        ok = ok && WriteAt(file, header.SamplesOffset, chunkOffsets.data(), chunkOffsets.size() * sizeof(uint64_t));
+    }
+
+    header.SamplesBytes = samplesEnd - header.SamplesOffset;
+
+    ok = ok
+        && WriteAt(file, header.PeaksOffset, peaks.data(), peaks.size() * sizeof(TapePeakRecord))
+        && WriteAt(file, 0, &header, sizeof(header));
+
+    file.close();
+    ok = ok && !file.fail();
+
+    // Replaces any tape already saved there in one go.
+    std::error_code renameError;
+    if (ok)
+    {
+        std::filesystem::rename(tempPath, path, renameError);
+    }
+
+    if (!ok || renameError)
+    {
+        std::error_code removeError;
+        std::filesystem::remove(tempPath, removeError);
+        error = "Could not write tape file";
+        return false;
+    }
+
+    return true;
+}
+
+bool TapeFile::Load(
+    const std::string& path,
+    AnnotationStore& annotations,
+    std::unique_ptr<RecordBuffer>& buffer,
+    uint32_t& sampleRate,
+    std::string& error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error = "Could not open tape file";
+        return false;
+    }
+
+    std::error_code sizeError;
+    const uint64_t size = std::filesystem::file_size(path, sizeError);
+
+    TapeFileHeader header;
+    if (sizeError || !ReadAt(file, 0, &header, sizeof(header)))
+    {
+        error = "Could not read tape file";
+        return false;
+    }
+
+    if (memcmp(header.Magic, TAPE_FILE_MAGIC, sizeof(header.Magic)) != 0 || header.Version != TAPE_FILE_VERSION)
+    {
+        error = "Not a tape file";
+        return false;
+    }
+
+    const bool compressed = (header.Flags & TAPE_FILE_COMPRESSED) != 0;
+    if (header.Length == 0 || header.Length > UINT32_MAX
+        || header.StringsOffset > header.SpansOffset
+        || header.SpansOffset > header.PeaksOffset
+        || header.PeaksOffset > header.SamplesOffset
+        || header.SamplesOffset > size
+        || header.SamplesBytes > size - header.SamplesOffset)
+    {
+        error = "Corrupt tape file";
+        return false;
+    }
+
+    auto loaded = std::make_unique<RecordBuffer>(static_cast<size_t>(header.Length));
+    TapeStore& tape = *loaded->m_tape;
+    auto& bins = loaded->m_peakLevels[0];
+
+    const bool mapped = !compressed && tape.IsSpilled();
+    const uint64_t rawBytes = mapped ? tape.GetChunkCount() * RAW_CHUNK_BYTES : header.Length * sizeof(float);
+    std::vector<TapePeakRecord> peaks(bins.size());
+    if (header.PeakBinShift != loaded->m_peakBinShift
+        || (mapped && header.PeaksOffset + peaks.size() * sizeof(TapePeakRecord) > header.SamplesOffset)
+        || (mapped && header.SamplesOffset % TAPE_FILE_ALIGNMENT != 0)
+        || (!compressed && header.SamplesBytes < rawBytes))
+    {
+        error = "Corrupt tape file";
+        return false;
+    }
+
+    std::vector<uint8_t> strings(static_cast<size_t>(header.SpansOffset - header.StringsOffset));
+    std::vector<uint8_t> spanData(static_cast<size_t>(header.PeaksOffset - header.SpansOffset));
+    if (!ReadAt(file, header.StringsOffset, strings.data(), strings.size())
+        || !ReadAt(file, header.SpansOffset, spanData.data(), spanData.size())
+        || (mapped && !ReadAt(file, header.PeaksOffset, peaks.data(), peaks.size() * sizeof(TapePeakRecord))))
+    {
+        error = "Could not read tape file";
+        return false;
+    }
+
+    // Annotation ids only mean something to the store that made them, so intern the
+    // strings again.
+    std::vector<AnnotationId> ids = { NO_ANNOTATION };
+    size_t pos = 0;
+    for (uint32_t i = 0; i < header.StringCount; i++)
+    {
+        uint32_t stringSize = 0;
+        if (strings.size() - pos < sizeof(stringSize))
+        {
+            error = "Corrupt tape file";
+            return false;
+        }
+
+        memcpy(&stringSize, strings.data() + pos, sizeof(stringSize));
+        pos += sizeof(stringSize);
+        if (strings.size() - pos < stringSize)
+        {
+            error = "Corrupt tape file";
+            return false;
+        }
+
+        ids.push_back(annotations.Intern(std::string_view(reinterpret_cast<const char*>(strings.data() + pos), stringSize)));
+        pos += stringSize;
+    }
+
+    std::vector<AnnotationSpan> spans;
+    spans.reserve(static_cast<size_t>(std::min(header.SpanCount, header.Length)));
+    uint64_t spanStart = 0;
+    pos = 0;
+    for (uint64_t i = 0; i < header.SpanCount; i++)
+    {
+        uint64_t spanLength = 0;
+        uint64_t number = 0;
+        if (!TapeCoding::ReadVarint(spanData, pos, spanLength) || !TapeCoding::ReadVarint(spanData, pos, number)
+            || spanLength == 0 || spanLength > header.Length - spanStart || number >= ids.size())
+        {
+            error = "Corrupt tape file";
+            return false;
+        }
+
+        spans.push_back(AnnotationSpan{ static_cast<uint32_t>(spanStart), static_cast<uint32_t>(spanLength), ids[number] });
+        spanStart += spanLength;
+    }
+
+    if (spanStart != header.Length)
+    {
+        error = "Corrupt tape file";
+        return false;
+    }
+
+    loaded->RestoreSpans(spans);
+
+    const size_t chunkCount = tape.GetChunkCount();
+    std::vector<float> samples(TAPE_CHUNK_SIZE);
+    if (!compressed)
+    {
+        // Straight from the file, long tapes are streamed from it in place and short ones
+        // read in whole.
+        file.close();
+        if (!tape.OpenFile(path, header.SamplesOffset, error))
+        {
+            return false;
+        }
+
+        for (size_t chunk = 0; !mapped && chunk < chunkCount; chunk++)
+        {
+            tape.ReadChunk(chunk, samples.data());
+            SummariseChunk(samples.data(), chunk, tape.GetSize(), loaded->m_peakBinShift, peaks);
+        }
+    }
+    else
+    {
+        std::vector<uint64_t> chunkOffsets(chunkCount + 1);
+        if (header.SamplesBytes < chunkOffsets.size() * sizeof(uint64_t)
+            || !ReadAt(file, header.SamplesOffset, chunkOffsets.data(), chunkOffsets.size() * sizeof(uint64_t)))
+        {
+            error = "Corrupt tape file";
+            return false;
+        }
+
+        if (!tape.Open(error))
+        {
+            return false;
+        }
+
+        std::vector<uint8_t> coded;
+        for (size_t chunk = 0; chunk < chunkCount; chunk++)
+        {
+            const uint64_t start = chunkOffsets[chunk];
+            const uint64_t end = chunkOffsets[chunk + 1];
+            if (start > end || end > header.SamplesBytes || end - start > 1 + RAW_CHUNK_BYTES)
+            {
+                error = "Corrupt tape file";
+                return false;
+            }
+
+            coded.resize(static_cast<size_t>(end - start));
+            if (!ReadAt(file, header.SamplesOffset + start, coded.data(), coded.size())
+                || !TapeCoding::DecodeChunk(coded.data(), coded.size(), samples.data()))
+            {
+                error = "Corrupt tape file";
+                return false;
+            }
+
+            tape.WriteChunk(chunk, samples.data());
+            SummariseChunk(samples.data(), chunk, tape.GetSize(), loaded->m_peakBinShift, peaks);
+        }
+    }
+
+    for (size_t bin = 0; bin < bins.size(); bin++)
+    {
+        bins[bin].Min = peaks[bin].Min;
+        bins[bin].Max = peaks[bin].Max;
+        bins[bin].SumSquares = peaks[bin].SumSquares;
+        bins[bin].Count = peaks[bin].Count;
+    }
+
+    loaded->RebuildPeaks();
+
+    sampleRate = header.SampleRate;
+    buffer = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AnnotationStore.h"
+
+namespace Cassette
+{
+    class RecordBuffer;
+
+    // A saved tape, little endian throughout:
+    //
+    //   TapeFileHeader
+    //   Annotation strings, each a uint32 length then that many bytes.
+    //   Annotation spans in tape order, each a varint length then a varint string number
+    //   counting from 1, 0 for no annotation.
+    //   Level 0 of the peak pyramid as TapePeakRecords, only for mapped tapes so their
+    //   waveform is there without reading every sample.
+    //   Samples.
+    //
+    // Raw samples of tapes too long to keep in memory start on a TAPE_FILE_ALIGNMENT
+    // boundary and are padded out to whole chunks so they can be mapped straight from the
+    // file. Compressed ones are a table of chunk count + 1 offsets, relative to the start
+    // of the samples, then each chunk coded on its own.
+    constexpr uint32_t TAPE_FILE_VERSION = 1;
+    constexpr uint32_t TAPE_FILE_COMPRESSED = 0x1;
+
+    // Windows only maps views on 64k boundaries.
+    constexpr uint64_t TAPE_FILE_ALIGNMENT = 65536;
+
+    struct TapeFileHeader
+    {
+        char Magic[4];
+        uint32_t Version;
+        uint32_t Flags;
+        uint32_t SampleRate;
+        uint64_t Length;
+        uint32_t PeakBinShift;
+        uint32_t StringCount;
+        uint64_t SpanCount;
+        uint64_t StringsOffset;
+        uint64_t SpansOffset;
+        uint64_t PeaksOffset;
+        uint64_t SamplesOffset;
+        uint64_t SamplesBytes;
+    };
+
+    struct TapePeakRecord
+    {
+        float Min;
+        float Max;
+        double SumSquares;
+        uint32_t Count;
+        uint32_t Reserved;
+    };
+
+    // How chunks of samples and the span list are coded in the file.
+    namespace TapeCoding
+    {
+        // A TAPE_CHUNK_SIZE chunk as the differences between neighbouring samples, zigzagged
+        // and Rice coded, keeping every bit including NaN payloads and the sign of zero.
+        // Falls back to the raw samples for noise that won't compress.
+        void EncodeChunk(const float* samples, std::vector<uint8_t>& out);
+
+        // False if the chunk is cut short or isn't one EncodeChunk writes.
+        bool DecodeChunk(const uint8_t* data, size_t size, float* samples);
+
+        // Seven bits a byte, lowest first, the top bit set on all but the last.
+        void WriteVarint(std::vector<uint8_t>& out, uint64_t value);
+
+        // Reads from pos and moves it past the varint. False if it runs off the end.
+        bool ReadVarint(const std::vector<uint8_t>& data, size_t& pos, uint64_t& value);
+    }
+
+    class TapeFile
+    {
+    public:
+        // Game thread. The audio thread must not be recording onto the tape while it is
+        // saved. Written to a temporary file first so a failed save never leaves half a
+        // tape behind. Compression is lossless, deltas of the samples Rice coded.
+        static bool Save(
+            RecordBuffer& buffer,
+            uint32_t sampleRate,
+            AnnotationStore& annotations,
+            const std::string& path,
+            bool compress,
+            std::string& error);
+
+        // Game thread. Long uncompressed tapes are mapped from the file rather than read,
+        // so load instantly and keep the file open until the tape is dropped.
+        static bool Load(
+            const std::string& path,
+            AnnotationStore& annotations,
+            std::unique_ptr<RecordBuffer>& buffer,
+            uint32_t& sampleRate,
+            std::string& error);
+    };
+}
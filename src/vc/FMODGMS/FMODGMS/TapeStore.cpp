@@ -0,0 +1,539 @@
+#include "TapeStore.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace Cassette;
+
+namespace
+{
+    constexpr size_t TAPE_CHUNK_MASK = TAPE_CHUNK_SIZE - 1;
+
+    // How far ahead to keep paged in at full speed, in samples. Scaled by the tape's speed.
+    constexpr double STREAM_LOOKAHEAD = 96000.0;
+
+    constexpr auto STREAM_INTERVAL = std::chrono::milliseconds(5);
+}
+
+TapeStore::TapeStore(size_t length) :
+    m_length(length),
+    m_chunkCount(std::max((length + TAPE_CHUNK_SIZE - 1) >> TAPE_CHUNK_SHIFT, static_cast<size_t>(1))),
+    m_spilled(m_chunkCount > TAPE_RESIDENT_CHUNKS)
+{
+    const size_t slotCount = m_spilled ? TAPE_RESIDENT_CHUNKS : m_chunkCount;
+
+    m_slots.resize(slotCount * TAPE_CHUNK_SIZE);
+    m_slotChunks.resize(slotCount, NO_SLOT);
+    m_slotDirty = std::make_unique<std::atomic<bool>[]>(slotCount);
+    m_chunkSlots = std::make_unique<std::atomic<int32_t>[]>(m_chunkCount);
+
+    for (size_t slot = 0; slot < slotCount; slot++)
+    {
+        m_slotDirty[slot].store(false, std::memory_order_relaxed);
+    }
+
+    // Short tapes keep every chunk in the slot of the same number for good.
+    for (size_t chunk = 0; chunk < m_chunkCount; chunk++)
+    {
+        const int32_t slot = m_spilled ? NO_SLOT : static_cast<int32_t>(chunk);
+        m_chunkSlots[chunk].store(slot, std::memory_order_relaxed);
+
+        if (!m_spilled)
+        {
+            m_slotChunks[chunk] = slot;
+        }
+    }
+}
+
+TapeStore::~TapeStore()
+{
+    this->Close();
+}
+
+bool TapeStore::Open(std::string& error)
+{
+    if (!m_spilled || m_view != nullptr)
+    {
+        return true;
+    }
+
+    const uint64_t bytes = static_cast<uint64_t>(m_chunkCount) * TAPE_CHUNK_SIZE * sizeof(float);
+    if (!this->CreateMapping(bytes, error))
+    {
+        this->Close();
+        return false;
+    }
+
+    this->StartStreaming();
+    return true;
+}
+
+bool TapeStore::OpenFile(const std::string& path, uint64_t offset, std::string& error)
+{
+    if (!m_spilled)
+    {
+        // Small enough to read straight into memory and be done with the file, which only
+        // needs to hold the samples.
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            error = "Could not open tape file";
+            return false;
+        }
+
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char*>(m_slots.data()), static_cast<std::streamsize>(m_length * sizeof(float)));
+        if (!file)
+        {
+            error = "Could not read tape file";
+            return false;
+        }
+
+        return true;
+    }
+
+    if (m_view != nullptr)
+    {
+        error = "Tape already open";
+        return false;
+    }
+
+    const uint64_t bytes = static_cast<uint64_t>(m_chunkCount) * TAPE_CHUNK_SIZE * sizeof(float);
+    if (!this->MapFile(path, offset, bytes, error))
+    {
+        this->Close();
+        return false;
+    }
+
+    this->StartStreaming();
+    return true;
+}
+
+void TapeStore::StartStreaming()
+{
+    // Have the start of the tape ready before the first callback.
+    this->Stream();
+
+    m_stopping = false;
+    m_streamer = std::thread(&TapeStore::StreamLoop, this);
+}
+
+void TapeStore::ReadChunk(size_t chunk, float* out)
+{
+    std::lock_guard<std::mutex> lock(m_pagingMutex);
+
+    const int32_t slot = m_chunkSlots[chunk].load();
+    if (slot != NO_SLOT)
+    {
+        memcpy(out, this->GetSlot(slot), TAPE_CHUNK_SIZE * sizeof(float));
+    }
+    else if (m_view != nullptr)
+    {
+        memcpy(out, m_view + chunk * TAPE_CHUNK_SIZE, TAPE_CHUNK_SIZE * sizeof(float));
+    }
+    else
+    {
+        std::fill(out, out + TAPE_CHUNK_SIZE, 0.f);
+    }
+}
+
+void TapeStore::WriteChunk(size_t chunk, const float* samples)
+{
+    std::lock_guard<std::mutex> lock(m_pagingMutex);
+
+    if (m_view != nullptr)
+    {
+        memcpy(m_view + chunk * TAPE_CHUNK_SIZE, samples, TAPE_CHUNK_SIZE * sizeof(float));
+    }
+
+    const int32_t slot = m_chunkSlots[chunk].load();
+    if (slot != NO_SLOT)
+    {
+        memcpy(this->GetSlot(slot), samples, TAPE_CHUNK_SIZE * sizeof(float));
+    }
+}
+
+#ifdef _WIN32
+
+bool TapeStore::CreateMapping(uint64_t bytes, std::string& error)
+{
+    char dir[MAX_PATH];
+    char path[MAX_PATH];
+    if (GetTempPathA(MAX_PATH, dir) == 0 || GetTempFileNameA(dir, "tap", 0, path) == 0)
+    {
+        error = "Could not name tape file";
+        return false;
+    }
+
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        error = "Could not create tape file";
+        return false;
+    }
+
+    m_file = file;
+
+    // A fresh mapping past the end of the file grows it with zeros, blank tape.
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(bytes >> 32), static_cast<DWORD>(bytes & 0xFFFFFFFF), nullptr);
+    if (mapping == nullptr)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    m_mapping = mapping;
+
+    m_view = static_cast<float*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(bytes)));
+    if (m_view == nullptr)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    return true;
+}
+
+bool TapeStore::MapFile(const std::string& path, uint64_t offset, uint64_t bytes, std::string& error)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        error = "Could not open tape file";
+        return false;
+    }
+
+    m_file = file;
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    m_mapping = mapping;
+
+    m_view = static_cast<float*>(MapViewOfFile(mapping, FILE_MAP_COPY,
+        static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset & 0xFFFFFFFF), static_cast<SIZE_T>(bytes)));
+    if (m_view == nullptr)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    return true;
+}
+
+void TapeStore::Unmap()
+{
+    if (m_view != nullptr)
+    {
+        UnmapViewOfFile(m_view);
+        m_view = nullptr;
+    }
+
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+
+    if (m_file != nullptr)
+    {
+        CloseHandle(m_file);
+        m_file = nullptr;
+    }
+}
+
+#else
+
+bool TapeStore::CreateMapping(uint64_t bytes, std::string& error)
+{
+    std::error_code tempError;
+    std::string path = (std::filesystem::temp_directory_path(tempError) / "tapXXXXXX").string();
+    const int file = tempError ? -1 : mkstemp(path.data());
+    if (file == -1)
+    {
+        error = "Could not create tape file";
+        return false;
+    }
+
+    // Out of the directory straight away, the space goes once the file is closed.
+    unlink(path.c_str());
+    m_file = file;
+
+    // Growing the file fills it with zeros, blank tape.
+    if (ftruncate(file, static_cast<off_t>(bytes)) != 0)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(bytes), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    m_view = static_cast<float*>(view);
+    m_viewBytes = static_cast<size_t>(bytes);
+    return true;
+}
+
+bool TapeStore::MapFile(const std::string& path, uint64_t offset, uint64_t bytes, std::string& error)
+{
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file == -1)
+    {
+        error = "Could not open tape file";
+        return false;
+    }
+
+    m_file = file;
+
+    // Private writes never reach the file, the same as a copy on write view.
+    void* view = mmap(nullptr, static_cast<size_t>(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, static_cast<off_t>(offset));
+    if (view == MAP_FAILED)
+    {
+        error = "Could not map tape file";
+        return false;
+    }
+
+    m_view = static_cast<float*>(view);
+    m_viewBytes = static_cast<size_t>(bytes);
+    return true;
+}
+
+void TapeStore::Unmap()
+{
+    if (m_view != nullptr)
+    {
+        munmap(m_view, m_viewBytes);
+        m_view = nullptr;
+        m_viewBytes = 0;
+    }
+
+    if (m_file != -1)
+    {
+        close(m_file);
+        m_file = -1;
+    }
+}
+
+#endif
+
+void TapeStore::Close()
+{
+    if (m_streamer.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_streamerMutex);
+            m_stopping = true;
+        }
+
+        m_streamerWake.notify_all();
+        m_streamer.join();
+    }
+
+    this->Unmap();
+}
+
+uint64_t TapeStore::GetMissCount() const
+{
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+void TapeStore::BeginAccess()
+{
+    m_accessEpoch.fetch_add(1);
+}
+
+void TapeStore::EndAccess()
+{
+    m_accessEpoch.fetch_add(1, std::memory_order_release);
+}
+
+void TapeStore::SetHead(size_t pos, double velocity)
+{
+    m_headPos.store(pos, std::memory_order_relaxed);
+    m_headVelocity.store(velocity, std::memory_order_relaxed);
+}
+
+float* TapeStore::GetSlot(int32_t slot)
+{
+    return m_slots.data() + static_cast<size_t>(slot) * TAPE_CHUNK_SIZE;
+}
+
+float TapeStore::Read(size_t pos) const
+{
+    const int32_t slot = m_chunkSlots[pos >> TAPE_CHUNK_SHIFT].load();
+    if (slot == NO_SLOT)
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return 0.f;
+    }
+
+    return m_slots[static_cast<size_t>(slot) * TAPE_CHUNK_SIZE + (pos & TAPE_CHUNK_MASK)];
+}
+
+void TapeStore::Write(size_t pos, float value)
+{
+    const int32_t slot = m_chunkSlots[pos >> TAPE_CHUNK_SHIFT].load();
+    if (slot == NO_SLOT)
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    m_slots[static_cast<size_t>(slot) * TAPE_CHUNK_SIZE + (pos & TAPE_CHUNK_MASK)] = value;
+
+    // Published to the streamer by EndAccess.
+    if (!m_slotDirty[slot].load(std::memory_order_relaxed))
+    {
+        m_slotDirty[slot].store(true, std::memory_order_relaxed);
+    }
+}
+
+const float* TapeStore::ReadRun(size_t pos, size_t& count) const
+{
+    const size_t chunkEnd = (pos | TAPE_CHUNK_MASK) + 1;
+    count = std::min(chunkEnd, m_length) - pos;
+
+    const int32_t slot = m_chunkSlots[pos >> TAPE_CHUNK_SHIFT].load();
+    if (slot == NO_SLOT)
+    {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    return m_slots.data() + static_cast<size_t>(slot) * TAPE_CHUNK_SIZE + (pos & TAPE_CHUNK_MASK);
+}
+
+void TapeStore::StreamLoop()
+{
+    std::unique_lock<std::mutex> lock(m_streamerMutex);
+    while (!m_stopping)
+    {
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> paging(m_pagingMutex);
+            this->Stream();
+        }
+        lock.lock();
+
+        m_streamerWake.wait_for(lock, STREAM_INTERVAL, [this] { return m_stopping.load(); });
+    }
+}
+
+void TapeStore::Stream()
+{
+    const size_t slotCount = m_slotChunks.size();
+    const size_t headChunk = std::min(m_headPos.load(std::memory_order_relaxed) >> TAPE_CHUNK_SHIFT, m_chunkCount - 1);
+    const double velocity = m_headVelocity.load(std::memory_order_relaxed);
+
+    // Chunks in order of need: under the head, the ones it is heading into, then the rest
+    // behind it so a short rewind is still in memory. The tape loops so the ends wrap.
+    const size_t ahead = std::min(slotCount - 2, 1 + static_cast<size_t>(std::abs(velocity) * STREAM_LOOKAHEAD / TAPE_CHUNK_SIZE));
+    const size_t forward = velocity < 0.0 ? m_chunkCount - 1 : 1;
+    const size_t backward = m_chunkCount - forward;
+
+    size_t wanted[TAPE_RESIDENT_CHUNKS];
+    wanted[0] = headChunk;
+    for (size_t i = 1; i < slotCount; i++)
+    {
+        const size_t step = i <= ahead ? forward : backward;
+        const size_t from = i == ahead + 1 ? headChunk : wanted[i - 1];
+        wanted[i] = (from + step) % m_chunkCount;
+    }
+
+    for (size_t i = 0; i < slotCount; i++)
+    {
+        const size_t chunk = wanted[i];
+        if (m_chunkSlots[chunk].load(std::memory_order_relaxed) != NO_SLOT)
+        {
+            continue;
+        }
+
+        // Every slot is wanted once they are all filled, so reuse one holding a chunk we
+        // no longer need.
+        int32_t victim = NO_SLOT;
+        for (size_t slot = 0; slot < slotCount && victim == NO_SLOT; slot++)
+        {
+            const int32_t held = m_slotChunks[slot];
+            if (held == NO_SLOT || std::find(wanted, wanted + slotCount, static_cast<size_t>(held)) == wanted + slotCount)
+            {
+                victim = static_cast<int32_t>(slot);
+            }
+        }
+
+        if (victim == NO_SLOT || m_stopping)
+        {
+            return;
+        }
+
+        this->PageOut(victim);
+        this->PageIn(chunk, victim);
+    }
+}
+
+void TapeStore::WaitForAudio()
+{
+    // Pairs with BeginAccess, the audio thread either saw the slot unpublished or is
+    // still inside the access that may be using it.
+    const uint64_t epoch = m_accessEpoch.load();
+    if ((epoch & 1) == 0)
+    {
+        return;
+    }
+
+    while (m_accessEpoch.load(std::memory_order_acquire) == epoch && !m_stopping)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void TapeStore::PageOut(int32_t slot)
+{
+    const int32_t chunk = m_slotChunks[slot];
+    if (chunk == NO_SLOT)
+    {
+        return;
+    }
+
+    m_chunkSlots[chunk].store(NO_SLOT);
+    this->WaitForAudio();
+
+    if (m_slotDirty[slot].exchange(false, std::memory_order_acquire))
+    {
+        memcpy(m_view + static_cast<size_t>(chunk) * TAPE_CHUNK_SIZE, this->GetSlot(slot), TAPE_CHUNK_SIZE * sizeof(float));
+    }
+
+    m_slotChunks[slot] = NO_SLOT;
+}
+
+void TapeStore::PageIn(size_t chunk, int32_t slot)
+{
+    // Reading the mapping may fault in pages from disk, fine on this thread.
+    memcpy(this->GetSlot(slot), m_view + chunk * TAPE_CHUNK_SIZE, TAPE_CHUNK_SIZE * sizeof(float));
+
+    m_slotDirty[slot].store(false, std::memory_order_relaxed);
+    m_slotChunks[slot] = static_cast<int32_t>(chunk);
+    m_chunkSlots[chunk].store(slot, std::memory_order_release);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Cassette
+{
+    // Tape is paged in and out of memory in chunks of this many samples.
+    constexpr size_t TAPE_CHUNK_SHIFT = 15;
+    constexpr size_t TAPE_CHUNK_SIZE = static_cast<size_t>(1) << TAPE_CHUNK_SHIFT;
+
+    // Tapes longer than this many chunks spill to disk and only keep this many in memory,
+    // a little under 7 seconds at 48kHz.
+    constexpr size_t TAPE_RESIDENT_CHUNKS = 10;
+
+    // Samples behind a RecordBuffer. Short tapes sit wholly in memory. Longer ones live in
+    // a temporary memory-mapped file and a streaming thread keeps the chunks around the
+    // head in memory, reading further ahead the faster the tape is moving.
+    //
+    // The audio thread only ever touches chunks that are in memory so never waits on the
+    // disk. Anything not paged in yet reads as silence and writes to it are dropped.
+    class TapeStore
+    {
+    public:
+        TapeStore(size_t length);
+        ~TapeStore();
+
+        TapeStore(const TapeStore&) = delete;
+        TapeStore& operator=(const TapeStore&) = delete;
+
+        // Creates the backing file and starts streaming, nothing to do for short tapes.
+        bool Open(std::string& error);
+
+        // Streams from offset bytes into an existing file instead, which has to hold every
+        // chunk in full and start on a 64k boundary. Mapped copy on write so recording over
+        // the tape never changes the file. Short tapes are read in once and only need the
+        // samples themselves.
+        bool OpenFile(const std::string& path, uint64_t offset, std::string& error);
+
+        // Game thread. Whole chunks of tape whether or not they are paged in. Never call
+        // while the audio thread might be writing to the same chunk.
+        void ReadChunk(size_t chunk, float* out);
+        void WriteChunk(size_t chunk, const float* samples);
+        size_t GetChunkCount() const { return m_chunkCount; }
+
+        size_t GetSize() const { return m_length; }
+        bool IsSpilled() const { return m_spilled; }
+
+        // Reads and writes that found their chunk paged out.
+        uint64_t GetMissCount() const;
+
+        // Audio thread. Every read or write has to happen between these so the streamer
+        // knows when a chunk it has paged out is no longer being used.
+        void BeginAccess();
+        void EndAccess();
+
+        // Audio thread. Where the head is and how fast it moves in samples a sample.
+        void SetHead(size_t pos, double velocity);
+
+        // Audio thread.
+        float Read(size_t pos) const;
+        void Write(size_t pos, float value);
+
+        // Audio thread. Samples from pos to the end of its chunk, or null when the chunk
+        // is paged out. count is set either way.
+        const float* ReadRun(size_t pos, size_t& count) const;
+
+    private:
+        static constexpr int32_t NO_SLOT = -1;
+
+        size_t m_length;
+        size_t m_chunkCount;
+        bool m_spilled;
+
+        // Chunk sized slots of memory, and for each chunk of tape which slot holds it.
+        std::vector<float> m_slots;
+        std::unique_ptr<std::atomic<int32_t>[]> m_chunkSlots;
+        std::unique_ptr<std::atomic<bool>[]> m_slotDirty;
+
+        // Owned by the streamer, which chunk each slot holds.
+        std::vector<int32_t> m_slotChunks;
+
+        // Odd while the audio thread is between BeginAccess and EndAccess.
+        std::atomic<uint64_t> m_accessEpoch = 0;
+
+        std::atomic<size_t> m_headPos = 0;
+        std::atomic<double> m_headVelocity = 0.0;
+        mutable std::atomic<uint64_t> m_misses = 0;
+
+#ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#else
+        int m_file = -1;
+        size_t m_viewBytes = 0;
+#endif
+        float* m_view = nullptr;
+
+        std::thread m_streamer;
+        std::mutex m_streamerMutex;
+
+        // Held while the streamer pages so the game thread can read and write whole chunks.
+        std::mutex m_pagingMutex;
+        std::condition_variable m_streamerWake;
+        std::atomic<bool> m_stopping = false;
+
+        float* GetSlot(int32_t slot);
+        void StartStreaming();
+        void StreamLoop();
+        void Stream();
+        void PageOut(int32_t slot);
+        void PageIn(size_t chunk, int32_t slot);
+        void WaitForAudio();
+        void Close();
+
+        // Platform specific, leave whatever they managed to open for Unmap to close.
+        bool CreateMapping(uint64_t bytes, std::string& error);
+        bool MapFile(const std::string& path, uint64_t offset, uint64_t bytes, std::string& error);
+        void Unmap();
+    };
+}
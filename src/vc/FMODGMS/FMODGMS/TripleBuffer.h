@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest copy of a value from one writer thread to one reader thread, e.g.
+// telemetry from a DSP callback to GML. Neither side ever waits and the reader never
+// sees a half written value, it just skips any it was too slow to pick up.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer only. Holds an older value, fill all of it before publishing.
+    T& Back()
+    {
+        return m_slots[m_back];
+    }
+
+    // Writer only. Swaps the back slot for the spare one.
+    void Publish()
+    {
+        m_back = m_spare.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Reader only. The latest published value, stays put until the next Read.
+    const T& Read()
+    {
+        if (m_spare.load(std::memory_order_relaxed) & FRESH)
+        {
+            m_front = m_spare.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        return m_slots[m_front];
+    }
+
+private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH = 0x4;
+
+    std::array<T, 3> m_slots = {};
+
+    uint8_t m_back = 0;
+    uint8_t m_front = 1;
+
+    // Index of the slot in the middle, flagged when the writer has put something new there.
+    std::atomic<uint8_t> m_spare = 2;
+};
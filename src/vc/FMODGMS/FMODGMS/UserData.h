@@ -1,7 +1,27 @@
 #pragma once
 #include <cstdint>
+#include <memory>
+#include "AnnotationStore.h"
 
 struct SoundUserData
 {
     uint32_t Id;
-};
\ No newline at end of file
+};
+
+struct ChannelUserData
+{
+    AnnotationCursor Cursor;
+};
+
+namespace FMOD
+{
+    class Channel;
+}
+
+// An entry in the channel list. Channel is null until a sound is first played on it, then
+// FMOD's user data for it points at UserData.
+struct ChannelSlot
+{
+    FMOD::Channel* Channel = nullptr;
+    std::unique_ptr<ChannelUserData> UserData;
+};
@@ -29,8 +29,15 @@
 #include "Cassette.h"
 #include "AnnotationStore.h"
 #include "UserData.h"
+#include "SlotMap.h"
+#include "SpectrumAnalyzer.h"
+#include "SpectrumView.h"
+#include "FFTPlans.h"
+#include "SpectrogramJob.h"
+#include "BeatTracker.h"
 #include "ConstantReader.h"
 #include "SpeechSynth.h"
+#include "SynthVoicePool.h"
 
 #pragma region Global variables
 
@@ -38,12 +45,9 @@ ConstantReader Constants::Globals("C:\\users\\daslocom\\tmp\\cassette_globals.tx
 
 // System Stuff
 FMOD::System *sys = NULL;
-std::unordered_map <std::size_t, FMOD::Channel*> channelList;
-std::size_t nChannels = 0;
-std::unordered_map <std::size_t, FMOD::Sound*> soundList;
-std::size_t nSounds = 0;
-std::unordered_map <std::size_t, FMOD::DSP*> effectList;
-std::size_t nEffects = 0;
+SlotMap<ChannelSlot> channelList;
+SlotMap<FMOD::Sound*> soundList;
+SlotMap<FMOD::DSP*> effectList;
 FMOD::ChannelGroup *masterGroup;
 FMOD_RESULT result;
 const char* errorMessage;
@@ -55,13 +59,22 @@ FMOD_CREATESOUNDEXINFO *soundParams = new FMOD_CREATESOUNDEXINFO();
 std::string dlsName;
 
 // Spectrum DSP Stuff
-FMOD::DSP *fftdsp = NULL;
-float domFreq;
 int playbackRate = 48000;
-int windowSize = 128;
-int nyquist = windowSize / 2;
-std::vector <float> binValues(nyquist);
-FMOD_DSP_PARAMETER_FFT *fftParams;
+std::unique_ptr<SpectrumAnalyzer> masterAnalyzer;
+SpectrumView spectrumView;
+SlotMap<std::unique_ptr<SpectrumAnalyzer>> spectrumAnalyzers;
+
+// FMODGMS_Util_FFT and FMODGMS_Util_STFT
+FFTPlanCache fftPlans;
+std::size_t stftPoints = 1024;
+std::size_t stftHop = 512;
+bool stftNormalize = false;
+
+// Beat tracking Stuff
+std::unique_ptr<BeatTrackerDSP> beatTracker;
+
+// Spectrogram Stuff
+SlotMap<std::unique_ptr<SpectrogramJob>> spectrogramJobs;
 
 // Unicode stuff
 //std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> u16Converter;
@@ -70,6 +83,37 @@ AnnotationStore annotationStore;
 
 std::unique_ptr<Cassette::CassetteDSP> cassetteDsp;
 std::unique_ptr<SpeechSynthDSP> speechSynthDsp;
+UtteranceHandle defaultUtterance = INVALID_UTTERANCE;
+std::string defaultSpeaker;
+std::unique_ptr<SynthVoicePool> synthVoicePool;
+
+// Handles come from GML as doubles, anything that can't be one never matches.
+static SlotHandle ToHandle(double value)
+{
+	return (value >= 0.0 && value < (double)INVALID_SLOT_HANDLE) ? (SlotHandle)round(value) : INVALID_SLOT_HANDLE;
+}
+
+static double TooManySounds(FMOD::Sound* sound)
+{
+	sound->release();
+	errorMessage = "Too many sounds.";
+	return GMS_error;
+}
+
+// Their DSPs come off the master group first, the mixer would otherwise keep calling into
+// the freed objects.
+static void DestroyCassette()
+{
+	if (cassetteDsp != nullptr)
+		cassetteDsp->Unregister(sys);
+
+	if (synthVoicePool != nullptr)
+		synthVoicePool->Unregister(sys);
+
+	cassetteDsp.reset();
+	speechSynthDsp.reset();
+	synthVoicePool.reset();
+}
 
 #pragma endregion
 
@@ -88,16 +132,10 @@ GMexport double FMODGMS_Sys_Initialize(double maxChan)
 	//Init System
 	int mc = (int)round(maxChan);
 
-	for (int i = 0; i < nyquist; i++)
-	{
-		binValues[i] = 0;
-	}
-
 	result = sys->init(mc, FMOD_INIT_NORMAL, 0);
 
 	soundParams->cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
 	soundParams->dlsname = 0;
-	fftdsp = NULL;
 	
 	//if (result != FMOD_OK)
 	return FMODGMS_Util_ErrorChecker();
@@ -119,32 +157,32 @@ GMexport double FMODGMS_Sys_Update()
 
 	const bool forceRefresh = false;
 	Constants::Globals.Refresh(forceRefresh);
-	
-	if (speechSynthDsp != nullptr)
-	{
-		speechSynthDsp->Tick();
-	}
 
-	//Check to see if anything is playing before gathering spectrum data
-	bool playState = false;
-	masterGroup->isPlaying(&playState);
+	if (cassetteDsp != nullptr)
+		cassetteDsp->UpdateEnvironmentAnnotation();
 
-	if (playState && fftdsp != NULL)
+	std::string error;
+	if (masterAnalyzer != nullptr)
 	{
-		result = fftdsp->getParameterData(FMOD_DSP_FFT_SPECTRUMDATA, (void **)&fftParams, 0, 0, 0);
-		if (result != FMOD_OK)
-			return FMODGMS_Util_ErrorChecker();
-		
-		int numChan = fftParams->numchannels;
+		//Check to see if anything is playing before gathering spectrum data
+		bool playState = false;
+		masterGroup->isPlaying(&playState);
 
-		for (int j = 0; j < nyquist; j++)
+		if (playState && !masterAnalyzer->Update(error))
 		{
-			binValues[j] = 0;
-
-			for (int i = 0; i < numChan; i++)
-				binValues[j] += fftParams->spectrum[i][j];
+			errorMessageAlloc = error;
+			errorMessage = errorMessageAlloc.c_str();
+			return GMS_error;
+		}
+	}
 
-			binValues[j] /= numChan;
+	for (std::unique_ptr<SpectrumAnalyzer>& analyzer : spectrumAnalyzers)
+	{
+		if (!analyzer->Update(error))
+		{
+			errorMessageAlloc = error;
+			errorMessage = errorMessageAlloc.c_str();
+			return GMS_error;
 		}
 	}
 
@@ -154,40 +192,40 @@ GMexport double FMODGMS_Sys_Update()
 // Closes and releases the system
 GMexport double FMODGMS_Sys_Close()
 {
+	// Stop analysing sounds before they go
+	spectrogramJobs.Clear();
+
 	// Free sounds
-	for (auto itr = soundList.cbegin(); itr != soundList.cend(); ++itr)
+	for (FMOD::Sound* sound : soundList)
 	{
 		SoundUserData* userData;
-		if (itr->second->getUserData(reinterpret_cast<void **>(&userData)) == FMOD_OK)
+		if (sound->getUserData(reinterpret_cast<void **>(&userData)) == FMOD_OK)
 		{
 			delete userData;
 		}
 
-		result = itr->second->release();
+		result = sound->release();
 		if (result != FMOD_OK)
 			return FMODGMS_Util_ErrorChecker();
 	}
-	soundList.clear();
-	nSounds = 0;
+	soundList.Clear();
 
 	// Free DSP
-	if (fftdsp != NULL)
-	{
-		result = masterGroup->removeDSP(fftdsp);
-		if (result != FMOD_OK)
-			return FMODGMS_Util_ErrorChecker();
+	masterAnalyzer.reset();
+	spectrumAnalyzers.Clear();
+	DestroyCassette();
 
-		result = fftdsp->release();
-		if (result != FMOD_OK)
-			return FMODGMS_Util_ErrorChecker();
-	}
+	if (beatTracker != nullptr)
+		beatTracker->Unregister(sys);
+
+	beatTracker.reset();
 	
 	// Free system
 	result = sys->close();
 	if (result != FMOD_OK)
 		return FMODGMS_Util_ErrorChecker();
 
-	nChannels = 0;
+	channelList.Clear();
 
 	result = sys->release();
 	if (result != FMOD_OK)
@@ -300,16 +338,16 @@ GMexport double FMODGMS_Sys_Get_OutputMode()
 	return (double)output;
 }
 
-// Gets the highest index in soundList (number of sounds - 1)
+// Gets one more than the highest slot index in soundList, freed slots are reused before it grows
 GMexport double FMODGMS_Sys_Get_MaxSoundIndex()
 {
-	return nSounds;
+	return (double)soundList.GetSlotCount();
 }
 
-// Returns the highest index in channelList (number of channels - 1)
+// Returns one more than the highest slot index in channelList, freed slots are reused before it grows
 GMexport double FMODGMS_Sys_Get_MaxChannelIndex()
 {
-	return nChannels;
+	return (double)channelList.GetSlotCount();
 }
 
 // Returns the DSP buffer size
@@ -337,535 +375,671 @@ GMexport double FMODGMS_Sys_Get_NumDSPBuffers()
 // Init Spectrum DSP
 GMexport double FMODGMS_FFT_Init(double wSize)
 {
-	windowSize = (int)round(wSize);
-
 	result = sys->getMasterChannelGroup(&masterGroup);
 	if (result != FMOD_OK)
 		return FMODGMS_Util_ErrorChecker();
 
-	result = sys->createDSPByType(FMOD_DSP_TYPE_FFT, &fftdsp);
-	if (result != FMOD_OK)
-		return FMODGMS_Util_ErrorChecker();
-
-	result = masterGroup->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL, fftdsp);
-	if (result != FMOD_OK)
-		return FMODGMS_Util_ErrorChecker();
-
 	result = sys->getSoftwareFormat(&playbackRate, 0, 0);
 	if (result != FMOD_OK)
 		return FMODGMS_Util_ErrorChecker();
 
-	result = fftdsp->setParameterInt(FMOD_DSP_FFT_WINDOWTYPE, FMOD_DSP_FFT_WINDOW_TRIANGLE);
-	if (result != FMOD_OK)
-		return FMODGMS_Util_ErrorChecker();
+	auto analyzer = std::make_unique<SpectrumAnalyzer>();
+	std::string error;
+	if (!analyzer->Create(sys, (int)round(wSize), FMOD_DSP_FFT_WINDOW_TRIANGLE, error)
+		|| !analyzer->Attach(masterGroup, FMOD_CHANNELCONTROL_DSP_TAIL, error))
+	{
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
 
-	result = fftdsp->setParameterInt(FMOD_DSP_FFT_WINDOWSIZE, windowSize);
-	return FMODGMS_Util_ErrorChecker();
+	masterAnalyzer = std::move(analyzer);
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-// Sets the FFT window size (winodw size = 2 * nyquist = 2 * number of bins) 
+// Sets the FFT window size, a power of two from 128 to 16384 (window size = 2 * number of bins)
 // FMODGMS_FFT_Get_NumBins should be called after this function to ensure the game know what the new number of bins are
-// NOTE: Doesn't work yet
 GMexport double FMODGMS_FFT_Set_WindowSize(double size)
 {
-	if (fftdsp == NULL)
+	if (masterAnalyzer == nullptr)
 	{
 		errorMessage = "FFT not initialized";
 		return GMS_error;
 	}
-	windowSize = (int)round(size);
-	nyquist = windowSize / 2;
-	binValues.clear();
-	for (int i = 0; i < nyquist; i++)
+
+	std::string error;
+	if (!masterAnalyzer->SetWindowSize((int)round(size), error))
 	{
-		binValues[i] = 0;
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
 	}
 
-	result = fftdsp->setParameterInt(FMOD_DSP_FFT_WINDOWSIZE, windowSize);
-	return FMODGMS_Util_ErrorChecker();
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
 // Returns the domainant frequency
 GMexport double FMODGMS_FFT_Get_DominantFrequency()
 {
-	if (fftdsp == NULL)
+	if (masterAnalyzer == nullptr)
 	{
 		errorMessage = "FFT not initialized";
 		return GMS_error;
 	}
-	result = fftdsp->getParameterFloat(FMOD_DSP_FFT_DOMINANT_FREQ, &domFreq, 0, 0);
-	if (result != FMOD_OK)
-		return FMODGMS_Util_ErrorChecker();
-	else
-		return domFreq;
+
+	float frequency;
+	std::string error;
+	if (!masterAnalyzer->GetDominantFrequency(frequency, error))
+	{
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return frequency;
 }
 
 // Returns the value of a certain bin in the spectrum
 GMexport double FMODGMS_FFT_Get_BinValue(double index)
 {
-	if (fftdsp == NULL)
+	if (masterAnalyzer == nullptr)
 	{
 		errorMessage = "FFT not initialized";
 		return GMS_error;
 	}
 	unsigned int i = (unsigned int)index;
 
-	if (i < binValues.size())
-		return binValues[i];
+	if (i < masterAnalyzer->GetBinCount())
+		return masterAnalyzer->GetBins()[i];
 	else
 		return GMS_error;
 }
 
-// Returns the number of nims in the spectrum data (= nyquist = windowSize / 2)
-GMexport double FMODGMS_FFT_Get_NumBins()
+// Sets how FMODGMS_FFT_Get_Spectrum_Buffer shapes the spectrum.
+// scale is 0 for linear magnitudes or 1 for decibels, silence reads as -100dB.
+// bands is 0 for every bin, 1 for octave bands or 3 for third octave bands, each the RMS of its bins.
+// smoothing, from 0 up to 1, is how much of its value from the last call each value keeps.
+GMexport double FMODGMS_FFT_Set_SpectrumMode(double scale, double bands, double smoothing)
 {
-	if (fftdsp == NULL)
+	const int sc = (int)round(scale);
+	const int b = (int)round(bands);
+	if (sc < 0 || sc > 1)
 	{
-		errorMessage = "FFT not initialized";
+		errorMessage = "Invalid spectrum scale";
 		return GMS_error;
 	}
-	return (double)nyquist;
-}
 
-// Normalizes the current spectrum data, use before getting if desirable
-GMexport double FMODGMS_FFT_Normalize()
-{
-	if (fftdsp == NULL)
+	if (b != 0 && b != 1 && b != 3)
 	{
-		errorMessage = "FFT not initialized";
+		errorMessage = "Invalid spectrum bands";
 		return GMS_error;
 	}
-	auto maxIterator = std::max_element(&binValues[0], &binValues[nyquist - 1]);
-	float maxVol = *maxIterator;
-	for (int i = 0; i < windowSize; i++)
+
+	if (smoothing < 0 || smoothing >= 1)
 	{
-		binValues[i] = binValues[i] / maxVol;
+		errorMessage = "Invalid spectrum smoothing";
+		return GMS_error;
 	}
-	return FMODGMS_Util_ErrorChecker();
-}
-
-#pragma endregion
 
-#pragma region Sound Functions
+	const SpectrumBands spectrumBands = b == 0 ? SpectrumBands::Bins : (b == 1 ? SpectrumBands::Octaves : SpectrumBands::ThirdOctaves);
+	spectrumView.Configure((SpectrumScale)sc, spectrumBands, (float)smoothing);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
 
-// Loads a sound and indexes it in soundList
-GMexport double FMODGMS_Snd_LoadSound(char* filename)
+// Returns how many values FMODGMS_FFT_Get_Spectrum_Buffer writes in the current mode
+GMexport double FMODGMS_FFT_Get_SpectrumCount()
 {
-	FMOD::Sound *sound = NULL;
-	//const auto params = FMOD_CREATESOUNDEXINFO();
-	result = sys->createSound(filename, FMOD_DEFAULT /*| FMOD_3D*/, soundParams, &sound);
-
-	// we cool?
-	double isOK = FMODGMS_Util_ErrorChecker();
-
-	// Yes, index the sound
-	if (isOK == GMS_true)
+	if (masterAnalyzer == nullptr)
 	{
-		const uint32_t soundId = nSounds;
-
-		auto userData = new SoundUserData();
-		userData->Id = soundId;
-
-		sound->setUserData(userData);
+		errorMessage = "FFT not initialized";
+		return GMS_error;
+	}
 
-		soundList.emplace(soundId, sound);
+	return (double)spectrumView.GetCount(masterAnalyzer->GetBinCount(), (uint32_t)playbackRate);
+}
 
-		nSounds++;
-		return soundId;
+// Fills a buffer of float32s with the whole spectrum, shaped as set by FMODGMS_FFT_Set_SpectrumMode,
+// in place of calling FMODGMS_FFT_Get_BinValue for every bin. Smoothing advances once per call.
+// Return value, if not error, is how many values were written.
+GMexport double FMODGMS_FFT_Get_Spectrum_Buffer(float* buffer, double count)
+{
+	if (masterAnalyzer == nullptr)
+	{
+		errorMessage = "FFT not initialized";
+		return GMS_error;
 	}
 
-	// No? Then don't index the new sound
-	else
+	if (count < 0)
+	{
+		errorMessage = "Invalid count";
 		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)spectrumView.Export(masterAnalyzer->GetBins(), masterAnalyzer->GetBinCount(), (uint32_t)playbackRate, buffer, (size_t)round(count));
 }
 
+// Returns the number of bins in the spectrum data (= nyquist = windowSize / 2)
+GMexport double FMODGMS_FFT_Get_NumBins()
+{
+	if (masterAnalyzer == nullptr)
+	{
+		errorMessage = "FFT not initialized";
+		return GMS_error;
+	}
+	return (double)masterAnalyzer->GetBinCount();
+}
 
-GMexport double FMODGMS_Snd_AnnotateSound(double inSoundId, char* annotations)
+// Normalizes the current spectrum data, use before getting if desirable
+GMexport double FMODGMS_FFT_Normalize()
 {
-	const auto soundId = (size_t)std::round(inSoundId);
-	const auto sound = soundList.find(soundId);
-	if (sound != soundList.end())
+	if (masterAnalyzer == nullptr)
 	{
-		if (annotationStore.ParseAddAnnotationList(soundId, annotations))
-		{
-			return GMS_true;
-		}
+		errorMessage = "FFT not initialized";
+		return GMS_error;
 	}
 
-	return GMS_false;
+	masterAnalyzer->Normalize();
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-// Loads a sound toa stream and indexes it in soundList
-GMexport double FMODGMS_Snd_LoadStream(char* filename)
-{
-	FMOD::Sound *sound;
-	result = sys->createStream(filename, FMOD_DEFAULT, soundParams, &sound);
+#pragma endregion
 
-	// we cool?
-	double isOK = FMODGMS_Util_ErrorChecker();
+#pragma region Analyzer Functions
 
-	// Yes, index the sound
-	if (isOK == GMS_true)
+SpectrumAnalyzer* GetAnalyzer(double analyzer)
+{
+	std::unique_ptr<SpectrumAnalyzer>* found = spectrumAnalyzers.Find(ToHandle(analyzer));
+	if (found == nullptr)
 	{
-		soundList.emplace(nSounds++, sound);
-		return nSounds - 1;
+		errorMessage = "Invalid analyzer.";
+		return nullptr;
 	}
 
-	// No? Then don't index the new sound
-	else
-		return GMS_error;
+	return found->get();
 }
 
-// Loads a sound, with optional advanced parameters, and indexes it in soundList.
-//
-// mode is FMOD_MODE bit flags.
-//
-// exInfo is an pointer to a buffer with data for FMOD_CREATESOUNDEXINFO.
-// Optional. To use all default values, pass 0 to the exInfo parameter itself.
-// The buffer must be 8 byte aligned. Values should be unsigned.
-// It must contain every value for FMOD_CREATESOUNDEXINFO in correct order as documented in fmod.
-// Use value 0 for default settings.
-GMexport double FMODGMS_Snd_LoadSound_Ext(char* location, double mode, uint64_t* exInfo)
+// Creates a spectrum analyzer alongside the FMODGMS_FFT one, with its own window size (a power of two
+// from 128 to 16384) and window type (0 rectangle, 1 triangle, 2 hamming, 3 hanning, 4 blackman,
+// 5 blackman-harris). It hears nothing until attached. Its bins are read in FMODGMS_Sys_Update.
+// Returns the analyzer's index.
+GMexport double FMODGMS_Analyzer_Create(double windowSize, double windowType)
 {
-	FMOD::Sound *sound = NULL;
-	FMOD_MODE _mode = FMOD_DEFAULT | (unsigned int)(mode+0.5);
-
-	//if exInfo is used, transfer data to struct and pass to createSound
-	if (exInfo != 0)
+	auto analyzer = std::make_unique<SpectrumAnalyzer>();
+	std::string error;
+	if (!analyzer->Create(sys, (int)round(windowSize), (FMOD_DSP_FFT_WINDOW)(int)round(windowType), error))
 	{
-		FMOD_CREATESOUNDEXINFO _exInfo;
-		_exInfo.cbsize =				(int)sizeof(_exInfo);
-		_exInfo.length =				(unsigned int)exInfo[0];
-		_exInfo.fileoffset =			(unsigned int)exInfo[1];
-		_exInfo.numchannels =			(int)exInfo[2];
-		_exInfo.defaultfrequency =		(int)exInfo[3];
-		_exInfo.format =				(FMOD_SOUND_FORMAT)exInfo[4];
-		_exInfo.decodebuffersize =		(unsigned int)exInfo[5];
-		_exInfo.initialsubsound =		(int)exInfo[6];
-		_exInfo.numsubsounds =			(int)exInfo[7];
-		_exInfo.inclusionlist =			(int*)exInfo[8];
-		_exInfo.inclusionlistnum =		(int)exInfo[9];
-		_exInfo.pcmreadcallback =		0; //not supported
-		_exInfo.pcmsetposcallback =		0; //not supported
-		_exInfo.nonblockcallback =		0; //not supported
-		_exInfo.dlsname =				(const char*)exInfo[13];
-		_exInfo.encryptionkey =			(const char*)exInfo[14];
-		_exInfo.maxpolyphony =			(int)exInfo[15];
-		_exInfo.userdata =				(void*)exInfo[16];
-		_exInfo.suggestedsoundtype =	(FMOD_SOUND_TYPE)exInfo[17];
-		_exInfo.fileuseropen =			0; //not supported
-		_exInfo.fileuserclose =			0; //not supported
-		_exInfo.fileuserread =			0; //not supported
-		_exInfo.fileuserseek =			0; //not supported
-		_exInfo.fileuserasyncread =		0; //not supported
-		_exInfo.fileuserasynccancel =	0; //not supported
-		_exInfo.fileuserdata =			(void*)exInfo[24];
-		_exInfo.filebuffersize =		(int)exInfo[25];
-		_exInfo.channelorder =			(FMOD_CHANNELORDER)exInfo[26];
-		_exInfo.channelmask =			(FMOD_CHANNELMASK)exInfo[27];
-		_exInfo.initialsoundgroup =		0; //not supported
-		_exInfo.initialseekposition =	(unsigned int)exInfo[29];
-		_exInfo.initialseekpostype =	(FMOD_TIMEUNIT)exInfo[30];
-		_exInfo.ignoresetfilesystem =	(int)exInfo[31];
-		_exInfo.audioqueuepolicy =		(unsigned int)exInfo[32];
-		_exInfo.minmidigranularity =	(unsigned int)exInfo[33];
-		_exInfo.nonblockthreadid =		(unsigned int)exInfo[34];
-		_exInfo.fsbguid =				0; //not supported
-		result = sys->createSound(location, _mode, &_exInfo, &sound);
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
 	}
-	else
-		result = sys->createSound(location, _mode, NULL, &sound);
-	
-	// we cool?
-	double isOK = FMODGMS_Util_ErrorChecker();
 
-	// Yes, index the sound
-	if (isOK == GMS_true)
+	const SlotHandle handle = spectrumAnalyzers.Insert(std::move(analyzer));
+	if (handle == INVALID_SLOT_HANDLE)
 	{
-		soundList.emplace(nSounds++, sound);
-		return nSounds - 1;
+		errorMessage = "Too many analyzers.";
+		return GMS_error;
 	}
 
-	// No? Then don't index the new sound
-	else
-		return GMS_error;
+	errorMessage = "No errors.";
+	return (double)handle;
 }
 
-// Unload a sound and removes it from soundList
-GMexport double FMODGMS_Snd_Unload(double index)
+static double AttachAnalyzer(SpectrumAnalyzer* analyzer, FMOD::ChannelControl* target, double postEffects)
 {
-	std::size_t i = (std::size_t)round(index);
-
-	if (soundList.count(i) == 1)
+	std::string error;
+	if (!analyzer->Attach(target, postEffects >= 0.5 ? FMOD_CHANNELCONTROL_DSP_HEAD : FMOD_CHANNELCONTROL_DSP_TAIL, error))
 	{
-		soundList[i]->release();
-		soundList.erase(i);
-		errorMessage = "No errors.";
-		return GMS_true;
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
 	}
 
-	else
-	{
-		errorMessage = "Index out of bounds.";
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Moves the analyzer onto the master group. postEffects is 0 to hear the mix before the master
+// group's effects, 1 after them.
+GMexport double FMODGMS_Analyzer_Attach_Master(double analyzer, double postEffects)
+{
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
 		return GMS_error;
-	}
+
+	FMOD::ChannelGroup* group = nullptr;
+	result = sys->getMasterChannelGroup(&group);
+	if (result != FMOD_OK)
+		return FMODGMS_Util_ErrorChecker();
+
+	return AttachAnalyzer(a, group, postEffects);
 }
 
-// Plays a sound on a given channel
-GMexport double FMODGMS_Snd_PlaySound(double index, double channel)
+// Moves the analyzer onto whatever a channel is playing, before or after its effects as above.
+// Playing another sound on the channel starts a new FMOD channel, attach again afterwards.
+GMexport double FMODGMS_Analyzer_Attach_Channel(double analyzer, double channel, double postEffects)
 {
-	std::size_t i = (std::size_t)round(index);
-	std::size_t c = (std::size_t)round(channel);
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-	// check to see if channel is already playing. if so, stop it.
-	if (channelList.count(c) == 0 || soundList.count(i) == 0)
+	ChannelSlot* c = channelList.Find(ToHandle(channel));
+	if (c == nullptr || c->Channel == nullptr)
 	{
 		errorMessage = "Index out of bounds.";
 		return GMS_error;
 	}
 
-	// play sound
-	result = sys->playSound(soundList[i], 0, false, &channelList[c]);
-
-	return FMODGMS_Util_ErrorChecker();
+	return AttachAnalyzer(a, c->Channel, postEffects);
 }
 
-// Sets to current active DLS bank to be loaded with subsequent MIDI files
-// --------------
-// TODO: This function should incorporate the use of FMODGMS_Snd_LoadSound_Ext
-// instead of using it own private FMOD_CREATESOUNDEXINFO object
-// --------------
-GMexport double FMODGMS_Snd_Set_DLS(char* filename)
+// Takes the analyzer off what it was attached to, its bins read 0 until it is attached again.
+GMexport double FMODGMS_Analyzer_Detach(double analyzer)
 {
-	dlsName = filename;
-	soundParams->dlsname = dlsName.c_str();
-	return FMODGMS_Util_ErrorChecker();
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
+
+	a->Detach();
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-// Reverts DLS bank back to default
-GMexport double FMODGMS_Snd_Remove_DLS()
+// FMODGMS_Analyzer_Get_NumBins should be called after this function, as with FMODGMS_FFT_Set_WindowSize
+GMexport double FMODGMS_Analyzer_Set_WindowSize(double analyzer, double size)
 {
-	soundParams->dlsname = 0;
-	return FMODGMS_Util_ErrorChecker();
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
+
+	std::string error;
+	if (!a->SetWindowSize((int)round(size), error))
+	{
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-// Set loop mode and count for a particular sound
-GMexport double FMODGMS_Snd_Set_LoopMode(double index, double mode, double times)
+// Window types as for FMODGMS_Analyzer_Create
+GMexport double FMODGMS_Analyzer_Set_WindowType(double analyzer, double windowType)
 {
-	std::size_t i = (std::size_t)round(index);
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-	if (soundList.count(i) == 1)
+	std::string error;
+	if (!a->SetWindowType((FMOD_DSP_FFT_WINDOW)(int)round(windowType), error))
 	{
-		int m = (int)round(mode);
-		int t = (int)round(times);
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
 
-		switch (m)
-		{
-			// loop off
-		case 0:
-			result = soundList[i]->setMode(FMOD_LOOP_OFF);
-			break;
+	errorMessage = "No errors.";
+	return GMS_true;
+}
 
-			// loop on
-		case 1:
-			result = soundList[i]->setMode(FMOD_LOOP_NORMAL);
-			break;
+GMexport double FMODGMS_Analyzer_Get_NumBins(double analyzer)
+{
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-			// loop bidi
-		case 2:
-			result = soundList[i]->setMode(FMOD_LOOP_BIDI);
-			break;
+	return (double)a->GetBinCount();
+}
 
-		default:
-			errorMessage = "Unknown loop mode";
-		}
+GMexport double FMODGMS_Analyzer_Get_BinValue(double analyzer, double index)
+{
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-		result = soundList[i]->setLoopCount(t);
+	unsigned int i = (unsigned int)index;
+	if (i < a->GetBinCount())
+		return a->GetBins()[i];
+	else
+		return GMS_error;
+}
 
-		return FMODGMS_Util_ErrorChecker();
-	}
+// Fills a buffer of float32s with up to count bins. Return value, if not error, is how many were written.
+GMexport double FMODGMS_Analyzer_Get_Buffer(double analyzer, float* buffer, double count)
+{
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-	else
+	if (count < 0)
 	{
-		errorMessage = "Index out of bounds";
+		errorMessage = "Invalid count";
 		return GMS_error;
 	}
+
+	const std::size_t n = std::min((std::size_t)round(count), a->GetBinCount());
+	std::copy(a->GetBins(), a->GetBins() + n, buffer);
+	errorMessage = "No errors.";
+	return (double)n;
 }
 
-// Sets the loop points for a particular sound. Can be used in conjuction with FMODGMS_Util_SecondsToSamples
-// or FMODGMS_Util_BeatsToSamples for precise loop point control.
-GMexport double FMODGMS_Snd_Set_LoopPoints(double index, double startTimeInSamples, double endTimeInSamples)
+GMexport double FMODGMS_Analyzer_Get_DominantFrequency(double analyzer)
 {
-	std::size_t i = (std::size_t)round(index);
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-	if (soundList.count(i) == 1)
+	float frequency;
+	std::string error;
+	if (!a->GetDominantFrequency(frequency, error))
 	{
-		int s = (int)round(startTimeInSamples);
-		int e = (int)round(endTimeInSamples);
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
 
-		result = soundList[i]->setLoopPoints(s, FMOD_TIMEUNIT_PCM, e, FMOD_TIMEUNIT_PCM);
+	errorMessage = "No errors.";
+	return frequency;
+}
 
-		return FMODGMS_Util_ErrorChecker();
-	}
+// Normalizes the analyzer's current bins, as FMODGMS_FFT_Normalize does
+GMexport double FMODGMS_Analyzer_Normalize(double analyzer)
+{
+	SpectrumAnalyzer* a = GetAnalyzer(analyzer);
+	if (a == nullptr)
+		return GMS_error;
 
-	else
+	a->Normalize();
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Detaches the analyzer and frees its DSP
+GMexport double FMODGMS_Analyzer_Free(double analyzer)
+{
+	if (!spectrumAnalyzers.Erase(ToHandle(analyzer)))
 	{
-		errorMessage = "Index out of bounds";
+		errorMessage = "Invalid analyzer.";
 		return GMS_error;
 	}
+
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-// Sets the channel volume of a module file
-GMexport double FMODGMS_Snd_Set_ModChannelVolume(double index, double modChannel, double vol)
+#pragma endregion
+
+#pragma region Beat Functions
+
+// Starts listening to the master group for onsets, tempo and beats, see FMODGMS_Beat_Get_Events
+GMexport double FMODGMS_Beat_Init()
 {
-	std::size_t i = (std::size_t)round(index);
-	int mc = (int)round(modChannel);
+	if (beatTracker != nullptr)
+	{
+		errorMessage = "Beat tracker already initialized";
+		return GMS_error;
+	}
 
-	if (soundList.count(i) == 1)
+	auto tracker = std::make_unique<BeatTrackerDSP>();
+	std::string error;
+	if (!tracker->Register(sys, error))
 	{
-		// check to see if the sound is a module
-		FMOD_SOUND_TYPE type;
-		soundList[i]->getFormat(&type, 0, 0, 0);
+		tracker->Unregister(sys);
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
 
-		if (type == FMOD_SOUND_TYPE_MOD ||
-			type == FMOD_SOUND_TYPE_S3M ||
-			type == FMOD_SOUND_TYPE_XM ||
-			type == FMOD_SOUND_TYPE_IT)
-		{
-			// to see if modchannel is out of bounds
-			int numChan;
-			soundList[i]->getMusicNumChannels(&numChan);
+	beatTracker = std::move(tracker);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
 
-			if (numChan > mc && 0 <= mc)
-			{
-				soundList[i]->setMusicChannelVolume(mc, (float)vol);
-				errorMessage = "No errors.";
-				return GMS_true;
-			}
+// How far above the recent average a sound has to jump to count as an onset, 1.5 by default
+GMexport double FMODGMS_Beat_Set_Sensitivity(double sensitivity)
+{
+	if (beatTracker == nullptr)
+	{
+		errorMessage = "Beat tracker not initialized";
+		return GMS_error;
+	}
 
-			else
-			{
-				errorMessage = "Module channel out of bounds.";
-				return GMS_error;
-			}
-		}
+	beatTracker->SetSensitivity((float)sensitivity);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
 
-		// not a module
-		else
-		{
-			errorMessage = "Not a MOD, S3M, XM, or IT.";
-			return GMS_error;
-		}
+// Fills a buffer of float64s with the events found since the last call, oldest first, three
+// values each: type (1 onset, 2 beat, 3 tempo change), the sample it happened at on the
+// FMODGMS_Beat_Get_Time clock, and its value (onset strength, or the BPM for beats and tempo
+// changes, 0 when the beat is lost). Events that don't fit are kept for the next call.
+// Return value, if not error, is how many events were written.
+GMexport double FMODGMS_Beat_Get_Events(double* buffer, double maxEvents)
+{
+	if (beatTracker == nullptr)
+	{
+		errorMessage = "Beat tracker not initialized";
+		return GMS_error;
 	}
 
-	// index out of bounds
-	else
+	if (maxEvents < 0)
 	{
-		errorMessage = "Index out of bounds.";
+		errorMessage = "Invalid count";
 		return GMS_error;
 	}
+
+	const size_t count = (size_t)round(maxEvents);
+	size_t written = 0;
+	BeatEvent event;
+	while (written < count && beatTracker->PopEvent(event))
+	{
+		buffer[3 * written] = (double)event.Type;
+		buffer[3 * written + 1] = (double)event.Time;
+		buffer[3 * written + 2] = event.Value;
+		written++;
+	}
+
+	errorMessage = "No errors.";
+	return (double)written;
 }
 
-// Get the currently set DLS bank
-GMexport const char* FMODGMS_Snd_Get_DLS()
+// Current tempo estimate, 0 until there is a steady beat
+GMexport double FMODGMS_Beat_Get_BPM()
 {
-	return soundParams->dlsname;
+	return beatTracker != nullptr ? beatTracker->GetBpm() : 0.0;
 }
 
-// Gets the loop points for a particular sound.
-GMexport double FMODGMS_Snd_Get_LoopPoints(double index, double whichOne)
+// Samples the beat tracker has heard, to compare event times against
+GMexport double FMODGMS_Beat_Get_Time()
 {
-	// whichOne
-	// 0 = start;
-	// 1 = end;
+	return beatTracker != nullptr ? (double)beatTracker->GetSampleTime() : 0.0;
+}
+
+// Events lost because FMODGMS_Beat_Get_Events wasn't called often enough
+GMexport double FMODGMS_Beat_Get_DroppedCount()
+{
+	return beatTracker != nullptr ? (double)beatTracker->GetDroppedCount() : 0.0;
+}
+
+#pragma endregion
+
+#pragma region Sound Functions
+
+// Loads a sound and indexes it in soundList
+GMexport double FMODGMS_Snd_LoadSound(char* filename)
+{
+	FMOD::Sound *sound = NULL;
+	//const auto params = FMOD_CREATESOUNDEXINFO();
+	result = sys->createSound(filename, FMOD_DEFAULT /*| FMOD_3D*/, soundParams, &sound);
 
-	std::size_t i = (std::size_t)round(index);
+	// we cool?
+	double isOK = FMODGMS_Util_ErrorChecker();
 
-	if (soundList.count(i) == 1)
+	// Yes, index the sound
+	if (isOK == GMS_true)
 	{
-		unsigned int start = 0;
-		unsigned int end = 0;
+		const SlotHandle soundId = soundList.Insert(sound);
+		if (soundId == INVALID_SLOT_HANDLE)
+			return TooManySounds(sound);
 
-		soundList[i]->getLoopPoints(&start, FMOD_TIMEUNIT_PCM, &end, FMOD_TIMEUNIT_PCM);
+		auto userData = new SoundUserData();
+		userData->Id = soundId;
 
-		if (whichOne < 1.0)
-			return (double)start;
-		else
-			return (double)end;
+		sound->setUserData(userData);
+
+		return soundId;
 	}
 
+	// No? Then don't index the new sound
 	else
-	{
-		errorMessage = "Index out of bounds.";
 		return GMS_error;
-	}
 }
 
-// Gets the length of an audio file in PCM samples
-GMexport double FMODGMS_Snd_Get_Length(double index)
-{
-	std::size_t i = (std::size_t)round(index);
 
-	if (soundList.count(i) == 1)
+GMexport double FMODGMS_Snd_AnnotateSound(double inSoundId, char* annotations)
+{
+	const SlotHandle soundId = ToHandle(inSoundId);
+	if (soundList.Contains(soundId))
 	{
-		unsigned int len;
-		soundList[i]->getLength(&len, FMOD_TIMEUNIT_PCM);
-		return (double)len;
+		if (annotationStore.ParseAddAnnotationList(soundId, annotations))
+		{
+			return GMS_true;
+		}
 	}
 
-	// index out of bounds
-	else
-	{
-		errorMessage = "Index out of bounds.";
-		return GMS_error;
-	}
+	return GMS_false;
 }
 
-// Gets the channel volume of a module file
-GMexport double FMODGMS_Snd_Get_ModChannelVolume(double index, double modChannel)
+// Loads a sound toa stream and indexes it in soundList
+GMexport double FMODGMS_Snd_LoadStream(char* filename)
 {
-	std::size_t i = (std::size_t)round(index);
-	int mc = (int)round(modChannel);
+	FMOD::Sound *sound;
+	result = sys->createStream(filename, FMOD_DEFAULT, soundParams, &sound);
 
-	if (soundList.count(i) == 1)
+	// we cool?
+	double isOK = FMODGMS_Util_ErrorChecker();
+
+	// Yes, index the sound
+	if (isOK == GMS_true)
 	{
-		// check to see if the sound is a module
-		FMOD_SOUND_TYPE type;
-		soundList[i]->getFormat(&type, 0, 0, 0);
+		const SlotHandle soundId = soundList.Insert(sound);
+		if (soundId == INVALID_SLOT_HANDLE)
+			return TooManySounds(sound);
 
-		if (type == FMOD_SOUND_TYPE_MOD ||
-			type == FMOD_SOUND_TYPE_S3M ||
-			type == FMOD_SOUND_TYPE_XM ||
-			type == FMOD_SOUND_TYPE_IT)
-		{
-			// to see if modchannel is out of bounds
-			int numChan;
-			soundList[i]->getMusicNumChannels(&numChan);
+		return soundId;
+	}
 
-			if (numChan > mc && 0 <= mc)
-			{
-				float vol;
-				soundList[i]->getMusicChannelVolume(mc,&vol);
-				errorMessage = "No errors.";
-				return (double)vol;
-			}
+	// No? Then don't index the new sound
+	else
+		return GMS_error;
+}
 
-			else
+// Loads a sound, with optional advanced parameters, and indexes it in soundList.
+//
+// mode is FMOD_MODE bit flags.
+//
+// exInfo is an pointer to a buffer with data for FMOD_CREATESOUNDEXINFO.
+// Optional. To use all default values, pass 0 to the exInfo parameter itself.
+// The buffer must be 8 byte aligned. Values should be unsigned.
+// It must contain every value for FMOD_CREATESOUNDEXINFO in correct order as documented in fmod.
+// Use value 0 for default settings.
+GMexport double FMODGMS_Snd_LoadSound_Ext(char* location, double mode, uint64_t* exInfo)
+{
+	FMOD::Sound *sound = NULL;
+	FMOD_MODE _mode = FMOD_DEFAULT | (unsigned int)(mode+0.5);
+
+	//if exInfo is used, transfer data to struct and pass to createSound
+	if (exInfo != 0)
+	{
+		FMOD_CREATESOUNDEXINFO _exInfo;
+		_exInfo.cbsize =				(int)sizeof(_exInfo);
+		_exInfo.length =				(unsigned int)exInfo[0];
+		_exInfo.fileoffset =			(unsigned int)exInfo[1];
+		_exInfo.numchannels =			(int)exInfo[2];
+		_exInfo.defaultfrequency =		(int)exInfo[3];
+		_exInfo.format =				(FMOD_SOUND_FORMAT)exInfo[4];
+		_exInfo.decodebuffersize =		(unsigned int)exInfo[5];
+		_exInfo.initialsubsound =		(int)exInfo[6];
+		_exInfo.numsubsounds =			(int)exInfo[7];
+		_exInfo.inclusionlist =			(int*)exInfo[8];
+		_exInfo.inclusionlistnum =		(int)exInfo[9];
+		_exInfo.pcmreadcallback =		0; //not supported
+		_exInfo.pcmsetposcallback =		0; //not supported
+		_exInfo.nonblockcallback =		0; //not supported
+		_exInfo.dlsname =				(const char*)exInfo[13];
+		_exInfo.encryptionkey =			(const char*)exInfo[14];
+		_exInfo.maxpolyphony =			(int)exInfo[15];
+		_exInfo.userdata =				(void*)exInfo[16];
+		_exInfo.suggestedsoundtype =	(FMOD_SOUND_TYPE)exInfo[17];
+		_exInfo.fileuseropen =			0; //not supported
+		_exInfo.fileuserclose =			0; //not supported
+		_exInfo.fileuserread =			0; //not supported
+		_exInfo.fileuserseek =			0; //not supported
+		_exInfo.fileuserasyncread =		0; //not supported
+		_exInfo.fileuserasynccancel =	0; //not supported
+		_exInfo.fileuserdata =			(void*)exInfo[24];
+		_exInfo.filebuffersize =		(int)exInfo[25];
+		_exInfo.channelorder =			(FMOD_CHANNELORDER)exInfo[26];
+		_exInfo.channelmask =			(FMOD_CHANNELMASK)exInfo[27];
+		_exInfo.initialsoundgroup =		0; //not supported
+		_exInfo.initialseekposition =	(unsigned int)exInfo[29];
+		_exInfo.initialseekpostype =	(FMOD_TIMEUNIT)exInfo[30];
+		_exInfo.ignoresetfilesystem =	(int)exInfo[31];
+		_exInfo.audioqueuepolicy =		(unsigned int)exInfo[32];
+		_exInfo.minmidigranularity =	(unsigned int)exInfo[33];
+		_exInfo.nonblockthreadid =		(unsigned int)exInfo[34];
+		_exInfo.fsbguid =				0; //not supported
+		result = sys->createSound(location, _mode, &_exInfo, &sound);
+	}
+	else
+		result = sys->createSound(location, _mode, NULL, &sound);
+	
+	// we cool?
+	double isOK = FMODGMS_Util_ErrorChecker();
+
+	// Yes, index the sound
+	if (isOK == GMS_true)
+	{
+		const SlotHandle soundId = soundList.Insert(sound);
+		if (soundId == INVALID_SLOT_HANDLE)
+			return TooManySounds(sound);
+
+		return soundId;
+	}
+
+	// No? Then don't index the new sound
+	else
+		return GMS_error;
+}
+
+// Unload a sound and removes it from soundList
+GMexport double FMODGMS_Snd_Unload(double index)
+{
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		for (const auto& job : spectrogramJobs)
+		{
+			if (job->GetSound() == soundList[i] && job->GetState() == SpectrogramState::Running)
 			{
-				errorMessage = "Module channel out of bounds.";
+				errorMessage = "Sound is being analysed, cancel its spectrogram first.";
 				return GMS_error;
 			}
 		}
 
-		// not a module
-		else
-		{
-			errorMessage = "Not a MOD, S3M, XM, or IT.";
-			return GMS_error;
-		}
+		soundList[i]->release();
+		soundList.Erase(i);
+		errorMessage = "No errors.";
+		return GMS_true;
 	}
 
-	// index out of bounds
 	else
 	{
 		errorMessage = "Index out of bounds.";
@@ -873,88 +1047,160 @@ GMexport double FMODGMS_Snd_Get_ModChannelVolume(double index, double modChannel
 	}
 }
 
-// Gets the number of channels in a module file
-GMexport double FMODGMS_Snd_Get_ModNumChannels(double index)
+// Plays a sound on a given channel
+GMexport double FMODGMS_Snd_PlaySound(double index, double channel)
 {
-	std::size_t i = (std::size_t)round(index);
-	
-	if (soundList.count(i) == 1)
+	SlotHandle i = ToHandle(index);
+	SlotHandle c = ToHandle(channel);
+
+	// check to see if channel is already playing. if so, stop it.
+	if (!channelList.Contains(c) || !soundList.Contains(i))
 	{
-		// check to see if sound is a module
-		FMOD_SOUND_TYPE type;
-		soundList[i]->getFormat(&type, 0, 0, 0);
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
 
-		if (type == FMOD_SOUND_TYPE_MOD ||
-			type == FMOD_SOUND_TYPE_S3M ||
-			type == FMOD_SOUND_TYPE_XM ||
-			type == FMOD_SOUND_TYPE_IT)
-		{
-			int nc;
-			soundList[i]->getMusicNumChannels(&nc);
-			return (double)nc;
-		}
+	// play sound
+	result = sys->playSound(soundList[i], 0, false, &channelList[c].Channel);
 
-		// not a module
-		else
+	if (result == FMOD_OK)
+	{
+		// Keep the channel's annotation cursor with the FMOD channel so the cassette can find it
+		channelList[c].Channel->setUserData(channelList[c].UserData.get());
+	}
+
+	return FMODGMS_Util_ErrorChecker();
+}
+
+// Sets to current active DLS bank to be loaded with subsequent MIDI files
+// --------------
+// TODO: This function should incorporate the use of FMODGMS_Snd_LoadSound_Ext
+// instead of using it own private FMOD_CREATESOUNDEXINFO object
+// --------------
+GMexport double FMODGMS_Snd_Set_DLS(char* filename)
+{
+	dlsName = filename;
+	soundParams->dlsname = dlsName.c_str();
+	return FMODGMS_Util_ErrorChecker();
+}
+
+// Reverts DLS bank back to default
+GMexport double FMODGMS_Snd_Remove_DLS()
+{
+	soundParams->dlsname = 0;
+	return FMODGMS_Util_ErrorChecker();
+}
+
+// Set loop mode and count for a particular sound
+GMexport double FMODGMS_Snd_Set_LoopMode(double index, double mode, double times)
+{
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		int m = (int)round(mode);
+		int t = (int)round(times);
+
+		switch (m)
 		{
-			errorMessage = "Not a MOD, S3M, XM, or IT.";
-			return GMS_error;
+			// loop off
+		case 0:
+			result = soundList[i]->setMode(FMOD_LOOP_OFF);
+			break;
+
+			// loop on
+		case 1:
+			result = soundList[i]->setMode(FMOD_LOOP_NORMAL);
+			break;
+
+			// loop bidi
+		case 2:
+			result = soundList[i]->setMode(FMOD_LOOP_BIDI);
+			break;
+
+		default:
+			errorMessage = "Unknown loop mode";
 		}
+
+		result = soundList[i]->setLoopCount(t);
+
+		return FMODGMS_Util_ErrorChecker();
 	}
 
-	// index out of bounds
 	else
 	{
-		errorMessage = "Index out of bounds.";
+		errorMessage = "Index out of bounds";
 		return GMS_error;
 	}
 }
 
-//Gets number of channels (e.g 2 for left and right) of sound
-GMexport double FMODGMS_Snd_Get_NumChannels(double index)
+// Sets the loop points for a particular sound. Can be used in conjuction with FMODGMS_Util_SecondsToSamples
+// or FMODGMS_Util_BeatsToSamples for precise loop point control.
+GMexport double FMODGMS_Snd_Set_LoopPoints(double index, double startTimeInSamples, double endTimeInSamples)
 {
-	std::size_t i = (std::size_t)round(index);
+	SlotHandle i = ToHandle(index);
 
-	if (soundList.count(i) == 1)
+	if (soundList.Contains(i))
 	{
-		int channels;
+		int s = (int)round(startTimeInSamples);
+		int e = (int)round(endTimeInSamples);
 
-		result = soundList[i]->getFormat(NULL, NULL, &channels, NULL);
-		if (result == FMOD_OK)
-			return (double)channels;
-		else
-		{
-			errorMessage = "Failed to get data";
-			return GMS_error;
-		}
-		
+		result = soundList[i]->setLoopPoints(s, FMOD_TIMEUNIT_PCM, e, FMOD_TIMEUNIT_PCM);
+
+		return FMODGMS_Util_ErrorChecker();
 	}
+
 	else
 	{
-		errorMessage = "Index out of bounds.";
+		errorMessage = "Index out of bounds";
 		return GMS_error;
 	}
 }
 
-//Gets number of bits per sample (resolution) of sound
-GMexport double FMODGMS_Snd_Get_BitsPerSample(double index)
+// Sets the channel volume of a module file
+GMexport double FMODGMS_Snd_Set_ModChannelVolume(double index, double modChannel, double vol)
 {
-	std::size_t i = (std::size_t)round(index);
+	SlotHandle i = ToHandle(index);
+	int mc = (int)round(modChannel);
 
-	if (soundList.count(i) == 1)
+	if (soundList.Contains(i))
 	{
-		int bits;
+		// check to see if the sound is a module
+		FMOD_SOUND_TYPE type;
+		soundList[i]->getFormat(&type, 0, 0, 0);
 
-		result = soundList[i]->getFormat(NULL, NULL, NULL, &bits);
-		if (result == FMOD_OK)
-			return (double)bits;
+		if (type == FMOD_SOUND_TYPE_MOD ||
+			type == FMOD_SOUND_TYPE_S3M ||
+			type == FMOD_SOUND_TYPE_XM ||
+			type == FMOD_SOUND_TYPE_IT)
+		{
+			// to see if modchannel is out of bounds
+			int numChan;
+			soundList[i]->getMusicNumChannels(&numChan);
+
+			if (numChan > mc && 0 <= mc)
+			{
+				soundList[i]->setMusicChannelVolume(mc, (float)vol);
+				errorMessage = "No errors.";
+				return GMS_true;
+			}
+
+			else
+			{
+				errorMessage = "Module channel out of bounds.";
+				return GMS_error;
+			}
+		}
+
+		// not a module
 		else
 		{
-			errorMessage = "Failed to get data";
+			errorMessage = "Not a MOD, S3M, XM, or IT.";
 			return GMS_error;
 		}
-
 	}
+
+	// index out of bounds
 	else
 	{
 		errorMessage = "Index out of bounds.";
@@ -962,12 +1208,208 @@ GMexport double FMODGMS_Snd_Get_BitsPerSample(double index)
 	}
 }
 
-//Gets default frequency (samples per second) of sound
+// Get the currently set DLS bank
+GMexport const char* FMODGMS_Snd_Get_DLS()
+{
+	return soundParams->dlsname;
+}
+
+// Gets the loop points for a particular sound.
+GMexport double FMODGMS_Snd_Get_LoopPoints(double index, double whichOne)
+{
+	// whichOne
+	// 0 = start;
+	// 1 = end;
+
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		unsigned int start = 0;
+		unsigned int end = 0;
+
+		soundList[i]->getLoopPoints(&start, FMOD_TIMEUNIT_PCM, &end, FMOD_TIMEUNIT_PCM);
+
+		if (whichOne < 1.0)
+			return (double)start;
+		else
+			return (double)end;
+	}
+
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+// Gets the length of an audio file in PCM samples
+GMexport double FMODGMS_Snd_Get_Length(double index)
+{
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		unsigned int len;
+		soundList[i]->getLength(&len, FMOD_TIMEUNIT_PCM);
+		return (double)len;
+	}
+
+	// index out of bounds
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+// Gets the channel volume of a module file
+GMexport double FMODGMS_Snd_Get_ModChannelVolume(double index, double modChannel)
+{
+	SlotHandle i = ToHandle(index);
+	int mc = (int)round(modChannel);
+
+	if (soundList.Contains(i))
+	{
+		// check to see if the sound is a module
+		FMOD_SOUND_TYPE type;
+		soundList[i]->getFormat(&type, 0, 0, 0);
+
+		if (type == FMOD_SOUND_TYPE_MOD ||
+			type == FMOD_SOUND_TYPE_S3M ||
+			type == FMOD_SOUND_TYPE_XM ||
+			type == FMOD_SOUND_TYPE_IT)
+		{
+			// to see if modchannel is out of bounds
+			int numChan;
+			soundList[i]->getMusicNumChannels(&numChan);
+
+			if (numChan > mc && 0 <= mc)
+			{
+				float vol;
+				soundList[i]->getMusicChannelVolume(mc,&vol);
+				errorMessage = "No errors.";
+				return (double)vol;
+			}
+
+			else
+			{
+				errorMessage = "Module channel out of bounds.";
+				return GMS_error;
+			}
+		}
+
+		// not a module
+		else
+		{
+			errorMessage = "Not a MOD, S3M, XM, or IT.";
+			return GMS_error;
+		}
+	}
+
+	// index out of bounds
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+// Gets the number of channels in a module file
+GMexport double FMODGMS_Snd_Get_ModNumChannels(double index)
+{
+	SlotHandle i = ToHandle(index);
+	
+	if (soundList.Contains(i))
+	{
+		// check to see if sound is a module
+		FMOD_SOUND_TYPE type;
+		soundList[i]->getFormat(&type, 0, 0, 0);
+
+		if (type == FMOD_SOUND_TYPE_MOD ||
+			type == FMOD_SOUND_TYPE_S3M ||
+			type == FMOD_SOUND_TYPE_XM ||
+			type == FMOD_SOUND_TYPE_IT)
+		{
+			int nc;
+			soundList[i]->getMusicNumChannels(&nc);
+			return (double)nc;
+		}
+
+		// not a module
+		else
+		{
+			errorMessage = "Not a MOD, S3M, XM, or IT.";
+			return GMS_error;
+		}
+	}
+
+	// index out of bounds
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+//Gets number of channels (e.g 2 for left and right) of sound
+GMexport double FMODGMS_Snd_Get_NumChannels(double index)
+{
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		int channels;
+
+		result = soundList[i]->getFormat(NULL, NULL, &channels, NULL);
+		if (result == FMOD_OK)
+			return (double)channels;
+		else
+		{
+			errorMessage = "Failed to get data";
+			return GMS_error;
+		}
+		
+	}
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+//Gets number of bits per sample (resolution) of sound
+GMexport double FMODGMS_Snd_Get_BitsPerSample(double index)
+{
+	SlotHandle i = ToHandle(index);
+
+	if (soundList.Contains(i))
+	{
+		int bits;
+
+		result = soundList[i]->getFormat(NULL, NULL, NULL, &bits);
+		if (result == FMOD_OK)
+			return (double)bits;
+		else
+		{
+			errorMessage = "Failed to get data";
+			return GMS_error;
+		}
+
+	}
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+//Gets default frequency (samples per second) of sound
 GMexport double FMODGMS_Snd_Get_DefaultFrequency(double index)
 {
-	std::size_t i = (std::size_t)round(index);
+	SlotHandle i = ToHandle(index);
 
-	if (soundList.count(i) == 1)
+	if (soundList.Contains(i))
 	{
 		float freq;
 
@@ -980,208 +1422,821 @@ GMexport double FMODGMS_Snd_Get_DefaultFrequency(double index)
 			return GMS_error;
 		}
 
-	}
-	else
+	}
+	else
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+}
+
+
+// Populates a buffer with raw data in PCM format from a section of the sound.
+// pos and length are in unit bytes.
+// Return value, if not error, is how many bytes were read (may be less than length if for example reaching end of sound).
+// NB: You should read the remarks in fmod's documentation for this function before using it.
+GMexport double FMODGMS_Snd_ReadData(double index, double pos, double length, void* buffer)
+{
+	SlotHandle i = ToHandle(index);
+
+	//check for parameter validity
+	if (!soundList.Contains(i))
+	{
+		errorMessage = "Index out of bounds.";
+		return GMS_error;
+	}
+	unsigned int maxLength = 0;
+	soundList[i]->getLength(&maxLength, FMOD_TIMEUNIT_PCMBYTES);
+	if (length > maxLength || length < 0)
+	{
+		errorMessage = "Invalid length";
+		return GMS_error;
+	}
+	if (pos > maxLength || pos < 0)
+	{
+		errorMessage = "Invalid position";
+		return GMS_error;
+	}
+	unsigned int _pos = (unsigned int)(pos + 0.5);
+	unsigned int _length = (unsigned int)(length + 0.5);
+
+	//seek to pos
+	result = soundList[i]->seekData(_pos);
+	if (result != FMOD_OK)
+	{
+		//errorMessage = "Failed to seek to pos";
+		errorMessageAlloc = std::to_string(result);
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
+
+	sys->update();
+			
+	//read sound and populate buffer
+	unsigned int read = 0;
+	result = soundList[i]->readData(buffer, _length, &read);
+	if (result != FMOD_OK && result != FMOD_ERR_FILE_EOF)
+	{
+		errorMessage = "Failed to read data.";
+		return GMS_error;
+	}
+
+	return (double)read;
+}
+
+static double CreateCassette(const std::vector<Cassette::TapeFormat>& tapes)
+{
+	DestroyCassette();
+
+	// The cassette only reads channelList from FMODGMS_Sys_Update, on the game thread.
+	synthVoicePool = std::make_unique<SynthVoicePool>();
+	speechSynthDsp = std::make_unique<SpeechSynthDSP>(&annotationStore, synthVoicePool.get());
+	synthVoicePool->SetSequencer(speechSynthDsp.get());
+	cassetteDsp = std::make_unique<Cassette::CassetteDSP>(tapes, &annotationStore, &channelList, speechSynthDsp.get());
+
+	// Registered after the cassette so it sits before it in the chain and gets recorded.
+	// Speech is rendered by the voice pool's DSP.
+	std::string error;
+	if (!cassetteDsp->Register(sys, error) || !synthVoicePool->Register(sys, error))
+    {
+		DestroyCassette();
+		errorMessageAlloc = error;
+		errorMessage = errorMessageAlloc.c_str();
+        return GMS_error;
+    }
+
+    //masterGroup->setMode(FMOD_3D);
+    //masterGroup->set3DLevel(0.125);
+	//FMOD_VECTOR posVec, velVec;
+    //masterGroup->set3DAttributes(&posVec, &velVec);
+
+    return GMS_true;
+}
+
+GMexport double FMODGMS_Create_Cassette()
+{
+	return CreateCassette({ Cassette::TapeFormat{}, Cassette::TapeFormat{} });
+}
+
+// Creates count cassettes, each tape seconds long and stored at sampleRate, 0 for the mixer's rate.
+// A lower rate such as 16000 saves memory and mixing time at the cost of the top end.
+// Anything longer than a few seconds is kept in a temporary file and streamed in around the play head.
+GMexport double FMODGMS_Create_Cassettes(double count, double seconds, double sampleRate)
+{
+	int mixRate = 0;
+	if (sys == nullptr || sys->getSoftwareFormat(&mixRate, 0, 0) != FMOD_OK || mixRate <= 0)
+	{
+		errorMessage = "Could not get sample rate";
+		return GMS_error;
+	}
+
+	const int n = (int)round(count);
+	if (n < 1)
+	{
+		errorMessage = "Invalid cassette count";
+		return GMS_error;
+	}
+
+	// Same limits FMOD puts on its own mixer rate.
+	const int rate = (int)round(sampleRate);
+	if (rate != 0 && (rate < 8000 || rate > 192000))
+	{
+		errorMessage = "Invalid tape sample rate";
+		return GMS_error;
+	}
+
+	const double length = seconds * (rate == 0 ? mixRate : rate);
+	if (!(length >= 1.0) || length > (double)UINT32_MAX)
+	{
+		errorMessage = "Invalid tape length";
+		return GMS_error;
+	}
+
+	const Cassette::TapeFormat format{ (size_t)round(length), (uint32_t)rate };
+	return CreateCassette(std::vector<Cassette::TapeFormat>(n, format));
+}
+
+// Same as FMODGMS_Create_Cassette but with tapes of the given length in seconds.
+GMexport double FMODGMS_Create_Cassette_Length(double seconds)
+{
+	return FMODGMS_Create_Cassettes(2, seconds, 0);
+}
+
+// The single speaker driven by FMODGMS_Talk, each call interrupts the last.
+static void TalkDefault(const std::string_view& dialogue)
+{
+	speechSynthDsp->Stop(defaultUtterance);
+	defaultUtterance = speechSynthDsp->Talk(dialogue, defaultSpeaker);
+}
+
+GMexport double FMODGMS_Set_VoiceSynth(double enabled, double pitch)
+{
+	if (enabled)
+	{
+		const auto text = Constants::Globals.GetString("speech_synth_text");
+		TalkDefault(text);
+	}
+	return 1.0;
+}
+
+GMexport double FMODGMS_Talk(const char* dialogue, const char* speaker)
+{
+	defaultSpeaker = speaker;
+	TalkDefault(dialogue);
+	return 1.0;
+}
+
+GMexport double FMODGMS_Is_Talking()
+{
+	return speechSynthDsp != nullptr && speechSynthDsp->IsTalking();
+}
+
+GMexport double FMODGMS_Get_VoiceSynth_FreqBuf(double offset)
+{
+	if (offset < 0 || offset > 1.0)
+	{
+		return 0.0;
+	}
+
+	const size_t framesAgo = (size_t)std::round(offset * (double)(SpeechSynthDSP::FREQ_HISTORY_LENGTH - 1));
+	return speechSynthDsp->ReadFreqHistory(framesAgo);
+}
+
+// Fills a buffer of float32s with the speech frequency of the last count frames, newest first.
+// Return value, if not error, is how many values were written (at most 128).
+GMexport double FMODGMS_Get_VoiceSynth_FreqBuffer(float* buffer, double count)
+{
+	if (speechSynthDsp == nullptr)
+	{
+		errorMessage = "Speech synth not created.";
+		return GMS_error;
+	}
+
+	if (count < 0)
+	{
+		errorMessage = "Invalid count";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)speechSynthDsp->ReadFreqHistory(buffer, (size_t)round(count));
+}
+
+bool GetUtterance(double handle, UtteranceHandle& utterance)
+{
+	if (speechSynthDsp == nullptr)
+	{
+		errorMessage = "Speech synth not created.";
+		return false;
+	}
+
+	utterance = (UtteranceHandle)round(handle);
+	if (!speechSynthDsp->IsTalking(utterance))
+	{
+		errorMessage = "Invalid utterance handle.";
+		return false;
+	}
+
+	return true;
+}
+
+// Starts speaking alongside any other utterances, returns a handle or -1 when every speaker is busy.
+GMexport double FMODGMS_Utterance_Start(const char* dialogue, const char* speaker)
+{
+	if (speechSynthDsp == nullptr)
+	{
+		errorMessage = "Speech synth not created.";
+		return GMS_error;
+	}
+
+	const UtteranceHandle utterance = speechSynthDsp->Talk(dialogue, speaker);
+	if (utterance == INVALID_UTTERANCE)
+	{
+		errorMessage = "Too many utterances.";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)utterance;
+}
+
+GMexport double FMODGMS_Utterance_Stop(double handle)
+{
+	UtteranceHandle utterance;
+	if (!GetUtterance(handle, utterance))
+	{
+		return GMS_error;
+	}
+
+	speechSynthDsp->Stop(utterance);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Returns 1 while the utterance is still speaking.
+GMexport double FMODGMS_Utterance_Is_Talking(double handle)
+{
+	return speechSynthDsp != nullptr && speechSynthDsp->IsTalking((UtteranceHandle)round(handle));
+}
+
+GMexport double FMODGMS_Utterance_Set_Pitch(double handle, double pitch)
+{
+	UtteranceHandle utterance;
+	if (!GetUtterance(handle, utterance))
+	{
+		return GMS_error;
+	}
+
+	speechSynthDsp->SetPitch(utterance, pitch);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+GMexport double FMODGMS_Utterance_Set_Volume(double handle, double volume)
+{
+	UtteranceHandle utterance;
+	if (!GetUtterance(handle, utterance))
+	{
+		return GMS_error;
+	}
+
+	speechSynthDsp->SetVolume(utterance, (float)volume);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Number of utterances currently speaking.
+GMexport double FMODGMS_Utterance_Get_Count()
+{
+	return speechSynthDsp != nullptr ? (double)speechSynthDsp->GetTalkingCount() : 0.0;
+}
+
+// Switches which cassette is played and recorded on, counting from 0.
+GMexport double FMODGMS_Set_Cassette_Active(double index)
+{
+	if (cassetteDsp == nullptr)
+	{
+		errorMessage = "Cassette not created.";
+		return GMS_error;
+	}
+
+	const int i = (int)round(index);
+	if (i < 0 || i >= (int)cassetteDsp->GetTapeCount())
+	{
+		errorMessage = "Invalid cassette index";
+		return GMS_error;
+	}
+
+	cassetteDsp->SetActive((size_t)i);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+GMexport double FMODGMS_Get_Cassette_Active()
+{
+	return cassetteDsp != nullptr ? (double)cassetteDsp->GetActive() : 0.0;
+}
+
+GMexport double FMODGMS_Get_Cassette_Count()
+{
+	return cassetteDsp != nullptr ? (double)cassetteDsp->GetTapeCount() : 0.0;
+}
+
+// Saves a cassette's tape and annotations to a file, losslessly compressed if compress is true.
+// Stop recording onto the cassette first.
+GMexport double FMODGMS_Save_Cassette(double index, const char* path, double compress)
+{
+	if (cassetteDsp == nullptr)
+	{
+		errorMessage = "Cassette not created.";
+		return GMS_error;
+	}
+
+	std::string error;
+	if (index < 0 || !cassetteDsp->SaveTape((size_t)round(index), path, compress >= 0.5, error))
+	{
+		errorMessageAlloc = index < 0 ? "Invalid cassette index" : error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Replaces a cassette's tape with one saved by FMODGMS_Save_Cassette, it must have been recorded at
+// the same sample rate. Long uncompressed tapes play straight from the file, which stays open meanwhile.
+GMexport double FMODGMS_Load_Cassette(double index, const char* path)
+{
+	if (cassetteDsp == nullptr)
+	{
+		errorMessage = "Cassette not created.";
+		return GMS_error;
+	}
+
+	std::string error;
+	if (index < 0 || !cassetteDsp->LoadTape((size_t)round(index), path, error))
+	{
+		errorMessageAlloc = index < 0 ? "Invalid cassette index" : error;
+		errorMessage = errorMessageAlloc.c_str();
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+GMexport double FMODGMS_Set_Cassette_State(double mode)
+{
+	const Cassette::CassetteState x = (Cassette::CassetteState)round(mode);
+	cassetteDsp->SetState(x);
+	return 0.0;
+}
+
+// 0 = linear, 1 = cubic (default), 2 = windowed sinc. Higher is cleaner at odd tape speeds but costs more.
+GMexport double FMODGMS_Set_Cassette_Resample_Quality(double quality)
+{
+	const int q = (int)round(quality);
+	if (q < 0 || q >= (int)Resampling::RESAMPLE_QUALITY_COUNT)
+	{
+		errorMessage = "Invalid resample quality";
+		return GMS_error;
+	}
+
+	cassetteDsp->SetResampleQuality((Resampling::ResampleQuality)q);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+GMexport double FMODGMS_Get_Cassette_Waveform(double x)
+{
+	return cassetteDsp->GetWaveform(x);
+}
+
+// Fills a buffer of float32s with min, max pairs for columns evenly spaced across the active tape,
+// so needs room for 2 * columns values. Reads a snapshot from the last mix so never stalls the audio.
+// Return value, if not error, is the number of columns written.
+GMexport double FMODGMS_Get_Cassette_Waveform_Buffer(float* buffer, double columns)
+{
+	if (cassetteDsp == nullptr)
+	{
+		errorMessage = "Cassette not created.";
+		return GMS_error;
+	}
+
+	if (columns < 1)
+	{
+		errorMessage = "Invalid column count";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)cassetteDsp->GetWaveformOverview(buffer, (size_t)round(columns));
+}
+
+std::string GetCassetteWorldAnnotation_String;
+GMexport const char* FMODGMS_Get_Cassette_WorldAnnotation()
+{
+	const AnnotationId curAnnot = cassetteDsp->GetCurrentWorldAnnotation();
+	GetCassetteWorldAnnotation_String = annotationStore.GetString(curAnnot);
+
+	return GetCassetteWorldAnnotation_String.c_str();
+}
+
+GMexport double FMODGMS_Get_Cassette_Pos()
+{
+	return cassetteDsp->GetActivePosition();
+}
+
+// Number of heap allocations made inside the cassette's audio callback so far.
+// Only counted in debug builds, anything other than 0 is a bug.
+GMexport double FMODGMS_Get_Cassette_CallbackAllocations()
+{
+	return (double)cassetteDsp->GetCallbackAllocations();
+}
+
+GMexport double Constant_Get_Bool(const char* s)
+{
+	return Constants::Globals.GetBool(s) ? 1.0 : 0.0;
+}
+
+GMexport double FMODGMS_Constant_Get_Double_From_Obj(const char* obj, const char* s)
+{
+	return Constants::Globals.GetObj(obj)->GetDouble(s);
+}
+
+GMexport double FMODGMS_Constant_Get_Double(const char* s)
+{
+	return Constants::Globals.GetDouble(s);
+}
+
+std::string _constant_ret;
+GMexport const char* FMODGMS_Constant_Get_String_Dangerous(const char* s)
+{
+	_constant_ret = Constants::Globals.GetString(s);
+	return _constant_ret.c_str();
+}
+
+GMexport double FMODGMS_Set_3d_X(double channel, double x, double y, double z)
+{
+	//std::size_t c = (std::size_t)round(channel);
+
+	//if (c < channelList.size())
+	//{
+	//}
+	/*
+		FMOD_VECTOR _position, _velocity, _up, _forward;
+	   _position.x = (float)x; 
+	   _position.y = (float)y;
+	   _position.z = (float)z;
+
+       _velocity.x = 0; 
+       _velocity.y = 0; 
+       _velocity.z = 0; 
+
+       _forward.x = 0; 
+       _forward.y = 0;
+       _forward.z = 1; 
+
+           _up.x = 0; 
+           _up.y = 1;
+           _up.z = 0; 
+		   sys->set3DListenerAttributes(0, &_position, &_velocity, &_forward, &_up);
+		   */
+
+	return GMS_true;
+}
+
+#pragma endregion
+
+#pragma region Spectrogram Functions
+
+SpectrogramJob* GetSpectrogramJob(double job)
+{
+	std::unique_ptr<SpectrogramJob>* found = spectrogramJobs.Find(ToHandle(job));
+	if (found == nullptr)
 	{
-		errorMessage = "Index out of bounds.";
-		return GMS_error;
+		errorMessage = "Invalid spectrogram job.";
+		return nullptr;
 	}
-}
 
+	return found->get();
+}
 
-// Populates a buffer with raw data in PCM format from a section of the sound.
-// pos and length are in unit bytes.
-// Return value, if not error, is how many bytes were read (may be less than length if for example reaching end of sound).
-// NB: You should read the remarks in fmod's documentation for this function before using it.
-GMexport double FMODGMS_Snd_ReadData(double index, double pos, double length, void* buffer)
+// Starts working out a loaded sound's spectrogram and onset strength in the background. Frames are
+// numPoints samples (even) every hopSize samples, each as FMODGMS_Util_FFT would give them.
+// threads is how many threads analyse frames, 0 for one fewer than the CPU has.
+// Don't play, read or unload the sound until the job has finished or been cancelled.
+// Returns the job's index.
+GMexport double FMODGMS_Snd_Spectrogram_Start(double index, double numPoints, double hopSize, double threads)
 {
-	std::size_t i = (std::size_t)round(index);
-
-	//check for parameter validity
-	if (soundList.count(i) == 0)
+	SlotHandle i = ToHandle(index);
+	if (!soundList.Contains(i))
 	{
 		errorMessage = "Index out of bounds.";
 		return GMS_error;
 	}
-	unsigned int maxLength = 0;
-	soundList[i]->getLength(&maxLength, FMOD_TIMEUNIT_PCMBYTES);
-	if (length > maxLength || length < 0)
+
+	const int _numPoints = (int)(numPoints + 0.5);
+	const int _hopSize = (int)(hopSize + 0.5);
+	int _threads = (int)(threads + 0.5);
+	if (_numPoints <= 0 || (_numPoints & 1) == 1)
 	{
-		errorMessage = "Invalid length";
+		errorMessage = "numPoints must be even and positive.";
 		return GMS_error;
 	}
-	if (pos > maxLength || pos < 0)
+
+	if (_hopSize <= 0)
 	{
-		errorMessage = "Invalid position";
+		errorMessage = "hopSize must be positive.";
 		return GMS_error;
 	}
-	unsigned int _pos = (unsigned int)(pos + 0.5);
-	unsigned int _length = (unsigned int)(length + 0.5);
 
-	//seek to pos
-	result = soundList[i]->seekData(_pos);
-	if (result != FMOD_OK)
+	if (_threads <= 0)
+		_threads = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+
+	auto job = std::make_unique<SpectrogramJob>(soundList[i], (std::size_t)_numPoints, (std::size_t)_hopSize, (std::size_t)_threads);
+
+	std::string error;
+	if (!job->Start(error))
 	{
-		//errorMessage = "Failed to seek to pos";
-		errorMessageAlloc = std::to_string(result);
+		errorMessageAlloc = error;
 		errorMessage = errorMessageAlloc.c_str();
 		return GMS_error;
 	}
 
-	sys->update();
-			
-	//read sound and populate buffer
-	unsigned int read = 0;
-	result = soundList[i]->readData(buffer, _length, &read);
-	if (result != FMOD_OK && result != FMOD_ERR_FILE_EOF)
+	const SlotHandle handle = spectrogramJobs.Insert(std::move(job));
+	if (handle == INVALID_SLOT_HANDLE)
 	{
-		errorMessage = "Failed to read data.";
+		errorMessage = "Too many spectrogram jobs.";
 		return GMS_error;
 	}
 
-	return (double)read;
+	errorMessage = "No errors.";
+	return handle;
 }
 
-GMexport double FMODGMS_Create_Cassette()
+// Returns 0 while running, 1 when done, 2 if it failed (the error message says why) or 3 if cancelled
+GMexport double FMODGMS_Spectrogram_Get_State(double job)
 {
-	// TODO HANDLE RACE CONDITIONS WITH CHANNELLIST!
-	speechSynthDsp = std::make_unique<SpeechSynthDSP>();
-	cassetteDsp = std::make_unique<Cassette::CassetteDSP>(1, &annotationStore, &channelList, speechSynthDsp.get());
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
 
-	std::string error;
-	if (!cassetteDsp->Register(sys, error) || !speechSynthDsp->Register(sys, error))
-    {
-		errorMessageAlloc = error;
+	const SpectrogramState state = j->GetState();
+	if (state == SpectrogramState::Failed)
+	{
+		errorMessageAlloc = j->GetError();
 		errorMessage = errorMessageAlloc.c_str();
-        return GMS_error;
-    }
+	}
+	else
+		errorMessage = "No errors.";
 
-    //masterGroup->setMode(FMOD_3D);
-    //masterGroup->set3DLevel(0.125);
-	//FMOD_VECTOR posVec, velVec;
-    //masterGroup->set3DAttributes(&posVec, &velVec);
+	return (double)state;
+}
 
-    return GMS_true;
+// Returns the fraction of frames analysed so far, from 0 to 1
+GMexport double FMODGMS_Spectrogram_Get_Progress(double job)
+{
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	return j->GetProgress();
 }
 
-GMexport double FMODGMS_Set_VoiceSynth(double enabled, double pitch)
+GMexport double FMODGMS_Spectrogram_Get_FrameCount(double job)
 {
-	if (enabled)
-	{
-		const auto text = Constants::Globals.GetString("speech_synth_text");
-        speechSynthDsp->Talk(text);
-	}
-	return 1.0;
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	return (double)j->GetFrameCount();
 }
 
-GMexport double FMODGMS_Talk(const char* dialogue, const char* speaker)
+// Returns the number of magnitudes in each frame (numPoints / 4)
+GMexport double FMODGMS_Spectrogram_Get_BinCount(double job)
 {
-	speechSynthDsp->SetSpeaker(speaker);
-    speechSynthDsp->Talk(dialogue);
-	return 1.0;
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	return (double)j->GetBinCount();
 }
 
-GMexport double FMODGMS_Is_Talking()
+// Once done, fills a buffer of float32s with the frames one after another, so needs room for
+// FrameCount * BinCount values. Return value, if not error, is how many values were written.
+GMexport double FMODGMS_Spectrogram_Get_Buffer(double job, float* buffer, double count)
 {
-	return speechSynthDsp != nullptr && speechSynthDsp->IsTalking();
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	if (j->GetState() != SpectrogramState::Done || count < 0)
+	{
+		errorMessage = count < 0 ? "Invalid count" : "Spectrogram not done.";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)j->CopySpectrogram(buffer, (std::size_t)round(count));
 }
 
-GMexport double FMODGMS_Get_VoiceSynth_FreqBuf(double offset)
+// Once done, fills a buffer of float32s with the onset strength of each frame, spectral flux scaled
+// so the strongest is 1. Return value, if not error, is how many values were written.
+GMexport double FMODGMS_Spectrogram_Get_Onsets(double job, float* buffer, double count)
 {
-	if (offset < 0 || offset > 1.0)
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	if (j->GetState() != SpectrogramState::Done || count < 0)
 	{
-		return 0.0;
+		errorMessage = count < 0 ? "Invalid count" : "Spectrogram not done.";
+		return GMS_error;
 	}
 
-	const int bufOffset = (int)(-std::round(offset * (double)speechSynthDsp->m_freqBuf.Size()));
-	return speechSynthDsp->m_freqBuf.ReadOffset(bufOffset);
+	errorMessage = "No errors.";
+	return (double)j->CopyOnsets(buffer, (std::size_t)round(count));
 }
 
-GMexport double FMODGMS_Set_Cassette_State(double mode)
+// Stops a running job soon after, poll its state to know when the sound is free again
+GMexport double FMODGMS_Spectrogram_Cancel(double job)
 {
-	const Cassette::CassetteState x = (Cassette::CassetteState)round(mode);
-	cassetteDsp->SetState(x);
-	return 0.0;
+	SpectrogramJob* j = GetSpectrogramJob(job);
+	if (j == nullptr)
+		return GMS_error;
+
+	j->Cancel();
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-GMexport double FMODGMS_Get_Cassette_Waveform(double x)
+// Frees a job and its results, cancelling it first and waiting for its threads if it is still running
+GMexport double FMODGMS_Spectrogram_Free(double job)
 {
-	return cassetteDsp->GetWaveform(x);
+	if (!spectrogramJobs.Erase(ToHandle(job)))
+	{
+		errorMessage = "Invalid spectrogram job.";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-std::string GetCassetteWorldAnnotation_String;
-GMexport const char* FMODGMS_Get_Cassette_WorldAnnotation()
+#pragma endregion
+
+#pragma region Voice Pool Functions
+
+bool GetVoice(double handle, VoiceHandle& voice)
 {
-	const auto& curAnnot = cassetteDsp->GetCurrentWorldAnnotation();
-	if (curAnnot.Value.has_value())
+	if (synthVoicePool == nullptr)
 	{
-		GetCassetteWorldAnnotation_String = curAnnot.Value.value();
+		errorMessage = "Voice pool not created.";
+		return false;
 	}
-	else
+
+	voice = (VoiceHandle)round(handle);
+	if (!synthVoicePool->IsValid(voice))
 	{
-		GetCassetteWorldAnnotation_String.clear();
+		errorMessage = "Invalid voice handle.";
+		return false;
 	}
 
-	return GetCassetteWorldAnnotation_String.c_str();
+	return true;
 }
 
-GMexport double FMODGMS_Get_Cassette_Pos()
+// Allocates a voice from the pool, steals the least important one when all are in use.
+GMexport double FMODGMS_Voice_Allocate()
 {
-	return cassetteDsp->GetActivePosition();
+	if (synthVoicePool == nullptr)
+	{
+		errorMessage = "Voice pool not created.";
+		return GMS_error;
+	}
+
+	errorMessage = "No errors.";
+	return (double)synthVoicePool->Allocate();
 }
 
-GMexport double Constant_Get_Bool(const char* s)
+// Releases the voice, it keeps ringing out until its envelope finishes.
+GMexport double FMODGMS_Voice_Release(double handle)
 {
-	return Constants::Globals.GetBool(s) ? 1.0 : 0.0;
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
+
+	synthVoicePool->Release(voice);
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-GMexport double FMODGMS_Constant_Get_Double_From_Obj(const char* obj, const char* s)
+// Returns 1 if the handle still owns its voice, 0 if it was released or stolen.
+GMexport double FMODGMS_Voice_Is_Valid(double handle)
 {
-	return Constants::Globals.GetObj(obj)->GetDouble(s);
+	return synthVoicePool != nullptr && synthVoicePool->IsValid((VoiceHandle)round(handle));
 }
 
-GMexport double FMODGMS_Constant_Get_Double(const char* s)
+GMexport double FMODGMS_Voice_Set_Key(double handle, double keydown)
 {
-	return Constants::Globals.GetDouble(s);
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
+
+	synthVoicePool->SetKeydown(voice, keydown > 0.5);
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-std::string _constant_ret;
-GMexport const char* FMODGMS_Constant_Get_String_Dangerous(const char* s)
+// Presses or releases the key on an exact sample of the pool's clock, see FMODGMS_Voice_Get_Time.
+GMexport double FMODGMS_Voice_Set_Key_At(double handle, double keydown, double sampleTime)
 {
-	_constant_ret = Constants::Globals.GetString(s);
-	return _constant_ret.c_str();
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
+
+	synthVoicePool->SetKeydown(voice, keydown > 0.5, sampleTime > 0.0 ? (SampleTime)round(sampleTime) : IMMEDIATE);
+	errorMessage = "No errors.";
+	return GMS_true;
 }
 
-GMexport double FMODGMS_Set_3d_X(double channel, double x, double y, double z)
+// Samples the voice pool has rendered, for scheduling with the ..._At functions.
+GMexport double FMODGMS_Voice_Get_Time()
 {
-	//std::size_t c = (std::size_t)round(channel);
+	return synthVoicePool != nullptr ? (double)synthVoicePool->GetSampleTime() : 0.0;
+}
 
-	//if (c < channelList.size())
-	//{
-	//}
-	/*
-		FMOD_VECTOR _position, _velocity, _up, _forward;
-	   _position.x = (float)x; 
-	   _position.y = (float)y;
-	   _position.z = (float)z;
+GMexport double FMODGMS_Voice_Set_Pitch(double handle, double pitch)
+{
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
 
-       _velocity.x = 0; 
-       _velocity.y = 0; 
-       _velocity.z = 0; 
+	synthVoicePool->SetPitch(voice, pitch);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
 
-       _forward.x = 0; 
-       _forward.y = 0;
-       _forward.z = 1; 
+GMexport double FMODGMS_Voice_Set_Volume(double handle, double volume)
+{
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
 
-           _up.x = 0; 
-           _up.y = 1;
-           _up.z = 0; 
-		   sys->set3DListenerAttributes(0, &_position, &_velocity, &_forward, &_up);
-		   */
+	synthVoicePool->SetVolume(voice, (float)volume);
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Wave is 0 for sine, 1 for pulse and 2 for saw. Times are in samples, pulse width is
+// the fraction of the cycle the pulse is high.
+GMexport double FMODGMS_Voice_Set_Config(double handle, double wave, double pulseWidth, double freq, double freqSmooth,
+	double attack, double decay, double sustain, double release, double ampSmooth, double lowPassAlpha)
+{
+	VoiceHandle voice;
+	if (!GetVoice(handle, voice))
+	{
+		return GMS_error;
+	}
+
+	const int w = (int)round(wave);
+	if (w < (int)WaveType::SIN || w > (int)WaveType::SAW)
+	{
+		errorMessage = "Invalid wave type.";
+		return GMS_error;
+	}
 
+	FMSynthConfig config;
+	config.Wave = (WaveType)w;
+	config.PulseWidth = 6.282 * pulseWidth;
+	config.Freq = freq;
+	config.FreqSmoothK = freqSmooth;
+	config.AmpASDR = AudioProcessors::ASDRConfig{ attack, sustain, decay, release };
+	config.AmpSmoothK = ampSmooth;
+	config.LowPassAlpha = lowPassAlpha;
+
+	synthVoicePool->SetConfig(voice, config);
+	errorMessage = "No errors.";
 	return GMS_true;
 }
 
+// Number of voices currently being rendered.
+GMexport double FMODGMS_Voice_Get_ActiveCount()
+{
+	return synthVoicePool != nullptr ? (double)synthVoicePool->GetActiveCount() : 0.0;
+}
+
 #pragma endregion
 
 #pragma region Channel Functions
@@ -1189,24 +2244,32 @@ GMexport double FMODGMS_Set_3d_X(double channel, double x, double y, double z)
 // Creates a new channel
 GMexport double FMODGMS_Chan_CreateChannel()
 {
-	FMOD::Channel* chan = nullptr;
-	channelList.emplace(nChannels++, chan);
+	ChannelSlot chan;
+	chan.UserData = std::make_unique<ChannelUserData>();
+
+	const SlotHandle c = channelList.Insert(std::move(chan));
+	if (c == INVALID_SLOT_HANDLE)
+	{
+		errorMessage = "Too many channels.";
+		return GMS_error;
+	}
 
 	errorMessage = "No errors.";
-	return nChannels - 1;
+	return c;
 }
 
 //Deletes a channel
 GMexport double FMODGMS_Chan_RemoveChannel(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		if (channelList[c] != NULL)
+		if (channelList[c].Channel != NULL)
 		{
-			channelList[c]->stop();
-			channelList.erase(c);
+			channelList[c].Channel->stop();
+			channelList[c].Channel->setUserData(nullptr);
+			channelList.Erase(c);
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1229,13 +2292,13 @@ GMexport double FMODGMS_Chan_RemoveChannel(double channel)
 // Pauses a channel
 GMexport double FMODGMS_Chan_PauseChannel(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		if (channelList[c] != NULL)
+		if (channelList[c].Channel != NULL)
 		{
-			channelList[c]->setPaused(true);
+			channelList[c].Channel->setPaused(true);
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1258,13 +2321,13 @@ GMexport double FMODGMS_Chan_PauseChannel(double channel)
 //Resumes a puased channel
 GMexport double FMODGMS_Chan_ResumeChannel(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		if (channelList[c] != NULL)
+		if (channelList[c].Channel != NULL)
 		{
-			channelList[c]->setPaused(false);
+			channelList[c].Channel->setPaused(false);
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1287,13 +2350,13 @@ GMexport double FMODGMS_Chan_ResumeChannel(double channel)
 // Stops a channel
 GMexport double FMODGMS_Chan_StopChannel(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		if (channelList[c] != NULL)
+		if (channelList[c].Channel != NULL)
 		{
-			channelList[c]->stop();
+			channelList[c].Channel->stop();
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1316,7 +2379,7 @@ GMexport double FMODGMS_Chan_StopChannel(double channel)
 // Sets the playing position of a channel
 GMexport double FMODGMS_Chan_Set_Position(double channel, double pos)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
 	unsigned int p;
 	if (pos < 0)
@@ -1324,9 +2387,9 @@ GMexport double FMODGMS_Chan_Set_Position(double channel, double pos)
 	else
 		p = (unsigned int)pos;
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		result = channelList[c]->setPosition(p, FMOD_TIMEUNIT_PCM);
+		result = channelList[c].Channel->setPosition(p, FMOD_TIMEUNIT_PCM);
 		errorMessage = "No errors.";
 		return GMS_true;
 	}
@@ -1342,12 +2405,12 @@ GMexport double FMODGMS_Chan_Set_Position(double channel, double pos)
 // Sets the volume of a channel
 GMexport double FMODGMS_Chan_Set_Volume(double channel, double vol)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 	float v = (float)vol;
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		result = channelList[c]->setVolume(v);
+		result = channelList[c].Channel->setVolume(v);
 		errorMessage = "No errors.";
 		return GMS_true;
 	}
@@ -1363,12 +2426,12 @@ GMexport double FMODGMS_Chan_Set_Volume(double channel, double vol)
 //Sets playback frequency of a channel
 GMexport double FMODGMS_Chan_Set_Frequency(double channel, double freq)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 	float f = (float)freq;
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		result = channelList[c]->setFrequency(f);
+		result = channelList[c].Channel->setFrequency(f);
 		errorMessage = "No errors.";
 		return GMS_true;
 	}
@@ -1384,12 +2447,12 @@ GMexport double FMODGMS_Chan_Set_Frequency(double channel, double freq)
 //Sets frequency multiplier of a channel
 GMexport double FMODGMS_Chan_Set_Pitch(double channel, double pitch)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 	float p = (float)pitch;
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		result = channelList[c]->setPitch(p);
+		result = channelList[c].Channel->setPitch(p);
 		errorMessage = "No errors.";
 		return GMS_true;
 	}
@@ -1405,13 +2468,13 @@ GMexport double FMODGMS_Chan_Set_Pitch(double channel, double pitch)
 // Sets the order position of a channel playing a MOD
 GMexport double FMODGMS_Chan_Set_ModOrder(double channel, double ord)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 
 		// check to see if the sound is a module
 		FMOD_SOUND_TYPE type;
@@ -1428,7 +2491,7 @@ GMexport double FMODGMS_Chan_Set_ModOrder(double channel, double ord)
 			else
 				_ord = (unsigned int)ord;
 
-			channelList[c]->setPosition(_ord, FMOD_TIMEUNIT_MODORDER);
+			channelList[c].Channel->setPosition(_ord, FMOD_TIMEUNIT_MODORDER);
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1452,13 +2515,13 @@ GMexport double FMODGMS_Chan_Set_ModOrder(double channel, double ord)
 // Sets the row position of a channel playing a MOD
 GMexport double FMODGMS_Chan_Set_ModRow(double channel, double row)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 
 		// check to see if the sound is a module
 		FMOD_SOUND_TYPE type;
@@ -1475,7 +2538,7 @@ GMexport double FMODGMS_Chan_Set_ModRow(double channel, double row)
 			else
 				r = (unsigned int)row;
 
-			channelList[c]->setPosition(r, FMOD_TIMEUNIT_MODROW);
+			channelList[c].Channel->setPosition(r, FMOD_TIMEUNIT_MODROW);
 			errorMessage = "No errors.";
 			return GMS_true;
 		}
@@ -1499,11 +2562,11 @@ GMexport double FMODGMS_Chan_Set_ModRow(double channel, double row)
 //Sets current mute status (1= muted, 0=unmuted)
 GMexport double FMODGMS_Chan_Set_Mute(double channel, double mute)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
-		channelList[c]->setMute((mute > 0.5));
+		channelList[c].Channel->setMute((mute > 0.5));
 		return FMODGMS_Util_ErrorChecker();
 	}
 
@@ -1518,18 +2581,18 @@ GMexport double FMODGMS_Chan_Set_Mute(double channel, double mute)
 // Returns the current position of the sound being played on the channel
 GMexport double FMODGMS_Chan_Get_Position(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		/*
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 		*/
 
 		unsigned int pos;
-		channelList[c]->getPosition(&pos, FMOD_TIMEUNIT_PCM);
+		channelList[c].Channel->getPosition(&pos, FMOD_TIMEUNIT_PCM);
 		errorMessage = "No errors.";
 		return (double)pos;
 	}
@@ -1545,12 +2608,12 @@ GMexport double FMODGMS_Chan_Get_Position(double channel)
 // Returns the volume of a channel
 GMexport double FMODGMS_Chan_Get_Volume(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		float vol;
-		channelList[c]->getVolume(&vol);
+		channelList[c].Channel->getVolume(&vol);
 		errorMessage = "No errors.";
 		return (double)vol;
 	}
@@ -1566,12 +2629,12 @@ GMexport double FMODGMS_Chan_Get_Volume(double channel)
 // Returns the frequency the channel is being played at
 GMexport double FMODGMS_Chan_Get_Frequency(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		float freq;
-		channelList[c]->getFrequency(&freq);
+		channelList[c].Channel->getFrequency(&freq);
 		errorMessage = "No errors.";
 		return (double)freq;
 	}
@@ -1587,12 +2650,12 @@ GMexport double FMODGMS_Chan_Get_Frequency(double channel)
 //Returns the frequency multipler of a channel
 GMexport double FMODGMS_Chan_Get_Pitch(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 	
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		float pitch;
-		channelList[c]->getPitch(&pitch);
+		channelList[c].Channel->getPitch(&pitch);
 		errorMessage = "No errors.";
 		return (double)pitch;
 	}
@@ -1608,13 +2671,13 @@ GMexport double FMODGMS_Chan_Get_Pitch(double channel)
 // Returns current order of a module playing in a particular channel
 GMexport double FMODGMS_Chan_Get_ModOrder(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 
 		// check to see if the sound is a module
 		FMOD_SOUND_TYPE type;
@@ -1626,7 +2689,7 @@ GMexport double FMODGMS_Chan_Get_ModOrder(double channel)
 			type == FMOD_SOUND_TYPE_IT)
 		{
 			unsigned int pos;
-			channelList[c]->getPosition(&pos, FMOD_TIMEUNIT_MODORDER);
+			channelList[c].Channel->getPosition(&pos, FMOD_TIMEUNIT_MODORDER);
 			errorMessage = "No errors.";
 			return (double)pos;
 		}
@@ -1650,13 +2713,13 @@ GMexport double FMODGMS_Chan_Get_ModOrder(double channel)
 // Returns current pattern of a module playing in a particular channel
 GMexport double FMODGMS_Chan_Get_ModPattern(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 
 		// check to see if the sound is a module
 		FMOD_SOUND_TYPE type;
@@ -1668,7 +2731,7 @@ GMexport double FMODGMS_Chan_Get_ModPattern(double channel)
 			type == FMOD_SOUND_TYPE_IT)
 		{
 			unsigned int pos;
-			channelList[c]->getPosition(&pos, FMOD_TIMEUNIT_MODPATTERN);
+			channelList[c].Channel->getPosition(&pos, FMOD_TIMEUNIT_MODPATTERN);
 			errorMessage = "No errors.";
 			return (double)pos;
 		}
@@ -1692,13 +2755,13 @@ GMexport double FMODGMS_Chan_Get_ModPattern(double channel)
 // Returns current row of a module playing in a particular channel
 GMexport double FMODGMS_Chan_Get_ModRow(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		// get handle of sound currently playing in channel
 		FMOD::Sound *snd;
-		channelList[c]->getCurrentSound(&snd);
+		channelList[c].Channel->getCurrentSound(&snd);
 
 		// check to see if the sound is a module
 		FMOD_SOUND_TYPE type;
@@ -1710,7 +2773,7 @@ GMexport double FMODGMS_Chan_Get_ModRow(double channel)
 			type == FMOD_SOUND_TYPE_IT)
 		{
 			unsigned int pos;
-			channelList[c]->getPosition(&pos, FMOD_TIMEUNIT_MODROW);
+			channelList[c].Channel->getPosition(&pos, FMOD_TIMEUNIT_MODROW);
 			errorMessage = "No errors.";
 			return (double)pos;
 		}
@@ -1734,12 +2797,12 @@ GMexport double FMODGMS_Chan_Get_ModRow(double channel)
 //Gets current mute status (1= muted, 0=unmuted)
 GMexport double FMODGMS_Chan_Get_Mute(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		bool muted;
-		if (channelList[c]->getMute(&muted) == FMOD_OK)
+		if (channelList[c].Channel->getMute(&muted) == FMOD_OK)
 		{
 			return (double)muted;
 		}
@@ -1761,11 +2824,11 @@ GMexport double FMODGMS_Chan_Get_Mute(double channel)
 // Checks if the given channel is currently playing a sound
 GMexport double FMODGMS_Chan_Is_Playing(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
-	if (channelList.count(c) == 1)
+	SlotHandle c = ToHandle(channel);
+	if (channelList.Contains(c))
 	{
 		bool playing;
-		if (channelList[c]->isPlaying(&playing) == FMOD_OK)
+		if (channelList[c].Channel->isPlaying(&playing) == FMOD_OK)
 		{
 			return (double)playing;
 		}
@@ -1786,19 +2849,19 @@ GMexport double FMODGMS_Chan_Is_Playing(double channel)
 //Adds an effect e to the i-th index of effect chain of a channel
 GMexport double FMODGMS_Chan_Add_Effect(double channel, double e, double i)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1u)
+	if (channelList.Contains(c))
 	{
-		std::size_t effectIndex = (std::size_t)round(e);
-		if (effectList.count(effectIndex) == 0u)
+		SlotHandle effectIndex = ToHandle(e);
+		if (!effectList.Contains(effectIndex))
 		{
 			errorMessage = "Invalid effect index";
 			return GMS_error;
 		}
 		FMOD::DSP* effect = effectList[effectIndex];
 
-		if (channelList[c]->addDSP((int)round(i), effect) == FMOD_OK)
+		if (channelList[c].Channel->addDSP((int)round(i), effect) == FMOD_OK)
 			return FMODGMS_Util_ErrorChecker();
 		else
 		{
@@ -1816,19 +2879,19 @@ GMexport double FMODGMS_Chan_Add_Effect(double channel, double e, double i)
 //Removes an effect e from the effect chain of a channel
 GMexport double FMODGMS_Chan_Remove_Effect(double channel, double e)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1u)
+	if (channelList.Contains(c))
 	{
-		std::size_t effectIndex = (std::size_t)round(e);
-		if (effectList.count(effectIndex) == 0u)
+		SlotHandle effectIndex = ToHandle(e);
+		if (!effectList.Contains(effectIndex))
 		{
 			errorMessage = "Invalid effect index";
 			return GMS_error;
 		}
 		FMOD::DSP* effect = effectList[effectIndex];
 
-		if (channelList[c]->removeDSP(effect) == FMOD_OK)
+		if (channelList[c].Channel->removeDSP(effect) == FMOD_OK)
 			return FMODGMS_Util_ErrorChecker();
 		else
 		{
@@ -1846,12 +2909,12 @@ GMexport double FMODGMS_Chan_Remove_Effect(double channel, double e)
 //Get current level/loudness of audio (RMS value)
 GMexport double FMODGMS_Chan_Get_Level(double channel)
 {
-	std::size_t c = (std::size_t)round(channel);
+	SlotHandle c = ToHandle(channel);
 
-	if (channelList.count(c) == 1)
+	if (channelList.Contains(c))
 	{
 		FMOD::DSP* headDSP;
-		channelList[c]->getDSP(FMOD_CHANNELCONTROL_DSP_TAIL, &headDSP);
+		channelList[c].Channel->getDSP(FMOD_CHANNELCONTROL_DSP_TAIL, &headDSP);
 
 		//enable channel metering if it isn't already
 		bool meteringEnabled = 0;
@@ -1886,9 +2949,9 @@ GMexport double FMODGMS_Chan_Get_Level(double channel)
 // Get number of tags in a sound
 GMexport double FMODGMS_Snd_Get_NumTags(double index)
 {
-	std::size_t i = (std::size_t)round(index);
+	SlotHandle i = ToHandle(index);
 
-	if (soundList.count(i) == 1)
+	if (soundList.Contains(i))
 	{
 		int numTags;
 		soundList[i]->getNumTags(&numTags, 0);
@@ -1908,9 +2971,9 @@ GMexport double FMODGMS_Snd_Get_NumTags(double index)
 // Get a tag name for a particular sound
 GMexport const char* FMODGMS_Snd_Get_TagName(double soundIndex, double tagIndex)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		int ti = (int)round(tagIndex);
@@ -1943,9 +3006,9 @@ GMexport const char* FMODGMS_Snd_Get_TagName(double soundIndex, double tagIndex)
 // Get a tag's type from a given index
 GMexport double FMODGMS_Snd_Get_TagTypeFromIndex(double soundIndex, double tagIndex)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		int ti = (int)round(tagIndex);
@@ -1978,10 +3041,10 @@ GMexport double FMODGMS_Snd_Get_TagTypeFromIndex(double soundIndex, double tagIn
 // Get a tag's data type from a given index
 GMexport double FMODGMS_Snd_Get_TagDataTypeFromIndex(double soundIndex, double tagIndex)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		int ti = (int)round(tagIndex);
@@ -2014,9 +3077,9 @@ GMexport double FMODGMS_Snd_Get_TagDataTypeFromIndex(double soundIndex, double t
 // Get a tag's numerical value (int, float) from a given index
 GMexport double FMODGMS_Snd_Get_TagRealFromIndex(double soundIndex, double tagIndex)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		int ti = (int)round(tagIndex);
@@ -2066,9 +3129,9 @@ GMexport double FMODGMS_Snd_Get_TagRealFromIndex(double soundIndex, double tagIn
 // Get a tag's string value from a given index
 GMexport const char* FMODGMS_Snd_Get_TagStringFromIndex(double soundIndex, double tagIndex)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		int ti = (int)round(tagIndex);
@@ -2140,9 +3203,9 @@ GMexport const char* FMODGMS_Snd_Get_TagStringFromIndex(double soundIndex, doubl
 // Get a tag's type from a given name
 GMexport double FMODGMS_Snd_Get_TagTypeFromName(double soundIndex, char* tagName)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		FMOD_TAG tag;
@@ -2187,9 +3250,9 @@ GMexport double FMODGMS_Snd_Get_TagTypeFromName(double soundIndex, char* tagName
 // Get a tag's data type from a given name
 GMexport double FMODGMS_Snd_Get_TagDataTypeFromName(double soundIndex, char* tagName)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		FMOD_TAG tag;
@@ -2232,9 +3295,9 @@ GMexport double FMODGMS_Snd_Get_TagDataTypeFromName(double soundIndex, char* tag
 // Get a tag's numerical value (int, float) from a given name
 GMexport double FMODGMS_Snd_Get_TagRealFromName(double soundIndex, char* tagName)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		FMOD_TAG tag;
@@ -2294,9 +3357,9 @@ GMexport double FMODGMS_Snd_Get_TagRealFromName(double soundIndex, char* tagName
 // Get a tag's string value from a given name
 GMexport const char* FMODGMS_Snd_Get_TagStringFromName(double soundIndex, char* tagName)
 {
-	std::size_t si = (std::size_t)round(soundIndex);
+	SlotHandle si = ToHandle(soundIndex);
 
-	if (soundList.count(si) == 1)
+	if (soundList.Contains(si))
 	{
 		int numTags;
 		FMOD_TAG tag;
@@ -2412,9 +3475,9 @@ GMexport double FMODGMS_Snd_Get_Type(double index)
 	24 - Max
 	*/
 
-	std::size_t i = (std::size_t)round(index);
+	SlotHandle i = ToHandle(index);
 
-	if (soundList.count(i) == 1)
+	if (soundList.Contains(i))
 	{
 		FMOD_SOUND_TYPE type;
 		soundList[i]->getFormat(&type, 0, 0, 0);
@@ -2449,8 +3512,13 @@ GMexport double FMODGMS_Effect_Create(double t)
 	FMOD::DSP* effect = NULL;
 	if (sys->createDSPByType((FMOD_DSP_TYPE)type, &effect) == FMOD_OK)
 	{
-		effectList.emplace(nEffects++, effect);
-		return nEffects - 1;
+		const SlotHandle effectIndex = effectList.Insert(effect);
+		if (effectIndex != INVALID_SLOT_HANDLE)
+			return effectIndex;
+
+		effect->release();
+		errorMessage = "Too many effects.";
+		return GMS_error;
 	}
 
 	errorMessage = "FMOD could not create effect.";
@@ -2460,8 +3528,8 @@ GMexport double FMODGMS_Effect_Create(double t)
 //Sets a parameter a of effect e to value v. For parameters of different effects, see fmod_dsp_effects.h
 GMexport double FMODGMS_Effect_Set_Parameter(double e, double p, double v)
 {
-	std::size_t effectIndex = (std::size_t)round(e);
-	if (effectList.count(effectIndex) == 0)
+	SlotHandle effectIndex = ToHandle(e);
+	if (!effectList.Contains(effectIndex))
 	{
 		errorMessage = "Invalid effect index";
 		return GMS_error;
@@ -2503,8 +3571,8 @@ GMexport double FMODGMS_Effect_Set_Parameter(double e, double p, double v)
 
 GMexport double FMODGMS_Effect_Get_Parameter(double e, double p)
 {
-	std::size_t effectIndex = (std::size_t)round(e);
-	if (effectList.count(effectIndex) == 0)
+	SlotHandle effectIndex = ToHandle(e);
+	if (!effectList.Contains(effectIndex))
 	{
 		errorMessage = "Invalid effect index";
 		return GMS_error;
@@ -2550,8 +3618,8 @@ GMexport double FMODGMS_Effect_Get_Parameter(double e, double p)
 //Frees an effect from the memory
 GMexport double FMODGMS_Effect_Remove(double e)
 {
-	std::size_t effectIndex = (std::size_t)round(e);
-	if (effectList.count(effectIndex) == 0)
+	SlotHandle effectIndex = ToHandle(e);
+	if (!effectList.Contains(effectIndex))
 	{
 		errorMessage = "Invalid effect index";
 		return GMS_error;
@@ -2559,7 +3627,7 @@ GMexport double FMODGMS_Effect_Remove(double e)
 	FMOD::DSP* effect = effectList[effectIndex];
 	if (effect->release() == FMOD_OK)
 	{
-		effectList.erase(effectIndex);
+		effectList.Erase(effectIndex);
 		return FMODGMS_Util_ErrorChecker();
 	}
 
@@ -2571,22 +3639,16 @@ GMexport double FMODGMS_Effect_Remove(double e)
 GMexport double FMODGMS_Effect_RemoveAll()
 {
 	bool success = true;
-	std::vector<std::size_t> toRemove;
-	for (auto itr = effectList.cbegin(); itr != effectList.cend(); ++itr)
+	effectList.EraseIf([&](FMOD::DSP* effect)
 	{
-		if (itr->second->release() != FMOD_OK)
+		if (effect->release() != FMOD_OK)
 		{
 			success = false;
+			return false;
 		}
-		else
-		{
-			toRemove.push_back(itr->first);
-		}
-	}
-	for (auto itr = toRemove.cbegin(); itr != toRemove.cend(); ++itr)
-	{
-		effectList.erase(*itr);
-	}
+
+		return true;
+	});
 
 	if (success == false)
 	{
@@ -2621,54 +3683,87 @@ GMexport const char* FMODGMS_Util_Handshake()
 GMexport double FMODGMS_Util_FFT(float* bufferIn, float* bufferOut, double numPoints, double normalize)
 {
 	int _numPoints = (int)(numPoints + 0.5);
-	if (_numPoints <= 0 || (_numPoints & 1) == 1 || _numPoints > 4096)
+	if (_numPoints <= 0 || (_numPoints & 1) == 1)
 	{
 		errorMessage = "numPoints must be even and positive.";
 		return GMS_error;
 	}
 
-	//apply hann window (and measure loudness)
-	double loudness = 0;
-	float bufferInTemp[4096];
-	for (int i = 0; i < _numPoints; i++)
+	//windowed fft, plans are kept for next time
+	FFTPlan* plan = fftPlans.Get((std::size_t)_numPoints);
+	if (plan == NULL)
+	{
+		errorMessage = "Failed to allocate memory.";
+		return GMS_error;
+	}
+
+	const double loudness = plan->Analyse(bufferIn, bufferOut);
+
+	//optional normalizing
+	if (normalize > 0.5)
+		NormalizeMagnitudes(bufferOut, plan->GetMagnitudeCount());
+
+	return loudness;
+}
+
+// Sets up FMODGMS_Util_STFT: frames of numPoints samples (even), starting every hopSize samples,
+// each normalized as FMODGMS_Util_FFT does if normalize is true.
+GMexport double FMODGMS_Util_Set_STFT(double numPoints, double hopSize, double normalize)
+{
+	const int _numPoints = (int)(numPoints + 0.5);
+	const int _hopSize = (int)(hopSize + 0.5);
+	if (_numPoints <= 0 || (_numPoints & 1) == 1)
 	{
-		bufferInTemp[i] = bufferIn[i]*powf(sinf((float)3.141592*i/(_numPoints-1)),2);
-		loudness += pow(bufferInTemp[i], 2);
+		errorMessage = "numPoints must be even and positive.";
+		return GMS_error;
 	}
 
-	//do fft
-	kiss_fftr_cfg cfg = kiss_fftr_alloc(_numPoints, 0, NULL, NULL);
-	if (cfg == NULL)
+	if (_hopSize <= 0)
 	{
-		errorMessage = "Failed to allocate memory.";
+		errorMessage = "hopSize must be positive.";
 		return GMS_error;
 	}
-	int numPointsQuarter = (int)(_numPoints / 4. + 0.5);
-	kiss_fft_cpx bufferOutTemp[1024];
-	kiss_fftr(cfg, bufferInTemp, bufferOutTemp);
-	for (int i = 0; i < numPointsQuarter; i++)
+
+	stftPoints = (std::size_t)_numPoints;
+	stftHop = (std::size_t)_hopSize;
+	stftNormalize = normalize > 0.5;
+	errorMessage = "No errors.";
+	return GMS_true;
+}
+
+// Returns how many frames FMODGMS_Util_STFT makes from numSamples samples
+GMexport double FMODGMS_Util_Get_STFT_FrameCount(double numSamples)
+{
+	const std::size_t samples = numSamples > 0 ? (std::size_t)(numSamples + 0.5) : 0;
+	return samples < stftPoints ? 0.0 : (double)(1 + (samples - stftPoints) / stftHop);
+}
+
+// Runs FMODGMS_Util_FFT over every frame of a buffer of numSamples float32s, as set by FMODGMS_Util_Set_STFT.
+// bufferOut gets numPoints / 4 magnitudes per frame, one frame after another, so needs room for
+// FMODGMS_Util_Get_STFT_FrameCount(numSamples) * numPoints / 4 float32s.
+// Return value, if not error, is the number of frames written.
+GMexport double FMODGMS_Util_STFT(float* bufferIn, float* bufferOut, double numSamples)
+{
+	FFTPlan* plan = fftPlans.Get(stftPoints);
+	if (plan == NULL)
 	{
-		bufferOut[i] = (sqrt(bufferOutTemp[i].i*bufferOutTemp[i].i + bufferOutTemp[i].r*bufferOutTemp[i].r)/_numPoints);
+		errorMessage = "Failed to allocate memory.";
+		return GMS_error;
 	}
-	
-	//optional normalizing
-	if (normalize > 0.5)
+
+	const std::size_t frames = (std::size_t)FMODGMS_Util_Get_STFT_FrameCount(numSamples);
+	const std::size_t magnitudes = plan->GetMagnitudeCount();
+	for (std::size_t frame = 0; frame < frames; frame++)
 	{
-		float normalizeFactor = 1;
-		for (int i = 0; i < numPointsQuarter; i++)
-		{
-			if (bufferOut[i] > normalizeFactor)
-				normalizeFactor = bufferOut[i];
-		}
-		for (int i = 0; i < numPointsQuarter; i++)
-		{
-			bufferOut[i] /= normalizeFactor;
-		}
+		float* out = bufferOut + frame * magnitudes;
+		plan->Analyse(bufferIn + frame * stftHop, out);
+
+		if (stftNormalize)
+			NormalizeMagnitudes(out, magnitudes);
 	}
-	
-	kiss_fftr_free(cfg);
 
-	return sqrt(loudness/_numPoints);
+	errorMessage = "No errors.";
+	return (double)frames;
 }
 
 // Helper function: converts FMOD Results to error message strings and returns GMS_true (1.0) if 
@@ -43,6 +43,31 @@ GMexport double FMODGMS_FFT_Get_DominantFrequency();
 GMexport double FMODGMS_FFT_Get_BinValue(double index);
 GMexport double FMODGMS_FFT_Get_NumBins();
 GMexport double FMODGMS_FFT_Normalize();
+GMexport double FMODGMS_FFT_Set_SpectrumMode(double scale, double bands, double smoothing);
+GMexport double FMODGMS_FFT_Get_SpectrumCount();
+GMexport double FMODGMS_FFT_Get_Spectrum_Buffer(float* buffer, double count);
+
+// Analyzer Functions
+GMexport double FMODGMS_Analyzer_Create(double windowSize, double windowType);
+GMexport double FMODGMS_Analyzer_Attach_Master(double analyzer, double postEffects);
+GMexport double FMODGMS_Analyzer_Attach_Channel(double analyzer, double channel, double postEffects);
+GMexport double FMODGMS_Analyzer_Detach(double analyzer);
+GMexport double FMODGMS_Analyzer_Set_WindowSize(double analyzer, double size);
+GMexport double FMODGMS_Analyzer_Set_WindowType(double analyzer, double windowType);
+GMexport double FMODGMS_Analyzer_Get_NumBins(double analyzer);
+GMexport double FMODGMS_Analyzer_Get_BinValue(double analyzer, double index);
+GMexport double FMODGMS_Analyzer_Get_Buffer(double analyzer, float* buffer, double count);
+GMexport double FMODGMS_Analyzer_Get_DominantFrequency(double analyzer);
+GMexport double FMODGMS_Analyzer_Normalize(double analyzer);
+GMexport double FMODGMS_Analyzer_Free(double analyzer);
+
+// Beat Functions
+GMexport double FMODGMS_Beat_Init();
+GMexport double FMODGMS_Beat_Set_Sensitivity(double sensitivity);
+GMexport double FMODGMS_Beat_Get_Events(double* buffer, double maxEvents);
+GMexport double FMODGMS_Beat_Get_BPM();
+GMexport double FMODGMS_Beat_Get_Time();
+GMexport double FMODGMS_Beat_Get_DroppedCount();
 
 // Sound Functions
 GMexport double FMODGMS_Snd_LoadSound(char* filename);
@@ -65,6 +90,17 @@ GMexport double FMODGMS_Snd_Get_BitsPerSample(double index);
 GMexport double FMODGMS_Snd_Get_DefaultFrequency(double index);
 GMexport double FMODGMS_Snd_ReadData(double index, double pos, double length, void* buffer);
 
+// Spectrogram Functions
+GMexport double FMODGMS_Snd_Spectrogram_Start(double index, double numPoints, double hopSize, double threads);
+GMexport double FMODGMS_Spectrogram_Get_State(double job);
+GMexport double FMODGMS_Spectrogram_Get_Progress(double job);
+GMexport double FMODGMS_Spectrogram_Get_FrameCount(double job);
+GMexport double FMODGMS_Spectrogram_Get_BinCount(double job);
+GMexport double FMODGMS_Spectrogram_Get_Buffer(double job, float* buffer, double count);
+GMexport double FMODGMS_Spectrogram_Get_Onsets(double job, float* buffer, double count);
+GMexport double FMODGMS_Spectrogram_Cancel(double job);
+GMexport double FMODGMS_Spectrogram_Free(double job);
+
 // Tag Functions
 GMexport double FMODGMS_Snd_Get_NumTags(double index);
 GMexport const char* FMODGMS_Snd_Get_TagName(double soundIndex, double tagIndex);
@@ -117,6 +153,9 @@ GMexport double FMODGMS_Effect_RemoveAll();
 GMexport const char* FMODGMS_Util_GetErrorMessage();
 GMexport const char* FMODGMS_Util_Handshake();
 GMexport double FMODGMS_Util_FFT(float* bufferIn, float* bufferOut, double numPoints, double normalize);
+GMexport double FMODGMS_Util_Set_STFT(double numPoints, double hopSize, double normalize);
+GMexport double FMODGMS_Util_Get_STFT_FrameCount(double numSamples);
+GMexport double FMODGMS_Util_STFT(float* bufferIn, float* bufferOut, double numSamples);
 
 // Internal helper functions
 double FMODGMS_Util_ErrorChecker();
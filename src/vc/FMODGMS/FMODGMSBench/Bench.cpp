@@ -0,0 +1,838 @@
+// Offline render harness for the custom DSPs.
+//
+// Drives each DSP's callback directly with synthetic input, no FMOD system or output
+// device is created. Reports timing and allocations across block sizes and channel
+// layouts, and can write or compare golden renders so DSP optimisations can be checked
+// for bit exactness (or closeness with --tolerance).
+//
+// Raw renders are large, so the checked in goldens are digests of them, one file per
+// platform as libm and the compiler move the last bits. --digests fails on any render
+// that doesn't hash the same, --golden shows how far off it is.
+//
+// Usage:
+//   FMODGMSBench [--write-golden <dir>] [--golden <dir>] [--tolerance <x>]
+//                [--write-digests <file>] [--digests <file>] [--no-timing] [--filter <name>]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AllocationCounter.h"
+#include "AnnotationStore.h"
+#include "Cassette.h"
+#include "CassetteDistortion.h"
+#include "ConstantReader.h"
+#include "FMSynth.h"
+#include "MixKernels.h"
+#include "Resampler.h"
+#include "SpeechSynth.h"
+#include "SynthVoicePool.h"
+
+// Must sit in the working directory, see bench_constants.txt next to this file.
+ConstantReader Constants::Globals("bench_constants.txt");
+
+namespace
+{
+    constexpr uint32_t SAMPLE_RATE = 48000;
+    constexpr uint32_t BUFFER_SIZES[] = { 64, 128, 256, 512, 1024, 2048, 4096 };
+    constexpr int CHANNEL_COUNTS[] = { 1, 2, 6, 8 };
+
+    // Four seconds of audio per configuration.
+    constexpr uint32_t BENCH_FRAMES = SAMPLE_RATE * 4;
+
+    constexpr uint32_t GOLDEN_BLOCK_SIZE = 512;
+    constexpr uint32_t GOLDEN_FRAMES = 16384;
+    constexpr uint32_t RANDOM_SEED = 1234;
+
+    // Owns everything a DSP needs so every run starts from the same state.
+    class BenchTarget
+    {
+    public:
+        virtual ~BenchTarget() = default;
+        virtual void Process(float* in, float* out, uint32_t length, int channels) = 0;
+    };
+
+    class CassetteTarget : public BenchTarget
+    {
+    public:
+        // tapeRate of 0 keeps the tapes at the mixer's rate.
+        CassetteTarget(Cassette::CassetteState state, uint32_t tapeRate = 0) :
+            m_speechSynth(&m_annotationStore, &m_voicePool),
+            m_cassette(
+                { Cassette::TapeFormat{ Cassette::RECORDBUFFER_SIZE, tapeRate }, Cassette::TapeFormat{ Cassette::RECORDBUFFER_SIZE, tapeRate } },
+                &m_annotationStore,
+                &m_channels,
+                &m_speechSynth)
+        {
+            if (state == Cassette::CassetteState::CASSETTE_PLAYING)
+            {
+                // Put something on the tape to play back.
+                std::vector<float> in(SAMPLE_RATE);
+                std::vector<float> out(SAMPLE_RATE);
+                for (uint32_t i = 0; i < in.size(); i++)
+                {
+                    in[i] = 0.5f * static_cast<float>(sin(i * 0.05));
+                }
+
+                int channels = 1;
+                m_cassette.SetState(Cassette::CassetteState::CASSETTE_RECORDING);
+                m_cassette.Callback(in.data(), out.data(), static_cast<uint32_t>(in.size()), channels, &channels);
+            }
+
+            m_cassette.SetState(state);
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            int outChannels = channels;
+            m_cassette.Callback(in, out, length, channels, &outChannels);
+        }
+
+    private:
+        AnnotationStore m_annotationStore;
+        SlotMap<ChannelSlot> m_channels;
+        SynthVoicePool m_voicePool;
+        SpeechSynthDSP m_speechSynth;
+        Cassette::CassetteDSP m_cassette;
+    };
+
+    class FMSynthTarget : public BenchTarget
+    {
+    public:
+        FMSynthTarget(WaveType wave)
+        {
+            FMSynthConfig config;
+            config.AmpASDR = AudioProcessors::ASDRConfig{ 400.0, 0.6, 2000.0, 4000.0 };
+            config.AmpSmoothK = 8.0;
+            config.Wave = wave;
+            config.PulseWidth = 6.282 * 0.3;
+            config.Freq = 3.0;
+            config.FreqSmoothK = 16.0;
+            config.LowPassAlpha = 0.4;
+
+            m_synth.SetConfig(config);
+            m_synth.SetEnabled(true);
+            m_synth.SetKeydown(true);
+            m_synth.SetPitch(1.0);
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            int outChannels = channels;
+            m_synth.Callback(in, out, length, channels, &outChannels);
+        }
+
+    private:
+        FMSynthDSP m_synth;
+    };
+
+    // A crowd of voices held down at different pitches, all rendered by the one DSP.
+    class VoicePoolTarget : public BenchTarget
+    {
+    public:
+        VoicePoolTarget(size_t voices)
+        {
+            for (size_t i = 0; i < voices; i++)
+            {
+                FMSynthConfig config;
+                config.AmpASDR = AudioProcessors::ASDRConfig{ 400.0, 0.6, 2000.0, 4000.0 };
+                config.AmpSmoothK = 8.0;
+                config.Wave = static_cast<WaveType>(i % 3);
+                config.PulseWidth = 6.282 * 0.3;
+                config.Freq = 3.0 + 0.25 * i;
+                config.FreqSmoothK = 16.0;
+                config.LowPassAlpha = 0.4;
+
+                const VoiceHandle voice = m_pool.Allocate();
+                m_pool.SetConfig(voice, config);
+                m_pool.SetVolume(voice, 1.f / static_cast<float>(voices));
+                m_pool.SetKeydown(voice, true);
+            }
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            int outChannels = channels;
+            m_pool.Callback(in, out, length, channels, &outChannels);
+        }
+
+    private:
+        SynthVoicePool m_pool;
+    };
+
+    // Several speakers babbling over each other, sequenced and rendered by the voice pool.
+    class SpeechTarget : public BenchTarget
+    {
+    public:
+        SpeechTarget(size_t speakers) :
+            m_speechSynth(&m_annotationStore, &m_pool),
+            m_utterances(speakers, INVALID_UTTERANCE)
+        {
+            m_pool.SetSequencer(&m_speechSynth);
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            static const char* LINES[] = { "hello there", "the quick brown fox", "what a lovely tape", "mm hmm" };
+
+            // Keep everyone talking.
+            for (size_t i = 0; i < m_utterances.size(); i++)
+            {
+                if (!m_speechSynth.IsTalking(m_utterances[i]))
+                {
+                    m_utterances[i] = m_speechSynth.Talk(LINES[i % std::size(LINES)], "bench_speaker");
+                    m_speechSynth.SetVolume(m_utterances[i], 1.f / static_cast<float>(m_utterances.size()));
+                }
+            }
+
+            int outChannels = channels;
+            m_pool.Callback(in, out, length, channels, &outChannels);
+        }
+
+    private:
+        AnnotationStore m_annotationStore;
+        SynthVoicePool m_pool;
+        SpeechSynthDSP m_speechSynth;
+        std::vector<UtteranceHandle> m_utterances;
+    };
+
+    // Distortion is mono, channels are processed as one long run like the cassette does.
+    class DistortionTarget : public BenchTarget
+    {
+    public:
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            const size_t count = static_cast<size_t>(length) * channels;
+            memcpy(out, in, count * sizeof(float));
+
+            const auto constants = Constants::Globals.ReadSnapshot();
+            m_distort.Run(out, count, *constants);
+        }
+
+    private:
+        Cassette::CassetteDistortion m_distort;
+    };
+
+    // The cassette mix kernel on its own, with a loud tape so the clamp gets exercised.
+    class MixTarget : public BenchTarget
+    {
+    public:
+        MixTarget(MixKernels::InstructionSet isa) :
+            m_kernel(MixKernels::MixKernel::Create(isa)),
+            m_tape(BUFFER_SIZES[std::size(BUFFER_SIZES) - 1]),
+            m_mono(m_tape.size())
+        {
+            for (size_t i = 0; i < m_tape.size(); i++)
+            {
+                m_tape[i] = static_cast<float>(sin(i * 0.01));
+            }
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            m_kernel.Run(in, out, length, channels, m_tape.data(), 0.9f, m_mono.data());
+        }
+
+    private:
+        MixKernels::MixKernel m_kernel;
+        std::vector<float> m_tape;
+        std::vector<float> m_mono;
+    };
+
+    // Tape playback through the resampler, drifting between a fifth and full speed the
+    // way the cassette control eases in and out.
+    class ResampleTarget : public BenchTarget
+    {
+    public:
+        ResampleTarget(Resampling::ResampleQuality quality, MixKernels::InstructionSet isa) :
+            m_resampler(Resampling::Resampler::Create(quality, isa)),
+            m_tape(Cassette::RECORDBUFFER_SIZE),
+            m_window(2 * BUFFER_SIZES[std::size(BUFFER_SIZES) - 1] + 128),
+            m_mono(BUFFER_SIZES[std::size(BUFFER_SIZES) - 1])
+        {
+            for (size_t i = 0; i < Cassette::RECORDBUFFER_SIZE; i++)
+            {
+                m_tape.Push(static_cast<float>(0.4 * sin(i * 0.05) + 0.2 * sin(i * 0.9)), NO_ANNOTATION);
+            }
+        }
+
+        void Process(float* in, float* out, uint32_t length, int channels) override
+        {
+            const double step = 0.6 + 0.4 * sin(m_blocks++ * 0.05);
+            const double last = m_pos + (length - 1) * step;
+
+            const int64_t start = static_cast<int64_t>(floor(m_pos)) - m_resampler.GetTapsBefore();
+            const size_t count = static_cast<size_t>(floor(last) - floor(m_pos)) + m_resampler.GetTapsBefore() + m_resampler.GetTapsAfter() + 2;
+            m_tape.CopyWindow(start, count, m_window.data());
+            m_resampler.Run(m_window.data(), m_pos - start, step, m_mono.data(), length);
+
+            for (uint32_t frame = 0; frame < length; frame++)
+            {
+                for (int chan = 0; chan < channels; chan++)
+                {
+                    out[static_cast<size_t>(frame) * channels + chan] = m_mono[frame];
+                }
+            }
+
+            m_pos = fmod(m_pos + length * step, static_cast<double>(Cassette::RECORDBUFFER_SIZE));
+        }
+
+    private:
+        Resampling::Resampler m_resampler;
+        Cassette::RecordBuffer m_tape;
+        std::vector<float> m_window;
+        std::vector<float> m_mono;
+        double m_pos = 0.0;
+        uint32_t m_blocks = 0;
+    };
+
+    struct BenchCase
+    {
+        const char* Name;
+        std::function<std::unique_ptr<BenchTarget>()> Create;
+    };
+
+    std::vector<BenchCase> MakeCases()
+    {
+        std::vector<BenchCase> cases = {
+            { "cassette_play", [] { return std::make_unique<CassetteTarget>(Cassette::CassetteState::CASSETTE_PLAYING); } },
+            { "cassette_record", [] { return std::make_unique<CassetteTarget>(Cassette::CassetteState::CASSETTE_RECORDING); } },
+            { "cassette_play_16k", [] { return std::make_unique<CassetteTarget>(Cassette::CassetteState::CASSETTE_PLAYING, 16000); } },
+            { "cassette_record_16k", [] { return std::make_unique<CassetteTarget>(Cassette::CassetteState::CASSETTE_RECORDING, 16000); } },
+            { "fmsynth_sin", [] { return std::make_unique<FMSynthTarget>(WaveType::SIN); } },
+            { "fmsynth_pulse", [] { return std::make_unique<FMSynthTarget>(WaveType::PULSE); } },
+            { "fmsynth_saw", [] { return std::make_unique<FMSynthTarget>(WaveType::SAW); } },
+            { "voicepool_1", [] { return std::make_unique<VoicePoolTarget>(1); } },
+            { "voicepool_16", [] { return std::make_unique<VoicePoolTarget>(16); } },
+            { "speech_4", [] { return std::make_unique<SpeechTarget>(4); } },
+            { "distortion", [] { return std::make_unique<DistortionTarget>(); } },
+            { "mix_scalar", [] { return std::make_unique<MixTarget>(MixKernels::InstructionSet::Scalar); } },
+        };
+
+        if (MixKernels::MixKernel::IsSupported(MixKernels::InstructionSet::SSE2))
+        {
+            cases.push_back({ "mix_sse2", [] { return std::make_unique<MixTarget>(MixKernels::InstructionSet::SSE2); } });
+        }
+
+        if (MixKernels::MixKernel::IsSupported(MixKernels::InstructionSet::AVX2))
+        {
+            cases.push_back({ "mix_avx2", [] { return std::make_unique<MixTarget>(MixKernels::InstructionSet::AVX2); } });
+        }
+
+        using Resampling::ResampleQuality;
+        using MixKernels::InstructionSet;
+
+        cases.push_back({ "resample_linear", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Linear, InstructionSet::Scalar); } });
+        cases.push_back({ "resample_cubic", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Cubic, InstructionSet::Scalar); } });
+        cases.push_back({ "resample_sinc", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Sinc, InstructionSet::Scalar); } });
+
+        if (MixKernels::MixKernel::IsSupported(InstructionSet::SSE2))
+        {
+            cases.push_back({ "resample_sinc_sse2", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Sinc, InstructionSet::SSE2); } });
+        }
+
+        if (MixKernels::MixKernel::IsSupported(InstructionSet::AVX2))
+        {
+            cases.push_back({ "resample_linear_avx2", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Linear, InstructionSet::AVX2); } });
+            cases.push_back({ "resample_cubic_avx2", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Cubic, InstructionSet::AVX2); } });
+            cases.push_back({ "resample_sinc_avx2", [] { return std::make_unique<ResampleTarget>(ResampleQuality::Sinc, InstructionSet::AVX2); } });
+        }
+
+        return cases;
+    }
+
+    // Deterministic test signal, two tones and a little noise.
+    std::vector<float> MakeInput(uint32_t frames, int channels)
+    {
+        std::vector<float> input(static_cast<size_t>(frames) * channels);
+        uint32_t lcg = RANDOM_SEED;
+
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            const double t = static_cast<double>(i) / SAMPLE_RATE;
+            for (int chan = 0; chan < channels; chan++)
+            {
+                lcg = lcg * 1664525u + 1013904223u;
+                const double noise = (static_cast<double>(lcg >> 8) / static_cast<double>(1 << 24)) - 0.5;
+                const double tone = 0.4 * sin(2.0 * 3.14159265358979 * (220.0 + 20.0 * chan) * t)
+                    + 0.2 * sin(2.0 * 3.14159265358979 * 3520.0 * t);
+                input[static_cast<size_t>(i) * channels + chan] = static_cast<float>(tone + 0.02 * noise);
+            }
+        }
+
+        return input;
+    }
+
+    struct BenchResult
+    {
+        double NsPerSample;
+        double AllocationsPerCall;
+        double WorstBlockUs;
+    };
+
+    BenchResult RunBench(const BenchCase& benchCase, const std::vector<float>& input, uint32_t blockSize, int channels)
+    {
+        srand(RANDOM_SEED);
+        auto target = benchCase.Create();
+
+        std::vector<float> in(static_cast<size_t>(blockSize) * channels);
+        std::vector<float> out(in.size());
+
+        // Warm up caches and any lazily sized state.
+        memcpy(in.data(), input.data(), in.size() * sizeof(float));
+        target->Process(in.data(), out.data(), blockSize, channels);
+
+        const uint32_t blocks = BENCH_FRAMES / blockSize;
+        const uint32_t inputFrames = static_cast<uint32_t>(input.size() / channels);
+
+        double totalNs = 0.0;
+        double worstNs = 0.0;
+        uint64_t allocations = 0;
+
+        for (uint32_t block = 0; block < blocks; block++)
+        {
+            const uint32_t startFrame = (block * blockSize) % (inputFrames - blockSize);
+            memcpy(in.data(), input.data() + static_cast<size_t>(startFrame) * channels, in.size() * sizeof(float));
+
+            AllocationCounter::Scope scope;
+            const auto start = std::chrono::steady_clock::now();
+
+            target->Process(in.data(), out.data(), blockSize, channels);
+
+            const auto end = std::chrono::steady_clock::now();
+            allocations += scope.Count();
+
+            const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            totalNs += ns;
+            worstNs = std::max(worstNs, ns);
+        }
+
+        BenchResult result;
+        result.NsPerSample = totalNs / (static_cast<double>(blocks) * blockSize * channels);
+        result.AllocationsPerCall = static_cast<double>(allocations) / blocks;
+        result.WorstBlockUs = worstNs / 1000.0;
+        return result;
+    }
+
+    std::vector<float> RenderGolden(const BenchCase& benchCase, const std::vector<float>& input, int channels)
+    {
+        srand(RANDOM_SEED);
+        auto target = benchCase.Create();
+
+        std::vector<float> in(static_cast<size_t>(GOLDEN_BLOCK_SIZE) * channels);
+        std::vector<float> rendered(static_cast<size_t>(GOLDEN_FRAMES) * channels);
+
+        for (uint32_t frame = 0; frame < GOLDEN_FRAMES; frame += GOLDEN_BLOCK_SIZE)
+        {
+            const size_t offset = static_cast<size_t>(frame) * channels;
+            memcpy(in.data(), input.data() + offset, in.size() * sizeof(float));
+            target->Process(in.data(), rendered.data() + offset, GOLDEN_BLOCK_SIZE, channels);
+        }
+
+        return rendered;
+    }
+
+    // Worst signal to error ratio of each resampler over a few tape speeds, reading a pure
+    // tone against the exact tone it should have produced.
+    void PrintResampleQuality()
+    {
+        constexpr double FREQS[] = { 0.01, 0.1, 0.25, 0.4 };
+        constexpr double STEPS[] = { 0.37, 0.5, 0.9, 1.0 };
+        constexpr uint32_t COUNT = 4096;
+        constexpr double START = 100.25;
+
+        printf("%-16s", "resample snr dB");
+        for (const double freq : FREQS)
+        {
+            printf(" %6.2f/smp", freq);
+        }
+        printf("\n");
+
+        for (size_t q = 0; q < Resampling::RESAMPLE_QUALITY_COUNT; q++)
+        {
+            const auto resampler = Resampling::Resampler::Select(static_cast<Resampling::ResampleQuality>(q));
+            printf("%-16s", Resampling::Resampler::GetName(resampler.GetQuality()));
+
+            for (const double freq : FREQS)
+            {
+                double worst = 1000.0;
+                for (const double step : STEPS)
+                {
+                    std::vector<float> source(static_cast<size_t>(START + COUNT * step) + 256);
+                    for (size_t i = 0; i < source.size(); i++)
+                    {
+                        source[i] = static_cast<float>(sin(2.0 * 3.14159265358979 * freq * i));
+                    }
+
+                    std::vector<float> out(COUNT);
+                    resampler.Run(source.data(), START, step, out.data(), COUNT);
+
+                    double signal = 0.0;
+                    double error = 0.0;
+                    for (uint32_t i = 0; i < COUNT; i++)
+                    {
+                        const double expected = sin(2.0 * 3.14159265358979 * freq * (START + i * step));
+                        signal += expected * expected;
+                        error += (out[i] - expected) * (out[i] - expected);
+                    }
+
+                    worst = std::min(worst, 10.0 * log10(signal / std::max(error, 1e-30)));
+                }
+
+                printf(" %10.1f", worst);
+            }
+            printf("\n");
+        }
+
+        printf("\n");
+    }
+
+    // Every vector kernel against scalar on awkward input: NaN, infinities, signed zeros
+    // and values far outside the clamp. The clamped output has to match bit for bit, but
+    // for which NaN comes out when both sides of an add are one. The mono average adds the
+    // channels in another order, so it only has to be within rounding of the size of what
+    // was added up.
+    bool CheckMixKernels()
+    {
+        constexpr uint32_t FRAMES = 1021;
+        constexpr float VOLUME = 0.9f;
+        const float specials[] = {
+            NAN, -NAN, INFINITY, -INFINITY, 0.f, -0.f, 1.f, -1.f, 1e30f, -1e30f, 1e-40f, 0.9999999f };
+
+        const auto scalar = MixKernels::MixKernel::Create(MixKernels::InstructionSet::Scalar);
+        bool ok = true;
+
+        for (const auto isa : { MixKernels::InstructionSet::SSE2, MixKernels::InstructionSet::AVX2 })
+        {
+            if (!MixKernels::MixKernel::IsSupported(isa))
+            {
+                continue;
+            }
+
+            const auto kernel = MixKernels::MixKernel::Create(isa);
+            for (const int channels : CHANNEL_COUNTS)
+            {
+                const size_t samples = static_cast<size_t>(FRAMES) * channels;
+                std::vector<float> in(samples);
+                std::vector<float> add(FRAMES);
+                uint32_t lcg = RANDOM_SEED;
+                for (size_t i = 0; i < samples; i++)
+                {
+                    lcg = lcg * 1664525u + 1013904223u;
+                    in[i] = (lcg >> 28) == 0
+                        ? specials[(lcg >> 8) % std::size(specials)]
+                        : 4.f * (static_cast<float>(lcg >> 8) / static_cast<float>(1 << 24)) - 2.f;
+                }
+
+                for (uint32_t i = 0; i < FRAMES; i++)
+                {
+                    add[i] = i % 7 == 0 ? specials[i % std::size(specials)] : static_cast<float>(sin(i * 0.01));
+                }
+
+                std::vector<float> expectedOut(samples);
+                std::vector<float> expectedMono(FRAMES);
+                std::vector<float> out(samples);
+                std::vector<float> mono(FRAMES);
+                scalar.Run(in.data(), expectedOut.data(), FRAMES, channels, add.data(), VOLUME, expectedMono.data());
+                kernel.Run(in.data(), out.data(), FRAMES, channels, add.data(), VOLUME, mono.data());
+
+                size_t outMismatches = 0;
+                for (size_t i = 0; i < samples; i++)
+                {
+                    const bool bothNan = std::isnan(out[i]) && std::isnan(expectedOut[i]);
+                    outMismatches += !bothNan && memcmp(&out[i], &expectedOut[i], sizeof(float)) != 0;
+                }
+
+                size_t monoMismatches = 0;
+                for (uint32_t frame = 0; frame < FRAMES; frame++)
+                {
+                    double magnitude = 0.0;
+                    for (int chan = 0; chan < channels; chan++)
+                    {
+                        magnitude += std::abs(in[static_cast<size_t>(frame) * channels + chan]);
+                    }
+
+                    const double expected = expectedMono[frame];
+                    const double actual = mono[frame];
+                    const bool same = (std::isnan(expected) && std::isnan(actual)) || expected == actual
+                        || std::abs(expected - actual) <= 1e-6 * magnitude / channels;
+                    monoMismatches += !same;
+                }
+
+                const bool pass = outMismatches == 0 && monoMismatches == 0;
+                printf("mix check %-6s %dch out mismatches %zu mono mismatches %zu %s\n",
+                    MixKernels::MixKernel::GetName(isa), channels, outMismatches, monoMismatches, pass ? "ok" : "FAIL");
+                ok &= pass;
+            }
+        }
+
+        printf("\n");
+        return ok;
+    }
+
+    std::string GoldenPath(const std::string& dir, const BenchCase& benchCase, int channels)
+    {
+        return dir + "/" + benchCase.Name + "_" + std::to_string(channels) + "ch.raw";
+    }
+
+    bool WriteGolden(const std::string& path, const std::vector<float>& data)
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(float));
+        return file.good();
+    }
+
+    bool ReadGolden(const std::string& path, std::vector<float>& data)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return false;
+        }
+
+        const auto size = static_cast<size_t>(file.tellg());
+        data.resize(size / sizeof(float));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+        return file.good();
+    }
+
+    // FNV-1a over the sample bits.
+    uint64_t Digest(const std::vector<float>& data)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < data.size() * sizeof(float); i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    std::string DigestKey(const BenchCase& benchCase, int channels)
+    {
+        return std::string(benchCase.Name) + "_" + std::to_string(channels) + "ch";
+    }
+
+    bool WriteDigests(const std::string& path, const std::map<std::string, uint64_t>& digests)
+    {
+        std::ofstream file(path);
+        file << "# FMODGMSBench --write-digests, FNV-1a 64 of each golden render\n";
+        for (const auto& [key, digest] : digests)
+        {
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(digest));
+            file << key << " " << hex << "\n";
+        }
+
+        return file.good();
+    }
+
+    bool ReadDigests(const std::string& path, std::map<std::string, uint64_t>& digests)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            const size_t space = line.find(' ');
+            if (line.empty() || line[0] == '#' || space == std::string::npos)
+            {
+                continue;
+            }
+
+            digests[line.substr(0, space)] = strtoull(line.c_str() + space + 1, nullptr, 16);
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string writeGoldenDir;
+    std::string goldenDir;
+    std::string writeDigestsPath;
+    std::string digestsPath;
+    std::string filter;
+    double tolerance = 0.0;
+    bool timing = true;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+
+        if (arg == "--write-golden" && hasValue)
+        {
+            writeGoldenDir = argv[++i];
+        }
+        else if (arg == "--golden" && hasValue)
+        {
+            goldenDir = argv[++i];
+        }
+        else if (arg == "--tolerance" && hasValue)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (arg == "--write-digests" && hasValue)
+        {
+            writeDigestsPath = argv[++i];
+        }
+        else if (arg == "--digests" && hasValue)
+        {
+            digestsPath = argv[++i];
+        }
+        else if (arg == "--no-timing")
+        {
+            timing = false;
+        }
+        else if (arg == "--filter" && hasValue)
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            printf("Usage: %s [--write-golden <dir>] [--golden <dir>] [--tolerance <x>]"
+                " [--write-digests <file>] [--digests <file>] [--no-timing] [--filter <name>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::map<std::string, uint64_t> expectedDigests;
+    if (!digestsPath.empty() && !ReadDigests(digestsPath, expectedDigests))
+    {
+        printf("Could not read %s\n", digestsPath.c_str());
+        return 1;
+    }
+
+    std::map<std::string, uint64_t> digests;
+
+    if (!AllocationCounter::Enabled())
+    {
+        printf("Note: allocation tracking is compiled out, allocs/call will read 0.\n\n");
+    }
+
+    printf("Cassette mix kernel: %s\n\n",
+        MixKernels::MixKernel::GetName(MixKernels::MixKernel::Select().GetInstructionSet()));
+
+    const auto cases = MakeCases();
+    bool failed = false;
+
+    if (timing && (filter.empty() || std::string("resample").find(filter) != std::string::npos || filter.find("resample") != std::string::npos))
+    {
+        PrintResampleQuality();
+    }
+
+    if (filter.empty() || filter.find("mix") != std::string::npos)
+    {
+        failed |= !CheckMixKernels();
+    }
+
+    if (timing)
+    {
+        printf("%-16s %6s %4s %12s %12s %14s\n", "dsp", "block", "ch", "ns/sample", "allocs/call", "worst block us");
+    }
+
+    for (const auto& benchCase : cases)
+    {
+        if (!filter.empty() && std::string(benchCase.Name).find(filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        for (const int channels : CHANNEL_COUNTS)
+        {
+            const auto input = MakeInput(std::max(BENCH_FRAMES, GOLDEN_FRAMES) + BUFFER_SIZES[0], channels);
+
+            if (timing)
+            {
+                for (const uint32_t blockSize : BUFFER_SIZES)
+                {
+                    const auto result = RunBench(benchCase, input, blockSize, channels);
+                    printf("%-16s %6u %4d %12.3f %12.2f %14.2f\n",
+                        benchCase.Name, blockSize, channels, result.NsPerSample, result.AllocationsPerCall, result.WorstBlockUs);
+                }
+            }
+
+            if (writeGoldenDir.empty() && goldenDir.empty() && writeDigestsPath.empty() && digestsPath.empty())
+            {
+                continue;
+            }
+
+            const auto rendered = RenderGolden(benchCase, input, channels);
+            const auto key = DigestKey(benchCase, channels);
+            digests[key] = Digest(rendered);
+
+            if (!digestsPath.empty())
+            {
+                const auto expected = expectedDigests.find(key);
+                if (expected == expectedDigests.end())
+                {
+                    printf("DIGEST MISSING %s\n", key.c_str());
+                    failed = true;
+                }
+                else
+                {
+                    const bool pass = expected->second == digests[key];
+                    printf("digest %-16s %dch %s\n", benchCase.Name, channels, pass ? "ok" : "FAIL");
+                    failed |= !pass;
+                }
+            }
+
+            if (!writeGoldenDir.empty())
+            {
+                const auto path = GoldenPath(writeGoldenDir, benchCase, channels);
+                if (!WriteGolden(path, rendered))
+                {
+                    printf("Could not write %s\n", path.c_str());
+                    failed = true;
+                }
+            }
+
+            if (!goldenDir.empty())
+            {
+                const auto path = GoldenPath(goldenDir, benchCase, channels);
+                std::vector<float> expected;
+                if (!ReadGolden(path, expected) || expected.size() != rendered.size())
+                {
+                    printf("GOLDEN MISSING %s\n", path.c_str());
+                    failed = true;
+                    continue;
+                }
+
+                double maxDiff = 0.0;
+                for (size_t i = 0; i < rendered.size(); i++)
+                {
+                    maxDiff = std::max(maxDiff, static_cast<double>(std::abs(rendered[i] - expected[i])));
+                }
+
+                const bool pass = maxDiff <= tolerance;
+                printf("golden %-16s %dch max diff %g %s\n", benchCase.Name, channels, maxDiff, pass ? "ok" : "FAIL");
+                failed |= !pass;
+            }
+        }
+    }
+
+    if (!writeDigestsPath.empty() && !WriteDigests(writeDigestsPath, digests))
+    {
+        printf("Could not write %s\n", writeDigestsPath.c_str());
+        failed = true;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+// Stands in for the FMOD library in the headless Linux build, see build_linux.sh.
+//
+// The bench drives the DSP callbacks itself and never creates a system, so none of
+// these are reached. They only satisfy the linker for the registration and channel
+// code compiled into the plugin sources. The Windows build links fmod_vc.lib instead.
+
+#include "fmod.hpp"
+
+namespace FMOD
+{
+    FMOD_RESULT System::getSoftwareFormat(int*, FMOD_SPEAKERMODE*, int*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT System::getDSPBufferSize(unsigned int*, int*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT System::createDSP(const FMOD_DSP_DESCRIPTION*, DSP**) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT System::getMasterChannelGroup(ChannelGroup**) { return FMOD_ERR_UNSUPPORTED; }
+
+    FMOD_RESULT Sound::getUserData(void**) { return FMOD_ERR_UNSUPPORTED; }
+
+    FMOD_RESULT ChannelControl::isPlaying(bool*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT ChannelControl::addDSP(int, DSP*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT ChannelControl::removeDSP(DSP*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT ChannelControl::getUserData(void**) { return FMOD_ERR_UNSUPPORTED; }
+
+    FMOD_RESULT Channel::getPosition(unsigned int*, FMOD_TIMEUNIT) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT Channel::getCurrentSound(Sound**) { return FMOD_ERR_UNSUPPORTED; }
+
+    FMOD_RESULT DSP::release() { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT DSP::setUserData(void*) { return FMOD_ERR_UNSUPPORTED; }
+    FMOD_RESULT DSP::getUserData(void**) { return FMOD_ERR_UNSUPPORTED; }
+}
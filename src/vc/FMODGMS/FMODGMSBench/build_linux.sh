@@ -0,0 +1,8 @@
+# Headless build of the bench for Linux CI, no FMOD library needed (see FMODStub.cpp).
+# Run from this directory, then check the renders with
+#   ./FMODGMSBench --digests golden/linux_x64.txt
+echo "Building FMODGMSBench..."
+SOURCES="AllocationCounter AnnotationStore Cassette CassetteControl CassetteDistortion ConstantReader FMSynth MixKernels Oscillator Resampler RingBuffer SpectrumView SpeechSynth SynthVoicePool TapeFile TapeStore"
+${CXX:-g++} -std=c++20 -m64 -O2 -ffp-contract=off -Wall -Wno-unknown-pragmas -DFMODGMS_TRACK_ALLOCATIONS -I../FMODGMS -I../FMODGMS/kissfft \
+    -o FMODGMSBench Bench.cpp FMODStub.cpp $(for s in $SOURCES; do printf "../FMODGMS/%s.cpp " $s; done) -lpthread || exit 1
+echo "Finished"
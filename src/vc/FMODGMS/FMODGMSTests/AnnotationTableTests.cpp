@@ -0,0 +1,119 @@
+#include "CppUnitTest.h"
+#include "AnnotationStore.h"
+#include <random>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace FMODGMSTests
+{
+	// The annotation Find should return, straight from the definition: of those the
+	// position is strictly inside, the one that started last, later in the list on ties.
+	const Annotation* FindDirect(const std::vector<Annotation>& sorted, double position)
+	{
+		const Annotation* found = nullptr;
+		for (const auto& x : sorted)
+		{
+			if (position > x.Range.Start && position < x.Range.End)
+			{
+				found = &x;
+			}
+		}
+
+		return found;
+	}
+
+	void CheckAgainstDirect(const AnnotationTable& table, std::mt19937& random, double length)
+	{
+		const auto& sorted = table.GetAnnotations();
+		std::uniform_real_distribution<double> positions(-1.0, length + 1.0);
+
+		uint32_t cursor = 0;
+		for (int i = 0; i < 2000; i++)
+		{
+			// Mostly random, sometimes exactly on an annotation's start or end.
+			double position = positions(random);
+			if (i % 4 == 0 && !sorted.empty())
+			{
+				const auto& x = sorted[random() % sorted.size()];
+				position = (i % 8 == 0) ? x.Range.Start : x.Range.End;
+			}
+
+			const Annotation* expected = FindDirect(sorted, position);
+
+			uint32_t index = UINT32_MAX;
+			const Annotation* found = table.Find(position, &index);
+			Assert::IsTrue(expected == found);
+			if (found != nullptr)
+			{
+				Assert::IsTrue(&sorted[index] == found);
+			}
+
+			// Sequential playback through the cursor has to agree too.
+			const Annotation* fromCursor = table.FindFrom(position, &cursor);
+			Assert::IsTrue(expected == fromCursor);
+		}
+	}
+
+	TEST_CLASS(AnnotationTableTests)
+	{
+	public:
+
+		TEST_METHOD(FindEmpty)
+		{
+			AnnotationTable table(std::vector<Annotation>{});
+			uint32_t index = 0;
+			Assert::IsTrue(table.Find(1.0, &index) == nullptr);
+		}
+
+		TEST_METHOD(FindRandomOverlaps)
+		{
+			std::mt19937 random(42);
+			for (size_t count : { 1, 2, 3, 7, 8, 9, 100, 257 })
+			{
+				std::uniform_real_distribution<double> starts(0.0, 100.0);
+				std::exponential_distribution<double> lengths(0.2);
+
+				std::vector<Annotation> annotations;
+				for (size_t i = 0; i < count; i++)
+				{
+					const double start = starts(random);
+					annotations.push_back(Annotation{ "x", TimeRange{ start, start + lengths(random) } });
+				}
+
+				// Some sharing a start, so ties are covered.
+				if (count > 2)
+				{
+					annotations[1].Range.Start = annotations[0].Range.Start;
+				}
+
+				CheckAgainstDirect(AnnotationTable(annotations), random, 100.0);
+			}
+		}
+
+		TEST_METHOD(FindUnderLongAnnotation)
+		{
+			// Word level annotations under one covering the whole track, the layout that
+			// made a walk back over the earlier annotations linear.
+			std::vector<Annotation> annotations;
+			annotations.push_back(Annotation{ "track", TimeRange{ 0.0, 1000.0 } });
+			for (int i = 0; i < 1000; i++)
+			{
+				const double start = i + 0.25;
+				annotations.push_back(Annotation{ "word", TimeRange{ start, start + 0.5 } });
+			}
+
+			const AnnotationTable table(annotations);
+
+			uint32_t index = 0;
+			Assert::IsTrue(table.Find(500.5, &index)->Value == "word");
+			Assert::AreEqual(static_cast<uint32_t>(501), index);
+			Assert::IsTrue(table.Find(500.9, &index)->Value == "track");
+			Assert::AreEqual(static_cast<uint32_t>(0), index);
+			Assert::IsTrue(table.Find(1000.5, &index) == nullptr);
+
+			std::mt19937 random(7);
+			CheckAgainstDirect(table, random, 1000.0);
+		}
+	};
+}
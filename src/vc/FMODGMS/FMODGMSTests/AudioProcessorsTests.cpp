@@ -0,0 +1,270 @@
+#include "CppUnitTest.h"
+#include "AudioProcessors.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace AudioProcessors;
+
+namespace FMODGMSTests
+{
+	constexpr double FILTER_SAMPLE_RATE = 48000.0;
+
+	std::vector<float> Noise(size_t count, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+		std::vector<float> samples(count);
+		for (auto& sample : samples)
+		{
+			sample = uniform(random);
+		}
+
+		return samples;
+	}
+
+	// Processes the samples in blocks of uneven sizes, carrying the state between them.
+	template <typename Process>
+	std::vector<float> InBlocks(std::vector<float> samples, Process process)
+	{
+		const size_t sizes[] = { 1, 64, 7, 256, 3, 128, 31 };
+		size_t pos = 0;
+		for (size_t i = 0; pos < samples.size(); i++)
+		{
+			const size_t size = std::min(sizes[i % std::size(sizes)], samples.size() - pos);
+			process(std::span<float>(samples.data() + pos, size));
+			pos += size;
+		}
+
+		return samples;
+	}
+
+	// Carrying the state between blocks has to give exactly what one long block does.
+	bool SameOutput(const std::vector<float>& a, const std::vector<float>& b)
+	{
+		return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+	}
+
+	void AssertClose(const std::vector<float>& expected, const std::vector<float>& actual, float tolerance, const wchar_t* name)
+	{
+		Assert::AreEqual(expected.size(), actual.size(), name);
+		for (size_t i = 0; i < expected.size(); i++)
+		{
+			Assert::AreEqual(expected[i], actual[i], tolerance, name);
+		}
+	}
+
+	// Direct form I in double straight from the unnormalised RBJ cookbook formulas, to
+	// check the coefficients and the transposed form against.
+	std::vector<float> ReferenceBiquad(const std::vector<float>& input, BiquadType type, double freq, double q)
+	{
+		const double w0 = 2.0 * 3.14159265358979 * freq / FILTER_SAMPLE_RATE;
+		const double alpha = sin(w0) / (2.0 * q);
+		const double cosw0 = cos(w0);
+
+		double b[3];
+		switch (type)
+		{
+		case BiquadType::HighPass:
+			b[0] = (1.0 + cosw0) / 2.0; b[1] = -(1.0 + cosw0); b[2] = (1.0 + cosw0) / 2.0;
+			break;
+		case BiquadType::BandPass:
+			b[0] = alpha; b[1] = 0.0; b[2] = -alpha;
+			break;
+		case BiquadType::Notch:
+			b[0] = 1.0; b[1] = -2.0 * cosw0; b[2] = 1.0;
+			break;
+		default:
+			b[0] = (1.0 - cosw0) / 2.0; b[1] = 1.0 - cosw0; b[2] = (1.0 - cosw0) / 2.0;
+			break;
+		}
+
+		const double a[3] = { 1.0 + alpha, -2.0 * cosw0, 1.0 - alpha };
+
+		std::vector<float> output(input.size());
+		double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			const double x0 = input[i];
+			const double y0 = (b[0] * x0 + b[1] * x1 + b[2] * x2 - a[1] * y1 - a[2] * y2) / a[0];
+			x2 = x1; x1 = x0;
+			y2 = y1; y1 = y0;
+			output[i] = static_cast<float>(y0);
+		}
+
+		return output;
+	}
+
+	// Amplitude of a unit sine at freq once the filter has settled.
+	template <typename Process>
+	float SineGain(double freq, Process process)
+	{
+		std::vector<float> samples(9600);
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			samples[i] = static_cast<float>(sin(2.0 * 3.14159265358979 * freq * static_cast<double>(i) / FILTER_SAMPLE_RATE));
+		}
+
+		process(std::span<float>(samples));
+
+		// RMS over the second half, a whole number of cycles for every frequency used here.
+		double sumSquares = 0.0;
+		for (size_t i = samples.size() / 2; i < samples.size(); i++)
+		{
+			sumSquares += static_cast<double>(samples[i]) * samples[i];
+		}
+
+		return static_cast<float>(sqrt(2.0 * sumSquares / static_cast<double>(samples.size() / 2)));
+	}
+
+	TEST_CLASS(AudioProcessorsTests)
+	{
+	public:
+
+		TEST_METHOD(OnePoleFilters)
+		{
+			std::vector<float> dc(4800, 0.5f);
+
+			OnePoleState lowState;
+			LowPass(std::span<float>(dc), 0.01f, lowState);
+			Assert::AreEqual(0.5f, dc.back(), 1e-5f, L"low pass settles on DC");
+
+			std::fill(dc.begin(), dc.end(), 0.5f);
+			HighPassState highState;
+			HighPass(std::span<float>(dc), 0.99f, highState);
+			Assert::AreEqual(0.f, dc.back(), 1e-5f, L"high pass removes DC");
+
+			const auto noise = Noise(2000, 1);
+			OnePoleState wholeLow;
+			std::vector<float> whole = noise;
+			LowPass(std::span<float>(whole), 0.3f, wholeLow);
+			OnePoleState blockLow;
+			Assert::IsTrue(SameOutput(whole, InBlocks(noise, [&](std::span<float> block) { LowPass(block, 0.3f, blockLow); })), L"low pass in blocks");
+
+			HighPassState wholeHigh;
+			whole = noise;
+			HighPass(std::span<float>(whole), 0.7f, wholeHigh);
+			HighPassState blockHigh;
+			Assert::IsTrue(SameOutput(whole, InBlocks(noise, [&](std::span<float> block) { HighPass(block, 0.7f, blockHigh); })), L"high pass in blocks");
+		}
+
+		TEST_METHOD(BiquadMatchesReference)
+		{
+			struct BiquadCase
+			{
+				const wchar_t* Name;
+				BiquadType Type;
+				double Freq;
+				double Q;
+			};
+
+			const BiquadCase cases[] =
+			{
+				{ L"low pass", BiquadType::LowPass, 1000.0, 0.707 },
+				{ L"resonant low pass", BiquadType::LowPass, 200.0, 8.0 },
+				{ L"high pass", BiquadType::HighPass, 5000.0, 0.707 },
+				{ L"band pass", BiquadType::BandPass, 2000.0, 2.0 },
+				{ L"notch", BiquadType::Notch, 440.0, 4.0 },
+			};
+
+			const auto noise = Noise(4096, 2);
+			for (const auto& testCase : cases)
+			{
+				const BiquadCoeffs coeffs = BiquadCoeffs::Make(testCase.Type, testCase.Freq, testCase.Q, FILTER_SAMPLE_RATE);
+
+				std::vector<float> whole = noise;
+				BiquadState wholeState;
+				Biquad(std::span<float>(whole), coeffs, wholeState);
+				AssertClose(ReferenceBiquad(noise, testCase.Type, testCase.Freq, testCase.Q), whole, 1e-3f, testCase.Name);
+
+				BiquadState blockState;
+				Assert::IsTrue(SameOutput(whole, InBlocks(noise, [&](std::span<float> block) { Biquad(block, coeffs, blockState); })), testCase.Name);
+			}
+		}
+
+		TEST_METHOD(BiquadResponse)
+		{
+			auto gain = [](BiquadType type, double cutoff, double q, double freq)
+			{
+				const BiquadCoeffs coeffs = BiquadCoeffs::Make(type, cutoff, q, FILTER_SAMPLE_RATE);
+				BiquadState state;
+				return SineGain(freq, [&](std::span<float> data) { Biquad(data, coeffs, state); });
+			};
+
+			Assert::AreEqual(1.f, gain(BiquadType::LowPass, 2000.0, 0.707, 100.0), 0.01f, L"low pass passes lows");
+			Assert::IsTrue(gain(BiquadType::LowPass, 2000.0, 0.707, 16000.0) < 0.03f, L"low pass cuts highs");
+			Assert::IsTrue(gain(BiquadType::HighPass, 2000.0, 0.707, 100.0) < 0.01f, L"high pass cuts lows");
+			Assert::AreEqual(1.f, gain(BiquadType::HighPass, 2000.0, 0.707, 16000.0), 0.01f, L"high pass passes highs");
+			Assert::AreEqual(1.f, gain(BiquadType::BandPass, 2000.0, 2.0, 2000.0), 0.01f, L"band pass peaks at 0dB");
+			Assert::IsTrue(gain(BiquadType::Notch, 1000.0, 2.0, 1000.0) < 0.01f, L"notch removes its frequency");
+			Assert::AreEqual(1.f, gain(BiquadType::Notch, 1000.0, 2.0, 8000.0), 0.02f, L"notch passes the rest");
+		}
+
+		TEST_METHOD(StateVariableMatchesBiquad)
+		{
+			// Both are the bilinear transform of the same analogue filters, so should agree
+			// up to rounding. The band pass output has a peak gain of q rather than 1.
+			struct StateVariableCase
+			{
+				const wchar_t* Name;
+				StateVariableMode Mode;
+				BiquadType Type;
+				double Scale;
+			};
+
+			const double freq = 1500.0;
+			const double q = 3.0;
+			const StateVariableCase cases[] =
+			{
+				{ L"low pass", StateVariableMode::LowPass, BiquadType::LowPass, 1.0 },
+				{ L"high pass", StateVariableMode::HighPass, BiquadType::HighPass, 1.0 },
+				{ L"band pass", StateVariableMode::BandPass, BiquadType::BandPass, 1.0 / q },
+			};
+
+			const auto noise = Noise(4096, 3);
+			const StateVariableCoeffs coeffs = StateVariableCoeffs::Make(freq, q, FILTER_SAMPLE_RATE);
+			for (const auto& testCase : cases)
+			{
+				std::vector<float> whole = noise;
+				StateVariableState wholeState;
+				StateVariable(std::span<float>(whole), testCase.Mode, coeffs, wholeState);
+				for (auto& x : whole)
+				{
+					x = static_cast<float>(x * testCase.Scale);
+				}
+
+				AssertClose(ReferenceBiquad(noise, testCase.Type, freq, q), whole, 1e-3f, testCase.Name);
+
+				StateVariableState blockState;
+				std::vector<float> blocks = InBlocks(noise, [&](std::span<float> block) { StateVariable(block, testCase.Mode, coeffs, blockState); });
+				for (auto& x : blocks)
+				{
+					x = static_cast<float>(x * testCase.Scale);
+				}
+
+				Assert::IsTrue(SameOutput(whole, blocks), testCase.Name);
+			}
+		}
+
+		TEST_METHOD(StateVariableStableWhenSwept)
+		{
+			// Resonant, with the cutoff jumping across the whole range every few samples.
+			auto samples = Noise(48000, 4);
+			StateVariableState state;
+			const double cutoffs[] = { 40.0, 18000.0, 300.0, 9000.0, 60.0, 23000.0 };
+			for (size_t start = 0, i = 0; start < samples.size(); start += 16, i++)
+			{
+				const auto coeffs = StateVariableCoeffs::Make(cutoffs[i % std::size(cutoffs)], 20.0, FILTER_SAMPLE_RATE);
+				StateVariable(std::span<float>(samples.data() + start, 16), StateVariableMode::LowPass, coeffs, state);
+			}
+
+			for (const float x : samples)
+			{
+				Assert::IsTrue(std::isfinite(x) && std::abs(x) < 100.f);
+			}
+		}
+	};
+}
@@ -0,0 +1,250 @@
+#include "CppUnitTest.h"
+#include "Cassette.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Cassette;
+
+namespace FMODGMSTests
+{
+	constexpr size_t TAPE_LENGTH = 16;
+
+	constexpr AnnotationId A = 1;
+	constexpr AnnotationId B = 2;
+	constexpr AnnotationId C = 3;
+
+	// Recorded one sample at a time from Start, as the cassette does.
+	struct Run
+	{
+		uint32_t Start;
+		uint32_t Length;
+		AnnotationId Id;
+	};
+
+	struct AnnotationCase
+	{
+		const wchar_t* Name;
+		std::vector<Run> Runs;
+		std::vector<AnnotationSpan> Expected;
+	};
+
+	const std::vector<AnnotationCase> ANNOTATION_CASES =
+	{
+		{ L"blank tape", {}, { { 0, 16, NO_ANNOTATION } } },
+		{ L"single sample", { { 5, 1, A } }, { { 0, 5, NO_ANNOTATION }, { 5, 1, A }, { 6, 10, NO_ANNOTATION } } },
+		{ L"run at tape start", { { 0, 4, A } }, { { 0, 4, A }, { 4, 12, NO_ANNOTATION } } },
+		{ L"run at tape end", { { 12, 4, A } }, { { 0, 12, NO_ANNOTATION }, { 12, 4, A } } },
+		{ L"last sample of tape", { { 15, 1, A } }, { { 0, 15, NO_ANNOTATION }, { 15, 1, A } } },
+		{ L"whole tape", { { 0, 16, A } }, { { 0, 16, A } } },
+		{ L"runs back to back", { { 0, 3, A }, { 3, 3, B }, { 6, 3, A } },
+			{ { 0, 3, A }, { 3, 3, B }, { 6, 3, A }, { 9, 7, NO_ANNOTATION } } },
+
+		// Overwriting part of a span.
+		{ L"overwrite span start", { { 4, 4, A }, { 4, 1, B } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 1, B }, { 5, 3, A }, { 8, 8, NO_ANNOTATION } } },
+		{ L"overwrite span end", { { 4, 4, A }, { 7, 1, B } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 3, A }, { 7, 1, B }, { 8, 8, NO_ANNOTATION } } },
+		{ L"overwrite span middle", { { 4, 4, A }, { 5, 1, B } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 1, A }, { 5, 1, B }, { 6, 2, A }, { 8, 8, NO_ANNOTATION } } },
+		{ L"overwrite tape start", { { 0, 2, A }, { 0, 1, B } },
+			{ { 0, 1, B }, { 1, 1, A }, { 2, 14, NO_ANNOTATION } } },
+		{ L"overwrite single sample span", { { 4, 1, A }, { 4, 1, B } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 1, B }, { 5, 11, NO_ANNOTATION } } },
+		{ L"overwrite with the same id", { { 4, 4, A }, { 5, 1, A } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 4, A }, { 8, 8, NO_ANNOTATION } } },
+
+		// Merging with the span before.
+		{ L"grow previous span forwards", { { 4, 4, A }, { 8, 2, A } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 6, A }, { 10, 6, NO_ANNOTATION } } },
+		{ L"span start taken by previous", { { 4, 2, A }, { 6, 3, B }, { 6, 1, A } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 3, A }, { 7, 2, B }, { 9, 7, NO_ANNOTATION } } },
+		{ L"single sample gap filled from before", { { 4, 2, A }, { 7, 2, A }, { 6, 1, A } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 5, A }, { 9, 7, NO_ANNOTATION } } },
+		{ L"run recorded over with blank", { { 4, 2, A }, { 4, 2, NO_ANNOTATION } },
+			{ { 0, 16, NO_ANNOTATION } } },
+
+		// Merging with the span after.
+		{ L"grow next span backwards", { { 4, 4, A }, { 3, 1, A } },
+			{ { 0, 3, NO_ANNOTATION }, { 3, 5, A }, { 8, 8, NO_ANNOTATION } } },
+		{ L"span end taken by next", { { 4, 3, A }, { 7, 3, B }, { 6, 1, B } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 2, A }, { 6, 4, B }, { 10, 6, NO_ANNOTATION } } },
+		{ L"single sample span taken by next", { { 4, 2, A }, { 6, 1, B }, { 7, 2, C }, { 6, 1, C } },
+			{ { 0, 4, NO_ANNOTATION }, { 4, 2, A }, { 6, 3, C }, { 9, 7, NO_ANNOTATION } } },
+		{ L"tape end taken by last span", { { 12, 4, A }, { 11, 1, A } },
+			{ { 0, 11, NO_ANNOTATION }, { 11, 5, A } } },
+	};
+
+	// ReadPeaks(start, end) against a plain scan of what has been pushed.
+	void CheckPeaks(const RecordBuffer& buffer, const std::vector<float>& tape, size_t start, size_t end)
+	{
+		const PeakSummary peaks = buffer.ReadPeaks(start, end);
+
+		float min = 0.f;
+		float max = 0.f;
+		double sumSquares = 0.0;
+		for (size_t i = start; i < end; i++)
+		{
+			min = (i == start) ? tape[i] : std::min(min, tape[i]);
+			max = (i == start) ? tape[i] : std::max(max, tape[i]);
+			sumSquares += static_cast<double>(tape[i]) * tape[i];
+		}
+
+		Assert::AreEqual(static_cast<uint32_t>(end - start), peaks.Count);
+		Assert::AreEqual(min, peaks.Min);
+		Assert::AreEqual(max, peaks.Max);
+
+		// Bins sum their squares in float.
+		Assert::AreEqual(sumSquares, peaks.SumSquares, 1e-5 * (sumSquares + 1.0));
+	}
+
+	TEST_CLASS(RecordBufferTests)
+	{
+	public:
+
+		TEST_METHOD(WriteAnnotationSpans)
+		{
+			for (const auto& testCase : ANNOTATION_CASES)
+			{
+				RecordBuffer buffer(TAPE_LENGTH);
+				for (const auto& run : testCase.Runs)
+				{
+					buffer.Seek(run.Start);
+					for (uint32_t i = 0; i < run.Length; i++)
+					{
+						buffer.Push(0.f, run.Id);
+					}
+				}
+
+				const auto& spans = buffer.GetAnnotationSpans();
+				Assert::AreEqual(testCase.Expected.size(), spans.size(), testCase.Name);
+
+				for (size_t i = 0; i < spans.size(); i++)
+				{
+					Assert::AreEqual(testCase.Expected[i].Start, spans[i].Start, testCase.Name);
+					Assert::AreEqual(testCase.Expected[i].Length, spans[i].Length, testCase.Name);
+					Assert::AreEqual(testCase.Expected[i].Id, spans[i].Id, testCase.Name);
+				}
+
+				for (const auto& span : testCase.Expected)
+				{
+					for (uint32_t pos = span.Start; pos < span.Start + span.Length; pos++)
+					{
+						Assert::AreEqual(span.Id, buffer.ReadPosAnnotation(pos), testCase.Name);
+					}
+				}
+			}
+		}
+
+		TEST_METHOD(WriteAnnotationKeepsSpansMinimal)
+		{
+			// Every run of a repeating pattern written over one another, checked after each
+			// sample against the plain per sample annotation it should match.
+			RecordBuffer buffer(TAPE_LENGTH);
+			std::vector<AnnotationId> expected(TAPE_LENGTH, NO_ANNOTATION);
+			const AnnotationId ids[] = { A, A, B, NO_ANNOTATION, C, C, C, A };
+
+			uint32_t step = 0;
+			for (uint32_t start = 0; start < TAPE_LENGTH; start++)
+			{
+				for (uint32_t length = 1; length <= 5; length++)
+				{
+					buffer.Seek(start);
+					for (uint32_t i = 0; i < length; i++)
+					{
+						const AnnotationId id = ids[step++ % 8];
+						expected[(start + i) % TAPE_LENGTH] = id;
+						buffer.Push(0.f, id);
+					}
+
+					const auto& spans = buffer.GetAnnotationSpans();
+					uint32_t covered = 0;
+					for (size_t i = 0; i < spans.size(); i++)
+					{
+						Assert::AreEqual(covered, spans[i].Start);
+						Assert::IsTrue(spans[i].Length > 0);
+						Assert::IsTrue(i == 0 || spans[i - 1].Id != spans[i].Id);
+						covered += spans[i].Length;
+					}
+
+					Assert::AreEqual(static_cast<uint32_t>(TAPE_LENGTH), covered);
+
+					for (uint32_t pos = 0; pos < TAPE_LENGTH; pos++)
+					{
+						Assert::AreEqual(expected[pos], buffer.ReadPosAnnotation(pos));
+					}
+				}
+			}
+		}
+
+		TEST_METHOD(ReadPeaksMatchesScan)
+		{
+			// The pyramid only climbs on the last child of a node and repairs the path the
+			// head leaves on a Seek, so check ranges all over after random runs and seeks.
+			// Lengths that aren't whole bins or a power of two of them. Kept in memory, as
+			// paged out tape only has whole bins to read.
+			std::mt19937 random(2024);
+			for (const size_t length : { 1000, 4133, 100003 })
+			{
+				RecordBuffer buffer(length);
+				std::vector<float> tape(length, 0.f);
+				std::uniform_real_distribution<float> samples(-1.f, 1.f);
+				std::uniform_int_distribution<size_t> positions(0, length - 1);
+
+				size_t pos = 0;
+				CheckPeaks(buffer, tape, 0, length);
+
+				const int steps = length > 10000 ? 100 : 400;
+				for (int step = 0; step < steps; step++)
+				{
+					const uint32_t action = random() % 4;
+					if (action == 0)
+					{
+						pos = positions(random);
+						buffer.Seek(pos);
+					}
+					else
+					{
+						// Mostly short runs, sometimes long enough to cross several nodes or
+						// wrap round the end of the tape.
+						const size_t run = (action == 1) ? random() % (length + length / 2) : random() % 40;
+						const bool quiet = random() % 8 == 0;
+						for (size_t i = 0; i < run; i++)
+						{
+							const float sample = quiet ? 0.f : samples(random);
+							buffer.Push(sample, NO_ANNOTATION);
+							tape[pos] = sample;
+							pos = (pos + 1) % length;
+						}
+					}
+
+					for (int check = 0; check < 8; check++)
+					{
+						size_t start = positions(random);
+						size_t end = positions(random) + 1;
+						if (check == 0)
+						{
+							start = 0;
+							end = length;
+						}
+						else if (check == 1)
+						{
+							// Right around the head, where the pyramid may still be stale.
+							start = pos >= 20 ? pos - 20 : 0;
+							end = std::min(pos + 20, length);
+						}
+						else if (start >= end)
+						{
+							std::swap(start, end);
+							start--;
+							end++;
+						}
+
+						CheckPeaks(buffer, tape, start, end);
+					}
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,191 @@
+#include "CppUnitTest.h"
+#include "SlotMap.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace FMODGMSTests
+{
+	// Every handle in handles finds its value and the map holds nothing else.
+	void CheckLive(SlotMap<int>& map, const std::vector<SlotHandle>& handles, const std::vector<int>& values)
+	{
+		Assert::AreEqual(values.size(), map.Size());
+		for (size_t i = 0; i < handles.size(); i++)
+		{
+			Assert::IsTrue(map.Contains(handles[i]));
+			Assert::AreEqual(values[i], *map.Find(handles[i]));
+			Assert::AreEqual(values[i], map[handles[i]]);
+		}
+
+		std::vector<int> walked(map.begin(), map.end());
+		std::vector<int> expected = values;
+		std::sort(walked.begin(), walked.end());
+		std::sort(expected.begin(), expected.end());
+		Assert::IsTrue(walked == expected);
+	}
+
+	TEST_CLASS(SlotMapTests)
+	{
+	public:
+
+		TEST_METHOD(HandlesCountUpFromZero)
+		{
+			SlotMap<int> map;
+			for (int i = 0; i < 5; i++)
+			{
+				Assert::AreEqual(static_cast<SlotHandle>(i), map.Insert(i * 10));
+			}
+
+			Assert::IsFalse(map.Contains(5), L"never given out");
+			Assert::IsFalse(map.Contains(INVALID_SLOT_HANDLE));
+			Assert::IsTrue(map.Find(INVALID_SLOT_HANDLE) == nullptr);
+		}
+
+		TEST_METHOD(StaleHandleRejectedAfterErase)
+		{
+			SlotMap<int> map;
+			const SlotHandle a = map.Insert(1);
+			const SlotHandle b = map.Insert(2);
+
+			Assert::IsTrue(map.Erase(a));
+			Assert::IsFalse(map.Contains(a));
+			Assert::IsTrue(map.Find(a) == nullptr);
+			Assert::IsFalse(map.Erase(a), L"erased twice");
+
+			CheckLive(map, { b }, { 2 });
+		}
+
+		TEST_METHOD(StaleHandleRejectedAfterReuse)
+		{
+			SlotMap<int> map;
+			const SlotHandle a = map.Insert(1);
+			const SlotHandle b = map.Insert(2);
+			map.Erase(a);
+
+			// Same slot, so the same index with a new generation.
+			const SlotHandle c = map.Insert(3);
+			Assert::AreEqual(a & SLOT_INDEX_MASK, c & SLOT_INDEX_MASK);
+			Assert::AreNotEqual(a, c);
+			Assert::AreEqual(static_cast<size_t>(2), map.GetSlotCount());
+
+			Assert::IsFalse(map.Contains(a));
+			Assert::IsTrue(map.Find(a) == nullptr);
+			Assert::IsFalse(map.Erase(a), L"stale handle erased the value that reused its slot");
+
+			CheckLive(map, { b, c }, { 2, 3 });
+		}
+
+		TEST_METHOD(EraseMovesLastValueIntoHole)
+		{
+			SlotMap<int> map;
+			std::vector<SlotHandle> handles;
+			for (int i = 0; i < 6; i++)
+			{
+				handles.push_back(map.Insert(i));
+			}
+
+			// The first value leaves a hole the last one is moved into, the last leaves none.
+			map.Erase(handles[0]);
+			map.Erase(handles[3]);
+			map.Erase(handles[4]);
+
+			CheckLive(map, { handles[1], handles[2], handles[5] }, { 1, 2, 5 });
+		}
+
+		TEST_METHOD(EraseIfKeepsHandlesToMovedValues)
+		{
+			SlotMap<int> map;
+			std::vector<SlotHandle> handles;
+			for (int i = 0; i < 20; i++)
+			{
+				handles.push_back(map.Insert(i));
+			}
+
+			map.EraseIf([](int value) { return value % 3 == 0 || value == 19; });
+
+			std::vector<SlotHandle> live;
+			std::vector<int> values;
+			for (int i = 0; i < 20; i++)
+			{
+				if (i % 3 == 0 || i == 19)
+				{
+					Assert::IsFalse(map.Contains(handles[i]));
+				}
+				else
+				{
+					live.push_back(handles[i]);
+					values.push_back(i);
+				}
+			}
+
+			CheckLive(map, live, values);
+
+			// The freed slots are handed out again without growing the map.
+			const size_t slotCount = map.GetSlotCount();
+			for (int i = 0; i < 8; i++)
+			{
+				live.push_back(map.Insert(100 + i));
+				values.push_back(100 + i);
+			}
+
+			Assert::AreEqual(slotCount, map.GetSlotCount());
+			CheckLive(map, live, values);
+		}
+
+		TEST_METHOD(ClearInvalidatesHandles)
+		{
+			SlotMap<std::unique_ptr<int>> map;
+			std::vector<SlotHandle> handles;
+			for (int i = 0; i < 4; i++)
+			{
+				handles.push_back(map.Insert(std::make_unique<int>(i)));
+			}
+
+			map.Clear();
+			Assert::AreEqual(static_cast<size_t>(0), map.Size());
+			Assert::IsTrue(map.begin() == map.end());
+
+			for (int i = 0; i < 4; i++)
+			{
+				const SlotHandle handle = map.Insert(std::make_unique<int>(10 + i));
+				Assert::IsTrue(map.Contains(handle));
+			}
+
+			for (const SlotHandle handle : handles)
+			{
+				Assert::IsFalse(map.Contains(handle));
+				Assert::IsFalse(map.Erase(handle));
+			}
+
+			Assert::AreEqual(static_cast<size_t>(4), map.Size());
+		}
+
+		TEST_METHOD(GenerationWraps)
+		{
+			// A handle only comes back round after its slot has been reused once per
+			// generation, and a handle that wraps is still never INVALID_SLOT_HANDLE.
+			const uint32_t generations = 1u << (32 - SLOT_INDEX_BITS);
+
+			SlotMap<int> map;
+			const SlotHandle first = map.Insert(0);
+			map.Erase(first);
+
+			for (uint32_t i = 1; i < generations; i++)
+			{
+				const SlotHandle handle = map.Insert(static_cast<int>(i));
+				Assert::AreNotEqual(first, handle);
+				Assert::AreNotEqual(INVALID_SLOT_HANDLE, handle);
+				Assert::AreEqual(i, handle >> SLOT_INDEX_BITS);
+				Assert::IsFalse(map.Contains(first));
+				map.Erase(handle);
+			}
+
+			const SlotHandle wrapped = map.Insert(-1);
+			Assert::AreEqual(first, wrapped);
+			Assert::AreEqual(-1, map[wrapped]);
+			Assert::AreEqual(static_cast<size_t>(1), map.GetSlotCount());
+		}
+	};
+}
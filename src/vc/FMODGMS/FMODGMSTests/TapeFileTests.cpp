@@ -0,0 +1,417 @@
+#include "CppUnitTest.h"
+#include "Cassette.h"
+#include "TapeFile.h"
+#include "TapeStore.h"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace Cassette;
+
+namespace FMODGMSTests
+{
+	constexpr size_t RAW_CODED_SIZE = 1 + TAPE_CHUNK_SIZE * sizeof(float);
+	constexpr uint32_t SAMPLE_RATE = 48000;
+
+	float FromBits(uint32_t bits)
+	{
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	bool SameBits(const std::vector<float>& a, const std::vector<float>& b)
+	{
+		return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+	}
+
+	// Encodes and decodes one chunk, checking every bit comes back. Returns the coded size.
+	size_t RoundTripChunk(const std::vector<float>& samples, const wchar_t* name)
+	{
+		std::vector<uint8_t> coded;
+		TapeCoding::EncodeChunk(samples.data(), coded);
+
+		std::vector<float> decoded(TAPE_CHUNK_SIZE, 1.f);
+		Assert::IsTrue(TapeCoding::DecodeChunk(coded.data(), coded.size(), decoded.data()), name);
+		Assert::IsTrue(SameBits(samples, decoded), name);
+		return coded.size();
+	}
+
+	std::string TempTapePath(const char* name)
+	{
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+
+	std::vector<uint8_t> ReadFileBytes(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	void WriteFileBytes(const std::string& path, const std::vector<uint8_t>& bytes)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	}
+
+	template <typename T>
+	void SetHeaderField(std::vector<uint8_t>& bytes, size_t offset, T value)
+	{
+		memcpy(bytes.data() + offset, &value, sizeof(value));
+	}
+
+	// A short tape with a few annotated runs and samples that are every kind of awkward.
+	std::unique_ptr<RecordBuffer> MakeShortTape(AnnotationStore& annotations, std::vector<float>& samples)
+	{
+		const size_t length = 1000;
+		auto buffer = std::make_unique<RecordBuffer>(length);
+		const AnnotationId footsteps = annotations.Intern("footsteps");
+		const AnnotationId door = annotations.Intern("door");
+
+		samples.resize(length);
+		for (size_t i = 0; i < length; i++)
+		{
+			samples[i] = 0.5f * static_cast<float>(sin(0.01 * static_cast<double>(i)));
+		}
+
+		samples[10] = -0.f;
+		samples[11] = FromBits(0x7fc00001);
+		samples[12] = FromBits(0xffc12345);
+		samples[13] = INFINITY;
+		samples[14] = FromBits(0x00000001);
+
+		for (size_t i = 0; i < length; i++)
+		{
+			AnnotationId id = NO_ANNOTATION;
+			if (i >= 100 && i < 300)
+			{
+				id = footsteps;
+			}
+			else if (i >= 300 && i < 350)
+			{
+				id = door;
+			}
+			else if (i >= 900)
+			{
+				id = footsteps;
+			}
+
+			buffer->Push(samples[i], id);
+		}
+
+		return buffer;
+	}
+
+	TEST_CLASS(TapeFileTests)
+	{
+	public:
+
+		TEST_METHOD(ChunkRoundTripSilence)
+		{
+			const std::vector<float> samples(TAPE_CHUNK_SIZE, 0.f);
+			const size_t size = RoundTripChunk(samples, L"silence");
+			Assert::IsTrue(size < 1024, L"silence should code to almost nothing");
+		}
+
+		TEST_METHOD(ChunkRoundTripSine)
+		{
+			std::vector<float> samples(TAPE_CHUNK_SIZE);
+			for (size_t i = 0; i < samples.size(); i++)
+			{
+				samples[i] = 0.25f * static_cast<float>(sin(0.05 * static_cast<double>(i)));
+			}
+
+			const size_t size = RoundTripChunk(samples, L"sine");
+			Assert::IsTrue(size < RAW_CODED_SIZE, L"a sine should compress");
+		}
+
+		TEST_METHOD(ChunkRoundTripNoise)
+		{
+			// Random bit patterns, so every kind of NaN, infinity and denormal turns up too.
+			std::mt19937 random(1234);
+			std::vector<float> samples(TAPE_CHUNK_SIZE);
+			for (auto& sample : samples)
+			{
+				sample = FromBits(static_cast<uint32_t>(random()));
+			}
+
+			const size_t size = RoundTripChunk(samples, L"noise");
+			Assert::AreEqual(RAW_CODED_SIZE, size, L"noise should fall back to raw");
+		}
+
+		TEST_METHOD(ChunkRoundTripSignedZeros)
+		{
+			std::vector<float> samples(TAPE_CHUNK_SIZE);
+			for (size_t i = 0; i < samples.size(); i++)
+			{
+				samples[i] = (i % 2 == 0) ? 0.f : -0.f;
+			}
+
+			RoundTripChunk(samples, L"alternating zeros");
+
+			std::fill(samples.begin(), samples.end(), -0.f);
+			const size_t size = RoundTripChunk(samples, L"negative zeros");
+			Assert::IsTrue(size < 1024, L"constant negative zero should code to almost nothing");
+		}
+
+		TEST_METHOD(ChunkRoundTripSpecialValues)
+		{
+			const uint32_t special[] =
+			{
+				0x7fc00000, 0x7fc00001, 0xffc12345, 0x7f800001, 0xff800001,
+				0x7f800000, 0xff800000, 0x00000001, 0x807fffff, 0x80000000,
+			};
+
+			std::vector<float> samples(TAPE_CHUNK_SIZE, 0.f);
+			for (size_t i = 0; i < samples.size(); i++)
+			{
+				if (i % 7 == 0)
+				{
+					samples[i] = FromBits(special[(i / 7) % std::size(special)]);
+				}
+			}
+
+			RoundTripChunk(samples, L"NaN payloads, infinities and denormals");
+		}
+
+		TEST_METHOD(ChunkRoundTripEscapes)
+		{
+			// Quiet with rare huge spikes, so the deltas are too large for the Rice parameter
+			// chosen for the partition and have to be escaped.
+			std::vector<float> samples(TAPE_CHUNK_SIZE, 0.f);
+			for (size_t i = 0; i < samples.size(); i += 97)
+			{
+				samples[i] = (i % 2 == 0) ? 1e30f : -1e30f;
+			}
+
+			const size_t size = RoundTripChunk(samples, L"escapes");
+			Assert::IsTrue(size < RAW_CODED_SIZE, L"sparse spikes should still compress");
+		}
+
+		TEST_METHOD(DecodeChunkRejectsCorruptData)
+		{
+			std::vector<float> samples(TAPE_CHUNK_SIZE);
+			for (size_t i = 0; i < samples.size(); i++)
+			{
+				samples[i] = 0.25f * static_cast<float>(sin(0.05 * static_cast<double>(i)));
+			}
+
+			std::vector<uint8_t> coded;
+			TapeCoding::EncodeChunk(samples.data(), coded);
+
+			std::vector<float> decoded(TAPE_CHUNK_SIZE);
+			Assert::IsFalse(TapeCoding::DecodeChunk(coded.data(), 0, decoded.data()), L"empty");
+			Assert::IsFalse(TapeCoding::DecodeChunk(coded.data(), coded.size() / 2, decoded.data()), L"truncated");
+
+			std::vector<uint8_t> unknown = coded;
+			unknown[0] = 7;
+			Assert::IsFalse(TapeCoding::DecodeChunk(unknown.data(), unknown.size(), decoded.data()), L"unknown coding");
+
+			std::vector<uint8_t> raw(RAW_CODED_SIZE, 0);
+			Assert::IsTrue(TapeCoding::DecodeChunk(raw.data(), raw.size(), decoded.data()), L"raw");
+			Assert::IsFalse(TapeCoding::DecodeChunk(raw.data(), raw.size() - 1, decoded.data()), L"short raw");
+		}
+
+		TEST_METHOD(VarintRoundTrip)
+		{
+			struct VarintCase
+			{
+				uint64_t Value;
+				size_t Bytes;
+			};
+
+			const VarintCase cases[] =
+			{
+				{ 0, 1 }, { 1, 1 }, { 127, 1 }, { 128, 2 }, { 16383, 2 }, { 16384, 3 },
+				{ static_cast<uint64_t>(1) << 32, 5 }, { UINT64_MAX, 10 },
+			};
+
+			std::vector<uint8_t> data;
+			for (const auto& testCase : cases)
+			{
+				const size_t before = data.size();
+				TapeCoding::WriteVarint(data, testCase.Value);
+				Assert::AreEqual(testCase.Bytes, data.size() - before);
+			}
+
+			size_t pos = 0;
+			for (const auto& testCase : cases)
+			{
+				uint64_t value = 0;
+				Assert::IsTrue(TapeCoding::ReadVarint(data, pos, value));
+				Assert::AreEqual(testCase.Value, value);
+			}
+
+			Assert::AreEqual(data.size(), pos);
+
+			uint64_t value = 0;
+			Assert::IsFalse(TapeCoding::ReadVarint(data, pos, value), L"past the end");
+
+			std::vector<uint8_t> truncated;
+			TapeCoding::WriteVarint(truncated, 16384);
+			truncated.pop_back();
+			pos = 0;
+			Assert::IsFalse(TapeCoding::ReadVarint(truncated, pos, value), L"truncated");
+		}
+
+		TEST_METHOD(SaveLoadShortTape)
+		{
+			for (const bool compress : { false, true })
+			{
+				const wchar_t* name = compress ? L"compressed" : L"raw";
+				const std::string path = TempTapePath("fmodgms_test_short.tape");
+
+				AnnotationStore annotations;
+				std::vector<float> samples;
+				auto buffer = MakeShortTape(annotations, samples);
+
+				std::string error;
+				Assert::IsTrue(TapeFile::Save(*buffer, SAMPLE_RATE, annotations, path, compress, error), name);
+
+				// A fresh store, so the ids have to come back through the strings.
+				AnnotationStore loadedAnnotations;
+				loadedAnnotations.Intern("something else first");
+				std::unique_ptr<RecordBuffer> loaded;
+				uint32_t sampleRate = 0;
+				Assert::IsTrue(TapeFile::Load(path, loadedAnnotations, loaded, sampleRate, error), name);
+
+				Assert::AreEqual(SAMPLE_RATE, sampleRate, name);
+				Assert::AreEqual(buffer->GetSize(), loaded->GetSize(), name);
+
+				std::vector<float> loadedSamples(loaded->GetSize());
+				for (size_t i = 0; i < loadedSamples.size(); i++)
+				{
+					loadedSamples[i] = loaded->ReadPos(i);
+				}
+
+				Assert::IsTrue(SameBits(samples, loadedSamples), name);
+
+				const auto& spans = buffer->GetAnnotationSpans();
+				const auto& loadedSpans = loaded->GetAnnotationSpans();
+				Assert::AreEqual(spans.size(), loadedSpans.size(), name);
+				for (size_t i = 0; i < spans.size(); i++)
+				{
+					Assert::AreEqual(spans[i].Start, loadedSpans[i].Start, name);
+					Assert::AreEqual(spans[i].Length, loadedSpans[i].Length, name);
+					Assert::IsTrue(annotations.GetString(spans[i].Id) == loadedAnnotations.GetString(loadedSpans[i].Id), name);
+				}
+
+				loaded.reset();
+				std::filesystem::remove(path);
+			}
+		}
+
+		TEST_METHOD(SaveLoadSaveLongTape)
+		{
+			// Long enough to be spilled to disk and mapped back in when loaded raw.
+			const size_t length = TAPE_CHUNK_SIZE * (TAPE_RESIDENT_CHUNKS + 2) - 100;
+			for (const bool compress : { false, true })
+			{
+				const wchar_t* name = compress ? L"compressed" : L"raw";
+				const std::string firstPath = TempTapePath("fmodgms_test_long_1.tape");
+				const std::string secondPath = TempTapePath("fmodgms_test_long_2.tape");
+
+				AnnotationStore annotations;
+				const AnnotationId rain = annotations.Intern("rain");
+				RecordBuffer buffer(length);
+
+				std::string error;
+				Assert::IsTrue(buffer.Open(error), name);
+
+				buffer.BeginAccess();
+				for (size_t i = 0; i < 5000; i++)
+				{
+					buffer.Push(0.1f * static_cast<float>(sin(0.02 * static_cast<double>(i))), i < 2000 ? rain : NO_ANNOTATION);
+				}
+
+				buffer.EndAccess(1.0);
+
+				Assert::IsTrue(TapeFile::Save(buffer, SAMPLE_RATE, annotations, firstPath, compress, error), name);
+
+				AnnotationStore loadedAnnotations;
+				std::unique_ptr<RecordBuffer> loaded;
+				uint32_t sampleRate = 0;
+				Assert::IsTrue(TapeFile::Load(firstPath, loadedAnnotations, loaded, sampleRate, error), name);
+				Assert::AreEqual(length, loaded->GetSize(), name);
+				Assert::IsTrue(TapeFile::Save(*loaded, sampleRate, loadedAnnotations, secondPath, compress, error), name);
+
+				Assert::IsTrue(ReadFileBytes(firstPath) == ReadFileBytes(secondPath), name);
+
+				loaded.reset();
+				std::filesystem::remove(firstPath);
+				std::filesystem::remove(secondPath);
+			}
+		}
+
+		TEST_METHOD(LoadRejectsCorruptHeaders)
+		{
+			const std::string path = TempTapePath("fmodgms_test_valid.tape");
+			const std::string corruptPath = TempTapePath("fmodgms_test_corrupt.tape");
+
+			AnnotationStore annotations;
+			std::vector<float> samples;
+			auto buffer = MakeShortTape(annotations, samples);
+
+			std::string error;
+			Assert::IsTrue(TapeFile::Save(*buffer, SAMPLE_RATE, annotations, path, true, error));
+			const std::vector<uint8_t> valid = ReadFileBytes(path);
+			std::filesystem::remove(path);
+
+			TapeFileHeader header;
+			memcpy(&header, valid.data(), sizeof(header));
+
+			struct CorruptCase
+			{
+				const wchar_t* Name;
+				std::vector<uint8_t> Bytes;
+			};
+
+			std::vector<CorruptCase> cases;
+			auto corrupt = [&](const wchar_t* name, auto change)
+			{
+				std::vector<uint8_t> bytes = valid;
+				change(bytes);
+				cases.push_back({ name, std::move(bytes) });
+			};
+
+			corrupt(L"bad magic", [](auto& bytes) { bytes[0] = 'X'; });
+			corrupt(L"bad version", [](auto& bytes) { SetHeaderField(bytes, offsetof(TapeFileHeader, Version), TAPE_FILE_VERSION + 1); });
+			corrupt(L"zero length", [](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, Length), 0); });
+			corrupt(L"huge length", [](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, Length), static_cast<uint64_t>(1) << 33); });
+			corrupt(L"samples past the end", [&](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, SamplesOffset), valid.size() + 1); });
+			corrupt(L"samples bytes past the end", [&](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, SamplesBytes), header.SamplesBytes + 1); });
+			corrupt(L"sections out of order", [&](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, SpansOffset), header.PeaksOffset + 1); });
+			corrupt(L"extra span", [&](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, SpanCount), header.SpanCount + 1); });
+			corrupt(L"missing span", [&](auto& bytes) { SetHeaderField<uint64_t>(bytes, offsetof(TapeFileHeader, SpanCount), header.SpanCount - 1); });
+			corrupt(L"extra string", [&](auto& bytes) { SetHeaderField<uint32_t>(bytes, offsetof(TapeFileHeader, StringCount), header.StringCount + 1); });
+			corrupt(L"peak bin shift", [&](auto& bytes) { SetHeaderField<uint32_t>(bytes, offsetof(TapeFileHeader, PeakBinShift), header.PeakBinShift + 1); });
+			corrupt(L"truncated header", [](auto& bytes) { bytes.resize(sizeof(TapeFileHeader) - 1); });
+			corrupt(L"truncated samples", [](auto& bytes) { bytes.resize(bytes.size() - 1); });
+			corrupt(L"unknown chunk coding", [&](auto& bytes)
+			{
+				uint64_t firstChunk = 0;
+				memcpy(&firstChunk, bytes.data() + header.SamplesOffset, sizeof(firstChunk));
+				bytes[header.SamplesOffset + firstChunk] = 7;
+			});
+
+			for (const auto& testCase : cases)
+			{
+				WriteFileBytes(corruptPath, testCase.Bytes);
+
+				std::unique_ptr<RecordBuffer> loaded;
+				uint32_t sampleRate = 0;
+				std::string loadError;
+				Assert::IsFalse(TapeFile::Load(corruptPath, annotations, loaded, sampleRate, loadError), testCase.Name);
+				Assert::IsTrue(loaded == nullptr, testCase.Name);
+				Assert::IsFalse(loadError.empty(), testCase.Name);
+			}
+
+			std::filesystem::remove(corruptPath);
+		}
+	};
+}
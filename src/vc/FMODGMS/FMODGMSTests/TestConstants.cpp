@@ -0,0 +1,6 @@
+#include <filesystem>
+#include "ConstantReader.h"
+
+// The bench's constants, found from this file's path as the test runner doesn't start in
+// the project directory. __FILE__ is absolute with UseFullPaths.
+ConstantReader Constants::Globals((std::filesystem::path(__FILE__).parent_path() / ".." / "FMODGMSBench" / "bench_constants.txt").string());